@@ -0,0 +1,630 @@
+// AsyncPointLoader.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a template class called
+// AsyncPointLoader, which reads point files (see PointFile.hpp) without
+// blocking the thread that asks for them, and considerably faster than
+// readPointFile() can.
+//
+// There are three ideas at work here:
+//
+// * The file is read in chunks, and many chunks are being read at the same
+//   time.  Storage devices (especially SSDs) are much faster when they have
+//   many requests to work on at once than when they're handed one at a time.
+// * When io_uring is available (see IoUring.hpp), one thread hands the
+//   kernel a whole queue of reads at once and collects results as they
+//   arrive.  When it isn't, we fall back to having the workers in a
+//   ThreadPool each read chunks with pread(), which gets us the same
+//   parallelism at the cost of a blocked thread per outstanding read.
+// * As each chunk lands, any further work on it -- rearranging it into a
+//   PointArrays, or whatever the caller asks for via a "chunk callback" --
+//   is handed to the ThreadPool, so that it overlaps with the reading of the
+//   chunks that haven't landed yet.  A caller building an index can use the
+//   callback to start on each chunk as soon as it's available, rather than
+//   waiting until the whole file has been read.
+//
+// Every load function returns a std::future immediately; the loading is
+// done on a separate thread, so the caller's thread never waits on the disk
+// unless it calls get() or wait() on the future.  The vector or PointArrays
+// being loaded into must, of course, outlive the load, and shouldn't be
+// looked at until the future is ready (except for the chunks that the
+// callback has been told about).
+
+#ifndef ASYNCPOINTLOADER_HPP
+#define ASYNCPOINTLOADER_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "FileDescriptor.hpp"
+#include "IoUring.hpp"
+#include "Point.hpp"
+#include "PointArrays.hpp"
+#include "PointFile.hpp"
+#include "ThreadPool.hpp"
+
+
+
+// PointLoaderBackend selects how an AsyncPointLoader talks to the disk.
+// Automatic means "io_uring if this system supports it, the thread pool
+// otherwise."
+enum class PointLoaderBackend
+{
+    Automatic,
+    IoUring,
+    ThreadPool
+};
+
+
+
+template <typename CoordinateType>
+class AsyncPointLoader
+{
+public:
+    // A ChunkCallback is called once per chunk, on one of the ThreadPool's
+    // workers, as soon as the points in that chunk are in place.  Chunks
+    // can finish in any order, and the callback may be called for several
+    // chunks at once, so it must be safe to call from many threads.
+    using ChunkCallback =
+        std::function<void(std::size_t firstPoint, std::size_t pointCount)>;
+
+
+    // An AsyncPointLoader is configured with the backend to use, the number
+    // of points in each chunk, the maximum number of chunks to have in
+    // flight at once (for the io_uring backend), and the ThreadPool on
+    // which the per-chunk work (and, for the thread pool backend, the
+    // reading) should be done.
+    explicit AsyncPointLoader(
+        PointLoaderBackend backend = PointLoaderBackend::Automatic,
+        std::size_t pointsPerChunk = 65536,
+        unsigned int queueDepth = 32,
+        ThreadPool& pool = defaultThreadPool());
+
+
+    // backend() returns the backend actually in use, which is never
+    // Automatic.  Asking for io_uring on a system that doesn't allow it
+    // gets the thread pool instead, and if setting up io_uring fails when a
+    // load starts (it needs memory that a system's limits may not allow),
+    // that load falls back to the thread pool, too.
+    PointLoaderBackend backend() const;
+
+
+    // loadInto() reads a point file into an existing vector or PointArrays,
+    // resizing it to fit.  Reusing the same container from one load to
+    // the next avoids allocating new memory each time.  The future's value
+    // is the number of points loaded.
+    std::future<std::size_t> loadInto(
+        const std::string& path, std::vector<Point<CoordinateType>>& points,
+        ChunkCallback onChunk = ChunkCallback{}) const;
+
+    std::future<std::size_t> loadInto(
+        const std::string& path, PointArrays<CoordinateType>& arrays,
+        ChunkCallback onChunk = ChunkCallback{}) const;
+
+
+    // load() reads a point file into a new vector.
+    std::future<std::vector<Point<CoordinateType>>> load(const std::string& path) const;
+
+
+private:
+    static_assert(
+        std::is_trivially_copyable<Point<CoordinateType>>::value,
+        "Points must be trivially copyable to be read as raw bytes");
+
+    std::size_t loadPoints(
+        const std::string& path, std::vector<Point<CoordinateType>>& points,
+        const ChunkCallback& onChunk) const;
+
+    std::size_t loadArrays(
+        const std::string& path, PointArrays<CoordinateType>& arrays,
+        const ChunkCallback& onChunk) const;
+
+    template <typename Consume>
+    void readChunks(
+        const FileDescriptor& file, const PointFileHeader& header,
+        Point<CoordinateType>* directTarget, Consume consume) const;
+
+    template <typename Consume>
+    void readWithThreadPool(
+        const FileDescriptor& file, const PointFileHeader& header,
+        Point<CoordinateType>* directTarget, Consume consume) const;
+
+    template <typename Consume>
+    void readWithIoUring(
+        const FileDescriptor& file, const PointFileHeader& header,
+        Point<CoordinateType>* directTarget, Consume consume) const;
+
+    PointLoaderBackend backend_;
+    std::size_t pointsPerChunk_;
+    unsigned int queueDepth_;
+    ThreadPool* pool_;
+};
+
+
+
+template <typename CoordinateType>
+AsyncPointLoader<CoordinateType>::AsyncPointLoader(
+    PointLoaderBackend backend, std::size_t pointsPerChunk,
+    unsigned int queueDepth, ThreadPool& pool)
+    : backend_{backend},
+      pointsPerChunk_{std::max<std::size_t>(pointsPerChunk, 1)},
+      queueDepth_{std::max(queueDepth, 1u)},
+      pool_{&pool}
+{
+    // The length of an io_uring read is a 32-bit number, and Linux won't
+    // transfer more than a little under 2 GiB in one read anyway, so we
+    // keep each chunk to at most 2 GiB.
+    const std::size_t maxPointsPerChunk =
+        (std::size_t{1} << 31) / sizeof(Point<CoordinateType>);
+
+    pointsPerChunk_ = std::min(pointsPerChunk_, maxPointsPerChunk);
+
+#ifdef ICS46_HAVE_IO_URING
+    if (backend_ != PointLoaderBackend::ThreadPool)
+    {
+        backend_ = IoUring::isSupported()
+            ? PointLoaderBackend::IoUring : PointLoaderBackend::ThreadPool;
+    }
+#else
+    backend_ = PointLoaderBackend::ThreadPool;
+#endif
+}
+
+
+template <typename CoordinateType>
+PointLoaderBackend AsyncPointLoader<CoordinateType>::backend() const
+{
+    return backend_;
+}
+
+
+template <typename CoordinateType>
+std::future<std::size_t> AsyncPointLoader<CoordinateType>::loadInto(
+    const std::string& path, std::vector<Point<CoordinateType>>& points,
+    ChunkCallback onChunk) const
+{
+    return std::async(
+        std::launch::async,
+        [this, path, &points, onChunk]
+        {
+            return loadPoints(path, points, onChunk);
+        });
+}
+
+
+template <typename CoordinateType>
+std::future<std::size_t> AsyncPointLoader<CoordinateType>::loadInto(
+    const std::string& path, PointArrays<CoordinateType>& arrays,
+    ChunkCallback onChunk) const
+{
+    return std::async(
+        std::launch::async,
+        [this, path, &arrays, onChunk]
+        {
+            return loadArrays(path, arrays, onChunk);
+        });
+}
+
+
+template <typename CoordinateType>
+std::future<std::vector<Point<CoordinateType>>> AsyncPointLoader<CoordinateType>::load(
+    const std::string& path) const
+{
+    return std::async(
+        std::launch::async,
+        [this, path]
+        {
+            std::vector<Point<CoordinateType>> points;
+            loadPoints(path, points, ChunkCallback{});
+            return points;
+        });
+}
+
+
+// When loading into a vector of Points, the file's layout is the same as
+// the vector's, so each chunk is read directly into its final place and
+// there's nothing left to do afterward except tell the callback.
+
+template <typename CoordinateType>
+std::size_t AsyncPointLoader<CoordinateType>::loadPoints(
+    const std::string& path, std::vector<Point<CoordinateType>>& points,
+    const ChunkCallback& onChunk) const
+{
+    FileDescriptor file = FileDescriptor::open(path, O_RDONLY);
+    PointFileHeader header = readPointFileHeader<CoordinateType>(file);
+
+    points.resize(header.pointCount);
+
+    readChunks(
+        file, header, points.data(),
+        [&onChunk](std::size_t first, std::size_t count, const Point<CoordinateType>*)
+        {
+            if (onChunk)
+            {
+                onChunk(first, count);
+            }
+        });
+
+    return points.size();
+}
+
+
+// When loading into a PointArrays, on the other hand, each chunk is read
+// into a temporary buffer and then spread out into the three arrays.
+
+template <typename CoordinateType>
+std::size_t AsyncPointLoader<CoordinateType>::loadArrays(
+    const std::string& path, PointArrays<CoordinateType>& arrays,
+    const ChunkCallback& onChunk) const
+{
+    FileDescriptor file = FileDescriptor::open(path, O_RDONLY);
+    PointFileHeader header = readPointFileHeader<CoordinateType>(file);
+
+    arrays.resize(header.pointCount);
+
+    readChunks(
+        file, header, nullptr,
+        [&arrays, &onChunk](
+            std::size_t first, std::size_t count, const Point<CoordinateType>* chunk)
+        {
+            CoordinateType* xs = arrays.xs() + first;
+            CoordinateType* ys = arrays.ys() + first;
+            CoordinateType* zs = arrays.zs() + first;
+
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                xs[i] = chunk[i].x();
+                ys[i] = chunk[i].y();
+                zs[i] = chunk[i].z();
+            }
+
+            if (onChunk)
+            {
+                onChunk(first, count);
+            }
+        });
+
+    return arrays.size();
+}
+
+
+// readChunks() reads every chunk of the file, calling
+// consume(firstPoint, pointCount, chunkPoints) for each one as it arrives.
+// If directTarget isn't null, chunks are read straight into it; otherwise,
+// they're read into temporary buffers that live until consume() returns.
+
+template <typename CoordinateType>
+template <typename Consume>
+void AsyncPointLoader<CoordinateType>::readChunks(
+    const FileDescriptor& file, const PointFileHeader& header,
+    Point<CoordinateType>* directTarget, Consume consume) const
+{
+    if (header.pointCount == 0)
+    {
+        return;
+    }
+
+#ifdef ICS46_HAVE_IO_URING
+    if (backend_ == PointLoaderBackend::IoUring)
+    {
+        readWithIoUring(file, header, directTarget, consume);
+        return;
+    }
+#endif
+
+    readWithThreadPool(file, header, directTarget, consume);
+}
+
+
+template <typename CoordinateType>
+template <typename Consume>
+void AsyncPointLoader<CoordinateType>::readWithThreadPool(
+    const FileDescriptor& file, const PointFileHeader& header,
+    Point<CoordinateType>* directTarget, Consume consume) const
+{
+    const std::size_t pointCount = header.pointCount;
+    const std::size_t chunkCount = (pointCount + pointsPerChunk_ - 1) / pointsPerChunk_;
+
+    pool_->parallelFor(
+        0, chunkCount, 1,
+        [&](std::size_t firstChunk, std::size_t lastChunk)
+        {
+            std::vector<Point<CoordinateType>> staging;
+
+            for (std::size_t chunk = firstChunk; chunk < lastChunk; ++chunk)
+            {
+                const std::size_t first = chunk * pointsPerChunk_;
+                const std::size_t count = std::min(pointsPerChunk_, pointCount - first);
+
+                Point<CoordinateType>* target = directTarget + first;
+
+                if (directTarget == nullptr)
+                {
+                    staging.resize(count);
+                    target = staging.data();
+                }
+
+                file.readAt(
+                    target, count * sizeof(Point<CoordinateType>),
+                    header.dataOffset + first * sizeof(Point<CoordinateType>));
+
+                consume(first, count, target);
+            }
+        });
+}
+
+
+#ifdef ICS46_HAVE_IO_URING
+
+// The io_uring backend keeps up to queueDepth reads in flight, each
+// associated with a "slot."  When a read finishes, the slot's chunk is
+// handed to the ThreadPool to be consumed, and the slot goes back on the
+// free list; but, if the slot has its own staging buffer, we can't start
+// another read into it until the ThreadPool is done with its last chunk,
+// so we wait for that before reusing it.
+//
+// The kernel is allowed to complete a read having transferred fewer bytes
+// than we asked for, in which case we simply ask for the rest.
+//
+// If the ring can't be set up at all, nothing has been read yet, so we
+// read the whole file with the thread pool instead.
+//
+// If anything goes wrong -- a read fails, a chunk's consume() throws, or
+// the kernel refuses our requests -- we stop starting new reads (including
+// the rest of any partial read), but we still wait for the ones the kernel
+// has, because it's writing into buffers that we can't free until it's
+// done with them.  Reads we queued but never managed to hand over are
+// never started, so there's nothing to wait for there.  We also wait for
+// every chunk the ThreadPool is consuming, since those tasks refer to
+// consume, which lives in this function.  Only then is the first error
+// rethrown.
+
+template <typename CoordinateType>
+template <typename Consume>
+void AsyncPointLoader<CoordinateType>::readWithIoUring(
+    const FileDescriptor& file, const PointFileHeader& header,
+    Point<CoordinateType>* directTarget, Consume consume) const
+{
+    struct Slot
+    {
+        std::size_t first;
+        std::size_t count;
+        std::size_t bytesDone;
+        std::future<void> consumed;
+        std::vector<Point<CoordinateType>> staging;
+    };
+
+    const std::size_t pointCount = header.pointCount;
+    const std::size_t chunkCount = (pointCount + pointsPerChunk_ - 1) / pointsPerChunk_;
+    const std::size_t slotCount = std::min<std::size_t>(queueDepth_, chunkCount);
+
+    std::unique_ptr<IoUring> ringHolder;
+
+    try
+    {
+        ringHolder = std::make_unique<IoUring>(static_cast<unsigned int>(slotCount));
+    }
+    catch (const std::system_error&)
+    {
+        readWithThreadPool(file, header, directTarget, consume);
+        return;
+    }
+
+    IoUring& ring = *ringHolder;
+
+    std::vector<Slot> slots(slotCount);
+    std::vector<std::size_t> freeSlots;
+
+    for (std::size_t slot = slotCount; slot > 0; --slot)
+    {
+        freeSlots.push_back(slot - 1);
+    }
+
+    std::size_t nextChunk = 0;
+    std::size_t inFlight = 0;
+    std::exception_ptr error;
+
+    auto targetOf =
+        [&](Slot& slot)
+        {
+            return directTarget != nullptr
+                ? directTarget + slot.first : slot.staging.data();
+        };
+
+    auto startRead =
+        [&](std::size_t index)
+        {
+            Slot& slot = slots[index];
+            char* target = reinterpret_cast<char*>(targetOf(slot)) + slot.bytesDone;
+
+            ring.prepareRead(
+                file.get(), target,
+                static_cast<std::uint32_t>(
+                    slot.count * sizeof(Point<CoordinateType>) - slot.bytesDone),
+                header.dataOffset + slot.first * sizeof(Point<CoordinateType>)
+                    + slot.bytesDone,
+                index);
+
+            ++inFlight;
+        };
+
+    auto continueRead =
+        [&](std::size_t index)
+        {
+            if (error)
+            {
+                freeSlots.push_back(index);
+            }
+            else
+            {
+                startRead(index);
+            }
+        };
+
+    while (true)
+    {
+        while (!error && nextChunk < chunkCount && !freeSlots.empty())
+        {
+            const std::size_t index = freeSlots.back();
+            freeSlots.pop_back();
+
+            Slot& slot = slots[index];
+
+            if (slot.consumed.valid())
+            {
+                try
+                {
+                    slot.consumed.get();
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                    freeSlots.push_back(index);
+                    break;
+                }
+            }
+
+            slot.first = nextChunk * pointsPerChunk_;
+            slot.count = std::min(pointsPerChunk_, pointCount - slot.first);
+            slot.bytesDone = 0;
+
+            if (directTarget == nullptr)
+            {
+                slot.staging.resize(slot.count);
+            }
+
+            startRead(index);
+            ++nextChunk;
+        }
+
+        if (error ? inFlight == ring.pendingCount() : inFlight == 0)
+        {
+            break;
+        }
+
+        if (!error)
+        {
+            try
+            {
+                ring.submit(1);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+                continue;
+            }
+        }
+        else
+        {
+            // If even waiting fails, we fall back to polling, since
+            // there's no safe way to leave while reads are in flight.
+            try
+            {
+                ring.wait(1);
+            }
+            catch (const std::system_error&)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds{1});
+            }
+        }
+
+        IoUring::Completion completions[64];
+        const std::size_t completionCount = ring.reap(completions, 64);
+
+        for (std::size_t i = 0; i < completionCount; ++i)
+        {
+            const std::size_t index = completions[i].userData;
+            const int result = completions[i].result;
+            Slot& slot = slots[index];
+
+            --inFlight;
+
+            if (result == -EINTR || result == -EAGAIN)
+            {
+                continueRead(index);
+                continue;
+            }
+            else if (result <= 0)
+            {
+                if (!error)
+                {
+                    error = result < 0
+                        ? std::make_exception_ptr(
+                            std::system_error{-result, std::generic_category(), "io_uring read"})
+                        : std::make_exception_ptr(
+                            std::runtime_error{"unexpected end of file"});
+                }
+
+                freeSlots.push_back(index);
+                continue;
+            }
+
+            slot.bytesDone += static_cast<std::size_t>(result);
+
+            if (slot.bytesDone < slot.count * sizeof(Point<CoordinateType>))
+            {
+                continueRead(index);
+                continue;
+            }
+
+            if (!error)
+            {
+                const std::size_t first = slot.first;
+                const std::size_t count = slot.count;
+                const Point<CoordinateType>* points = targetOf(slot);
+
+                slot.consumed = pool_->submit(
+                    [&consume, first, count, points]
+                    {
+                        consume(first, count, points);
+                    });
+            }
+
+            freeSlots.push_back(index);
+        }
+    }
+
+    for (Slot& slot : slots)
+    {
+        if (slot.consumed.valid())
+        {
+            try
+            {
+                slot.consumed.get();
+            }
+            catch (...)
+            {
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+            }
+        }
+    }
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+#endif // ICS46_HAVE_IO_URING
+
+
+
+#endif // ASYNCPOINTLOADER_HPP
+
@@ -0,0 +1,255 @@
+// BatchScheduler.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a class called BatchScheduler, which
+// processes a large batch of small, independent items of work -- aligning
+// thousands of small point clouds, say, or computing their centroids --
+// spread across the threads of a ThreadPool.
+//
+// When each item of work is small, the cost of scheduling it can be as large
+// as the cost of doing it.  Submitting every item to a ThreadPool as its own
+// task means a memory allocation, a trip through a locked queue, and a
+// future to wait on, per item.  And if each item allocates its own temporary
+// memory, that's more trips to the heap, which many threads are all fighting
+// over at once.  A BatchScheduler avoids both costs:
+//
+// * Items are packed into a small number of tasks (a few per thread, so that
+//   a thread that finishes early can pick up some of the slack), each task
+//   processing a consecutive run of items.  The runs are chosen so that each
+//   task has about the same amount of work, according to an estimate of each
+//   item's cost provided by the caller; without one, all items are assumed
+//   to cost the same.
+// * Each task borrows a ScratchArena, which it resets before each item, and
+//   passes to the function processing the item.  Temporary memory allocated
+//   from the arena costs next to nothing, and since the arenas are kept from
+//   one batch to the next, they quickly grow to the size they need to be and
+//   stop allocating from the heap at all.
+//
+// run() returns a BatchReport describing how long the batch took and how
+// long its items waited: the latency of an item is the time from the start
+// of the batch until that item was finished, and the report includes the
+// median, 90th and 99th percentile, and maximum latency.
+
+#ifndef BATCHSCHEDULER_HPP
+#define BATCHSCHEDULER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "ScratchArena.hpp"
+#include "ThreadPool.hpp"
+
+
+
+struct BatchReport
+{
+    std::size_t itemCount = 0;
+    std::size_t taskCount = 0;
+    double seconds = 0.0;
+    double medianLatency = 0.0;
+    double latency90 = 0.0;
+    double latency99 = 0.0;
+    double maxLatency = 0.0;
+};
+
+
+
+class BatchScheduler
+{
+public:
+    // A BatchScheduler runs its work on the given ThreadPool, creating
+    // tasksPerThread tasks per thread in the pool (plus the thread calling
+    // run(), which helps), with arenas whose first block is arenaBytes.
+    explicit BatchScheduler(
+        ThreadPool& pool = defaultThreadPool(),
+        std::size_t tasksPerThread = 4,
+        std::size_t arenaBytes = 1 << 16);
+
+
+    // run() calls process(index, arena) once for each index in
+    // [0, itemCount), where arena is a ScratchArena& that has just been
+    // reset.  The second form also takes cost(index), which estimates how
+    // expensive each item is relative to the others (the number of points
+    // involved, for example).  Calls to process() for different items can
+    // happen at the same time on different threads.
+    template <typename Process>
+    BatchReport run(std::size_t itemCount, Process process);
+
+    template <typename Process, typename Cost>
+    BatchReport run(std::size_t itemCount, Process process, Cost cost);
+
+
+private:
+    ScratchArena* acquireArena();
+    void releaseArena(ScratchArena* arena);
+
+    ThreadPool* pool_;
+    std::size_t tasksPerThread_;
+    std::size_t arenaBytes_;
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<ScratchArena>> arenas_;
+    std::vector<ScratchArena*> freeArenas_;
+};
+
+
+
+// percentileOf() returns the value below which the given fraction of the
+// values lie, rearranging the values as it goes.
+double percentileOf(std::vector<double>& values, double fraction);
+
+
+
+inline BatchScheduler::BatchScheduler(
+    ThreadPool& pool, std::size_t tasksPerThread, std::size_t arenaBytes)
+    : pool_{&pool}, tasksPerThread_{std::max<std::size_t>(tasksPerThread, 1)},
+      arenaBytes_{arenaBytes}
+{
+}
+
+
+template <typename Process>
+BatchReport BatchScheduler::run(std::size_t itemCount, Process process)
+{
+    return run(itemCount, process, [](std::size_t) { return 1.0; });
+}
+
+
+// The items are split into tasks by walking through them, adding up their
+// costs, and ending a task whenever the running total passes the next
+// multiple of (total cost / number of tasks).
+
+template <typename Process, typename Cost>
+BatchReport BatchScheduler::run(std::size_t itemCount, Process process, Cost cost)
+{
+    using Clock = std::chrono::steady_clock;
+
+    BatchReport report;
+    report.itemCount = itemCount;
+
+    if (itemCount == 0)
+    {
+        return report;
+    }
+
+    const Clock::time_point start = Clock::now();
+
+    std::vector<double> costs(itemCount);
+    double totalCost = 0.0;
+
+    for (std::size_t i = 0; i < itemCount; ++i)
+    {
+        costs[i] = std::max(0.0, static_cast<double>(cost(i)));
+        totalCost += costs[i];
+    }
+
+    const std::size_t wantedTasks = std::min(
+        itemCount, (pool_->threadCount() + 1) * tasksPerThread_);
+
+    std::vector<std::size_t> taskStarts{0};
+    double runningCost = 0.0;
+
+    for (std::size_t i = 0; i < itemCount; ++i)
+    {
+        runningCost += costs[i];
+
+        const double boundary =
+            totalCost * static_cast<double>(taskStarts.size()) / static_cast<double>(wantedTasks);
+
+        if (runningCost >= boundary && i + 1 < itemCount && taskStarts.size() < wantedTasks)
+        {
+            taskStarts.push_back(i + 1);
+        }
+    }
+
+    taskStarts.push_back(itemCount);
+    report.taskCount = taskStarts.size() - 1;
+
+    std::vector<double> latencies(itemCount);
+
+    pool_->parallelFor(
+        0, report.taskCount, 1,
+        [&](std::size_t firstTask, std::size_t lastTask)
+        {
+            ScratchArena* arena = acquireArena();
+
+            try
+            {
+                for (std::size_t task = firstTask; task < lastTask; ++task)
+                {
+                    for (std::size_t i = taskStarts[task]; i < taskStarts[task + 1]; ++i)
+                    {
+                        arena->reset();
+                        process(i, *arena);
+
+                        latencies[i] = std::chrono::duration<double>(Clock::now() - start).count();
+                    }
+                }
+            }
+            catch (...)
+            {
+                releaseArena(arena);
+                throw;
+            }
+
+            releaseArena(arena);
+        });
+
+    report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    report.medianLatency = percentileOf(latencies, 0.5);
+    report.latency90 = percentileOf(latencies, 0.9);
+    report.latency99 = percentileOf(latencies, 0.99);
+    report.maxLatency = percentileOf(latencies, 1.0);
+
+    return report;
+}
+
+
+inline ScratchArena* BatchScheduler::acquireArena()
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    if (freeArenas_.empty())
+    {
+        arenas_.push_back(std::make_unique<ScratchArena>(arenaBytes_));
+        return arenas_.back().get();
+    }
+
+    ScratchArena* arena = freeArenas_.back();
+    freeArenas_.pop_back();
+    return arena;
+}
+
+
+inline void BatchScheduler::releaseArena(ScratchArena* arena)
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    freeArenas_.push_back(arena);
+}
+
+
+inline double percentileOf(std::vector<double>& values, double fraction)
+{
+    if (values.empty())
+    {
+        return 0.0;
+    }
+
+    const double clamped = std::min(std::max(fraction, 0.0), 1.0);
+    const std::size_t index = std::min(
+        values.size() - 1,
+        static_cast<std::size_t>(clamped * static_cast<double>(values.size() - 1) + 0.5));
+
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+
+
+#endif // BATCHSCHEDULER_HPP
+
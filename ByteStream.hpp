@@ -0,0 +1,226 @@
+// ByteStream.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines two small classes, ByteWriter and
+// ByteReader, for turning numbers into bytes and back again.  Whenever we
+// send data to another process or store it in a file that another machine
+// might read, we have to decide what order the bytes of each number go in,
+// since not every processor stores them the same way in memory.  These
+// classes always use little-endian order (least significant byte first),
+// no matter what kind of machine they're running on, by building each
+// number up out of shifts instead of copying it from memory.
+//
+// A ByteReader checks that every read stays within the bytes it was given,
+// throwing a ByteStreamException if the data ends too soon.  That's an
+// important property when the bytes come from somewhere we don't control.
+
+#ifndef BYTESTREAM_HPP
+#define BYTESTREAM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+
+class ByteStreamException : public std::runtime_error
+{
+public:
+    explicit ByteStreamException(const std::string& reason)
+        : std::runtime_error{reason}
+    {
+    }
+};
+
+
+
+// A ByteWriter appends to a vector of bytes that it doesn't own.
+class ByteWriter
+{
+public:
+    explicit ByteWriter(std::vector<std::uint8_t>& bytes);
+
+    void writeU8(std::uint8_t value);
+    void writeU16(std::uint16_t value);
+    void writeU32(std::uint32_t value);
+    void writeU64(std::uint64_t value);
+    void writeDouble(double value);
+    void writeBytes(const void* bytes, std::size_t count);
+
+    // size() returns the number of bytes in the vector so far, including
+    // any that were there before the ByteWriter was created.
+    std::size_t size() const;
+
+private:
+    std::vector<std::uint8_t>* bytes_;
+};
+
+
+
+// A ByteReader reads from a range of bytes that it doesn't own.
+class ByteReader
+{
+public:
+    ByteReader(const std::uint8_t* bytes, std::size_t size);
+
+    std::uint8_t readU8();
+    std::uint16_t readU16();
+    std::uint32_t readU32();
+    std::uint64_t readU64();
+    double readDouble();
+    void readBytes(void* bytes, std::size_t count);
+
+    // skip() moves past the given number of bytes without reading them,
+    // returning a pointer to the first of them.
+    const std::uint8_t* skip(std::size_t count);
+
+    // remaining() returns the number of bytes not yet read.
+    std::size_t remaining() const;
+
+private:
+    void require(std::size_t count) const;
+
+    const std::uint8_t* next_;
+    const std::uint8_t* end_;
+};
+
+
+
+inline ByteWriter::ByteWriter(std::vector<std::uint8_t>& bytes)
+    : bytes_{&bytes}
+{
+}
+
+
+inline void ByteWriter::writeU8(std::uint8_t value)
+{
+    bytes_->push_back(value);
+}
+
+
+inline void ByteWriter::writeU16(std::uint16_t value)
+{
+    writeU8(static_cast<std::uint8_t>(value));
+    writeU8(static_cast<std::uint8_t>(value >> 8));
+}
+
+
+inline void ByteWriter::writeU32(std::uint32_t value)
+{
+    writeU16(static_cast<std::uint16_t>(value));
+    writeU16(static_cast<std::uint16_t>(value >> 16));
+}
+
+
+inline void ByteWriter::writeU64(std::uint64_t value)
+{
+    writeU32(static_cast<std::uint32_t>(value));
+    writeU32(static_cast<std::uint32_t>(value >> 32));
+}
+
+
+inline void ByteWriter::writeDouble(double value)
+{
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    writeU64(bits);
+}
+
+
+inline void ByteWriter::writeBytes(const void* bytes, std::size_t count)
+{
+    const std::uint8_t* first = static_cast<const std::uint8_t*>(bytes);
+    bytes_->insert(bytes_->end(), first, first + count);
+}
+
+
+inline std::size_t ByteWriter::size() const
+{
+    return bytes_->size();
+}
+
+
+inline ByteReader::ByteReader(const std::uint8_t* bytes, std::size_t size)
+    : next_{bytes}, end_{bytes + size}
+{
+}
+
+
+inline std::uint8_t ByteReader::readU8()
+{
+    require(1);
+    return *next_++;
+}
+
+
+inline std::uint16_t ByteReader::readU16()
+{
+    const std::uint16_t low = readU8();
+    const std::uint16_t high = readU8();
+    return static_cast<std::uint16_t>(low | (high << 8));
+}
+
+
+inline std::uint32_t ByteReader::readU32()
+{
+    const std::uint32_t low = readU16();
+    const std::uint32_t high = readU16();
+    return low | (high << 16);
+}
+
+
+inline std::uint64_t ByteReader::readU64()
+{
+    const std::uint64_t low = readU32();
+    const std::uint64_t high = readU32();
+    return low | (high << 32);
+}
+
+
+inline double ByteReader::readDouble()
+{
+    const std::uint64_t bits = readU64();
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+
+inline void ByteReader::readBytes(void* bytes, std::size_t count)
+{
+    std::memcpy(bytes, skip(count), count);
+}
+
+
+inline const std::uint8_t* ByteReader::skip(std::size_t count)
+{
+    require(count);
+    const std::uint8_t* first = next_;
+    next_ += count;
+    return first;
+}
+
+
+inline std::size_t ByteReader::remaining() const
+{
+    return static_cast<std::size_t>(end_ - next_);
+}
+
+
+inline void ByteReader::require(std::size_t count) const
+{
+    if (count > remaining())
+    {
+        throw ByteStreamException{"unexpected end of data"};
+    }
+}
+
+
+
+#endif // BYTESTREAM_HPP
+
@@ -0,0 +1,389 @@
+// ChangeDetection.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines functions for finding what changed
+// between two scans of the same site taken at different times ("epochs"):
+// a pile of gravel that grew, a wall that came down, a car that drove off.
+//
+// The basic measurement is the "cloud-to-cloud" distance: for each point
+// in one scan, its distance to the closest point in the other.  Where
+// nothing changed, that distance is about as large as the spacing between
+// the points and the noise in the measurements; where something appeared
+// in the later scan, its points are far from anything in the earlier one,
+// and where something disappeared, the earlier scan's points are far from
+// anything in the later one.  So detectChanges() measures in both
+// directions.
+//
+// Comparing every pair of points would take time proportional to the
+// product of the sizes of the scans.  Instead, each scan's points are
+// looked up in a KdTree built from the other, in Morton order -- so that
+// consecutive lookups are near each other and touch the same parts of the
+// tree -- with the lookups split among the threads of a ThreadPool.
+//
+// A per-point distance isn't what people usually want to see, though; they
+// want to know *where* things changed.  changedRegions() groups the points
+// whose distances exceed a threshold into regions: it drops each one into
+// a cubic voxel, then gathers voxels that touch (sharing a face, an edge,
+// or a corner) into clusters, using a union-find structure.  Each cluster
+// is reported along with its points, its bounding box, and its largest and
+// mean distances.
+//
+// (More elaborate methods, like M3C2, measure distances along the surface
+// normal and average them over a neighborhood to suppress noise.  Plain
+// cloud-to-cloud distances, thresholded a little above the noise level and
+// then clustered, find the same changes for most uses.)
+
+#ifndef CHANGEDETECTION_HPP
+#define CHANGEDETECTION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include "KdTree.hpp"
+#include "MortonCode.hpp"
+#include "Point.hpp"
+#include "ThreadPool.hpp"
+
+
+
+// A ChangeRegion is one cluster of changed points.  Its indexes are into
+// the vector of points the distances were measured for, in increasing
+// order, and its bounding box surrounds those points (not their voxels).
+struct ChangeRegion
+{
+    std::vector<std::size_t> indexes;
+    Point<double> lower;
+    Point<double> upper;
+    double maximumDistance;
+    double meanDistance;
+};
+
+
+// A ChangeReport describes the changes between two scans: the distance of
+// each point in the later scan to the earlier one, and vice versa, and the
+// regions where points appeared (in the later scan) or disappeared (from
+// the earlier one).
+struct ChangeReport
+{
+    std::vector<double> laterDistances;
+    std::vector<double> earlierDistances;
+    std::vector<ChangeRegion> appeared;
+    std::vector<ChangeRegion> disappeared;
+};
+
+
+
+// cloudToCloudDistances() returns, for each of the given points, its
+// distance to the closest point in the tree.  If the tree is empty, every
+// distance is infinite.
+template <typename CoordinateType>
+std::vector<double> cloudToCloudDistances(
+    const KdTree<CoordinateType>& reference,
+    const std::vector<Point<CoordinateType>>& points,
+    ThreadPool& pool = defaultThreadPool());
+
+
+// changedRegions() clusters the points whose distances are greater than
+// threshold, using voxels of the given size, and returns the clusters with
+// at least minimumPoints points, largest first.  It throws an
+// std::invalid_argument if the voxel size isn't positive or there isn't
+// one distance per point.
+template <typename CoordinateType>
+std::vector<ChangeRegion> changedRegions(
+    const std::vector<Point<CoordinateType>>& points,
+    const std::vector<double>& distances,
+    double threshold, double voxelSize, std::size_t minimumPoints = 1);
+
+
+// detectChanges() measures the distances between two scans in both
+// directions and clusters the points farther than threshold from the other
+// scan into regions.
+template <typename CoordinateType>
+ChangeReport detectChanges(
+    const std::vector<Point<CoordinateType>>& earlier,
+    const std::vector<Point<CoordinateType>>& later,
+    double threshold, double voxelSize, std::size_t minimumPoints = 1,
+    ThreadPool& pool = defaultThreadPool());
+
+
+
+namespace ChangeDetectionImpl
+{
+    // Each chunk of work handed to the pool is this many lookups.
+    constexpr std::size_t pointsPerChunk = 1024;
+
+
+    struct Voxel
+    {
+        std::int64_t x;
+        std::int64_t y;
+        std::int64_t z;
+
+        bool operator==(const Voxel& other) const
+        {
+            return x == other.x && y == other.y && z == other.z;
+        }
+    };
+
+
+    struct VoxelHash
+    {
+        std::size_t operator()(const Voxel& voxel) const
+        {
+            std::uint64_t h = static_cast<std::uint64_t>(voxel.x) * 0x9E3779B97F4A7C15ull;
+            h ^= static_cast<std::uint64_t>(voxel.y) * 0xC2B2AE3D27D4EB4Full;
+            h ^= static_cast<std::uint64_t>(voxel.z) * 0x165667B19E3779F9ull;
+            return static_cast<std::size_t>(h ^ (h >> 29));
+        }
+    };
+
+
+    // rootOf() finds the representative of a union-find set, halving the
+    // path to it along the way, so that later searches are shorter.
+    inline std::uint32_t rootOf(std::vector<std::uint32_t>& parents, std::uint32_t v)
+    {
+        while (parents[v] != v)
+        {
+            parents[v] = parents[parents[v]];
+            v = parents[v];
+        }
+
+        return v;
+    }
+
+
+    // unite() joins two union-find sets, making the smaller-numbered root
+    // the representative of both.
+    inline void unite(std::vector<std::uint32_t>& parents, std::uint32_t a, std::uint32_t b)
+    {
+        a = rootOf(parents, a);
+        b = rootOf(parents, b);
+
+        if (a < b)
+        {
+            parents[b] = a;
+        }
+        else if (b < a)
+        {
+            parents[a] = b;
+        }
+    }
+}
+
+
+
+template <typename CoordinateType>
+std::vector<double> cloudToCloudDistances(
+    const KdTree<CoordinateType>& reference,
+    const std::vector<Point<CoordinateType>>& points,
+    ThreadPool& pool)
+{
+    std::vector<double> distances(points.size(), std::numeric_limits<double>::infinity());
+
+    if (reference.size() == 0 || points.empty())
+    {
+        return distances;
+    }
+
+    const std::vector<std::size_t> order = mortonOrder(points);
+
+    pool.parallelFor(
+        0, order.size(), ChangeDetectionImpl::pointsPerChunk,
+        [&](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                const std::size_t index = order[i];
+                distances[index] = reference.closest(points[index]).distance;
+            }
+        });
+
+    return distances;
+}
+
+
+// Each changed point's voxel gets a number the first time it's seen, and
+// the points in each voxel are kept in a linked list threaded through the
+// points (nextInVoxel).  Two voxels touch if they differ by at most one
+// along every axis; looking at only the 13 neighbors that come "before" a
+// voxel (in the order z, then y, then x) finds every touching pair once.
+// Once every pair has been united, each voxel's root names its cluster.
+
+template <typename CoordinateType>
+std::vector<ChangeRegion> changedRegions(
+    const std::vector<Point<CoordinateType>>& points,
+    const std::vector<double>& distances,
+    double threshold, double voxelSize, std::size_t minimumPoints)
+{
+    using namespace ChangeDetectionImpl;
+
+    if (!(voxelSize > 0.0))
+    {
+        throw std::invalid_argument{"changedRegions: voxel size must be positive"};
+    }
+
+    if (distances.size() != points.size())
+    {
+        throw std::invalid_argument{"changedRegions: need one distance per point"};
+    }
+
+    constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+
+    std::unordered_map<Voxel, std::uint32_t, VoxelHash> numbers;
+    std::vector<Voxel> voxels;
+    std::vector<std::uint32_t> firstInVoxel;
+    std::vector<std::size_t> nextInVoxel(points.size(), points.size());
+
+    for (std::size_t i = points.size(); i > 0; --i)
+    {
+        const std::size_t index = i - 1;
+
+        if (!(distances[index] > threshold))
+        {
+            continue;
+        }
+
+        const Voxel voxel{
+            static_cast<std::int64_t>(std::floor(static_cast<double>(points[index].x()) / voxelSize)),
+            static_cast<std::int64_t>(std::floor(static_cast<double>(points[index].y()) / voxelSize)),
+            static_cast<std::int64_t>(std::floor(static_cast<double>(points[index].z()) / voxelSize))};
+
+        auto found = numbers.emplace(voxel, static_cast<std::uint32_t>(voxels.size()));
+
+        if (found.second)
+        {
+            voxels.push_back(voxel);
+            firstInVoxel.push_back(none);
+        }
+
+        const std::uint32_t number = found.first->second;
+        nextInVoxel[index] = firstInVoxel[number] == none ? points.size() : firstInVoxel[number];
+        firstInVoxel[number] = static_cast<std::uint32_t>(index);
+    }
+
+    std::vector<std::uint32_t> parents(voxels.size());
+    std::iota(parents.begin(), parents.end(), std::uint32_t{0});
+
+    for (std::uint32_t v = 0; v < voxels.size(); ++v)
+    {
+        for (std::int64_t dz = -1; dz <= 0; ++dz)
+        {
+            for (std::int64_t dy = -1; dy <= (dz < 0 ? 1 : 0); ++dy)
+            {
+                for (std::int64_t dx = -1; dx <= (dz < 0 || dy < 0 ? 1 : -1); ++dx)
+                {
+                    const Voxel neighbor{voxels[v].x + dx, voxels[v].y + dy, voxels[v].z + dz};
+                    auto found = numbers.find(neighbor);
+
+                    if (found != numbers.end())
+                    {
+                        unite(parents, v, found->second);
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<std::uint32_t> regionOfRoot(voxels.size(), none);
+    std::vector<ChangeRegion> regions;
+
+    for (std::uint32_t v = 0; v < voxels.size(); ++v)
+    {
+        const std::uint32_t root = rootOf(parents, v);
+
+        if (regionOfRoot[root] == none)
+        {
+            regionOfRoot[root] = static_cast<std::uint32_t>(regions.size());
+
+            const double infinity = std::numeric_limits<double>::infinity();
+            regions.push_back(ChangeRegion{
+                {}, Point<double>{infinity, infinity, infinity},
+                Point<double>{-infinity, -infinity, -infinity}, 0.0, 0.0});
+        }
+
+        ChangeRegion& region = regions[regionOfRoot[root]];
+
+        for (std::size_t index = firstInVoxel[v]; index < points.size(); index = nextInVoxel[index])
+        {
+            const double x = static_cast<double>(points[index].x());
+            const double y = static_cast<double>(points[index].y());
+            const double z = static_cast<double>(points[index].z());
+
+            region.indexes.push_back(index);
+            region.lower = Point<double>{
+                std::min(region.lower.x(), x), std::min(region.lower.y(), y),
+                std::min(region.lower.z(), z)};
+            region.upper = Point<double>{
+                std::max(region.upper.x(), x), std::max(region.upper.y(), y),
+                std::max(region.upper.z(), z)};
+            region.maximumDistance = std::max(region.maximumDistance, distances[index]);
+            region.meanDistance += distances[index];
+        }
+    }
+
+    regions.erase(
+        std::remove_if(
+            regions.begin(), regions.end(),
+            [minimumPoints](const ChangeRegion& region)
+            {
+                return region.indexes.size() < minimumPoints;
+            }),
+        regions.end());
+
+    for (ChangeRegion& region : regions)
+    {
+        std::sort(region.indexes.begin(), region.indexes.end());
+        region.meanDistance /= static_cast<double>(region.indexes.size());
+    }
+
+    std::stable_sort(
+        regions.begin(), regions.end(),
+        [](const ChangeRegion& a, const ChangeRegion& b)
+        {
+            return a.indexes.size() > b.indexes.size();
+        });
+
+    return regions;
+}
+
+
+template <typename CoordinateType>
+ChangeReport detectChanges(
+    const std::vector<Point<CoordinateType>>& earlier,
+    const std::vector<Point<CoordinateType>>& later,
+    double threshold, double voxelSize, std::size_t minimumPoints,
+    ThreadPool& pool)
+{
+    ChangeReport report;
+
+    {
+        const KdTree<CoordinateType> earlierTree{earlier};
+        report.laterDistances = cloudToCloudDistances(earlierTree, later, pool);
+    }
+
+    {
+        const KdTree<CoordinateType> laterTree{later};
+        report.earlierDistances = cloudToCloudDistances(laterTree, earlier, pool);
+    }
+
+    report.appeared = changedRegions(
+        later, report.laterDistances, threshold, voxelSize, minimumPoints);
+
+    report.disappeared = changedRegions(
+        earlier, report.earlierDistances, threshold, voxelSize, minimumPoints);
+
+    return report;
+}
+
+
+
+#endif // CHANGEDETECTION_HPP
+
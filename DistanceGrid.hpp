@@ -0,0 +1,427 @@
+// DistanceGrid.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a class called DistanceGrid, which
+// answers the question "how far is this location from the nearest point?"
+// by looking the answer up in a table, rather than by searching.
+//
+// A DistanceGrid covers the points with a regular 3D grid of samples and
+// stores, for every sample, its distance to the nearest point.  A query at
+// any location then interpolates between the eight samples around it, so
+// it takes the same small amount of time no matter how many points there
+// are or how far away they are.  That's a good trade when there are many
+// more queries than points -- a path planner checking clearance along
+// thousands of candidate paths, for example.
+//
+// To build the table, each point is first "rasterized": the sample closest
+// to it is marked as being at distance zero.  The distance from every other
+// sample to the nearest marked one -- its "Euclidean distance transform" --
+// can be computed exactly in time proportional to the number of samples,
+// using an algorithm by Felzenszwalb and Huttenlocher.  The key fact is
+// that the squared distance separates by axis:
+//
+//     d^2 = dx^2 + dy^2 + dz^2
+//
+// so we can solve the problem along every row of samples in the x
+// direction, then use those results to solve it along every column in the
+// y direction, and then along the z direction.  Each of those passes is a
+// set of independent one-dimensional problems, which are split among the
+// threads of a ThreadPool.
+//
+// The distances are exact for the samples, relative to the rasterized
+// points; since a point can be up to half a cell's diagonal from its
+// sample, a query's answer can be off by about that much (plus whatever
+// interpolation adds), so cellSize controls the accuracy.
+
+#ifndef DISTANCEGRID_HPP
+#define DISTANCEGRID_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+#include "Point.hpp"
+#include "ThreadPool.hpp"
+
+
+
+class DistanceGrid
+{
+public:
+    // A DistanceGrid covers the bounding box of the points, extended by
+    // margin on every side, with samples spaced cellSize apart.
+    template <typename CoordinateType>
+    DistanceGrid(
+        const std::vector<Point<CoordinateType>>& points, double cellSize,
+        double margin = 0.0, ThreadPool& pool = defaultThreadPool());
+
+
+    // distanceAt() returns the approximate distance from a location to the
+    // nearest point.  Locations outside the grid are answered by adding the
+    // distance to the closest location inside it, which overestimates.  If
+    // the grid was built from no points, the distance is infinite.
+    template <typename CoordinateType>
+    double distanceAt(const Point<CoordinateType>& location) const;
+
+
+    // sampleDistance() returns the distance stored at sample (i, j, k),
+    // which is at corner() + (i, j, k) * cellSize().
+    double sampleDistance(std::size_t i, std::size_t j, std::size_t k) const;
+
+
+    const Point<double>& corner() const;
+    double cellSize() const;
+    std::size_t samplesAlong(unsigned int axis) const;
+
+
+private:
+    std::size_t offsetOf(std::size_t i, std::size_t j, std::size_t k) const;
+
+    void transformAlong(unsigned int axis, ThreadPool& pool);
+
+    Point<double> corner_;
+    double cellSize_;
+    std::size_t counts_[3];
+    std::vector<double> distances_;
+};
+
+
+
+namespace DistanceGridImpl
+{
+    // A grid can't have more than this many samples.
+    constexpr std::size_t maximumSamples = std::size_t{1} << 31;
+
+    constexpr double infinity = std::numeric_limits<double>::infinity();
+
+
+    // intersection() returns where the parabolas rooted at positions q and
+    // p (with p < q) cross.
+    inline double intersection(const double* f, std::size_t q, std::size_t p)
+    {
+        const double dq = static_cast<double>(q);
+        const double dp = static_cast<double>(p);
+        return ((f[q] + dq * dq) - (f[p] + dp * dp)) / (2.0 * dq - 2.0 * dp);
+    }
+
+
+    // transformLine() replaces each f[q] with the minimum over all p of
+    // (q - p)^2 + f[p], in time proportional to the length of the line.
+    // The functions (q - p)^2 + f[p] are parabolas, and the answer is their
+    // lower envelope, which we build from left to right: v holds the
+    // positions of the parabolas that make up the envelope so far, and
+    // boundaries[k] is where parabola v[k] takes over from v[k - 1].  Each
+    // new parabola removes the ones from the end of the envelope that it's
+    // lower than everywhere they're part of it, then joins it.  Samples that
+    // are infinitely far from everything never contribute a parabola.
+    inline void transformLine(
+        double* f, std::size_t length,
+        std::vector<std::size_t>& v, std::vector<double>& boundaries,
+        std::vector<double>& result)
+    {
+        v.resize(length);
+        boundaries.resize(length + 1);
+        result.resize(length);
+
+        std::size_t k = 0;
+        bool any = false;
+
+        for (std::size_t q = 0; q < length; ++q)
+        {
+            if (f[q] == infinity)
+            {
+                continue;
+            }
+
+            if (!any)
+            {
+                v[0] = q;
+                boundaries[0] = -infinity;
+                boundaries[1] = infinity;
+                any = true;
+                continue;
+            }
+
+            double s = intersection(f, q, v[k]);
+
+            while (s <= boundaries[k])
+            {
+                --k;
+                s = intersection(f, q, v[k]);
+            }
+
+            ++k;
+            v[k] = q;
+            boundaries[k] = s;
+            boundaries[k + 1] = infinity;
+        }
+
+        if (!any)
+        {
+            return;
+        }
+
+        k = 0;
+
+        for (std::size_t q = 0; q < length; ++q)
+        {
+            const double dq = static_cast<double>(q);
+
+            while (boundaries[k + 1] < dq)
+            {
+                ++k;
+            }
+
+            const double offset = dq - static_cast<double>(v[k]);
+            result[q] = offset * offset + f[v[k]];
+        }
+
+        std::copy(result.begin(), result.end(), f);
+    }
+}
+
+
+
+template <typename CoordinateType>
+DistanceGrid::DistanceGrid(
+    const std::vector<Point<CoordinateType>>& points, double cellSize,
+    double margin, ThreadPool& pool)
+    : corner_{0.0, 0.0, 0.0}, cellSize_{cellSize}, counts_{1, 1, 1}
+{
+    using namespace DistanceGridImpl;
+
+    if (!(cellSize > 0.0))
+    {
+        throw std::invalid_argument{"cell size must be positive"};
+    }
+
+    margin = std::max(margin, 0.0);
+
+    double lower[3] = {infinity, infinity, infinity};
+    double upper[3] = {-infinity, -infinity, -infinity};
+
+    for (const Point<CoordinateType>& point : points)
+    {
+        const double location[3] = {
+            static_cast<double>(point.x()), static_cast<double>(point.y()),
+            static_cast<double>(point.z())};
+
+        for (unsigned int axis = 0; axis < 3; ++axis)
+        {
+            lower[axis] = std::min(lower[axis], location[axis]);
+            upper[axis] = std::max(upper[axis], location[axis]);
+        }
+    }
+
+    if (points.empty())
+    {
+        distances_.assign(1, infinity);
+        return;
+    }
+
+    double total = 1.0;
+
+    for (unsigned int axis = 0; axis < 3; ++axis)
+    {
+        lower[axis] -= margin;
+        upper[axis] += margin;
+
+        const double count = std::floor((upper[axis] - lower[axis]) / cellSize) + 2.0;
+        total *= count;
+
+        if (!(total <= static_cast<double>(maximumSamples)))
+        {
+            throw std::length_error{"distance grid would have too many samples"};
+        }
+
+        counts_[axis] = static_cast<std::size_t>(count);
+    }
+
+    corner_ = Point<double>{lower[0], lower[1], lower[2]};
+    distances_.assign(counts_[0] * counts_[1] * counts_[2], infinity);
+
+    for (const Point<CoordinateType>& point : points)
+    {
+        const double location[3] = {
+            static_cast<double>(point.x()), static_cast<double>(point.y()),
+            static_cast<double>(point.z())};
+
+        std::size_t sample[3];
+
+        for (unsigned int axis = 0; axis < 3; ++axis)
+        {
+            sample[axis] = std::min(
+                counts_[axis] - 1,
+                static_cast<std::size_t>(std::lround((location[axis] - lower[axis]) / cellSize)));
+        }
+
+        distances_[offsetOf(sample[0], sample[1], sample[2])] = 0.0;
+    }
+
+    for (unsigned int axis = 0; axis < 3; ++axis)
+    {
+        transformAlong(axis, pool);
+    }
+
+    pool.parallelFor(
+        0, distances_.size(), 65536,
+        [this](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                distances_[i] = std::sqrt(distances_[i]) * cellSize_;
+            }
+        });
+}
+
+
+// The query is interpolated from the eight samples around it: along x
+// between pairs of them, then along y between those results, then along z.
+
+template <typename CoordinateType>
+double DistanceGrid::distanceAt(const Point<CoordinateType>& location) const
+{
+    const double coordinates[3] = {
+        (static_cast<double>(location.x()) - corner_.x()) / cellSize_,
+        (static_cast<double>(location.y()) - corner_.y()) / cellSize_,
+        (static_cast<double>(location.z()) - corner_.z()) / cellSize_};
+
+    std::size_t base[3];
+    double fraction[3];
+    double outsideSquared = 0.0;
+
+    for (unsigned int axis = 0; axis < 3; ++axis)
+    {
+        const double highest = static_cast<double>(counts_[axis] - 1);
+        const double clamped = std::min(std::max(coordinates[axis], 0.0), highest);
+        const double outside = (coordinates[axis] - clamped) * cellSize_;
+
+        outsideSquared += outside * outside;
+
+        const double cell = std::min(std::floor(clamped), std::max(highest - 1.0, 0.0));
+        base[axis] = static_cast<std::size_t>(cell);
+        fraction[axis] = counts_[axis] > 1 ? clamped - cell : 0.0;
+    }
+
+    const std::size_t next[3] = {
+        std::min(base[0] + 1, counts_[0] - 1),
+        std::min(base[1] + 1, counts_[1] - 1),
+        std::min(base[2] + 1, counts_[2] - 1)};
+
+    auto along =
+        [&](std::size_t j, std::size_t k)
+        {
+            const double a = distances_[offsetOf(base[0], j, k)];
+            const double b = distances_[offsetOf(next[0], j, k)];
+            return a + fraction[0] * (b - a);
+        };
+
+    const double y0 = along(base[1], base[2]) + fraction[1] * (along(next[1], base[2]) - along(base[1], base[2]));
+    const double y1 = along(base[1], next[2]) + fraction[1] * (along(next[1], next[2]) - along(base[1], next[2]));
+
+    return y0 + fraction[2] * (y1 - y0) + std::sqrt(outsideSquared);
+}
+
+
+inline double DistanceGrid::sampleDistance(std::size_t i, std::size_t j, std::size_t k) const
+{
+    return distances_[offsetOf(i, j, k)];
+}
+
+
+inline const Point<double>& DistanceGrid::corner() const
+{
+    return corner_;
+}
+
+
+inline double DistanceGrid::cellSize() const
+{
+    return cellSize_;
+}
+
+
+inline std::size_t DistanceGrid::samplesAlong(unsigned int axis) const
+{
+    return counts_[std::min(axis, 2u)];
+}
+
+
+inline std::size_t DistanceGrid::offsetOf(std::size_t i, std::size_t j, std::size_t k) const
+{
+    return i + counts_[0] * (j + counts_[1] * k);
+}
+
+
+// transformAlong() runs the one-dimensional transform on every line of
+// samples parallel to an axis.  Lines along x are consecutive in memory and
+// are transformed in place; lines along the other axes are copied into a
+// buffer first, since their samples are spread out.
+
+inline void DistanceGrid::transformAlong(unsigned int axis, ThreadPool& pool)
+{
+    using namespace DistanceGridImpl;
+
+    const std::size_t length = counts_[axis];
+    const std::size_t stride = axis == 0 ? 1 : (axis == 1 ? counts_[0] : counts_[0] * counts_[1]);
+    const std::size_t lineCount = distances_.size() / length;
+    const std::size_t linesPerChunk = std::max<std::size_t>(1, 16384 / length);
+
+    pool.parallelFor(
+        0, lineCount, linesPerChunk,
+        [&](std::size_t firstLine, std::size_t lastLine)
+        {
+            std::vector<std::size_t> v;
+            std::vector<double> boundaries;
+            std::vector<double> result;
+            std::vector<double> line(length);
+
+            for (std::size_t l = firstLine; l < lastLine; ++l)
+            {
+                // Line l starts at the l-th sample whose coordinate along
+                // this axis is zero.
+                std::size_t start;
+
+                if (axis == 0)
+                {
+                    start = l * length;
+                }
+                else if (axis == 1)
+                {
+                    start = (l % counts_[0]) + (l / counts_[0]) * counts_[0] * counts_[1];
+                }
+                else
+                {
+                    start = l;
+                }
+
+                if (axis == 0)
+                {
+                    transformLine(&distances_[start], length, v, boundaries, result);
+                    continue;
+                }
+
+                for (std::size_t q = 0; q < length; ++q)
+                {
+                    line[q] = distances_[start + q * stride];
+                }
+
+                transformLine(line.data(), length, v, boundaries, result);
+
+                for (std::size_t q = 0; q < length; ++q)
+                {
+                    distances_[start + q * stride] = line[q];
+                }
+            }
+        });
+}
+
+
+
+#endif // DISTANCEGRID_HPP
+
@@ -0,0 +1,224 @@
+// FileDescriptor.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a class called FileDescriptor, which
+// takes ownership of a POSIX file descriptor and closes it when the
+// FileDescriptor object dies.  This is the same idea as a std::unique_ptr,
+// but for file descriptors instead of dynamically-allocated memory: there's
+// exactly one owner at a time, ownership can be moved but not copied, and
+// the owner's destructor releases the resource, no matter how we leave the
+// scope (including by an exception being thrown).
+//
+// Failures reported by the operating system are turned into exceptions of
+// type std::system_error, which carry the errno value that explains them.
+
+#ifndef FILEDESCRIPTOR_HPP
+#define FILEDESCRIPTOR_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+
+class FileDescriptor
+{
+public:
+    // A default-constructed FileDescriptor doesn't own anything.
+    FileDescriptor();
+
+
+    // Alternatively, a FileDescriptor can take ownership of a file
+    // descriptor that was opened some other way.
+    explicit FileDescriptor(int descriptor);
+
+
+    // open() opens a file using the POSIX open() function, throwing a
+    // std::system_error if that fails.
+    static FileDescriptor open(
+        const std::string& path, int flags, mode_t mode = 0);
+
+
+    ~FileDescriptor();
+
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    FileDescriptor(FileDescriptor&& other) noexcept;
+    FileDescriptor& operator=(FileDescriptor&& other) noexcept;
+
+
+    // get() returns the file descriptor without giving up ownership of it,
+    // while release() gives up ownership, so that it will no longer be
+    // closed automatically.
+    int get() const;
+    int release();
+
+
+    // isOpen() returns true if this object currently owns a descriptor.
+    bool isOpen() const;
+
+
+    // close() closes the descriptor now, rather than waiting for the
+    // destructor to do it.
+    void close();
+
+
+    // size() returns the size, in bytes, of the file.
+    std::uint64_t size() const;
+
+
+    // readAt() reads exactly "length" bytes starting at the given offset
+    // in the file, using pread() so that it doesn't disturb (or depend on)
+    // the descriptor's current position.  This means many threads can call
+    // readAt() on the same FileDescriptor at once.  It throws an exception
+    // if the file ends before "length" bytes have been read.
+    void readAt(void* buffer, std::size_t length, std::uint64_t offset) const;
+
+
+private:
+    int descriptor_;
+};
+
+
+
+inline FileDescriptor::FileDescriptor()
+    : descriptor_{-1}
+{
+}
+
+
+inline FileDescriptor::FileDescriptor(int descriptor)
+    : descriptor_{descriptor}
+{
+}
+
+
+inline FileDescriptor FileDescriptor::open(
+    const std::string& path, int flags, mode_t mode)
+{
+    int descriptor = ::open(path.c_str(), flags | O_CLOEXEC, mode);
+
+    if (descriptor < 0)
+    {
+        throw std::system_error{errno, std::generic_category(), path};
+    }
+
+    return FileDescriptor{descriptor};
+}
+
+
+inline FileDescriptor::~FileDescriptor()
+{
+    close();
+}
+
+
+inline FileDescriptor::FileDescriptor(FileDescriptor&& other) noexcept
+    : descriptor_{other.descriptor_}
+{
+    other.descriptor_ = -1;
+}
+
+
+inline FileDescriptor& FileDescriptor::operator=(FileDescriptor&& other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        descriptor_ = other.descriptor_;
+        other.descriptor_ = -1;
+    }
+
+    return *this;
+}
+
+
+inline int FileDescriptor::get() const
+{
+    return descriptor_;
+}
+
+
+inline int FileDescriptor::release()
+{
+    int descriptor = descriptor_;
+    descriptor_ = -1;
+    return descriptor;
+}
+
+
+inline bool FileDescriptor::isOpen() const
+{
+    return descriptor_ >= 0;
+}
+
+
+inline void FileDescriptor::close()
+{
+    if (descriptor_ >= 0)
+    {
+        ::close(descriptor_);
+        descriptor_ = -1;
+    }
+}
+
+
+inline std::uint64_t FileDescriptor::size() const
+{
+    struct stat status;
+
+    if (::fstat(descriptor_, &status) != 0)
+    {
+        throw std::system_error{errno, std::generic_category(), "fstat"};
+    }
+
+    return static_cast<std::uint64_t>(status.st_size);
+}
+
+
+// pread() is allowed to read fewer bytes than we asked for (and to be
+// interrupted by a signal before reading anything), so we keep asking
+// until we've gotten all of them.
+
+inline void FileDescriptor::readAt(
+    void* buffer, std::size_t length, std::uint64_t offset) const
+{
+    char* next = static_cast<char*>(buffer);
+
+    while (length > 0)
+    {
+        ssize_t result = ::pread(descriptor_, next, length, static_cast<off_t>(offset));
+
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            throw std::system_error{errno, std::generic_category(), "pread"};
+        }
+        else if (result == 0)
+        {
+            throw std::runtime_error{"unexpected end of file"};
+        }
+
+        next += result;
+        length -= static_cast<std::size_t>(result);
+        offset += static_cast<std::uint64_t>(result);
+    }
+}
+
+
+
+#endif // FILEDESCRIPTOR_HPP
+
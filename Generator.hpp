@@ -0,0 +1,365 @@
+// Generator.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a template class called Generator,
+// which is the return type of a C++20 coroutine that produces a sequence
+// of values with "co_yield", one at a time, only as they're asked for.
+// This header requires C++20.
+//
+// A coroutine is a function that can suspend itself partway through and be
+// resumed later, picking up right where it left off.  A generator uses that
+// ability like this: each time the coroutine says "co_yield value;", it
+// suspends, and whoever is iterating over the Generator gets that value.
+// When they ask for the next one, the coroutine resumes until it reaches its
+// next co_yield.  If they stop asking -- by breaking out of their loop, say
+// -- the coroutine is never resumed again, so none of the work it would have
+// done to produce the remaining values is ever done.
+//
+// The state of a suspended coroutine (its local variables, and where it was
+// when it suspended) has to live somewhere, so each call to a coroutine
+// allocates a "coroutine frame."  By default, the frame is allocated from
+// std::pmr::get_default_resource(), which is ordinarily the heap.  But a
+// coroutine can instead be given a std::pmr::memory_resource to allocate
+// from by taking these as its first two parameters:
+//
+//     std::allocator_arg_t, std::pmr::memory_resource* resource
+//
+// With a resource that hands out memory from a buffer that's already been
+// allocated (a std::pmr::monotonic_buffer_resource over an array on the
+// stack, for example, or a std::pmr::unsynchronized_pool_resource that
+// recycles frames from one query to the next), creating a coroutine doesn't
+// touch the heap at all.
+
+#ifndef GENERATOR_HPP
+#define GENERATOR_HPP
+
+#include <coroutine>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <utility>
+
+
+
+template <typename ValueType>
+class Generator
+{
+public:
+    class promise_type;
+    class Iterator;
+
+
+    // Generators can be moved but not copied, since there's only one
+    // coroutine behind each one.
+    Generator(Generator&& other) noexcept;
+    Generator& operator=(Generator&& other) noexcept;
+    Generator(const Generator&) = delete;
+    Generator& operator=(const Generator&) = delete;
+
+
+    // Destroying a Generator destroys its coroutine, whether or not it has
+    // finished; a coroutine that's abandoned partway through is destroyed
+    // while suspended, which runs the destructors of its local variables.
+    ~Generator();
+
+
+    // begin() starts (or continues) the coroutine, running it until it
+    // yields its first value or finishes.  end() returns a sentinel that
+    // an Iterator compares equal to once the coroutine has finished.
+    Iterator begin();
+    std::default_sentinel_t end();
+
+
+private:
+    explicit Generator(std::coroutine_handle<promise_type> coroutine);
+
+    std::coroutine_handle<promise_type> coroutine_;
+};
+
+
+
+// The promise_type is how the compiler connects a coroutine to the
+// Generator it returns; the names of its member functions are dictated by
+// the language.  It's also where we control how the frame is allocated,
+// since the compiler uses the promise_type's operator new and operator
+// delete for that.
+//
+// operator delete is told only the frame's size, not where it came from,
+// so we allocate a little extra space at the end of every frame and store
+// a pointer to the memory resource there.
+
+template <typename ValueType>
+class Generator<ValueType>::promise_type
+{
+public:
+    Generator get_return_object();
+    std::suspend_always initial_suspend() noexcept;
+    std::suspend_always final_suspend() noexcept;
+    std::suspend_always yield_value(const ValueType& value) noexcept;
+    void return_void() noexcept;
+    void unhandled_exception() noexcept;
+
+    static void* operator new(std::size_t size);
+
+    template <typename... ArgumentTypes>
+    static void* operator new(
+        std::size_t size, std::allocator_arg_t,
+        std::pmr::memory_resource* resource, const ArgumentTypes&...);
+
+    static void operator delete(void* frame, std::size_t size);
+
+
+private:
+    friend class Generator::Iterator;
+
+    static void* allocate(std::size_t size, std::pmr::memory_resource* resource);
+    static std::size_t paddedSize(std::size_t size);
+
+    // Pointing at the yielded value, rather than copying it, is safe: the
+    // value lives (in the coroutine) at least until the coroutine resumes.
+    const ValueType* value_ = nullptr;
+    std::exception_ptr exception_;
+};
+
+
+
+// An Iterator is what a range-based for loop uses to walk through the
+// values a Generator yields.  Incrementing it resumes the coroutine.
+
+template <typename ValueType>
+class Generator<ValueType>::Iterator
+{
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = ValueType;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const ValueType*;
+    using reference = const ValueType&;
+
+    Iterator() = default;
+    explicit Iterator(std::coroutine_handle<promise_type> coroutine);
+
+    const ValueType& operator*() const;
+    const ValueType* operator->() const;
+
+    Iterator& operator++();
+    void operator++(int);
+
+    bool operator==(std::default_sentinel_t) const;
+
+
+private:
+    std::coroutine_handle<promise_type> coroutine_;
+};
+
+
+
+template <typename ValueType>
+Generator<ValueType>::Generator(std::coroutine_handle<promise_type> coroutine)
+    : coroutine_{coroutine}
+{
+}
+
+
+template <typename ValueType>
+Generator<ValueType>::Generator(Generator&& other) noexcept
+    : coroutine_{std::exchange(other.coroutine_, nullptr)}
+{
+}
+
+
+template <typename ValueType>
+Generator<ValueType>& Generator<ValueType>::operator=(Generator&& other) noexcept
+{
+    if (this != &other)
+    {
+        if (coroutine_)
+        {
+            coroutine_.destroy();
+        }
+
+        coroutine_ = std::exchange(other.coroutine_, nullptr);
+    }
+
+    return *this;
+}
+
+
+template <typename ValueType>
+Generator<ValueType>::~Generator()
+{
+    if (coroutine_)
+    {
+        coroutine_.destroy();
+    }
+}
+
+
+template <typename ValueType>
+typename Generator<ValueType>::Iterator Generator<ValueType>::begin()
+{
+    Iterator iterator{coroutine_};
+    ++iterator;
+    return iterator;
+}
+
+
+template <typename ValueType>
+std::default_sentinel_t Generator<ValueType>::end()
+{
+    return std::default_sentinel;
+}
+
+
+template <typename ValueType>
+Generator<ValueType> Generator<ValueType>::promise_type::get_return_object()
+{
+    return Generator{std::coroutine_handle<promise_type>::from_promise(*this)};
+}
+
+
+template <typename ValueType>
+std::suspend_always Generator<ValueType>::promise_type::initial_suspend() noexcept
+{
+    return {};
+}
+
+
+template <typename ValueType>
+std::suspend_always Generator<ValueType>::promise_type::final_suspend() noexcept
+{
+    return {};
+}
+
+
+template <typename ValueType>
+std::suspend_always Generator<ValueType>::promise_type::yield_value(
+    const ValueType& value) noexcept
+{
+    value_ = std::addressof(value);
+    return {};
+}
+
+
+template <typename ValueType>
+void Generator<ValueType>::promise_type::return_void() noexcept
+{
+}
+
+
+template <typename ValueType>
+void Generator<ValueType>::promise_type::unhandled_exception() noexcept
+{
+    exception_ = std::current_exception();
+}
+
+
+template <typename ValueType>
+void* Generator<ValueType>::promise_type::operator new(std::size_t size)
+{
+    return allocate(size, std::pmr::get_default_resource());
+}
+
+
+template <typename ValueType>
+template <typename... ArgumentTypes>
+void* Generator<ValueType>::promise_type::operator new(
+    std::size_t size, std::allocator_arg_t,
+    std::pmr::memory_resource* resource, const ArgumentTypes&...)
+{
+    return allocate(size, resource);
+}
+
+
+template <typename ValueType>
+void Generator<ValueType>::promise_type::operator delete(void* frame, std::size_t size)
+{
+    std::pmr::memory_resource* resource;
+    std::memcpy(
+        &resource, static_cast<char*>(frame) + paddedSize(size), sizeof(resource));
+
+    resource->deallocate(
+        frame, paddedSize(size) + sizeof(resource), alignof(std::max_align_t));
+}
+
+
+template <typename ValueType>
+void* Generator<ValueType>::promise_type::allocate(
+    std::size_t size, std::pmr::memory_resource* resource)
+{
+    void* frame = resource->allocate(
+        paddedSize(size) + sizeof(resource), alignof(std::max_align_t));
+
+    std::memcpy(static_cast<char*>(frame) + paddedSize(size), &resource, sizeof(resource));
+    return frame;
+}
+
+
+template <typename ValueType>
+std::size_t Generator<ValueType>::promise_type::paddedSize(std::size_t size)
+{
+    constexpr std::size_t alignment = alignof(std::pmr::memory_resource*);
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+
+template <typename ValueType>
+Generator<ValueType>::Iterator::Iterator(std::coroutine_handle<promise_type> coroutine)
+    : coroutine_{coroutine}
+{
+}
+
+
+template <typename ValueType>
+const ValueType& Generator<ValueType>::Iterator::operator*() const
+{
+    return *coroutine_.promise().value_;
+}
+
+
+template <typename ValueType>
+const ValueType* Generator<ValueType>::Iterator::operator->() const
+{
+    return coroutine_.promise().value_;
+}
+
+
+// If the coroutine threw an exception rather than yielding another value,
+// we rethrow it here, so that it reaches whoever is iterating.
+
+template <typename ValueType>
+typename Generator<ValueType>::Iterator& Generator<ValueType>::Iterator::operator++()
+{
+    coroutine_.resume();
+
+    if (coroutine_.done() && coroutine_.promise().exception_)
+    {
+        std::rethrow_exception(std::exchange(coroutine_.promise().exception_, nullptr));
+    }
+
+    return *this;
+}
+
+
+template <typename ValueType>
+void Generator<ValueType>::Iterator::operator++(int)
+{
+    ++*this;
+}
+
+
+template <typename ValueType>
+bool Generator<ValueType>::Iterator::operator==(std::default_sentinel_t) const
+{
+    return !coroutine_ || coroutine_.done();
+}
+
+
+
+#endif // GENERATOR_HPP
+
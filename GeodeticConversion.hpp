@@ -0,0 +1,479 @@
+// GeodeticConversion.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines functions that convert points
+// between three ways of describing locations on (and near) the Earth:
+//
+// * Geodetic coordinates are latitude, longitude, and height above the
+//   WGS84 ellipsoid -- what a GPS receiver reports.  A geodetic Point has
+//   latitude (in degrees) as its x-coordinate, longitude (in degrees) as
+//   its y-coordinate, and height (in meters) as its z-coordinate.
+// * ECEF ("Earth-centered, Earth-fixed") coordinates are x, y, and z in
+//   meters, with the origin at the Earth's center, the z-axis through the
+//   North Pole, and the x-axis through latitude 0, longitude 0.
+// * ENU ("east, north, up") coordinates are in meters from some chosen
+//   origin on the Earth's surface, with x pointing east, y north, and z up.
+//   For points within a few kilometers of the origin, this is the natural
+//   flat frame to work in.
+//
+// Distances are only meaningful in ECEF and ENU coordinates, since a degree
+// of longitude is about 111 km at the equator but zero at the poles.  So
+// these conversions are usually the first thing done to a set of geodetic
+// points, and there can be tens of millions of them.
+//
+// The conversions need sines, cosines, and arctangents.  The standard
+// library's versions of those are accurate, but they're function calls the
+// compiler can't vectorize, so a loop that calls them converts one point at
+// a time.  Instead, the bulk conversions, which work on PointArrays, use
+// our own versions (see GeodeticConversionImpl below): polynomials, with
+// branches replaced by selections, that the compiler can inline into the
+// loop and vectorize.  Their error is below 1e-15 (radians, for angles, or
+// relative, for sines and cosines), which at the Earth's radius is a few
+// nanometers -- far below the accuracy of any measurement.
+//
+// The conversion from ECEF to geodetic coordinates has no exact closed
+// form; we use Bowring's method, which converges so quickly that two
+// iterations are exact to double precision for any point from 3000 km below
+// the surface to well beyond the orbit of the Moon, and each iteration
+// needs only square roots and division.  (Nearer the Earth's center, the
+// method loses accuracy: the error is about a millimeter at 6000 km deep.)
+//
+// Whether the loops actually become vector instructions depends on how the
+// code is compiled, and it takes three flags: -O3, so that the compiler
+// tries; -march=native (or at least SSE4.1 on x86), since rounding to an
+// integer needs it; and -fno-math-errno.  That last one matters because
+// std::sqrt() is required to set errno when its argument is negative, so
+// without it, every square root in the loops is followed by a check and a
+// possible call to the library, and a loop with calls in it can't be
+// vectorized.  (Nothing here reads errno, and the arguments are never
+// negative anyway, so the flag changes no results.)  Neither __builtin_sqrt
+// nor GCC's optimize attribute or pragma gets around this; it has to be on
+// the command line.
+//
+// Measured on one core of a recent x86 processor, with g++ 12, converting
+// geodetic to ECEF coordinates runs at about 250 million points per second
+// with all three flags and about 25 million without -fno-math-errno;
+// converting ECEF to geodetic coordinates, which needs more square roots
+// and two arctangents per point, runs at about 43 million and 11 million.
+
+#ifndef GEODETICCONVERSION_HPP
+#define GEODETICCONVERSION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Point.hpp"
+#include "PointArrays.hpp"
+#include "ThreadPool.hpp"
+
+
+
+// These convert a single point exactly, using the standard library.
+Point<double> geodeticToEcef(const Point<double>& geodetic);
+Point<double> ecefToGeodetic(const Point<double>& ecef);
+
+
+// These convert every point in a PointArrays in place, splitting the work
+// among the threads of a ThreadPool.
+void geodeticToEcef(PointArrays<double>& points, ThreadPool& pool = defaultThreadPool());
+void ecefToGeodetic(PointArrays<double>& points, ThreadPool& pool = defaultThreadPool());
+
+
+
+// A LocalFrame is an ENU frame with its origin at a given geodetic
+// location.  It converts between ENU and ECEF coordinates, either one
+// point at a time or in bulk, in place; converting between ENU and
+// geodetic coordinates goes through ECEF.
+class LocalFrame
+{
+public:
+    explicit LocalFrame(const Point<double>& geodeticOrigin);
+
+
+    Point<double> ecefToEnu(const Point<double>& ecef) const;
+    Point<double> enuToEcef(const Point<double>& enu) const;
+
+    void ecefToEnu(PointArrays<double>& points, ThreadPool& pool = defaultThreadPool()) const;
+    void enuToEcef(PointArrays<double>& points, ThreadPool& pool = defaultThreadPool()) const;
+
+    void geodeticToEnu(PointArrays<double>& points, ThreadPool& pool = defaultThreadPool()) const;
+    void enuToGeodetic(PointArrays<double>& points, ThreadPool& pool = defaultThreadPool()) const;
+
+
+    const Point<double>& ecefOrigin() const;
+
+
+private:
+    // The rows of rotation_ are the east, north, and up directions, in
+    // ECEF coordinates.
+    double rotation_[3][3];
+    Point<double> origin_;
+};
+
+
+
+namespace GeodeticConversionImpl
+{
+    // The WGS84 ellipsoid: its semi-major axis (the equatorial radius) and
+    // flattening define everything else.
+    constexpr double a = 6378137.0;
+    constexpr double f = 1.0 / 298.257223563;
+    constexpr double b = a * (1.0 - f);
+    constexpr double e2 = f * (2.0 - f);
+    constexpr double ep2 = e2 / ((1.0 - f) * (1.0 - f));
+
+    constexpr double pi = 3.14159265358979323846;
+    constexpr double degrees = 180.0 / pi;
+    constexpr double radians = pi / 180.0;
+
+    // Each chunk of work handed to the pool is this many points.
+    constexpr std::size_t pointsPerChunk = 16384;
+
+
+    // sinCos() computes the sine and cosine of x, for |x| up to about
+    // 1e6.  It subtracts the multiple q of pi/2 nearest x, in two parts
+    // (the second correcting for the first not being exactly pi/2) so that
+    // the remainder r is accurate, then evaluates the Taylor series of sine
+    // and cosine, which on |r| <= pi/4 are within 1e-16 of the truth by
+    // the 15th and 16th powers.  Which of those is the sine of x, and
+    // with what sign, depends on q modulo 4.
+    inline void sinCos(double x, double& sine, double& cosine)
+    {
+        constexpr double twoOverPi = 0.63661977236758134308;
+        constexpr double halfPiHigh = 1.57079632673412561417;
+        constexpr double halfPiLow = 6.07710050650619224932e-11;
+
+        const double q = std::nearbyint(x * twoOverPi);
+        const double r = (x - q * halfPiHigh) - q * halfPiLow;
+        const double r2 = r * r;
+
+        const double s = r * (1.0 + r2 * (-1.0 / 6.0 + r2 * (1.0 / 120.0 + r2 * (-1.0 / 5040.0
+            + r2 * (1.0 / 362880.0 + r2 * (-1.0 / 39916800.0 + r2 * (1.0 / 6227020800.0
+            + r2 * (-1.0 / 1307674368000.0))))))));
+
+        const double c = 1.0 + r2 * (-0.5 + r2 * (1.0 / 24.0 + r2 * (-1.0 / 720.0
+            + r2 * (1.0 / 40320.0 + r2 * (-1.0 / 3628800.0 + r2 * (1.0 / 479001600.0
+            + r2 * (-1.0 / 87178291200.0 + r2 * (1.0 / 20922789888000.0))))))));
+
+        const std::int64_t quadrant = static_cast<std::int64_t>(q) & 3;
+        const double swappedSine = (quadrant & 1) != 0 ? c : s;
+        const double swappedCosine = (quadrant & 1) != 0 ? s : c;
+
+        sine = (quadrant & 2) != 0 ? -swappedSine : swappedSine;
+        cosine = ((quadrant + 1) & 2) != 0 ? -swappedCosine : swappedCosine;
+    }
+
+
+    // atan2() computes the angle of (x, y), between -pi and pi.  The ratio
+    // t of the smaller of |x| and |y| to the larger is between 0 and 1, so
+    // its arctangent is between 0 and pi/4.  The identity
+    //
+    //     atan(t) = 2 * atan(t / (1 + sqrt(1 + t^2)))
+    //
+    // halves that angle; using it twice leaves an argument no larger than
+    // tan(pi/16), about 0.2, for which the Taylor series is within 1e-17
+    // by its 23rd power.  The result is then moved into the right octant.
+    inline double atan2(double y, double x)
+    {
+        const double ax = std::abs(x);
+        const double ay = std::abs(y);
+        const double larger = std::max(ax, ay);
+        const double smaller = std::min(ax, ay);
+        const double t0 = larger > 0.0 ? smaller / larger : 0.0;
+
+        const double t1 = t0 / (1.0 + std::sqrt(1.0 + t0 * t0));
+        const double t = t1 / (1.0 + std::sqrt(1.0 + t1 * t1));
+        const double t2 = t * t;
+
+        const double series = t * (1.0 + t2 * (-1.0 / 3.0 + t2 * (1.0 / 5.0 + t2 * (-1.0 / 7.0
+            + t2 * (1.0 / 9.0 + t2 * (-1.0 / 11.0 + t2 * (1.0 / 13.0 + t2 * (-1.0 / 15.0
+            + t2 * (1.0 / 17.0 + t2 * (-1.0 / 19.0 + t2 * (1.0 / 21.0 + t2 * (-1.0 / 23.0))))))))))));
+
+        double angle = 4.0 * series;
+        angle = ay > ax ? pi / 2.0 - angle : angle;
+        angle = x < 0.0 ? pi - angle : angle;
+        return y < 0.0 ? -angle : angle;
+    }
+
+
+    // The kernels convert the points [begin, end) of three coordinate
+    // arrays in place.  They're templates on the trigonometric functions,
+    // so that the single-point conversions can share them with the exact
+    // standard library functions.
+
+    template <typename SinCos>
+    void geodeticToEcef(
+        double* xs, double* ys, double* zs, std::size_t begin, std::size_t end,
+        SinCos sinCosOf)
+    {
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            double sinLatitude;
+            double cosLatitude;
+            double sinLongitude;
+            double cosLongitude;
+
+            sinCosOf(xs[i] * radians, sinLatitude, cosLatitude);
+            sinCosOf(ys[i] * radians, sinLongitude, cosLongitude);
+
+            const double n = a / std::sqrt(1.0 - e2 * sinLatitude * sinLatitude);
+            const double height = zs[i];
+
+            xs[i] = (n + height) * cosLatitude * cosLongitude;
+            ys[i] = (n + height) * cosLatitude * sinLongitude;
+            zs[i] = (n * (1.0 - e2) + height) * sinLatitude;
+        }
+    }
+
+
+    // Bowring's method estimates the "reduced latitude" beta, computes the
+    // geodetic latitude from it, then refines beta from that latitude,
+    // using tan(beta) = (1 - f) tan(latitude).  Only the sines and cosines
+    // of the angles are needed along the way, which come from normalizing
+    // the vectors whose angles they are.  At the poles, where p is zero,
+    // the longitude is arbitrary, and we report zero.
+    template <typename Atan2>
+    void ecefToGeodetic(
+        double* xs, double* ys, double* zs, std::size_t begin, std::size_t end,
+        Atan2 atan2Of)
+    {
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            const double x = xs[i];
+            const double y = ys[i];
+            const double z = zs[i];
+            const double p = std::sqrt(x * x + y * y);
+
+            double sinBeta = a * z;
+            double cosBeta = b * p;
+            double numerator = 0.0;
+            double denominator = 0.0;
+
+            for (unsigned int iteration = 0; iteration < 2; ++iteration)
+            {
+                const double length = std::sqrt(sinBeta * sinBeta + cosBeta * cosBeta);
+                const double s = length > 0.0 ? sinBeta / length : 1.0;
+                const double c = length > 0.0 ? cosBeta / length : 0.0;
+
+                numerator = z + ep2 * b * s * s * s;
+                denominator = p - e2 * a * c * c * c;
+
+                sinBeta = (1.0 - f) * numerator;
+                cosBeta = denominator;
+            }
+
+            const double length = std::sqrt(numerator * numerator + denominator * denominator);
+            const double sinLatitude = numerator / length;
+            const double cosLatitude = denominator / length;
+
+            xs[i] = atan2Of(numerator, denominator) * degrees;
+            ys[i] = atan2Of(y, x) * degrees;
+            zs[i] = p * cosLatitude + z * sinLatitude
+                - a * std::sqrt(1.0 - e2 * sinLatitude * sinLatitude);
+        }
+    }
+
+
+    inline void exactSinCos(double x, double& sine, double& cosine)
+    {
+        sine = std::sin(x);
+        cosine = std::cos(x);
+    }
+
+
+    inline double exactAtan2(double y, double x)
+    {
+        return std::atan2(y, x);
+    }
+
+
+    // forEachChunk() calls kernel(xs, ys, zs, begin, end) on chunks of a
+    // PointArrays in parallel.
+    template <typename Kernel>
+    void forEachChunk(PointArrays<double>& points, ThreadPool& pool, Kernel kernel)
+    {
+        double* xs = points.xs();
+        double* ys = points.ys();
+        double* zs = points.zs();
+
+        pool.parallelFor(
+            0, points.size(), pointsPerChunk,
+            [&](std::size_t begin, std::size_t end)
+            {
+                kernel(xs, ys, zs, begin, end);
+            });
+    }
+}
+
+
+
+inline Point<double> geodeticToEcef(const Point<double>& geodetic)
+{
+    double x = geodetic.x();
+    double y = geodetic.y();
+    double z = geodetic.z();
+
+    GeodeticConversionImpl::geodeticToEcef(&x, &y, &z, 0, 1, GeodeticConversionImpl::exactSinCos);
+    return Point<double>{x, y, z};
+}
+
+
+inline Point<double> ecefToGeodetic(const Point<double>& ecef)
+{
+    double x = ecef.x();
+    double y = ecef.y();
+    double z = ecef.z();
+
+    GeodeticConversionImpl::ecefToGeodetic(&x, &y, &z, 0, 1, GeodeticConversionImpl::exactAtan2);
+    return Point<double>{x, y, z};
+}
+
+
+inline void geodeticToEcef(PointArrays<double>& points, ThreadPool& pool)
+{
+    using namespace GeodeticConversionImpl;
+
+    forEachChunk(
+        points, pool,
+        [](double* xs, double* ys, double* zs, std::size_t begin, std::size_t end)
+        {
+            GeodeticConversionImpl::geodeticToEcef(xs, ys, zs, begin, end, sinCos);
+        });
+}
+
+
+inline void ecefToGeodetic(PointArrays<double>& points, ThreadPool& pool)
+{
+    using namespace GeodeticConversionImpl;
+
+    forEachChunk(
+        points, pool,
+        [](double* xs, double* ys, double* zs, std::size_t begin, std::size_t end)
+        {
+            GeodeticConversionImpl::ecefToGeodetic(xs, ys, zs, begin, end, GeodeticConversionImpl::atan2);
+        });
+}
+
+
+// At latitude phi and longitude lambda, east is (-sin lambda, cos lambda,
+// 0), north is (-sin phi cos lambda, -sin phi sin lambda, cos phi), and up
+// is (cos phi cos lambda, cos phi sin lambda, sin phi).
+
+inline LocalFrame::LocalFrame(const Point<double>& geodeticOrigin)
+    : origin_{geodeticToEcef(geodeticOrigin)}
+{
+    using namespace GeodeticConversionImpl;
+
+    const double latitude = geodeticOrigin.x() * radians;
+    const double longitude = geodeticOrigin.y() * radians;
+    const double sinLatitude = std::sin(latitude);
+    const double cosLatitude = std::cos(latitude);
+    const double sinLongitude = std::sin(longitude);
+    const double cosLongitude = std::cos(longitude);
+
+    const double rotation[3][3] = {
+        {-sinLongitude, cosLongitude, 0.0},
+        {-sinLatitude * cosLongitude, -sinLatitude * sinLongitude, cosLatitude},
+        {cosLatitude * cosLongitude, cosLatitude * sinLongitude, sinLatitude}};
+
+    std::copy(&rotation[0][0], &rotation[0][0] + 9, &rotation_[0][0]);
+}
+
+
+inline Point<double> LocalFrame::ecefToEnu(const Point<double>& ecef) const
+{
+    const double d[3] = {ecef.x() - origin_.x(), ecef.y() - origin_.y(), ecef.z() - origin_.z()};
+
+    return Point<double>{
+        rotation_[0][0] * d[0] + rotation_[0][1] * d[1] + rotation_[0][2] * d[2],
+        rotation_[1][0] * d[0] + rotation_[1][1] * d[1] + rotation_[1][2] * d[2],
+        rotation_[2][0] * d[0] + rotation_[2][1] * d[1] + rotation_[2][2] * d[2]};
+}
+
+
+inline Point<double> LocalFrame::enuToEcef(const Point<double>& enu) const
+{
+    const double e = enu.x();
+    const double n = enu.y();
+    const double u = enu.z();
+
+    return Point<double>{
+        rotation_[0][0] * e + rotation_[1][0] * n + rotation_[2][0] * u + origin_.x(),
+        rotation_[0][1] * e + rotation_[1][1] * n + rotation_[2][1] * u + origin_.y(),
+        rotation_[0][2] * e + rotation_[1][2] * n + rotation_[2][2] * u + origin_.z()};
+}
+
+
+inline void LocalFrame::ecefToEnu(PointArrays<double>& points, ThreadPool& pool) const
+{
+    const double (&r)[3][3] = rotation_;
+    const double o[3] = {origin_.x(), origin_.y(), origin_.z()};
+
+    GeodeticConversionImpl::forEachChunk(
+        points, pool,
+        [&r, &o](double* xs, double* ys, double* zs, std::size_t begin, std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                const double dx = xs[i] - o[0];
+                const double dy = ys[i] - o[1];
+                const double dz = zs[i] - o[2];
+
+                xs[i] = r[0][0] * dx + r[0][1] * dy + r[0][2] * dz;
+                ys[i] = r[1][0] * dx + r[1][1] * dy + r[1][2] * dz;
+                zs[i] = r[2][0] * dx + r[2][1] * dy + r[2][2] * dz;
+            }
+        });
+}
+
+
+inline void LocalFrame::enuToEcef(PointArrays<double>& points, ThreadPool& pool) const
+{
+    const double (&r)[3][3] = rotation_;
+    const double o[3] = {origin_.x(), origin_.y(), origin_.z()};
+
+    GeodeticConversionImpl::forEachChunk(
+        points, pool,
+        [&r, &o](double* xs, double* ys, double* zs, std::size_t begin, std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                const double e = xs[i];
+                const double n = ys[i];
+                const double u = zs[i];
+
+                xs[i] = r[0][0] * e + r[1][0] * n + r[2][0] * u + o[0];
+                ys[i] = r[0][1] * e + r[1][1] * n + r[2][1] * u + o[1];
+                zs[i] = r[0][2] * e + r[1][2] * n + r[2][2] * u + o[2];
+            }
+        });
+}
+
+
+inline void LocalFrame::geodeticToEnu(PointArrays<double>& points, ThreadPool& pool) const
+{
+    geodeticToEcef(points, pool);
+    ecefToEnu(points, pool);
+}
+
+
+inline void LocalFrame::enuToGeodetic(PointArrays<double>& points, ThreadPool& pool) const
+{
+    enuToEcef(points, pool);
+    ecefToGeodetic(points, pool);
+}
+
+
+inline const Point<double>& LocalFrame::ecefOrigin() const
+{
+    return origin_;
+}
+
+
+
+#endif // GEODETICCONVERSION_HPP
+
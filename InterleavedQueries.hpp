@@ -0,0 +1,450 @@
+// InterleavedQueries.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines functions that answer a batch of
+// closest-point or nearest-neighbor queries against a KdTree, with the
+// same results as KdTree's own member functions, but by working on many
+// queries at once, interleaved, so that one query's wait for memory is
+// spent doing useful work on the others.
+//
+// A search through a large tree is dominated not by arithmetic, but by
+// waiting: each node it visits is likely not to be in the cache, and each
+// trip out to main memory takes a couple of hundred cycles, during which a
+// single search can do nothing, since it needs the node to know where to
+// go next.  But the processor can have many memory requests outstanding at
+// once, if only it knows about them.  So we keep a "group" of searches in
+// flight, each with its own state (its stack of nodes still to visit, and
+// the best points it has found so far), and take turns: each search does
+// one step -- looks at one node, or scans one leaf's points -- and then
+// issues a software prefetch for the memory its next step will need, and
+// hands over to the next search in the group.  By the time the turn comes
+// back around, the prefetched memory has (ideally) arrived.  When a search
+// finishes, its place in the group is given to the next query in the
+// batch.  This technique is known as "asynchronous memory access chaining"
+// (AMAC).
+//
+// The best group size depends on the machine: it should be large enough
+// that a full turn around the group takes about as long as a trip to
+// memory, but not so large that the group's prefetched data pushes itself
+// out of the cache.  Somewhere between 8 and 32 is usually right;
+// benchmarkClosestQueries() measures it.
+//
+// Interleaving only helps when the tree is much larger than the caches.
+// For a small tree, everything is already in the cache, and the
+// bookkeeping makes interleaved queries a little slower than plain ones.
+
+#ifndef INTERLEAVEDQUERIES_HPP
+#define INTERLEAVEDQUERIES_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "KdTree.hpp"
+#include "Point.hpp"
+#include "ThreadPool.hpp"
+
+
+
+// interleavedClosest() returns, for each query point, what KdTree::closest()
+// would return for it.  Each thread of the pool works through its share of
+// the queries in interleaved groups of groupSize.
+template <typename CoordinateType>
+std::vector<PointNeighbor> interleavedClosest(
+    const KdTree<CoordinateType>& tree, const std::vector<Point<CoordinateType>>& queries,
+    std::size_t groupSize = 16, ThreadPool& pool = defaultThreadPool());
+
+
+// interleavedNearest() returns, for each query point, what
+// KdTree::nearest() would return for it.
+template <typename CoordinateType>
+std::vector<std::vector<PointNeighbor>> interleavedNearest(
+    const KdTree<CoordinateType>& tree, const std::vector<Point<CoordinateType>>& queries,
+    std::size_t k, std::size_t groupSize = 16, ThreadPool& pool = defaultThreadPool());
+
+
+// benchmarkClosestQueries() answers the queries on the calling thread
+// alone, first one at a time with KdTree::closest() (reported as a group
+// size of 0), then interleaved with each of the given group sizes, and
+// returns the number of queries answered per second -- that is, the
+// throughput of a single core -- for each.
+struct QueryThroughput
+{
+    std::size_t groupSize;
+    double queriesPerSecond;
+};
+
+template <typename CoordinateType>
+std::vector<QueryThroughput> benchmarkClosestQueries(
+    const KdTree<CoordinateType>& tree, const std::vector<Point<CoordinateType>>& queries,
+    const std::vector<std::size_t>& groupSizes = {1, 4, 8, 16, 32});
+
+
+
+namespace InterleavedQueriesImpl
+{
+    constexpr std::size_t cacheLineSize = 64;
+
+    // Each thread takes this many queries at a time from its pool.
+    constexpr std::size_t queriesPerChunk = 1024;
+
+
+    inline void prefetch(const void* begin, std::size_t bytes)
+    {
+        const char* address = static_cast<const char*>(begin);
+
+        for (std::size_t offset = 0; offset < bytes; offset += cacheLineSize)
+        {
+            __builtin_prefetch(address + offset, 0, 3);
+        }
+    }
+
+
+    // A search policy says what a search keeps track of (its State), when
+    // a node can be skipped, and what to do with each point it finds.
+
+    struct ClosestSearch
+    {
+        struct State
+        {
+            double bestSquaredDistance;
+            std::uint32_t bestPosition;
+        };
+
+        void start(State& state) const
+        {
+            state.bestSquaredDistance = std::numeric_limits<double>::infinity();
+            state.bestPosition = std::numeric_limits<std::uint32_t>::max();
+        }
+
+        bool prunes(const State& state, double squaredDistance) const
+        {
+            return squaredDistance >= state.bestSquaredDistance;
+        }
+
+        void visit(State& state, double squaredDistance, std::uint32_t position) const
+        {
+            if (squaredDistance < state.bestSquaredDistance)
+            {
+                state.bestSquaredDistance = squaredDistance;
+                state.bestPosition = position;
+            }
+        }
+    };
+
+
+    struct NearestSearch
+    {
+        struct Candidate
+        {
+            double squaredDistance;
+            std::uint32_t position;
+
+            bool operator<(const Candidate& other) const
+            {
+                return squaredDistance < other.squaredDistance;
+            }
+        };
+
+        // The best k candidates are kept in a max-heap, as in
+        // KdTree::nearest().
+        struct State
+        {
+            std::vector<Candidate> best;
+        };
+
+        std::size_t k;
+
+        void start(State& state) const
+        {
+            state.best.clear();
+            state.best.reserve(k);
+        }
+
+        bool prunes(const State& state, double squaredDistance) const
+        {
+            return state.best.size() == k && squaredDistance >= state.best.front().squaredDistance;
+        }
+
+        void visit(State& state, double squaredDistance, std::uint32_t position) const
+        {
+            if (state.best.size() < k)
+            {
+                state.best.push_back(Candidate{squaredDistance, position});
+                std::push_heap(state.best.begin(), state.best.end());
+            }
+            else if (squaredDistance < state.best.front().squaredDistance)
+            {
+                std::pop_heap(state.best.begin(), state.best.end());
+                state.best.back() = Candidate{squaredDistance, position};
+                std::push_heap(state.best.begin(), state.best.end());
+            }
+        }
+    };
+
+
+    // run() searches for each of count queries, interleaving groupSize of
+    // them at a time, and calls finish(i, state) with the final state of
+    // the search for queries[i].  A search's steps alternate between two
+    // kinds: looking at the node on top of its stack, and scanning the
+    // points of a leaf it decided to visit on its previous step.  Either
+    // way, it ends its step by prefetching what its next step will read.
+
+    template <typename CoordinateType, typename Search, typename Finish>
+    void run(
+        const KdTree<CoordinateType>& tree, const Point<CoordinateType>* queries,
+        std::size_t count, std::size_t groupSize, const Search& search, Finish finish)
+    {
+        using Tree = KdTree<CoordinateType>;
+        using Node = typename Tree::Node;
+
+        struct Lane
+        {
+            std::size_t query;
+            Point<CoordinateType> point;
+            std::uint32_t pending[64];
+            std::size_t pendingCount;
+            std::uint32_t leaf;
+            bool active;
+            typename Search::State state;
+        };
+
+        const std::vector<Node>& nodes = tree.nodes();
+        const std::uint32_t root = tree.root();
+
+        if (root == Tree::noChild)
+        {
+            typename Search::State state;
+
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                search.start(state);
+                finish(i, state);
+            }
+
+            return;
+        }
+
+        std::vector<Lane> lanes(std::max<std::size_t>(std::min(groupSize, count), 1));
+        std::size_t nextQuery = 0;
+        std::size_t activeCount = 0;
+
+        auto load =
+            [&](Lane& lane)
+            {
+                lane.active = nextQuery < count;
+                lane.pendingCount = 0;
+                lane.leaf = Tree::noChild;
+
+                if (!lane.active)
+                {
+                    return;
+                }
+
+                lane.query = nextQuery++;
+                lane.point = queries[lane.query];
+                search.start(lane.state);
+                ++activeCount;
+
+                lane.pending[lane.pendingCount++] = root;
+                prefetch(&nodes[root], sizeof(Node));
+            };
+
+        for (Lane& lane : lanes)
+        {
+            load(lane);
+        }
+
+        while (activeCount > 0)
+        {
+            for (Lane& lane : lanes)
+            {
+                if (!lane.active)
+                {
+                    continue;
+                }
+
+                if (lane.leaf != Tree::noChild)
+                {
+                    const Node& leaf = nodes[lane.leaf];
+
+                    for (std::uint32_t i = leaf.begin; i < leaf.end; ++i)
+                    {
+                        search.visit(lane.state, lane.point.squaredDistanceFrom(tree.pointAt(i)), i);
+                    }
+
+                    lane.leaf = Tree::noChild;
+                }
+                else
+                {
+                    const std::uint32_t index = lane.pending[--lane.pendingCount];
+                    const Node& node = nodes[index];
+
+                    if (!search.prunes(lane.state, tree.squaredDistanceToNode(lane.point, node)))
+                    {
+                        if (node.left == Tree::noChild)
+                        {
+                            lane.leaf = index;
+
+                            prefetch(
+                                &tree.pointAt(node.begin),
+                                (node.end - node.begin) * sizeof(Point<CoordinateType>));
+                        }
+                        else
+                        {
+                            const bool below = Tree::coordinate(lane.point, node.axis) < node.split;
+                            lane.pending[lane.pendingCount++] = below ? node.right : node.left;
+                            lane.pending[lane.pendingCount++] = below ? node.left : node.right;
+                        }
+                    }
+                }
+
+                if (lane.leaf == Tree::noChild)
+                {
+                    if (lane.pendingCount > 0)
+                    {
+                        prefetch(&nodes[lane.pending[lane.pendingCount - 1]], sizeof(Node));
+                    }
+                    else
+                    {
+                        finish(lane.query, lane.state);
+                        --activeCount;
+                        load(lane);
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+
+template <typename CoordinateType>
+std::vector<PointNeighbor> interleavedClosest(
+    const KdTree<CoordinateType>& tree, const std::vector<Point<CoordinateType>>& queries,
+    std::size_t groupSize, ThreadPool& pool)
+{
+    using Search = InterleavedQueriesImpl::ClosestSearch;
+
+    std::vector<PointNeighbor> results(queries.size());
+
+    pool.parallelFor(
+        0, queries.size(), InterleavedQueriesImpl::queriesPerChunk,
+        [&](std::size_t begin, std::size_t end)
+        {
+            InterleavedQueriesImpl::run(
+                tree, queries.data() + begin, end - begin, groupSize, Search{},
+                [&](std::size_t i, const Search::State& state)
+                {
+                    results[begin + i] = state.bestPosition == std::numeric_limits<std::uint32_t>::max()
+                        ? PointNeighbor{tree.size(), std::numeric_limits<double>::infinity()}
+                        : PointNeighbor{tree.indexAt(state.bestPosition), std::sqrt(state.bestSquaredDistance)};
+                });
+        });
+
+    return results;
+}
+
+
+template <typename CoordinateType>
+std::vector<std::vector<PointNeighbor>> interleavedNearest(
+    const KdTree<CoordinateType>& tree, const std::vector<Point<CoordinateType>>& queries,
+    std::size_t k, std::size_t groupSize, ThreadPool& pool)
+{
+    using Search = InterleavedQueriesImpl::NearestSearch;
+
+    std::vector<std::vector<PointNeighbor>> results(queries.size());
+
+    if (k == 0)
+    {
+        return results;
+    }
+
+    pool.parallelFor(
+        0, queries.size(), InterleavedQueriesImpl::queriesPerChunk,
+        [&](std::size_t begin, std::size_t end)
+        {
+            InterleavedQueriesImpl::run(
+                tree, queries.data() + begin, end - begin, groupSize, Search{k},
+                [&](std::size_t i, Search::State& state)
+                {
+                    std::sort_heap(state.best.begin(), state.best.end());
+
+                    std::vector<PointNeighbor>& result = results[begin + i];
+                    result.reserve(state.best.size());
+
+                    for (const Search::Candidate& candidate : state.best)
+                    {
+                        result.push_back(PointNeighbor{
+                            tree.indexAt(candidate.position), std::sqrt(candidate.squaredDistance)});
+                    }
+                });
+        });
+
+    return results;
+}
+
+
+// The checksum keeps the compiler from deciding that results nobody looks
+// at don't need to be computed.
+
+template <typename CoordinateType>
+std::vector<QueryThroughput> benchmarkClosestQueries(
+    const KdTree<CoordinateType>& tree, const std::vector<Point<CoordinateType>>& queries,
+    const std::vector<std::size_t>& groupSizes)
+{
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<QueryThroughput> throughputs;
+    volatile double checksum = 0.0;
+
+    auto record =
+        [&](std::size_t groupSize, Clock::time_point start)
+        {
+            const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+            throughputs.push_back(QueryThroughput{
+                groupSize, seconds > 0.0 ? static_cast<double>(queries.size()) / seconds : 0.0});
+        };
+
+    const Clock::time_point plainStart = Clock::now();
+    double sum = 0.0;
+
+    for (const Point<CoordinateType>& query : queries)
+    {
+        sum += tree.closest(query).distance;
+    }
+
+    record(0, plainStart);
+    checksum = checksum + sum;
+
+    for (std::size_t groupSize : groupSizes)
+    {
+        using Search = InterleavedQueriesImpl::ClosestSearch;
+
+        const Clock::time_point start = Clock::now();
+        double groupSum = 0.0;
+
+        InterleavedQueriesImpl::run(
+            tree, queries.data(), queries.size(), groupSize, Search{},
+            [&](std::size_t, const Search::State& state)
+            {
+                groupSum += state.bestSquaredDistance;
+            });
+
+        record(groupSize, start);
+        checksum = checksum + groupSum;
+    }
+
+    return throughputs;
+}
+
+
+
+#endif // INTERLEAVEDQUERIES_HPP
+
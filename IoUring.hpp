@@ -0,0 +1,405 @@
+// IoUring.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a class called IoUring, a small
+// wrapper around Linux's io_uring interface for asynchronous I/O.  It
+// supports only what we need for reading files quickly: queueing up reads,
+// submitting them to the kernel, and collecting their results.
+//
+// io_uring works by sharing two ring buffers between our process and the
+// kernel.  We put requests ("submission queue entries") into one ring, and
+// the kernel puts results ("completion queue entries") into the other.
+// Because the rings are shared memory, we can queue up many reads and hand
+// all of them to the kernel with a single system call, and then find out
+// about all of the finished ones with (at most) one more.  Compare that to
+// calling read() once per chunk, where each call blocks the calling thread
+// until that one read is done.
+//
+// We talk to the kernel through the raw system calls rather than through
+// liburing, so that there's nothing extra to install.  The price is that
+// we have to be careful about memory ordering on the shared ring indexes;
+// the kernel reads our tail only after we've filled in the entries behind
+// it, so we publish it with a release store, and we read the kernel's tail
+// with an acquire load before looking at the completions behind it.
+//
+// io_uring is available from Linux 5.1 onward, though we use the READ
+// operation, which arrived in 5.6.  It can also be disabled by a system's
+// security policy.  IoUring::isSupported() checks whether we can use it;
+// when we can't, callers are expected to fall back to something else.
+
+#ifndef IOURING_HPP
+#define IOURING_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define ICS46_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef ICS46_HAVE_IO_URING
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+
+class IoUring
+{
+public:
+    // A Completion reports the outcome of one request: the userData value
+    // we attached when we queued it, and the result, which (like the
+    // result of read()) is the number of bytes transferred or, if
+    // negative, the negation of an errno value.
+    struct Completion
+    {
+        std::uint64_t userData;
+        int result;
+    };
+
+
+    // isSupported() returns true if io_uring can be used in this process.
+    static bool isSupported();
+
+
+    // Constructing an IoUring sets up a pair of rings with room for at
+    // least "entries" requests at a time, throwing a std::system_error if
+    // the kernel refuses.
+    explicit IoUring(unsigned int entries);
+
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+
+    // capacity() returns the number of requests that can be queued at once.
+    unsigned int capacity() const;
+
+
+    // prepareRead() queues a read of "length" bytes from the given offset
+    // of a file into "buffer".  Nothing is sent to the kernel until
+    // submit() is called.  It returns false if the submission ring is full.
+    bool prepareRead(
+        int descriptor, void* buffer, std::uint32_t length,
+        std::uint64_t offset, std::uint64_t userData);
+
+
+    // submit() hands all of the queued requests to the kernel.  If
+    // waitFor is non-zero, it also waits until at least that many
+    // requests have completed.  It throws a std::system_error if the
+    // kernel fails, or if it repeatedly refuses to take any of the
+    // requests.
+    void submit(unsigned int waitFor = 0);
+
+
+    // wait() waits until at least count requests have completed, without
+    // handing the kernel any queued requests, throwing a std::system_error
+    // if the kernel fails.  pendingCount() returns the number of requests
+    // queued but not yet handed to the kernel.
+    void wait(unsigned int count);
+    unsigned int pendingCount() const;
+
+
+    // reap() copies up to maxCompletions finished results into the given
+    // array, returning how many there were.  It never waits.
+    std::size_t reap(Completion* completions, std::size_t maxCompletions);
+
+
+private:
+    void release();
+
+    int descriptor_;
+
+    void* submissionRing_;
+    std::size_t submissionRingSize_;
+    void* completionRing_;
+    std::size_t completionRingSize_;
+    io_uring_sqe* entries_;
+    std::size_t entriesSize_;
+
+    unsigned int* submissionHead_;
+    unsigned int* submissionTail_;
+    unsigned int submissionMask_;
+    unsigned int* submissionArray_;
+    unsigned int submissionEntries_;
+    unsigned int pendingSubmissions_;
+
+    unsigned int* completionHead_;
+    unsigned int* completionTail_;
+    unsigned int completionMask_;
+    io_uring_cqe* completions_;
+};
+
+
+
+inline bool IoUring::isSupported()
+{
+    try
+    {
+        IoUring ring{1};
+        return true;
+    }
+    catch (const std::system_error&)
+    {
+        return false;
+    }
+}
+
+
+inline IoUring::IoUring(unsigned int entries)
+    : descriptor_{-1},
+      submissionRing_{MAP_FAILED}, submissionRingSize_{0},
+      completionRing_{MAP_FAILED}, completionRingSize_{0},
+      entries_{static_cast<io_uring_sqe*>(MAP_FAILED)}, entriesSize_{0},
+      pendingSubmissions_{0}
+{
+    io_uring_params parameters;
+    std::memset(&parameters, 0, sizeof(parameters));
+
+    descriptor_ = static_cast<int>(
+        ::syscall(__NR_io_uring_setup, entries, &parameters));
+
+    if (descriptor_ < 0)
+    {
+        throw std::system_error{errno, std::generic_category(), "io_uring_setup"};
+    }
+
+    submissionRingSize_ =
+        parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned int);
+    completionRingSize_ =
+        parameters.cq_off.cqes + parameters.cq_entries * sizeof(io_uring_cqe);
+
+    const bool singleMapping = (parameters.features & IORING_FEAT_SINGLE_MMAP) != 0;
+
+    if (singleMapping && completionRingSize_ > submissionRingSize_)
+    {
+        submissionRingSize_ = completionRingSize_;
+    }
+
+    submissionRing_ = ::mmap(
+        nullptr, submissionRingSize_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, descriptor_, IORING_OFF_SQ_RING);
+
+    if (submissionRing_ != MAP_FAILED)
+    {
+        if (singleMapping)
+        {
+            completionRing_ = submissionRing_;
+        }
+        else
+        {
+            completionRing_ = ::mmap(
+                nullptr, completionRingSize_, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, descriptor_, IORING_OFF_CQ_RING);
+        }
+    }
+
+    if (completionRing_ != MAP_FAILED)
+    {
+        entriesSize_ = parameters.sq_entries * sizeof(io_uring_sqe);
+        entries_ = static_cast<io_uring_sqe*>(::mmap(
+            nullptr, entriesSize_, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, descriptor_, IORING_OFF_SQES));
+    }
+
+    if (entries_ == MAP_FAILED)
+    {
+        int error = errno;
+        release();
+        throw std::system_error{error, std::generic_category(), "io_uring mmap"};
+    }
+
+    char* submission = static_cast<char*>(submissionRing_);
+    submissionHead_ = reinterpret_cast<unsigned int*>(submission + parameters.sq_off.head);
+    submissionTail_ = reinterpret_cast<unsigned int*>(submission + parameters.sq_off.tail);
+    submissionMask_ = *reinterpret_cast<unsigned int*>(submission + parameters.sq_off.ring_mask);
+    submissionArray_ = reinterpret_cast<unsigned int*>(submission + parameters.sq_off.array);
+    submissionEntries_ = parameters.sq_entries;
+
+    char* completion = static_cast<char*>(completionRing_);
+    completionHead_ = reinterpret_cast<unsigned int*>(completion + parameters.cq_off.head);
+    completionTail_ = reinterpret_cast<unsigned int*>(completion + parameters.cq_off.tail);
+    completionMask_ = *reinterpret_cast<unsigned int*>(completion + parameters.cq_off.ring_mask);
+    completions_ = reinterpret_cast<io_uring_cqe*>(completion + parameters.cq_off.cqes);
+}
+
+
+inline IoUring::~IoUring()
+{
+    release();
+}
+
+
+inline void IoUring::release()
+{
+    if (entries_ != MAP_FAILED)
+    {
+        ::munmap(entries_, entriesSize_);
+    }
+
+    if (completionRing_ != MAP_FAILED && completionRing_ != submissionRing_)
+    {
+        ::munmap(completionRing_, completionRingSize_);
+    }
+
+    if (submissionRing_ != MAP_FAILED)
+    {
+        ::munmap(submissionRing_, submissionRingSize_);
+    }
+
+    if (descriptor_ >= 0)
+    {
+        ::close(descriptor_);
+    }
+
+    entries_ = static_cast<io_uring_sqe*>(MAP_FAILED);
+    completionRing_ = MAP_FAILED;
+    submissionRing_ = MAP_FAILED;
+    descriptor_ = -1;
+}
+
+
+inline unsigned int IoUring::capacity() const
+{
+    return submissionEntries_;
+}
+
+
+inline bool IoUring::prepareRead(
+    int descriptor, void* buffer, std::uint32_t length,
+    std::uint64_t offset, std::uint64_t userData)
+{
+    const unsigned int head = __atomic_load_n(submissionHead_, __ATOMIC_ACQUIRE);
+    const unsigned int tail = *submissionTail_;
+
+    if (tail - head >= submissionEntries_)
+    {
+        return false;
+    }
+
+    const unsigned int index = tail & submissionMask_;
+    io_uring_sqe& entry = entries_[index];
+
+    std::memset(&entry, 0, sizeof(entry));
+    entry.opcode = IORING_OP_READ;
+    entry.fd = descriptor;
+    entry.addr = reinterpret_cast<std::uint64_t>(buffer);
+    entry.len = length;
+    entry.off = offset;
+    entry.user_data = userData;
+
+    submissionArray_[index] = index;
+    __atomic_store_n(submissionTail_, tail + 1, __ATOMIC_RELEASE);
+
+    ++pendingSubmissions_;
+    return true;
+}
+
+
+// The kernel can accept fewer requests than we offer, so we keep offering
+// the rest; but if it accepts none of them several times in a row, it isn't
+// going to, and we give up rather than spin forever.
+
+inline void IoUring::submit(unsigned int waitFor)
+{
+    constexpr unsigned int maximumRefusals = 16;
+    unsigned int refusals = 0;
+
+    while (pendingSubmissions_ > 0 || waitFor > 0)
+    {
+        const unsigned int flags = waitFor > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+        long result = ::syscall(
+            __NR_io_uring_enter, descriptor_, pendingSubmissions_, waitFor,
+            flags, nullptr, 0);
+
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            throw std::system_error{errno, std::generic_category(), "io_uring_enter"};
+        }
+
+        if (result == 0 && pendingSubmissions_ > 0)
+        {
+            if (++refusals == maximumRefusals)
+            {
+                throw std::system_error{EAGAIN, std::generic_category(), "io_uring_enter"};
+            }
+        }
+        else
+        {
+            refusals = 0;
+        }
+
+        pendingSubmissions_ -= static_cast<unsigned int>(result);
+        waitFor = 0;
+    }
+}
+
+
+inline void IoUring::wait(unsigned int count)
+{
+    while (true)
+    {
+        const long result = ::syscall(
+            __NR_io_uring_enter, descriptor_, 0, count, IORING_ENTER_GETEVENTS, nullptr, 0);
+
+        if (result >= 0)
+        {
+            return;
+        }
+        else if (errno != EINTR)
+        {
+            throw std::system_error{errno, std::generic_category(), "io_uring_enter"};
+        }
+    }
+}
+
+
+inline unsigned int IoUring::pendingCount() const
+{
+    return pendingSubmissions_;
+}
+
+
+inline std::size_t IoUring::reap(Completion* completions, std::size_t maxCompletions)
+{
+    unsigned int head = *completionHead_;
+    const unsigned int tail = __atomic_load_n(completionTail_, __ATOMIC_ACQUIRE);
+
+    std::size_t count = 0;
+
+    while (head != tail && count < maxCompletions)
+    {
+        const io_uring_cqe& entry = completions_[head & completionMask_];
+        completions[count].userData = entry.user_data;
+        completions[count].result = entry.res;
+
+        ++head;
+        ++count;
+    }
+
+    __atomic_store_n(completionHead_, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+#endif // ICS46_HAVE_IO_URING
+
+
+
+#endif // IOURING_HPP
+
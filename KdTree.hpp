@@ -0,0 +1,977 @@
+// KdTree.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a template class called KdTree,
+// which organizes a set of Points so that we can quickly answer questions
+// like "which k points are closest to this one?" and "which points are
+// within this distance of that one?"  The obvious way to answer questions
+// like these is to call distanceFrom() on every point, which takes time
+// proportional to the number of points for every question we ask.  A k-d
+// tree lets us skip most of the points most of the time.
+//
+// A k-d tree is a binary tree in which each node is responsible for some
+// of the points.  The root is responsible for all of them.  Each internal
+// node splits its points in half along one axis -- the one along which its
+// points are most spread out -- with the half whose coordinates are smaller
+// going to the left child and the rest going to the right.  When a node is
+// responsible for only a handful of points (no more than the "leaf size"),
+// we stop splitting, and it becomes a leaf.
+//
+// Each node also remembers the smallest box that contains all of its points.
+// When we're searching for points near some query, we can compare the query
+// against the box; if even the nearest part of the box is farther away than
+// what we're looking for, none of the node's points can be what we're
+// looking for, so we don't need to look at any of them.
+//
+// Rather than storing each node's points in the node, the tree keeps its own
+// copy of all of the points, rearranged so that every node's points are
+// stored consecutively; a node just remembers where its points begin and
+// end.  (A tree can instead be built over an array of points that belongs
+// to someone else, which it rearranges in place, when where the points
+// live matters; see NumaPointStore.hpp.)  Queries report points by their
+// index in the original vector, not their position in the tree, so the
+// tree also remembers each point's original index.
+//
+// Where the nodes are stored matters too.  A search walks from the root
+// down toward the leaves, and every node it visits that isn't already in
+// the cache costs a cache miss.  A Node, with its box, takes 80 bytes --
+// more than a cache line -- so the tree also keeps a compact copy of just
+// the part of each node that a search reads on the way down: where it
+// splits and where its children are, 16 bytes apiece.  The searches read
+// only those until they reach a leaf, bounding the distance to each
+// subtree by the splits they've crossed instead of by its box.  Four of
+// them fit in a 64-byte cache line, which gives the order of the nodes
+// something to work with.  build() stores the nodes depth-first, which
+// keeps a node near its children but puts its right subtree arbitrarily
+// far away; once the tree is built, it can optionally move its nodes into
+// one of two orders that keep the nodes near the top of the tree -- the
+// ones every search visits -- together (see KdTreeLayout below).  In
+// every order, a node's two children are stored side by side, so the
+// compact copy only needs to know where the left one is.
+
+#ifndef KDTREE_HPP
+#define KDTREE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "Point.hpp"
+
+
+
+// A PointNeighbor is one result of a query: the index of a point (in the
+// vector the tree was built from) and its distance from the query point.
+struct PointNeighbor
+{
+    std::size_t index;
+    double distance;
+};
+
+
+
+// A KdTreeLayout chooses the order in which a KdTree stores its nodes.
+//
+// * DepthFirst is the order build() creates them in: each node's two
+//   children are stored together, followed by the left child's
+//   descendants and then the right child's.
+// * Eytzinger stores the nodes one level at a time, the root first, then
+//   its two children, then their four children, and so on.  For a complete
+//   tree, this is the Eytzinger order used by implicit binary heaps, in
+//   which the children of the node at index i are at 2i+1 and 2i+2.  Our
+//   trees aren't always complete -- a node stops splitting when it has few
+//   enough points -- so the nodes still record their children's indexes,
+//   but the top levels of the tree, which every search visits, end up
+//   packed into the first few cache lines.
+// * VanEmdeBoas splits the tree at half its height into a top tree and the
+//   bottom trees hanging from it, stores the top tree, then each bottom
+//   tree, laying out each of those the same way.  (The pieces are made of
+//   pairs of children rather than single nodes, so that siblings stay side
+//   by side.)  However big a cache line (or page) is, some level of that
+//   recursion produces subtrees that fit in one, so a walk from the root
+//   to a leaf touches only a logarithmic number of them, in the number of
+//   levels, on every level of the memory hierarchy at once.  That's what
+//   makes the layout "cache-oblivious."
+//
+// How much the layout matters depends on how much of a search's time goes
+// into walking down the tree rather than into comparing points at the
+// leaves.  For a large tree and queries scattered all over it, the leaves
+// dominate, and the three layouts are within a few percent of each other.
+enum class KdTreeLayout
+{
+    DepthFirst,
+    Eytzinger,
+    VanEmdeBoas
+};
+
+
+
+template <typename CoordinateType>
+class KdTree
+{
+public:
+    // A Node is one node in the tree.  Most users of KdTree never need to
+    // know about nodes; they're exposed so that algorithms that need to
+    // walk the tree in their own way (see PointQueryStreams.hpp, for
+    // example) can do so.
+    //
+    // A leaf has no children; its left and right are both noChild.  The
+    // node's points are at tree positions [begin, end).  An internal node's
+    // right child is always stored immediately after its left child.
+    struct Node
+    {
+        double lower[3];
+        double upper[3];
+        double split;
+        std::uint32_t begin;
+        std::uint32_t end;
+        std::uint32_t left;
+        std::uint32_t right;
+        std::uint8_t axis;
+    };
+
+    static constexpr std::uint32_t noChild = std::numeric_limits<std::uint32_t>::max();
+
+
+    // Building a KdTree requires the points it should contain and,
+    // optionally, the largest number of points to store in a leaf and the
+    // order in which to store its nodes.  The tree makes its own copy of
+    // the points, so the vector doesn't need to outlive it.
+    explicit KdTree(
+        const std::vector<Point<CoordinateType>>& points,
+        std::size_t leafSize = 16,
+        KdTreeLayout layout = KdTreeLayout::DepthFirst);
+
+
+    // A KdTree can also be built over an array of points that it doesn't
+    // own.  Rather than copying them, it rearranges them in place, so
+    // afterward, points[position] is pointAt(position).  The array has to
+    // outlive the tree, and mustn't be changed while the tree is in use.
+    KdTree(
+        Point<CoordinateType>* points, std::size_t count,
+        std::size_t leafSize = 16,
+        KdTreeLayout layout = KdTreeLayout::DepthFirst);
+
+
+    // Copying a tree that owns its points copies them; a copy of a tree
+    // built over someone else's array refers to the same array.
+    KdTree(const KdTree& other);
+    KdTree(KdTree&& other) noexcept = default;
+    KdTree& operator=(const KdTree& other);
+    KdTree& operator=(KdTree&& other) noexcept = default;
+
+
+    // size() returns the number of points in the tree.
+    std::size_t size() const;
+
+
+    // layout() returns the order in which the tree stores its nodes.
+    KdTreeLayout layout() const;
+
+
+    // nearest() returns the k points closest to the query point (or all
+    // of them, if there are fewer than k), closest first.
+    std::vector<PointNeighbor> nearest(
+        const Point<CoordinateType>& query, std::size_t k) const;
+
+
+    // closest() returns the single point closest to the query point.  If
+    // the tree is empty, the result's index is size() and its distance is
+    // infinite.
+    PointNeighbor closest(const Point<CoordinateType>& query) const;
+
+
+    // withinRadius() returns every point whose distance from the query point
+    // is no more than radius, closest first.  No distance is negative, so a
+    // negative radius (or a NaN) finds nothing.
+    std::vector<PointNeighbor> withinRadius(
+        const Point<CoordinateType>& query, double radius) const;
+
+
+    // anyWithin() returns true if there's at least one point whose distance
+    // from the query point is no more than radius.  It stops as soon as it
+    // finds one, so it's much cheaper than withinRadius() when that's all
+    // we need to know.  Like withinRadius(), it finds nothing when radius
+    // is negative.
+    bool anyWithin(const Point<CoordinateType>& query, double radius) const;
+
+
+    // These functions give direct access to the tree's structure.  root()
+    // is the index of the root node in nodes(), which depends on the
+    // layout, so it's best not to assume it's zero; pointAt() and indexAt()
+    // return the point stored at a given tree position and its original
+    // index.
+    const std::vector<Node>& nodes() const;
+    std::uint32_t root() const;
+    const Point<CoordinateType>& pointAt(std::size_t position) const;
+    std::size_t indexAt(std::size_t position) const;
+
+
+    // squaredDistanceToNode() returns the square of the distance from the
+    // query point to the nearest part of a node's box, which is zero if
+    // the query point is inside it.
+    double squaredDistanceToNode(
+        const Point<CoordinateType>& query, const Node& node) const;
+
+
+    // coordinate() returns a point's coordinate along an axis (0 for x,
+    // 1 for y, 2 for z) as a double.
+    static double coordinate(const Point<CoordinateType>& point, unsigned int axis);
+
+
+private:
+    // A Branch is the part of a node that a search needs on its way down
+    // the tree, kept apart from the node's box so that it's small.  The
+    // right child is at left + 1.  A leaf's axis is leafAxis; everything
+    // else about a leaf is read from its Node.
+    struct Branch
+    {
+        double split;
+        std::uint32_t left;
+        std::uint32_t axis;
+    };
+
+    static constexpr std::uint32_t leafAxis = 3;
+
+    void initialize();
+    void build(std::uint32_t index, std::uint32_t begin, std::uint32_t end);
+
+    void arrange(KdTreeLayout layout);
+    std::uint32_t height(std::uint32_t node) const;
+    void arrangeVanEmdeBoas(
+        std::uint32_t parent, std::uint32_t levels, std::vector<std::uint32_t>& order) const;
+    void collectAtDepth(
+        std::uint32_t parent, std::uint32_t depth, std::vector<std::uint32_t>& found) const;
+    void gatherBranches();
+
+    template <typename Prune, typename VisitLeaf>
+    void descend(
+        const Point<CoordinateType>& query, Prune prune, VisitLeaf visitLeaf) const;
+
+    template <typename Visit>
+    void searchRadius(
+        const Point<CoordinateType>& query, double squaredRadius,
+        Visit visit) const;
+
+    // points_ is either ownPoints_.data() or the caller's array.  (Moving
+    // a vector doesn't move its elements, so a moved tree's points_ stays
+    // valid; copying one is a different story.)
+    std::vector<Point<CoordinateType>> ownPoints_;
+    Point<CoordinateType>* points_;
+    std::size_t size_;
+    std::vector<std::uint32_t> indexes_;
+    std::vector<Node> nodes_;
+    std::vector<Branch> branches_;
+    std::size_t leafSize_;
+    KdTreeLayout layout_;
+    std::uint32_t root_;
+};
+
+
+
+template <typename CoordinateType>
+KdTree<CoordinateType>::KdTree(
+    const std::vector<Point<CoordinateType>>& points, std::size_t leafSize,
+    KdTreeLayout layout)
+    : ownPoints_{points}, points_{ownPoints_.data()}, size_{points.size()},
+      leafSize_{std::max<std::size_t>(leafSize, 1)}, layout_{layout}, root_{noChild}
+{
+    initialize();
+}
+
+
+template <typename CoordinateType>
+KdTree<CoordinateType>::KdTree(
+    Point<CoordinateType>* points, std::size_t count, std::size_t leafSize,
+    KdTreeLayout layout)
+    : points_{points}, size_{count},
+      leafSize_{std::max<std::size_t>(leafSize, 1)}, layout_{layout}, root_{noChild}
+{
+    initialize();
+}
+
+
+template <typename CoordinateType>
+KdTree<CoordinateType>::KdTree(const KdTree& other)
+    : ownPoints_{other.ownPoints_},
+      points_{other.points_ == other.ownPoints_.data() ? ownPoints_.data() : other.points_},
+      size_{other.size_}, indexes_{other.indexes_}, nodes_{other.nodes_},
+      branches_{other.branches_}, leafSize_{other.leafSize_}, layout_{other.layout_}, root_{other.root_}
+{
+}
+
+
+template <typename CoordinateType>
+KdTree<CoordinateType>& KdTree<CoordinateType>::operator=(const KdTree& other)
+{
+    if (this != &other)
+    {
+        *this = KdTree{other};
+    }
+
+    return *this;
+}
+
+
+template <typename CoordinateType>
+void KdTree<CoordinateType>::initialize()
+{
+    if (size_ >= noChild)
+    {
+        throw std::length_error{"too many points for a KdTree"};
+    }
+
+    indexes_.resize(size_);
+
+    for (std::uint32_t i = 0; i < indexes_.size(); ++i)
+    {
+        indexes_[i] = i;
+    }
+
+    if (size_ > 0)
+    {
+        nodes_.reserve(2 * (size_ / leafSize_ + 1));
+        nodes_.resize(1);
+        root_ = 0;
+        build(root_, 0, static_cast<std::uint32_t>(size_));
+        arrange(layout_);
+        gatherBranches();
+    }
+}
+
+
+template <typename CoordinateType>
+std::size_t KdTree<CoordinateType>::size() const
+{
+    return size_;
+}
+
+
+template <typename CoordinateType>
+KdTreeLayout KdTree<CoordinateType>::layout() const
+{
+    return layout_;
+}
+
+
+// nearest() keeps the best k points found so far in a max-heap, so that the
+// farthest of them -- the one that the next candidate needs to beat -- is
+// always on top.  A subtree can be skipped once the heap is full and the
+// subtree is no closer than the top.
+
+template <typename CoordinateType>
+std::vector<PointNeighbor> KdTree<CoordinateType>::nearest(
+    const Point<CoordinateType>& query, std::size_t k) const
+{
+    struct Candidate
+    {
+        double squaredDistance;
+        std::uint32_t position;
+
+        bool operator<(const Candidate& other) const
+        {
+            return squaredDistance < other.squaredDistance;
+        }
+    };
+
+    std::vector<PointNeighbor> result;
+
+    if (k == 0 || root_ == noChild)
+    {
+        return result;
+    }
+
+    std::priority_queue<Candidate> best;
+
+    descend(
+        query,
+        [&](double squaredDistance)
+        {
+            return best.size() == k && squaredDistance >= best.top().squaredDistance;
+        },
+        [&](const Node& leaf)
+        {
+            for (std::uint32_t i = leaf.begin; i < leaf.end; ++i)
+            {
+                const double squaredDistance = query.squaredDistanceFrom(points_[i]);
+
+                if (best.size() < k)
+                {
+                    best.push(Candidate{squaredDistance, i});
+                }
+                else if (squaredDistance < best.top().squaredDistance)
+                {
+                    best.pop();
+                    best.push(Candidate{squaredDistance, i});
+                }
+            }
+
+            return true;
+        });
+
+    result.resize(best.size());
+
+    for (std::size_t i = result.size(); i > 0; --i)
+    {
+        result[i - 1] = PointNeighbor{
+            indexes_[best.top().position], std::sqrt(best.top().squaredDistance)};
+        best.pop();
+    }
+
+    return result;
+}
+
+
+template <typename CoordinateType>
+PointNeighbor KdTree<CoordinateType>::closest(const Point<CoordinateType>& query) const
+{
+    double bestSquaredDistance = std::numeric_limits<double>::infinity();
+    std::size_t bestIndex = size();
+
+    descend(
+        query,
+        [&](double squaredDistance)
+        {
+            return squaredDistance >= bestSquaredDistance;
+        },
+        [&](const Node& leaf)
+        {
+            for (std::uint32_t i = leaf.begin; i < leaf.end; ++i)
+            {
+                const double squaredDistance = query.squaredDistanceFrom(points_[i]);
+
+                if (squaredDistance < bestSquaredDistance)
+                {
+                    bestSquaredDistance = squaredDistance;
+                    bestIndex = indexes_[i];
+                }
+            }
+
+            return true;
+        });
+
+    return PointNeighbor{bestIndex, std::sqrt(bestSquaredDistance)};
+}
+
+
+template <typename CoordinateType>
+std::vector<PointNeighbor> KdTree<CoordinateType>::withinRadius(
+    const Point<CoordinateType>& query, double radius) const
+{
+    std::vector<PointNeighbor> result;
+
+    if (!(radius >= 0.0))
+    {
+        return result;
+    }
+
+    searchRadius(
+        query, radius * radius,
+        [&](std::uint32_t position, double squaredDistance)
+        {
+            result.push_back(PointNeighbor{indexes_[position], std::sqrt(squaredDistance)});
+            return true;
+        });
+
+    std::sort(
+        result.begin(), result.end(),
+        [](const PointNeighbor& a, const PointNeighbor& b)
+        {
+            return a.distance < b.distance;
+        });
+
+    return result;
+}
+
+
+template <typename CoordinateType>
+bool KdTree<CoordinateType>::anyWithin(
+    const Point<CoordinateType>& query, double radius) const
+{
+    bool found = false;
+
+    if (!(radius >= 0.0))
+    {
+        return found;
+    }
+
+    searchRadius(
+        query, radius * radius,
+        [&](std::uint32_t, double)
+        {
+            found = true;
+            return false;
+        });
+
+    return found;
+}
+
+
+template <typename CoordinateType>
+const std::vector<typename KdTree<CoordinateType>::Node>& KdTree<CoordinateType>::nodes() const
+{
+    return nodes_;
+}
+
+
+template <typename CoordinateType>
+std::uint32_t KdTree<CoordinateType>::root() const
+{
+    return root_;
+}
+
+
+template <typename CoordinateType>
+const Point<CoordinateType>& KdTree<CoordinateType>::pointAt(std::size_t position) const
+{
+    return points_[position];
+}
+
+
+template <typename CoordinateType>
+std::size_t KdTree<CoordinateType>::indexAt(std::size_t position) const
+{
+    return indexes_[position];
+}
+
+
+template <typename CoordinateType>
+double KdTree<CoordinateType>::squaredDistanceToNode(
+    const Point<CoordinateType>& query, const Node& node) const
+{
+    double squaredDistance = 0.0;
+
+    for (unsigned int axis = 0; axis < 3; ++axis)
+    {
+        const double value = coordinate(query, axis);
+        const double below = node.lower[axis] - value;
+        const double above = value - node.upper[axis];
+        const double gap = std::max(0.0, std::max(below, above));
+
+        squaredDistance += gap * gap;
+    }
+
+    return squaredDistance;
+}
+
+
+template <typename CoordinateType>
+double KdTree<CoordinateType>::coordinate(
+    const Point<CoordinateType>& point, unsigned int axis)
+{
+    switch (axis)
+    {
+    case 0:
+        return static_cast<double>(point.x());
+    case 1:
+        return static_cast<double>(point.y());
+    default:
+        return static_cast<double>(point.z());
+    }
+}
+
+
+// build() fills in nodes_[index], the node responsible for tree positions
+// [begin, end), and creates all of its descendants.  The split is made at
+// the median, which std::nth_element finds (and moves into place, with
+// smaller coordinates before it and larger ones after) in time
+// proportional to the number of points.  Splitting at the median keeps the
+// tree balanced, so its height is logarithmic in the number of points.
+// Both children are added to nodes_ before either is built, so they end up
+// side by side.
+
+template <typename CoordinateType>
+void KdTree<CoordinateType>::build(
+    std::uint32_t index, std::uint32_t begin, std::uint32_t end)
+{
+    Node node;
+
+    for (unsigned int axis = 0; axis < 3; ++axis)
+    {
+        node.lower[axis] = std::numeric_limits<double>::infinity();
+        node.upper[axis] = -std::numeric_limits<double>::infinity();
+    }
+
+    for (std::uint32_t i = begin; i < end; ++i)
+    {
+        for (unsigned int axis = 0; axis < 3; ++axis)
+        {
+            const double value = coordinate(points_[i], axis);
+            node.lower[axis] = std::min(node.lower[axis], value);
+            node.upper[axis] = std::max(node.upper[axis], value);
+        }
+    }
+
+    node.begin = begin;
+    node.end = end;
+    node.left = noChild;
+    node.right = noChild;
+    node.axis = 0;
+    node.split = 0.0;
+
+    for (unsigned int axis = 1; axis < 3; ++axis)
+    {
+        if (node.upper[axis] - node.lower[axis] > node.upper[node.axis] - node.lower[node.axis])
+        {
+            node.axis = static_cast<std::uint8_t>(axis);
+        }
+    }
+
+    nodes_[index] = node;
+
+    if (end - begin <= leafSize_)
+    {
+        return;
+    }
+
+    // The points and their original indexes have to move together, so we
+    // rearrange a vector of positions and then apply the same rearrangement
+    // to both.
+    const std::uint32_t middle = begin + (end - begin) / 2;
+    const unsigned int axis = node.axis;
+
+    std::vector<std::uint32_t> order(end - begin);
+
+    for (std::uint32_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = begin + i;
+    }
+
+    std::nth_element(
+        order.begin(), order.begin() + (middle - begin), order.end(),
+        [this, axis](std::uint32_t a, std::uint32_t b)
+        {
+            return coordinate(points_[a], axis) < coordinate(points_[b], axis);
+        });
+
+    std::vector<Point<CoordinateType>> points;
+    std::vector<std::uint32_t> indexes;
+    points.reserve(order.size());
+    indexes.reserve(order.size());
+
+    for (std::uint32_t position : order)
+    {
+        points.push_back(points_[position]);
+        indexes.push_back(indexes_[position]);
+    }
+
+    std::copy(points.begin(), points.end(), points_ + begin);
+    std::copy(indexes.begin(), indexes.end(), indexes_.begin() + begin);
+
+    const std::uint32_t left = static_cast<std::uint32_t>(nodes_.size());
+    nodes_.resize(nodes_.size() + 2);
+
+    nodes_[index].split = coordinate(points_[middle], axis);
+    nodes_[index].left = left;
+    nodes_[index].right = left + 1;
+
+    build(left, begin, middle);
+    build(left + 1, middle, end);
+}
+
+
+// arrange() moves the nodes into the order the layout asks for.  It first
+// decides the order -- a list of the existing indexes, in the order the
+// nodes should be stored -- and then moves every node to its new position,
+// translating its children's indexes as it goes.  Every layout stores the
+// root first and keeps siblings side by side.
+
+template <typename CoordinateType>
+void KdTree<CoordinateType>::arrange(KdTreeLayout layout)
+{
+    if (layout == KdTreeLayout::DepthFirst)
+    {
+        return;
+    }
+
+    std::vector<std::uint32_t> order;
+    order.reserve(nodes_.size());
+
+    if (layout == KdTreeLayout::Eytzinger)
+    {
+        // Storing the nodes one level at a time is a breadth-first
+        // traversal, and order itself can serve as its queue.
+        order.push_back(root_);
+
+        for (std::size_t i = 0; i < order.size(); ++i)
+        {
+            const Node& node = nodes_[order[i]];
+
+            if (node.left != noChild)
+            {
+                order.push_back(node.left);
+                order.push_back(node.right);
+            }
+        }
+    }
+    else
+    {
+        arrangeVanEmdeBoas(noChild, height(root_), order);
+    }
+
+    std::vector<std::uint32_t> moved(nodes_.size());
+
+    for (std::uint32_t i = 0; i < order.size(); ++i)
+    {
+        moved[order[i]] = i;
+    }
+
+    std::vector<Node> nodes;
+    nodes.reserve(nodes_.size());
+
+    for (std::uint32_t index : order)
+    {
+        Node node = nodes_[index];
+
+        if (node.left != noChild)
+        {
+            node.left = moved[node.left];
+            node.right = moved[node.right];
+        }
+
+        nodes.push_back(node);
+    }
+
+    nodes_ = std::move(nodes);
+    root_ = 0;
+}
+
+
+// height() returns the number of levels in the subtree whose root is the
+// given node; a leaf is one level.
+
+template <typename CoordinateType>
+std::uint32_t KdTree<CoordinateType>::height(std::uint32_t node) const
+{
+    if (nodes_[node].left == noChild)
+    {
+        return 1;
+    }
+
+    return 1 + std::max(height(nodes_[node].left), height(nodes_[node].right));
+}
+
+
+// arrangeVanEmdeBoas() appends to order the top levels of the subtree
+// below the children of the given parent, in van Emde Boas order.  It works
+// with pairs of siblings rather than single nodes, so that the pairs are
+// never split up; the parent noChild stands for the root, which has no
+// sibling.  The top half of the levels are laid out first, then each of
+// the subtrees hanging below them, left to right.  Since our trees aren't
+// always complete, some of those subtrees are shorter than others (or
+// missing altogether); they simply take up less room.
+
+template <typename CoordinateType>
+void KdTree<CoordinateType>::arrangeVanEmdeBoas(
+    std::uint32_t parent, std::uint32_t levels, std::vector<std::uint32_t>& order) const
+{
+    if (levels == 1)
+    {
+        if (parent == noChild)
+        {
+            order.push_back(root_);
+        }
+        else
+        {
+            order.push_back(nodes_[parent].left);
+            order.push_back(nodes_[parent].right);
+        }
+
+        return;
+    }
+
+    const std::uint32_t topLevels = levels / 2;
+    arrangeVanEmdeBoas(parent, topLevels, order);
+
+    std::vector<std::uint32_t> bottoms;
+    collectAtDepth(parent, topLevels, bottoms);
+
+    for (std::uint32_t bottom : bottoms)
+    {
+        arrangeVanEmdeBoas(bottom, levels - topLevels, order);
+    }
+}
+
+
+// collectAtDepth() appends to found the parents of the sibling pairs that
+// are the given number of levels below the children of the given parent,
+// left to right.
+
+template <typename CoordinateType>
+void KdTree<CoordinateType>::collectAtDepth(
+    std::uint32_t parent, std::uint32_t depth, std::vector<std::uint32_t>& found) const
+{
+    if (depth == 0)
+    {
+        found.push_back(parent);
+        return;
+    }
+
+    const std::uint32_t first = parent == noChild ? root_ : nodes_[parent].left;
+    const std::uint32_t last = parent == noChild ? root_ : nodes_[parent].right;
+
+    for (std::uint32_t node = first; node <= last; ++node)
+    {
+        if (nodes_[node].left != noChild)
+        {
+            collectAtDepth(node, depth - 1, found);
+        }
+    }
+}
+
+
+// gatherBranches() makes the compact copy of the nodes that the searches
+// descend through, in the same order as nodes_.
+
+template <typename CoordinateType>
+void KdTree<CoordinateType>::gatherBranches()
+{
+    branches_.resize(nodes_.size());
+
+    for (std::size_t i = 0; i < nodes_.size(); ++i)
+    {
+        const Node& node = nodes_[i];
+        branches_[i] = Branch{node.split, node.left, node.left == noChild ? leafAxis : node.axis};
+    }
+}
+
+
+// descend() is the search that the queries share.  It walks the tree
+// depth-first, nearer child first, since finding close points early lets
+// us skip more of the tree later, and calls visitLeaf(leaf) for each leaf
+// it reaches, stopping if that returns false.  prune(squaredDistance)
+// decides whether a subtree whose points are at least that far away
+// (squared) can be skipped.
+//
+// That distance isn't taken from the subtree's box, which would mean
+// reading its Node; instead, each pending subtree carries the query's
+// offset from it along each axis.  The offsets start as the query's
+// distance outside the root's box.  Crossing a split replaces the offset
+// along its axis with the query's distance from the splitting plane, since
+// every point on the far side is at least that far away along that axis.
+// That's a looser bound than the box, so a search may visit a few more
+// nodes, but until it reaches a leaf, it reads nothing but branches_.  At a
+// leaf, whose Node has to be read anyway, the leaf's box is checked too
+// before any of its points are, since it's usually much smaller than the
+// region the splits above it bound.  The squared distance adds up the offsets the same way squaredDistanceFrom()
+// adds up its differences, so rounding can never make it larger than the
+// squared distance to a point in the subtree.
+
+template <typename CoordinateType>
+template <typename Prune, typename VisitLeaf>
+void KdTree<CoordinateType>::descend(
+    const Point<CoordinateType>& query, Prune prune, VisitLeaf visitLeaf) const
+{
+    struct Pending
+    {
+        std::uint32_t node;
+        double squaredDistance;
+        double offsets[3];
+    };
+
+    if (root_ == noChild)
+    {
+        return;
+    }
+
+    const double values[3] = {coordinate(query, 0), coordinate(query, 1), coordinate(query, 2)};
+
+    Pending pending[64];
+    std::size_t pendingCount = 0;
+
+    Pending& first = pending[pendingCount++];
+    first.node = root_;
+
+    for (unsigned int axis = 0; axis < 3; ++axis)
+    {
+        const double below = nodes_[root_].lower[axis] - values[axis];
+        const double above = values[axis] - nodes_[root_].upper[axis];
+        first.offsets[axis] = std::max(0.0, std::max(below, above));
+    }
+
+    first.squaredDistance =
+        first.offsets[0] * first.offsets[0] + first.offsets[1] * first.offsets[1]
+        + first.offsets[2] * first.offsets[2];
+
+    while (pendingCount > 0)
+    {
+        const Pending current = pending[--pendingCount];
+
+        if (prune(current.squaredDistance))
+        {
+            continue;
+        }
+
+        const Branch& branch = branches_[current.node];
+
+        if (branch.axis == leafAxis)
+        {
+            const Node& leaf = nodes_[current.node];
+
+            if (!prune(squaredDistanceToNode(query, leaf)) && !visitLeaf(leaf))
+            {
+                return;
+            }
+
+            continue;
+        }
+
+        const double offset = values[branch.axis] - branch.split;
+        const bool below = offset < 0.0;
+
+        Pending& far = pending[pendingCount++];
+        far = current;
+        far.node = branch.left + (below ? 1 : 0);
+        far.offsets[branch.axis] = offset;
+        far.squaredDistance =
+            far.offsets[0] * far.offsets[0] + far.offsets[1] * far.offsets[1]
+            + far.offsets[2] * far.offsets[2];
+
+        Pending& near = pending[pendingCount++];
+        near = current;
+        near.node = branch.left + (below ? 0 : 1);
+    }
+}
+
+
+// searchRadius() calls visit(position, squaredDistance) for each point
+// within the radius, stopping early if visit() returns false.
+
+template <typename CoordinateType>
+template <typename Visit>
+void KdTree<CoordinateType>::searchRadius(
+    const Point<CoordinateType>& query, double squaredRadius, Visit visit) const
+{
+    descend(
+        query,
+        [&](double squaredDistance)
+        {
+            return squaredDistance > squaredRadius;
+        },
+        [&](const Node& leaf)
+        {
+            for (std::uint32_t i = leaf.begin; i < leaf.end; ++i)
+            {
+                const double squaredDistance = query.squaredDistanceFrom(points_[i]);
+
+                if (squaredDistance <= squaredRadius && !visit(i, squaredDistance))
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        });
+}
+
+
+
+#endif // KDTREE_HPP
+
@@ -0,0 +1,314 @@
+// MappedPoints.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines two class templates that keep
+// large arrays of points in memory mapped with MappedRegion (see
+// MappedRegion.hpp), so that they can use huge pages and be prefaulted:
+//
+// * A PointBuffer is a fixed-size array of points in anonymous memory; it's
+//   what a std::vector<Point<CoordinateType>> would be, if we could choose
+//   how its memory is mapped.
+// * A MappedPointFile maps a point file (see PointFile.hpp) into memory,
+//   so that its points can be read in place, without copying them at all.
+//   Since the file format stores the points exactly the way they're laid
+//   out in memory, the mapped bytes simply are an array of points.
+//
+// For arrays of a few gigabytes, mapping them with huge pages can make
+// scans and (especially) random lookups noticeably faster, since far fewer
+// of them miss in the TLB, and prefaulting moves the cost of the page
+// faults out of the first pass over the points and into setup, where it's
+// predictable.  PointScanBenchmark.hpp measures both effects.
+
+#ifndef MAPPEDPOINTS_HPP
+#define MAPPEDPOINTS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "FileDescriptor.hpp"
+#include "MappedRegion.hpp"
+#include "Point.hpp"
+#include "PointFile.hpp"
+
+
+
+struct PointMemoryOptions
+{
+    HugePages hugePages = HugePages::None;
+    bool prefault = false;
+};
+
+
+
+template <typename CoordinateType>
+class PointBuffer
+{
+public:
+    // A PointBuffer holds the given number of points, which start out with
+    // all of their coordinates zero, or a copy of the given points.
+    explicit PointBuffer(
+        std::size_t size, const PointMemoryOptions& options = PointMemoryOptions{});
+
+    explicit PointBuffer(
+        const std::vector<Point<CoordinateType>>& points,
+        const PointMemoryOptions& options = PointMemoryOptions{});
+
+
+    std::size_t size() const;
+
+    Point<CoordinateType>* data();
+    const Point<CoordinateType>* data() const;
+
+    Point<CoordinateType>& operator[](std::size_t index);
+    const Point<CoordinateType>& operator[](std::size_t index) const;
+
+    Point<CoordinateType>* begin();
+    Point<CoordinateType>* end();
+    const Point<CoordinateType>* begin() const;
+    const Point<CoordinateType>* end() const;
+
+
+    // memory() returns the region that holds the points.
+    const MappedRegion& memory() const;
+
+
+private:
+    MappedRegion memory_;
+    std::size_t size_;
+};
+
+
+
+template <typename CoordinateType>
+class MappedPointFile
+{
+public:
+    // open() maps a point file for reading, throwing a PointFileException
+    // if it isn't a file of Point<CoordinateType> objects, or a
+    // std::system_error if it can't be opened or mapped.  Explicit huge
+    // pages only exist for anonymous memory (and files on hugetlbfs), so
+    // asking for them here throws a std::invalid_argument; transparent
+    // huge pages are requested if asked for, but whether the kernel uses
+    // them depends on the file system.
+    static MappedPointFile open(
+        const std::string& path, const PointMemoryOptions& options = PointMemoryOptions{});
+
+
+    std::size_t size() const;
+    const Point<CoordinateType>* data() const;
+    const Point<CoordinateType>& operator[](std::size_t index) const;
+    const Point<CoordinateType>* begin() const;
+    const Point<CoordinateType>* end() const;
+
+    const PointFileHeader& header() const;
+    const MappedRegion& memory() const;
+
+
+private:
+    MappedPointFile(MappedRegion memory, const PointFileHeader& header);
+
+    MappedRegion memory_;
+    PointFileHeader header_;
+};
+
+
+
+template <typename CoordinateType>
+PointBuffer<CoordinateType>::PointBuffer(std::size_t size, const PointMemoryOptions& options)
+    : size_{size}
+{
+    static_assert(
+        std::is_trivially_copyable<Point<CoordinateType>>::value,
+        "points must be trivially copyable to live in mapped memory");
+
+    // Anonymous memory is already zero-filled, which is a valid array of
+    // points whose coordinates are all zero, so there's nothing to fill in.
+    memory_ = MappedRegion::anonymous(
+        std::max<std::size_t>(size, 1) * sizeof(Point<CoordinateType>),
+        PROT_READ | PROT_WRITE, options.hugePages);
+
+    if (options.prefault)
+    {
+        memory_.prefault(true);
+    }
+}
+
+
+template <typename CoordinateType>
+PointBuffer<CoordinateType>::PointBuffer(
+    const std::vector<Point<CoordinateType>>& points, const PointMemoryOptions& options)
+    : PointBuffer{points.size(), options}
+{
+    std::copy(points.begin(), points.end(), data());
+}
+
+
+template <typename CoordinateType>
+std::size_t PointBuffer<CoordinateType>::size() const
+{
+    return size_;
+}
+
+
+template <typename CoordinateType>
+Point<CoordinateType>* PointBuffer<CoordinateType>::data()
+{
+    return static_cast<Point<CoordinateType>*>(memory_.data());
+}
+
+
+template <typename CoordinateType>
+const Point<CoordinateType>* PointBuffer<CoordinateType>::data() const
+{
+    return static_cast<const Point<CoordinateType>*>(memory_.data());
+}
+
+
+template <typename CoordinateType>
+Point<CoordinateType>& PointBuffer<CoordinateType>::operator[](std::size_t index)
+{
+    return data()[index];
+}
+
+
+template <typename CoordinateType>
+const Point<CoordinateType>& PointBuffer<CoordinateType>::operator[](std::size_t index) const
+{
+    return data()[index];
+}
+
+
+template <typename CoordinateType>
+Point<CoordinateType>* PointBuffer<CoordinateType>::begin()
+{
+    return data();
+}
+
+
+template <typename CoordinateType>
+Point<CoordinateType>* PointBuffer<CoordinateType>::end()
+{
+    return data() + size_;
+}
+
+
+template <typename CoordinateType>
+const Point<CoordinateType>* PointBuffer<CoordinateType>::begin() const
+{
+    return data();
+}
+
+
+template <typename CoordinateType>
+const Point<CoordinateType>* PointBuffer<CoordinateType>::end() const
+{
+    return data() + size_;
+}
+
+
+template <typename CoordinateType>
+const MappedRegion& PointBuffer<CoordinateType>::memory() const
+{
+    return memory_;
+}
+
+
+// The mapping is private, so nothing we do to it could reach the file,
+// and we map the whole file rather than just the points, since mappings
+// have to start on a page boundary and the points start at dataOffset.
+
+template <typename CoordinateType>
+MappedPointFile<CoordinateType> MappedPointFile<CoordinateType>::open(
+    const std::string& path, const PointMemoryOptions& options)
+{
+    if (options.hugePages == HugePages::Explicit)
+    {
+        throw std::invalid_argument{"explicit huge pages can't be used for a point file"};
+    }
+
+    FileDescriptor file = FileDescriptor::open(path, O_RDONLY);
+    const PointFileHeader header = readPointFileHeader<CoordinateType>(file);
+
+    const std::size_t length = static_cast<std::size_t>(
+        header.dataOffset + header.pointCount * sizeof(Point<CoordinateType>));
+
+    MappedRegion memory = MappedRegion::map(
+        file, length, PROT_READ, MAP_PRIVATE | (options.prefault ? MAP_POPULATE : 0));
+
+    if (options.hugePages == HugePages::Transparent)
+    {
+        memory.adviseHugePages();
+    }
+
+    return MappedPointFile{std::move(memory), header};
+}
+
+
+template <typename CoordinateType>
+MappedPointFile<CoordinateType>::MappedPointFile(MappedRegion memory, const PointFileHeader& header)
+    : memory_{std::move(memory)}, header_{header}
+{
+}
+
+
+template <typename CoordinateType>
+std::size_t MappedPointFile<CoordinateType>::size() const
+{
+    return static_cast<std::size_t>(header_.pointCount);
+}
+
+
+template <typename CoordinateType>
+const Point<CoordinateType>* MappedPointFile<CoordinateType>::data() const
+{
+    return reinterpret_cast<const Point<CoordinateType>*>(
+        static_cast<const std::uint8_t*>(memory_.data()) + header_.dataOffset);
+}
+
+
+template <typename CoordinateType>
+const Point<CoordinateType>& MappedPointFile<CoordinateType>::operator[](std::size_t index) const
+{
+    return data()[index];
+}
+
+
+template <typename CoordinateType>
+const Point<CoordinateType>* MappedPointFile<CoordinateType>::begin() const
+{
+    return data();
+}
+
+
+template <typename CoordinateType>
+const Point<CoordinateType>* MappedPointFile<CoordinateType>::end() const
+{
+    return data() + size();
+}
+
+
+template <typename CoordinateType>
+const PointFileHeader& MappedPointFile<CoordinateType>::header() const
+{
+    return header_;
+}
+
+
+template <typename CoordinateType>
+const MappedRegion& MappedPointFile<CoordinateType>::memory() const
+{
+    return memory_;
+}
+
+
+
+#endif // MAPPEDPOINTS_HPP
+
@@ -0,0 +1,376 @@
+// MappedRegion.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a class called MappedRegion, which
+// takes ownership of a range of memory mapped with the POSIX mmap()
+// function and unmaps it when the MappedRegion object dies.  It's the same
+// idea as FileDescriptor (see FileDescriptor.hpp), applied to mappings:
+// exactly one owner at a time, ownership can be moved but not copied, and
+// the destructor releases the mapping no matter how we leave the scope.
+//
+// Mapping a file (or a shared memory object, which is a file that lives
+// only in memory) makes its contents appear in our address space, so that
+// reading it is just reading memory; the operating system brings the pages
+// in as they're touched.  Mapping the same file into several processes
+// shares the same physical memory among all of them.
+//
+// Two things about how pages are mapped can matter a lot for very large
+// regions.  First, every page of memory we touch needs an entry in the
+// processor's TLB (the cache of address translations), which only has room
+// for a few thousand; scanning gigabytes of ordinary 4 KB pages misses in
+// it constantly.  "Huge" pages (2 MB, usually) cover 512 times as much
+// memory per entry.  Linux offers them in two ways: transparent huge pages,
+// which the kernel uses when it can for memory we've asked it to (with
+// madvise()), and explicit huge pages, which come from a pool that an
+// administrator has to set aside ahead of time, but are guaranteed once
+// mapped.  Second, each page is only brought in the first time it's
+// touched, which costs a page fault; prefaulting brings every page in up
+// front, so that time isn't spread unpredictably across the first pass
+// over the data.
+
+#ifndef MAPPEDREGION_HPP
+#define MAPPEDREGION_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "FileDescriptor.hpp"
+
+
+
+enum class HugePages
+{
+    None,
+    Transparent,
+    Explicit
+};
+
+
+
+class MappedRegion
+{
+public:
+    // A default-constructed MappedRegion doesn't own anything.
+    MappedRegion();
+
+
+    // map() maps length bytes of a file, starting at the given offset, with
+    // the given protection (PROT_READ, PROT_WRITE, or both) and flags
+    // (usually MAP_SHARED), throwing a std::system_error if that fails.
+    // Including MAP_POPULATE in the flags prefaults the whole region.
+    static MappedRegion map(
+        const FileDescriptor& file, std::size_t length, int protection,
+        int flags = MAP_SHARED, std::uint64_t offset = 0);
+
+
+    // anonymous() maps length bytes of zero-filled memory that doesn't
+    // belong to any file, which is private to this process.  No physical
+    // memory is used for a page until it's first touched.
+    //
+    // With HugePages::Transparent, the region is aligned to a huge page
+    // boundary and the kernel is asked to use huge pages for it, which it
+    // will when it has them to spare.  With HugePages::Explicit, the
+    // region comes from the pool of explicit huge pages, and anonymous()
+    // throws a std::system_error if there aren't enough of them.  Either
+    // way, the length is rounded up to a whole number of huge pages, so
+    // size() may be larger than what was asked for.
+    static MappedRegion anonymous(
+        std::size_t length, int protection = PROT_READ | PROT_WRITE,
+        HugePages hugePages = HugePages::None);
+
+
+    // hugePageSize() returns the size of the system's (default) huge pages.
+    static std::size_t hugePageSize();
+
+
+    ~MappedRegion();
+
+    MappedRegion(const MappedRegion&) = delete;
+    MappedRegion& operator=(const MappedRegion&) = delete;
+
+    MappedRegion(MappedRegion&& other) noexcept;
+    MappedRegion& operator=(MappedRegion&& other) noexcept;
+
+
+    // data() returns the address of the first mapped byte, and size() the
+    // number of bytes mapped.
+    void* data() const;
+    std::size_t size() const;
+
+
+    // isMapped() returns true if this object currently owns a mapping.
+    bool isMapped() const;
+
+
+    // unmap() unmaps the region now, rather than waiting for the destructor
+    // to do it.
+    void unmap();
+
+
+    // adviseHugePages() asks the kernel to use transparent huge pages for
+    // the region, throwing a std::system_error if it can't (because they're
+    // disabled, say).  Whether they're actually used for a file's pages
+    // depends on the kind of file system the file is on.
+    void adviseHugePages();
+
+
+    // prefault() brings every page of the region into memory now, rather
+    // than one page fault at a time as they're touched.  Prefaulting for
+    // writing also allocates private copies of the pages of a private
+    // mapping, so that the first writes don't fault, either; it must not
+    // be done while other threads are writing to the region.
+    void prefault(bool forWriting = false);
+
+
+private:
+    MappedRegion(void* data, std::size_t size);
+
+    void* data_;
+    std::size_t size_;
+};
+
+
+
+namespace MappedRegionImpl
+{
+    // These are defined here because older C libraries' headers lack them.
+    constexpr int populateRead = 22;    // MADV_POPULATE_READ
+    constexpr int populateWrite = 23;   // MADV_POPULATE_WRITE
+}
+
+
+
+inline MappedRegion::MappedRegion()
+    : data_{nullptr}, size_{0}
+{
+}
+
+
+inline MappedRegion::MappedRegion(void* data, std::size_t size)
+    : data_{data}, size_{size}
+{
+}
+
+
+inline MappedRegion MappedRegion::map(
+    const FileDescriptor& file, std::size_t length, int protection,
+    int flags, std::uint64_t offset)
+{
+    void* data = ::mmap(
+        nullptr, length, protection, flags, file.get(), static_cast<off_t>(offset));
+
+    if (data == MAP_FAILED)
+    {
+        throw std::system_error{errno, std::generic_category(), "mmap"};
+    }
+
+    return MappedRegion{data, length};
+}
+
+
+// Transparent huge pages can only be used for the parts of a region that
+// are aligned to huge page boundaries, and mmap() only promises alignment
+// to ordinary pages, so we map an extra huge page's worth and unmap
+// whatever lies outside the aligned part.  The request for huge pages is
+// only a hint, so if the kernel refuses it, we carry on without them.
+
+inline MappedRegion MappedRegion::anonymous(
+    std::size_t length, int protection, HugePages hugePages)
+{
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    if (hugePages == HugePages::None)
+    {
+        void* data = ::mmap(nullptr, length, protection, flags, -1, 0);
+
+        if (data == MAP_FAILED)
+        {
+            throw std::system_error{errno, std::generic_category(), "mmap"};
+        }
+
+        return MappedRegion{data, length};
+    }
+
+    const std::size_t hugeSize = hugePageSize();
+    const std::size_t rounded = (length + hugeSize - 1) / hugeSize * hugeSize;
+
+    if (hugePages == HugePages::Explicit)
+    {
+        void* data = ::mmap(nullptr, rounded, protection, flags | MAP_HUGETLB, -1, 0);
+
+        if (data == MAP_FAILED)
+        {
+            throw std::system_error{errno, std::generic_category(), "mmap (explicit huge pages)"};
+        }
+
+        return MappedRegion{data, rounded};
+    }
+
+    void* raw = ::mmap(nullptr, rounded + hugeSize, protection, flags, -1, 0);
+
+    if (raw == MAP_FAILED)
+    {
+        throw std::system_error{errno, std::generic_category(), "mmap"};
+    }
+
+    const std::uintptr_t rawBegin = reinterpret_cast<std::uintptr_t>(raw);
+    const std::uintptr_t begin = (rawBegin + hugeSize - 1) / hugeSize * hugeSize;
+    const std::uintptr_t end = begin + rounded;
+
+    if (begin > rawBegin)
+    {
+        ::munmap(raw, begin - rawBegin);
+    }
+
+    if (rawBegin + rounded + hugeSize > end)
+    {
+        ::munmap(reinterpret_cast<void*>(end), rawBegin + rounded + hugeSize - end);
+    }
+
+    MappedRegion region{reinterpret_cast<void*>(begin), rounded};
+    ::madvise(region.data_, region.size_, MADV_HUGEPAGE);
+
+    return region;
+}
+
+
+inline std::size_t MappedRegion::hugePageSize()
+{
+    static const std::size_t size =
+        []
+        {
+            std::ifstream meminfo{"/proc/meminfo"};
+            std::string label;
+
+            while (meminfo >> label)
+            {
+                std::size_t kilobytes;
+
+                if (label == "Hugepagesize:" && meminfo >> kilobytes)
+                {
+                    return kilobytes * 1024;
+                }
+            }
+
+            return std::size_t{2} << 20;
+        }();
+
+    return size;
+}
+
+
+inline MappedRegion::~MappedRegion()
+{
+    unmap();
+}
+
+
+inline MappedRegion::MappedRegion(MappedRegion&& other) noexcept
+    : data_{other.data_}, size_{other.size_}
+{
+    other.data_ = nullptr;
+    other.size_ = 0;
+}
+
+
+inline MappedRegion& MappedRegion::operator=(MappedRegion&& other) noexcept
+{
+    if (this != &other)
+    {
+        unmap();
+        data_ = other.data_;
+        size_ = other.size_;
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+
+    return *this;
+}
+
+
+inline void* MappedRegion::data() const
+{
+    return data_;
+}
+
+
+inline std::size_t MappedRegion::size() const
+{
+    return size_;
+}
+
+
+inline bool MappedRegion::isMapped() const
+{
+    return data_ != nullptr;
+}
+
+
+inline void MappedRegion::unmap()
+{
+    if (data_ != nullptr)
+    {
+        ::munmap(data_, size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
+
+
+inline void MappedRegion::adviseHugePages()
+{
+    if (data_ != nullptr && ::madvise(data_, size_, MADV_HUGEPAGE) != 0)
+    {
+        throw std::system_error{errno, std::generic_category(), "madvise"};
+    }
+}
+
+
+// MADV_POPULATE_READ and MADV_POPULATE_WRITE arrived in Linux 5.14; on
+// older kernels, madvise() rejects them with EINVAL, and we touch one byte
+// of every page instead, which has the same effect, one fault at a time.
+
+inline void MappedRegion::prefault(bool forWriting)
+{
+    if (data_ == nullptr)
+    {
+        return;
+    }
+
+    const int advice = forWriting ? MappedRegionImpl::populateWrite : MappedRegionImpl::populateRead;
+
+    if (::madvise(data_, size_, advice) == 0)
+    {
+        return;
+    }
+    else if (errno != EINVAL)
+    {
+        throw std::system_error{errno, std::generic_category(), "madvise"};
+    }
+
+    const std::size_t pageSize = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    volatile std::uint8_t* bytes = static_cast<volatile std::uint8_t*>(data_);
+
+    for (std::size_t offset = 0; offset < size_; offset += pageSize)
+    {
+        const std::uint8_t value = bytes[offset];
+
+        if (forWriting)
+        {
+            bytes[offset] = value;
+        }
+    }
+}
+
+
+
+#endif // MAPPEDREGION_HPP
+
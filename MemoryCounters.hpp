@@ -0,0 +1,156 @@
+// MemoryCounters.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a class called MemoryCounters,
+// which counts the page faults and TLB misses that happen while a piece of
+// code runs, so that we can see (rather than guess) what effect huge pages
+// and prefaulting have (see MappedRegion.hpp and PointScanBenchmark.hpp).
+//
+// Page faults are counted by the operating system for every process, and
+// getrusage() reports them: "minor" faults are the ones satisfied without
+// reading anything from disk (such as the first touch of a page of fresh
+// memory), and "major" faults are the ones that had to wait for a read.
+//
+// TLB misses are counted by the processor itself, and we read them through
+// Linux's perf_event_open() system call.  Not every machine (or virtual
+// machine, or container) allows that, so the count is only reported when
+// it's available.  Only misses in user code, on the thread that created the
+// MemoryCounters and threads it starts afterward, are counted, since that's
+// all an unprivileged process is usually allowed to see.
+
+#ifndef MEMORYCOUNTERS_HPP
+#define MEMORYCOUNTERS_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "FileDescriptor.hpp"
+
+
+
+struct MemoryCounts
+{
+    std::uint64_t minorFaults = 0;
+    std::uint64_t majorFaults = 0;
+
+    // tlbMisses counts data TLB misses on loads; it's only meaningful when
+    // tlbMissesCounted is true.
+    std::uint64_t tlbMisses = 0;
+    bool tlbMissesCounted = false;
+};
+
+
+
+class MemoryCounters
+{
+public:
+    MemoryCounters();
+
+
+    // tlbMissesAvailable() returns true if this machine lets us count TLB
+    // misses.
+    bool tlbMissesAvailable() const;
+
+
+    // start() begins counting, and stop() returns what was counted since.
+    void start();
+    MemoryCounts stop();
+
+
+private:
+    FileDescriptor tlbCounter_;
+    MemoryCounts started_;
+};
+
+
+
+namespace MemoryCountersImpl
+{
+    inline MemoryCounts faultCounts()
+    {
+        rusage usage;
+        MemoryCounts counts;
+
+        if (::getrusage(RUSAGE_SELF, &usage) == 0)
+        {
+            counts.minorFaults = static_cast<std::uint64_t>(usage.ru_minflt);
+            counts.majorFaults = static_cast<std::uint64_t>(usage.ru_majflt);
+        }
+
+        return counts;
+    }
+}
+
+
+
+inline MemoryCounters::MemoryCounters()
+{
+    perf_event_attr attributes;
+    std::memset(&attributes, 0, sizeof(attributes));
+
+    attributes.type = PERF_TYPE_HW_CACHE;
+    attributes.size = sizeof(attributes);
+    attributes.config =
+        PERF_COUNT_HW_CACHE_DTLB
+        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attributes.disabled = 1;
+    attributes.inherit = 1;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+
+    tlbCounter_ = FileDescriptor{static_cast<int>(
+        ::syscall(SYS_perf_event_open, &attributes, 0, -1, -1, PERF_FLAG_FD_CLOEXEC))};
+}
+
+
+inline bool MemoryCounters::tlbMissesAvailable() const
+{
+    return tlbCounter_.isOpen();
+}
+
+
+inline void MemoryCounters::start()
+{
+    if (tlbCounter_.isOpen())
+    {
+        ::ioctl(tlbCounter_.get(), PERF_EVENT_IOC_RESET, 0);
+        ::ioctl(tlbCounter_.get(), PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    started_ = MemoryCountersImpl::faultCounts();
+}
+
+
+inline MemoryCounts MemoryCounters::stop()
+{
+    MemoryCounts counts = MemoryCountersImpl::faultCounts();
+    counts.minorFaults -= started_.minorFaults;
+    counts.majorFaults -= started_.majorFaults;
+
+    if (tlbCounter_.isOpen())
+    {
+        ::ioctl(tlbCounter_.get(), PERF_EVENT_IOC_DISABLE, 0);
+
+        std::uint64_t value = 0;
+
+        if (::read(tlbCounter_.get(), &value, sizeof(value)) == sizeof(value))
+        {
+            counts.tlbMisses = value;
+            counts.tlbMissesCounted = true;
+        }
+    }
+
+    return counts;
+}
+
+
+
+#endif // MEMORYCOUNTERS_HPP
+
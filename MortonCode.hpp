@@ -0,0 +1,394 @@
+// MortonCode.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines functions for computing Morton
+// codes (also called Z-order codes) for Points, and for sorting Points
+// into Morton order.
+//
+// A Morton code squeezes a point's three coordinates into a single integer
+// in a way that mostly preserves closeness: points that are near each other
+// in space usually have Morton codes that are near each other, too.  It
+// works like this.  First, we divide the space into a grid of 2^b cells
+// along each axis, and find which cell the point is in, giving us three
+// b-bit integers.  Then we interleave their bits -- one bit of x, then one
+// of y, then one of z, then the next bit of x, and so on -- into a single
+// 3b-bit integer.  With b = 21, that fits into 63 bits.
+//
+// Sorting points by their Morton codes puts them in the order a "Z"-shaped
+// curve would visit them as it winds its way through every cell of the grid.
+// It also has a tidy relationship to octrees: the top three bits of a code
+// say which of the eight halves-of-halves of the space a point is in, the
+// next three say which eighth of that eighth, and so on.  So the points in
+// any octree cell are consecutive in Morton order.
+//
+// The MortonGrid class remembers how a particular grid is laid out: the
+// corner of the cube it covers, the length of the cube's sides, and how
+// many bits per axis to use.  Its cells are cubes rather than boxes, which
+// is what we want whenever the codes are going to be used as an octree.
+
+#ifndef MORTONCODE_HPP
+#define MORTONCODE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+#include "Point.hpp"
+
+
+
+// mortonEncode() interleaves the low 21 bits of x, y, and z into a Morton
+// code, and mortonDecode() reverses it.
+std::uint64_t mortonEncode(std::uint32_t x, std::uint32_t y, std::uint32_t z);
+void mortonDecode(std::uint64_t code, std::uint32_t& x, std::uint32_t& y, std::uint32_t& z);
+
+
+
+template <typename CoordinateType>
+class MortonGrid
+{
+public:
+    static constexpr unsigned int maxBitsPerAxis = 21;
+
+
+    // A MortonGrid can be built to cover a set of points -- the cube is
+    // the smallest one, with the same corner as their bounding box, that
+    // contains them all -- or from an explicit corner and side length.
+    explicit MortonGrid(
+        const std::vector<Point<CoordinateType>>& points,
+        unsigned int bitsPerAxis = maxBitsPerAxis);
+
+    MortonGrid(
+        const Point<double>& corner, double sideLength,
+        unsigned int bitsPerAxis = maxBitsPerAxis);
+
+
+    // These functions return the grid's layout.
+    const Point<double>& corner() const;
+    double sideLength() const;
+    unsigned int bitsPerAxis() const;
+    double cellSize() const;
+
+
+    // cellOf() returns the grid cell containing a point, along each axis;
+    // points outside the cube are clamped into the nearest cell.
+    void cellOf(
+        const Point<CoordinateType>& point,
+        std::uint32_t& x, std::uint32_t& y, std::uint32_t& z) const;
+
+
+    // codeOf() returns the Morton code of the cell containing a point.
+    std::uint64_t codeOf(const Point<CoordinateType>& point) const;
+
+
+private:
+    std::uint32_t cellAlong(double value, double corner) const;
+
+    Point<double> corner_;
+    double sideLength_;
+    unsigned int bitsPerAxis_;
+    double cellsPerUnit_;
+};
+
+
+
+// mortonCodes() returns the Morton code of each point in a grid.
+template <typename CoordinateType>
+std::vector<std::uint64_t> mortonCodes(
+    const std::vector<Point<CoordinateType>>& points,
+    const MortonGrid<CoordinateType>& grid);
+
+
+// sortedOrder() returns the indexes of the given keys in increasing order
+// of key, with ties broken by index.  It uses a radix sort, which is much
+// faster than a comparison sort for large arrays of integer keys.
+std::vector<std::size_t> sortedOrder(const std::vector<std::uint64_t>& keys);
+
+
+// mortonOrder() returns the indexes of the given points in Morton order,
+// using a grid that covers all of them.
+template <typename CoordinateType>
+std::vector<std::size_t> mortonOrder(const std::vector<Point<CoordinateType>>& points);
+
+
+
+// To interleave bits, we spread the 21 bits of each coordinate out so that
+// there are two zero bits between each of them, then shift the three spread
+// values against each other and combine them.  The spreading is done in a
+// handful of steps, each of which moves groups of bits into place at once.
+
+namespace MortonCodeImpl
+{
+    inline std::uint64_t spread(std::uint32_t value)
+    {
+        std::uint64_t bits = value & 0x1fffff;
+        bits = (bits | (bits << 32)) & 0x001f00000000ffffULL;
+        bits = (bits | (bits << 16)) & 0x001f0000ff0000ffULL;
+        bits = (bits | (bits << 8)) & 0x100f00f00f00f00fULL;
+        bits = (bits | (bits << 4)) & 0x10c30c30c30c30c3ULL;
+        bits = (bits | (bits << 2)) & 0x1249249249249249ULL;
+        return bits;
+    }
+
+
+    inline std::uint32_t compact(std::uint64_t bits)
+    {
+        bits &= 0x1249249249249249ULL;
+        bits = (bits | (bits >> 2)) & 0x10c30c30c30c30c3ULL;
+        bits = (bits | (bits >> 4)) & 0x100f00f00f00f00fULL;
+        bits = (bits | (bits >> 8)) & 0x001f0000ff0000ffULL;
+        bits = (bits | (bits >> 16)) & 0x001f00000000ffffULL;
+        bits = (bits | (bits >> 32)) & 0x1fffff;
+        return static_cast<std::uint32_t>(bits);
+    }
+}
+
+
+inline std::uint64_t mortonEncode(std::uint32_t x, std::uint32_t y, std::uint32_t z)
+{
+    return (MortonCodeImpl::spread(x) << 2)
+        | (MortonCodeImpl::spread(y) << 1)
+        | MortonCodeImpl::spread(z);
+}
+
+
+inline void mortonDecode(
+    std::uint64_t code, std::uint32_t& x, std::uint32_t& y, std::uint32_t& z)
+{
+    x = MortonCodeImpl::compact(code >> 2);
+    y = MortonCodeImpl::compact(code >> 1);
+    z = MortonCodeImpl::compact(code);
+}
+
+
+template <typename CoordinateType>
+MortonGrid<CoordinateType>::MortonGrid(
+    const std::vector<Point<CoordinateType>>& points, unsigned int bitsPerAxis)
+    : corner_{0.0, 0.0, 0.0}, sideLength_{1.0},
+      bitsPerAxis_{std::min(std::max(bitsPerAxis, 1u), maxBitsPerAxis)}
+{
+    if (!points.empty())
+    {
+        double lower[3] = {
+            std::numeric_limits<double>::infinity(),
+            std::numeric_limits<double>::infinity(),
+            std::numeric_limits<double>::infinity()};
+
+        double upper[3] = {-lower[0], -lower[1], -lower[2]};
+
+        for (const Point<CoordinateType>& point : points)
+        {
+            const double values[3] = {
+                static_cast<double>(point.x()),
+                static_cast<double>(point.y()),
+                static_cast<double>(point.z())};
+
+            for (unsigned int axis = 0; axis < 3; ++axis)
+            {
+                lower[axis] = std::min(lower[axis], values[axis]);
+                upper[axis] = std::max(upper[axis], values[axis]);
+            }
+        }
+
+        corner_ = Point<double>{lower[0], lower[1], lower[2]};
+        sideLength_ = std::max({upper[0] - lower[0], upper[1] - lower[1], upper[2] - lower[2]});
+
+        if (!(sideLength_ > 0.0) || !std::isfinite(sideLength_))
+        {
+            sideLength_ = 1.0;
+        }
+    }
+
+    cellsPerUnit_ = static_cast<double>(std::uint64_t{1} << bitsPerAxis_) / sideLength_;
+}
+
+
+template <typename CoordinateType>
+MortonGrid<CoordinateType>::MortonGrid(
+    const Point<double>& corner, double sideLength, unsigned int bitsPerAxis)
+    : corner_{corner}, sideLength_{sideLength},
+      bitsPerAxis_{std::min(std::max(bitsPerAxis, 1u), maxBitsPerAxis)}
+{
+    cellsPerUnit_ = static_cast<double>(std::uint64_t{1} << bitsPerAxis_) / sideLength_;
+}
+
+
+template <typename CoordinateType>
+const Point<double>& MortonGrid<CoordinateType>::corner() const
+{
+    return corner_;
+}
+
+
+template <typename CoordinateType>
+double MortonGrid<CoordinateType>::sideLength() const
+{
+    return sideLength_;
+}
+
+
+template <typename CoordinateType>
+unsigned int MortonGrid<CoordinateType>::bitsPerAxis() const
+{
+    return bitsPerAxis_;
+}
+
+
+template <typename CoordinateType>
+double MortonGrid<CoordinateType>::cellSize() const
+{
+    return 1.0 / cellsPerUnit_;
+}
+
+
+template <typename CoordinateType>
+void MortonGrid<CoordinateType>::cellOf(
+    const Point<CoordinateType>& point,
+    std::uint32_t& x, std::uint32_t& y, std::uint32_t& z) const
+{
+    x = cellAlong(static_cast<double>(point.x()), corner_.x());
+    y = cellAlong(static_cast<double>(point.y()), corner_.y());
+    z = cellAlong(static_cast<double>(point.z()), corner_.z());
+}
+
+
+template <typename CoordinateType>
+std::uint64_t MortonGrid<CoordinateType>::codeOf(const Point<CoordinateType>& point) const
+{
+    std::uint32_t x;
+    std::uint32_t y;
+    std::uint32_t z;
+    cellOf(point, x, y, z);
+
+    return mortonEncode(x, y, z);
+}
+
+
+// A point on the far side of the cube would land in cell 2^b, one past the
+// last one, so we clamp it (and anything else outside the cube, or NaN)
+// into range.
+
+template <typename CoordinateType>
+std::uint32_t MortonGrid<CoordinateType>::cellAlong(double value, double corner) const
+{
+    const double cell = (value - corner) * cellsPerUnit_;
+    const double lastCell = static_cast<double>((std::uint64_t{1} << bitsPerAxis_) - 1);
+
+    if (!(cell > 0.0))
+    {
+        return 0;
+    }
+    else if (cell >= lastCell)
+    {
+        return static_cast<std::uint32_t>(lastCell);
+    }
+    else
+    {
+        return static_cast<std::uint32_t>(cell);
+    }
+}
+
+
+template <typename CoordinateType>
+std::vector<std::uint64_t> mortonCodes(
+    const std::vector<Point<CoordinateType>>& points,
+    const MortonGrid<CoordinateType>& grid)
+{
+    std::vector<std::uint64_t> codes(points.size());
+
+    for (std::size_t i = 0; i < points.size(); ++i)
+    {
+        codes[i] = grid.codeOf(points[i]);
+    }
+
+    return codes;
+}
+
+
+// sortedOrder() is a least-significant-digit radix sort, sorting by 16 bits
+// of the key at a time.  Each pass is stable, so after sorting by the low 16
+// bits and then by the next 16, keys with the same upper bits remain in
+// order by their lower ones, and so on.  Passes where every key has the same
+// digit wouldn't change anything, so we skip them; Morton codes using fewer
+// than 21 bits per axis leave the top digits all zero, for example.
+
+inline std::vector<std::size_t> sortedOrder(const std::vector<std::uint64_t>& keys)
+{
+    constexpr unsigned int digitBits = 16;
+    constexpr std::size_t digitCount = std::size_t{1} << digitBits;
+
+    // Each key travels with its index, so that every pass reads its keys
+    // sequentially rather than jumping around the keys vector.
+    struct Entry
+    {
+        std::uint64_t key;
+        std::size_t index;
+    };
+
+    std::vector<Entry> entries(keys.size());
+
+    for (std::size_t i = 0; i < keys.size(); ++i)
+    {
+        entries[i] = Entry{keys[i], i};
+    }
+
+    std::vector<Entry> scratch(keys.size());
+    std::vector<std::size_t> counts(digitCount);
+
+    for (unsigned int shift = 0; shift < 64; shift += digitBits)
+    {
+        std::fill(counts.begin(), counts.end(), 0);
+
+        for (const Entry& entry : entries)
+        {
+            ++counts[(entry.key >> shift) & (digitCount - 1)];
+        }
+
+        if (std::find(counts.begin(), counts.end(), keys.size()) != counts.end())
+        {
+            continue;
+        }
+
+        std::size_t total = 0;
+
+        for (std::size_t& count : counts)
+        {
+            const std::size_t start = total;
+            total += count;
+            count = start;
+        }
+
+        for (const Entry& entry : entries)
+        {
+            scratch[counts[(entry.key >> shift) & (digitCount - 1)]++] = entry;
+        }
+
+        std::swap(entries, scratch);
+    }
+
+    std::vector<std::size_t> order(keys.size());
+
+    for (std::size_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = entries[i].index;
+    }
+
+    return order;
+}
+
+
+template <typename CoordinateType>
+std::vector<std::size_t> mortonOrder(const std::vector<Point<CoordinateType>>& points)
+{
+    return sortedOrder(mortonCodes(points, MortonGrid<CoordinateType>{points}));
+}
+
+
+
+#endif // MORTONCODE_HPP
+
@@ -0,0 +1,470 @@
+// NeighborGraph.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a struct called NeighborGraph, a
+// graph connecting each point to the points nearest it, along with
+// functions that build one and that find shortest paths through it.
+//
+// The straight-line distance between two points isn't always the distance
+// that matters.  If the points were measured on a curved surface -- a rolled
+// up sheet of paper, say -- two points on neighboring layers of the roll are
+// close together in space, but far apart as far as an ant walking on the
+// paper is concerned.  That "distance along the surface" is called the
+// geodesic distance, and we can approximate it by connecting each point to
+// its k nearest neighbors (which are near each other along the surface,
+// too) and finding the length of the shortest path between points through
+// that graph.
+//
+// The graph is stored in "compressed sparse row" (CSR) form: the neighbors
+// of every vertex are stored one after another in a single array, and a
+// second array says where each vertex's neighbors begin.  That's far more
+// compact than a vector of neighbors for each vertex, and reading through
+// a vertex's neighbors reads consecutive memory.
+//
+// Shortest paths are found by "delta-stepping," a variant of Dijkstra's
+// algorithm designed to be run in parallel.  Dijkstra's algorithm finalizes
+// one vertex at a time, always the closest one not yet finalized, which
+// leaves nothing to do in parallel.  Delta-stepping instead groups vertices
+// into "buckets" by their tentative distance, each bucket covering a range
+// of width delta, and processes a whole bucket at once, relaxing the edges
+// of all of its vertices in parallel.  Edges no longer than delta ("light"
+// edges) can put vertices back into the current bucket, so they're relaxed
+// repeatedly until the bucket stays empty; longer ("heavy") edges can only
+// affect later buckets, so they're relaxed once, afterward.  A small delta
+// means less wasted work but less parallelism; a large one, the reverse.
+//
+// Distances from several sources are found in one run: a (source, vertex)
+// pair is treated as a vertex in its own right, so the buckets hold pairs
+// from all of the sources at once, giving each step more work to share.
+
+#ifndef NEIGHBORGRAPH_HPP
+#define NEIGHBORGRAPH_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "KdTree.hpp"
+#include "ThreadPool.hpp"
+
+
+
+struct NeighborGraph
+{
+    // The neighbors of vertex v are targets[offsets[v]] through
+    // targets[offsets[v + 1] - 1], and the edge to targets[e] has length
+    // weights[e].  offsets has one more element than there are vertices.
+    std::vector<std::size_t> offsets;
+    std::vector<std::uint32_t> targets;
+    std::vector<double> weights;
+
+
+    std::size_t vertexCount() const
+    {
+        return offsets.empty() ? 0 : offsets.size() - 1;
+    }
+
+
+    std::size_t edgeCount() const
+    {
+        return targets.size();
+    }
+};
+
+
+
+// buildNeighborGraph() connects each point in a tree (numbered as in the
+// vector the tree was built from) to its k nearest other points, with edges
+// as long as the distances between them.  If symmetric is true, every edge
+// goes both ways, so two points are neighbors if either one is among the
+// other's k nearest; otherwise, each vertex's edges go only to its own k
+// nearest neighbors.
+template <typename CoordinateType>
+NeighborGraph buildNeighborGraph(
+    const KdTree<CoordinateType>& tree, std::size_t k, bool symmetric = true,
+    ThreadPool& pool = defaultThreadPool());
+
+
+// shortestPathDistances() returns the length of the shortest path from each
+// of the sources to every vertex: the distance from sources[s] to vertex v
+// is element s * graph.vertexCount() + v.  Vertices that can't be reached
+// are infinitely far away.  If delta isn't positive, the average edge
+// length is used.  A delta so small that the longest edge spans more
+// buckets than the graph has edges is rejected with std::invalid_argument.
+std::vector<double> shortestPathDistances(
+    const NeighborGraph& graph, const std::vector<std::size_t>& sources,
+    double delta = 0.0, ThreadPool& pool = defaultThreadPool());
+
+
+// This version finds the distances from a single source.
+std::vector<double> shortestPathDistances(
+    const NeighborGraph& graph, std::size_t source,
+    double delta = 0.0, ThreadPool& pool = defaultThreadPool());
+
+
+
+namespace NeighborGraphImpl
+{
+    // lowerTo() lowers an atomic distance to the given value, if that's
+    // smaller, returning true if it did.
+    inline bool lowerTo(std::atomic<double>& distance, double value)
+    {
+        double current = distance.load(std::memory_order_relaxed);
+
+        while (value < current)
+        {
+            if (distance.compare_exchange_weak(current, value, std::memory_order_relaxed))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+}
+
+
+
+// The graph is built from a list of edges, found in parallel, one k-nearest
+// query per point.  Each vertex's edges are then sorted by target so that
+// duplicates (which symmetric graphs have whenever two points are each
+// other's neighbors) can be removed.
+
+template <typename CoordinateType>
+NeighborGraph buildNeighborGraph(
+    const KdTree<CoordinateType>& tree, std::size_t k, bool symmetric, ThreadPool& pool)
+{
+    const std::size_t n = tree.size();
+
+    std::vector<std::uint32_t> nearest(n * k);
+    std::vector<double> distances(n * k);
+    std::vector<std::size_t> found(n, 0);
+
+    pool.parallelFor(
+        0, n, 256,
+        [&](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t position = begin; position < end; ++position)
+            {
+                const std::size_t v = tree.indexAt(position);
+                const std::vector<PointNeighbor> neighbors = tree.nearest(tree.pointAt(position), k + 1);
+
+                for (const PointNeighbor& neighbor : neighbors)
+                {
+                    if (neighbor.index != v && found[v] < k)
+                    {
+                        nearest[v * k + found[v]] = static_cast<std::uint32_t>(neighbor.index);
+                        distances[v * k + found[v]] = neighbor.distance;
+                        ++found[v];
+                    }
+                }
+            }
+        });
+
+    NeighborGraph graph;
+    graph.offsets.assign(n + 1, 0);
+
+    for (std::size_t v = 0; v < n; ++v)
+    {
+        for (std::size_t i = 0; i < found[v]; ++i)
+        {
+            ++graph.offsets[v + 1];
+
+            if (symmetric)
+            {
+                ++graph.offsets[nearest[v * k + i] + 1];
+            }
+        }
+    }
+
+    for (std::size_t v = 0; v < n; ++v)
+    {
+        graph.offsets[v + 1] += graph.offsets[v];
+    }
+
+    std::vector<std::size_t> fill(graph.offsets.begin(), graph.offsets.end() - 1);
+    graph.targets.resize(graph.offsets[n]);
+    graph.weights.resize(graph.offsets[n]);
+
+    for (std::size_t v = 0; v < n; ++v)
+    {
+        for (std::size_t i = 0; i < found[v]; ++i)
+        {
+            const std::uint32_t u = nearest[v * k + i];
+
+            graph.targets[fill[v]] = u;
+            graph.weights[fill[v]++] = distances[v * k + i];
+
+            if (symmetric)
+            {
+                graph.targets[fill[u]] = static_cast<std::uint32_t>(v);
+                graph.weights[fill[u]++] = distances[v * k + i];
+            }
+        }
+    }
+
+    if (!symmetric)
+    {
+        return graph;
+    }
+
+    std::vector<std::size_t> kept(n, 0);
+
+    pool.parallelFor(
+        0, n, 1024,
+        [&](std::size_t begin, std::size_t end)
+        {
+            std::vector<std::pair<std::uint32_t, double>> edges;
+
+            for (std::size_t v = begin; v < end; ++v)
+            {
+                edges.clear();
+
+                for (std::size_t e = graph.offsets[v]; e < graph.offsets[v + 1]; ++e)
+                {
+                    edges.emplace_back(graph.targets[e], graph.weights[e]);
+                }
+
+                std::sort(edges.begin(), edges.end());
+
+                std::size_t e = graph.offsets[v];
+
+                for (std::size_t i = 0; i < edges.size(); ++i)
+                {
+                    if (i == 0 || edges[i].first != edges[i - 1].first)
+                    {
+                        graph.targets[e] = edges[i].first;
+                        graph.weights[e] = edges[i].second;
+                        ++e;
+                    }
+                }
+
+                kept[v] = e - graph.offsets[v];
+            }
+        });
+
+    std::size_t total = 0;
+
+    for (std::size_t v = 0; v < n; ++v)
+    {
+        const std::size_t start = graph.offsets[v];
+        graph.offsets[v] = total;
+
+        std::copy(graph.targets.begin() + start, graph.targets.begin() + start + kept[v], graph.targets.begin() + total);
+        std::copy(graph.weights.begin() + start, graph.weights.begin() + start + kept[v], graph.weights.begin() + total);
+
+        total += kept[v];
+    }
+
+    graph.offsets[n] = total;
+    graph.targets.resize(total);
+    graph.weights.resize(total);
+    graph.targets.shrink_to_fit();
+    graph.weights.shrink_to_fit();
+
+    return graph;
+}
+
+
+// Each bucket may hold a pair more than once, or hold a pair whose distance
+// has since dropped into an earlier bucket; such "stale" entries are simply
+// skipped when the bucket is processed.  Improvements found while relaxing
+// edges in parallel are collected per chunk and added to the buckets
+// afterward, so the buckets themselves are only ever changed by one thread.
+//
+// Relaxing an edge from the current bucket can only reach a bucket at most
+// (longest edge / delta) + 1 further along, so that many buckets (plus one
+// to spare for rounding) are all that can ever be nonempty at once.  The
+// buckets are kept in a ring of that size, with bucket b stored in slot
+// b % slots, rather than in a vector as long as the largest distance
+// divided by delta.
+
+inline std::vector<double> shortestPathDistances(
+    const NeighborGraph& graph, const std::vector<std::size_t>& sources,
+    double delta, ThreadPool& pool)
+{
+    using namespace NeighborGraphImpl;
+
+    constexpr std::size_t pairsPerChunk = 256;
+
+    const std::size_t n = graph.vertexCount();
+    const std::size_t pairCount = sources.size() * n;
+
+    if (!(delta > 0.0))
+    {
+        double total = 0.0;
+
+        for (double weight : graph.weights)
+        {
+            total += weight;
+        }
+
+        delta = graph.weights.empty() ? 1.0 : std::max(total / static_cast<double>(graph.weights.size()), 1e-300);
+    }
+
+    double longestEdge = 0.0;
+
+    for (double weight : graph.weights)
+    {
+        longestEdge = std::max(longestEdge, weight);
+    }
+
+    if (longestEdge / delta > static_cast<double>(graph.weights.size()))
+    {
+        throw std::invalid_argument{"delta is too small for the graph's edge lengths"};
+    }
+
+    const std::size_t slots = static_cast<std::size_t>(longestEdge / delta) + 3;
+
+    std::vector<std::atomic<double>> distances(pairCount);
+
+    for (std::atomic<double>& distance : distances)
+    {
+        distance.store(std::numeric_limits<double>::infinity(), std::memory_order_relaxed);
+    }
+
+    std::vector<std::vector<std::size_t>> buckets(slots);
+    std::size_t queued = 0;
+
+    auto bucketOf =
+        [delta](double distance)
+        {
+            return static_cast<std::size_t>(distance / delta);
+        };
+
+    auto addToBucket =
+        [&](std::size_t pair, double distance)
+        {
+            buckets[bucketOf(distance) % slots].push_back(pair);
+            ++queued;
+        };
+
+    for (std::size_t s = 0; s < sources.size(); ++s)
+    {
+        if (sources[s] >= n)
+        {
+            throw std::out_of_range{"shortest path source is not a vertex"};
+        }
+
+        distances[s * n + sources[s]].store(0.0, std::memory_order_relaxed);
+        addToBucket(s * n + sources[s], 0.0);
+    }
+
+    // relax() relaxes the light or heavy edges of the given pairs, in
+    // parallel, then adds the pairs whose distances improved to buckets.
+    auto relax =
+        [&](const std::vector<std::size_t>& pairs, bool light)
+        {
+            const std::size_t chunkCount = (pairs.size() + pairsPerChunk - 1) / pairsPerChunk;
+            std::vector<std::vector<std::pair<std::size_t, double>>> improved(chunkCount);
+
+            pool.parallelFor(
+                0, chunkCount, 1,
+                [&](std::size_t firstChunk, std::size_t lastChunk)
+                {
+                    for (std::size_t chunk = firstChunk; chunk < lastChunk; ++chunk)
+                    {
+                        const std::size_t end = std::min(pairs.size(), (chunk + 1) * pairsPerChunk);
+
+                        for (std::size_t i = chunk * pairsPerChunk; i < end; ++i)
+                        {
+                            const std::size_t pair = pairs[i];
+                            const std::size_t base = pair - pair % n;
+                            const std::size_t v = pair % n;
+                            const double here = distances[pair].load(std::memory_order_relaxed);
+
+                            for (std::size_t e = graph.offsets[v]; e < graph.offsets[v + 1]; ++e)
+                            {
+                                if ((graph.weights[e] <= delta) != light)
+                                {
+                                    continue;
+                                }
+
+                                const double there = here + graph.weights[e];
+
+                                if (lowerTo(distances[base + graph.targets[e]], there))
+                                {
+                                    improved[chunk].emplace_back(base + graph.targets[e], there);
+                                }
+                            }
+                        }
+                    }
+                });
+
+            for (const std::vector<std::pair<std::size_t, double>>& chunk : improved)
+            {
+                for (const std::pair<std::size_t, double>& entry : chunk)
+                {
+                    // Only the entry with the pair's final distance this
+                    // round matters; the others would be stale.
+                    if (distances[entry.first].load(std::memory_order_relaxed) == entry.second)
+                    {
+                        addToBucket(entry.first, entry.second);
+                    }
+                }
+            }
+        };
+
+    std::vector<std::size_t> frontier;
+    std::vector<std::size_t> settled;
+
+    for (std::size_t current = 0; queued > 0; ++current)
+    {
+        std::vector<std::size_t>& bucket = buckets[current % slots];
+        settled.clear();
+
+        while (!bucket.empty())
+        {
+            frontier.clear();
+            frontier.swap(bucket);
+            queued -= frontier.size();
+
+            std::sort(frontier.begin(), frontier.end());
+            frontier.erase(std::unique(frontier.begin(), frontier.end()), frontier.end());
+
+            frontier.erase(
+                std::remove_if(
+                    frontier.begin(), frontier.end(),
+                    [&](std::size_t pair)
+                    {
+                        return bucketOf(distances[pair].load(std::memory_order_relaxed)) != current;
+                    }),
+                frontier.end());
+
+            settled.insert(settled.end(), frontier.begin(), frontier.end());
+            relax(frontier, true);
+        }
+
+        std::sort(settled.begin(), settled.end());
+        settled.erase(std::unique(settled.begin(), settled.end()), settled.end());
+        relax(settled, false);
+    }
+
+    std::vector<double> result(pairCount);
+
+    for (std::size_t i = 0; i < pairCount; ++i)
+    {
+        result[i] = distances[i].load(std::memory_order_relaxed);
+    }
+
+    return result;
+}
+
+
+inline std::vector<double> shortestPathDistances(
+    const NeighborGraph& graph, std::size_t source, double delta, ThreadPool& pool)
+{
+    return shortestPathDistances(graph, std::vector<std::size_t>{source}, delta, pool);
+}
+
+
+
+#endif // NEIGHBORGRAPH_HPP
+
@@ -0,0 +1,498 @@
+// NumaPointStore.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a class template called
+// NumaPointStore, which splits a set of points into one partition per NUMA
+// node (see NumaTopology.hpp), keeps each partition's points and k-d tree
+// in that node's memory, gives each node its own ThreadPool whose workers
+// are pinned to that node's CPUs, and sends work about each partition to
+// the pool of the node that owns it.  The result is that threads scanning
+// or searching the points almost always read memory attached to their own
+// socket, rather than reaching across to the other one.
+//
+// The partitions are made with partitionPoints() (see PointPartition.hpp),
+// so each one is a compact region of space.  That matters for queries: a
+// query is first answered by the node whose partition is nearest to the
+// query point (usually the one containing it), and then only by the other
+// nodes whose partitions are close enough to hold something better, which
+// on a two-socket machine is rarely either of them.
+//
+// Each partition's points live in memory mapped just for them, which is
+// placed in one of two ways:
+//
+// * NumaPlacement::FirstTouch relies on Linux's default policy of putting
+//   each page on the node of the CPU that first touches it.  The points are
+//   copied in by the owning node's own workers, so their pages land there.
+// * NumaPlacement::Bind additionally calls bindMemoryToNode() before the
+//   copy, so the pages are placed on the node even if the operating system
+//   would have done otherwise; it throws if the system doesn't allow that.
+//
+// The partition's k-d tree is built over that same memory, rearranging the
+// points in place rather than copying them (see KdTree.hpp), so scans and
+// queries read the same, placed, copy of the points, and each point is
+// stored only once.  The rest of the tree -- its nodes and the points'
+// indexes, which are much smaller -- is built by one of the node's
+// workers, so first-touch places it on that node, too, although Bind
+// doesn't apply to it.  The points' memory can also use huge pages (see
+// MappedRegion.hpp).
+
+#ifndef NUMAPOINTSTORE_HPP
+#define NUMAPOINTSTORE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <future>
+#include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+#include "KdTree.hpp"
+#include "MappedRegion.hpp"
+#include "NumaTopology.hpp"
+#include "Point.hpp"
+#include "PointPartition.hpp"
+#include "ThreadPool.hpp"
+
+
+
+enum class NumaPlacement
+{
+    FirstTouch,
+    Bind
+};
+
+
+struct NumaPointStoreOptions
+{
+    NumaPlacement placement = NumaPlacement::FirstTouch;
+    HugePages hugePages = HugePages::None;
+    PartitionScheme scheme = PartitionScheme::KdSplits;
+    std::size_t leafSize = 16;
+    KdTreeLayout layout = KdTreeLayout::DepthFirst;
+};
+
+
+
+template <typename CoordinateType>
+class NumaPointStore
+{
+public:
+    explicit NumaPointStore(
+        const std::vector<Point<CoordinateType>>& points,
+        const NumaTopology& topology = NumaTopology::detect(),
+        const NumaPointStoreOptions& options = NumaPointStoreOptions{});
+
+    NumaPointStore(const NumaPointStore&) = delete;
+    NumaPointStore& operator=(const NumaPointStore&) = delete;
+
+
+    // There's one partition per node of the topology; partition i belongs
+    // to node i.
+    std::size_t partitionCount() const;
+    const NumaTopology& topology() const;
+
+
+    // These functions give access to one node's partition: its points,
+    // their bounds and indexes among the original points, its k-d tree,
+    // and the pool of threads pinned to its node.  The points are in the
+    // tree's order, so the point at position p is the original point
+    // partition(node).indexes[tree(node).indexAt(p)].
+    const Point<CoordinateType>* points(std::size_t node) const;
+    std::size_t size(std::size_t node) const;
+    const PointShard& partition(std::size_t node) const;
+    const KdTree<CoordinateType>& tree(std::size_t node) const;
+    ThreadPool& pool(std::size_t node);
+
+
+    // scan() calls function(node, points, count, first) for consecutive
+    // chunks of at most grainSize points of every partition, where points
+    // is the chunk's first point and first is its position within its
+    // partition.  Each partition's chunks are run by its own node's pool,
+    // and all of the nodes work at once.
+    template <typename Function>
+    void scan(std::size_t grainSize, Function function);
+
+
+    // nearest() and withinRadius() answer a batch of queries, returning one
+    // result per query, in the same order.  Results are identified by the
+    // original points' indexes, closest first.
+    std::vector<std::vector<PointNeighbor>> nearest(
+        const std::vector<Point<CoordinateType>>& queries, std::size_t k);
+
+    std::vector<std::vector<PointNeighbor>> withinRadius(
+        const std::vector<Point<CoordinateType>>& queries, double radius);
+
+
+private:
+    struct Partition
+    {
+        PointShard shard;
+        MappedRegion memory;
+        std::unique_ptr<KdTree<CoordinateType>> tree;
+        std::unique_ptr<ThreadPool> pool;
+    };
+
+    template <typename Function>
+    void onEachNode(Function function);
+
+    template <typename Search, typename Bound>
+    std::vector<std::vector<PointNeighbor>> route(
+        const std::vector<Point<CoordinateType>>& queries,
+        bool homeFirst, std::size_t keep, Search search, Bound bound);
+
+    NumaTopology topology_;
+    std::vector<Partition> partitions_;
+};
+
+
+
+namespace NumaPointStoreImpl
+{
+    template <typename CoordinateType>
+    Point<double> toDouble(const Point<CoordinateType>& point)
+    {
+        return Point<double>{
+            static_cast<double>(point.x()),
+            static_cast<double>(point.y()),
+            static_cast<double>(point.z())};
+    }
+
+
+    inline bool closer(const PointNeighbor& a, const PointNeighbor& b)
+    {
+        return a.distance < b.distance;
+    }
+
+
+    // This many queries (or points) is handed to a thread at a time.
+    constexpr std::size_t queryGrain = 64;
+    constexpr std::size_t copyGrain = 64 * 1024;
+}
+
+
+
+// Everything about a partition is set up by its own node's pool, so that
+// the memory each one touches first is the memory it'll be reading later.
+
+template <typename CoordinateType>
+NumaPointStore<CoordinateType>::NumaPointStore(
+    const std::vector<Point<CoordinateType>>& points, const NumaTopology& topology,
+    const NumaPointStoreOptions& options)
+    : topology_{topology}
+{
+    static_assert(
+        std::is_trivially_copyable<Point<CoordinateType>>::value,
+        "points must be trivially copyable to live in mapped memory");
+
+    PointPartition partition = partitionPoints(points, topology_.nodeCount(), options.scheme);
+
+    partitions_.resize(topology_.nodeCount());
+
+    for (std::size_t node = 0; node < partitions_.size(); ++node)
+    {
+        partitions_[node].shard = std::move(partition.shards[node]);
+        partitions_[node].pool = std::make_unique<ThreadPool>(topology_.node(node).cpus);
+    }
+
+    onEachNode(
+        [&](std::size_t node)
+        {
+            Partition& part = partitions_[node];
+            const std::vector<std::size_t>& indexes = part.shard.indexes;
+
+            const std::size_t bytes = std::max<std::size_t>(indexes.size(), 1) * sizeof(Point<CoordinateType>);
+            part.memory = MappedRegion::anonymous(bytes, PROT_READ | PROT_WRITE, options.hugePages);
+
+            if (options.placement == NumaPlacement::Bind)
+            {
+                bindMemoryToNode(part.memory.data(), bytes, topology_.node(node).id);
+            }
+
+            Point<CoordinateType>* destination = static_cast<Point<CoordinateType>*>(part.memory.data());
+
+            part.pool->parallelFor(
+                0, indexes.size(), NumaPointStoreImpl::copyGrain,
+                [&](std::size_t begin, std::size_t end)
+                {
+                    for (std::size_t i = begin; i < end; ++i)
+                    {
+                        new (destination + i) Point<CoordinateType>{points[indexes[i]]};
+                    }
+                });
+
+            part.tree = std::make_unique<KdTree<CoordinateType>>(
+                destination, indexes.size(), options.leafSize, options.layout);
+        });
+}
+
+
+template <typename CoordinateType>
+std::size_t NumaPointStore<CoordinateType>::partitionCount() const
+{
+    return partitions_.size();
+}
+
+
+template <typename CoordinateType>
+const NumaTopology& NumaPointStore<CoordinateType>::topology() const
+{
+    return topology_;
+}
+
+
+template <typename CoordinateType>
+const Point<CoordinateType>* NumaPointStore<CoordinateType>::points(std::size_t node) const
+{
+    return static_cast<const Point<CoordinateType>*>(partitions_.at(node).memory.data());
+}
+
+
+template <typename CoordinateType>
+std::size_t NumaPointStore<CoordinateType>::size(std::size_t node) const
+{
+    return partitions_.at(node).shard.indexes.size();
+}
+
+
+template <typename CoordinateType>
+const PointShard& NumaPointStore<CoordinateType>::partition(std::size_t node) const
+{
+    return partitions_.at(node).shard;
+}
+
+
+template <typename CoordinateType>
+const KdTree<CoordinateType>& NumaPointStore<CoordinateType>::tree(std::size_t node) const
+{
+    return *partitions_.at(node).tree;
+}
+
+
+template <typename CoordinateType>
+ThreadPool& NumaPointStore<CoordinateType>::pool(std::size_t node)
+{
+    return *partitions_.at(node).pool;
+}
+
+
+// onEachNode() runs function(node) as a task on each node's pool, and
+// waits for all of them.  Each task can then use parallelFor() on its own
+// pool to spread its work across its node's CPUs.
+
+template <typename CoordinateType>
+template <typename Function>
+void NumaPointStore<CoordinateType>::onEachNode(Function function)
+{
+    std::vector<std::future<void>> done;
+
+    for (std::size_t node = 0; node < partitions_.size(); ++node)
+    {
+        done.push_back(partitions_[node].pool->submit([&function, node] { function(node); }));
+    }
+
+    for (std::future<void>& result : done)
+    {
+        result.wait();
+    }
+
+    for (std::future<void>& result : done)
+    {
+        result.get();
+    }
+}
+
+
+template <typename CoordinateType>
+template <typename Function>
+void NumaPointStore<CoordinateType>::scan(std::size_t grainSize, Function function)
+{
+    onEachNode(
+        [&](std::size_t node)
+        {
+            const Point<CoordinateType>* nodePoints = points(node);
+
+            partitions_[node].pool->parallelFor(
+                0, size(node), grainSize,
+                [&](std::size_t begin, std::size_t end)
+                {
+                    function(node, nodePoints + begin, end - begin, begin);
+                });
+        });
+}
+
+
+template <typename CoordinateType>
+std::vector<std::vector<PointNeighbor>> NumaPointStore<CoordinateType>::nearest(
+    const std::vector<Point<CoordinateType>>& queries, std::size_t k)
+{
+    if (k == 0)
+    {
+        return std::vector<std::vector<PointNeighbor>>(queries.size());
+    }
+
+    return route(
+        queries, true, k,
+        [k](const KdTree<CoordinateType>& tree, const Point<CoordinateType>& query)
+        {
+            return tree.nearest(query, k);
+        },
+        [k](const std::vector<PointNeighbor>& found)
+        {
+            return found.size() < k
+                ? std::numeric_limits<double>::infinity()
+                : std::nextafter(found[k - 1].distance * found[k - 1].distance, 0.0);
+        });
+}
+
+
+template <typename CoordinateType>
+std::vector<std::vector<PointNeighbor>> NumaPointStore<CoordinateType>::withinRadius(
+    const std::vector<Point<CoordinateType>>& queries, double radius)
+{
+    return route(
+        queries, false, std::numeric_limits<std::size_t>::max(),
+        [radius](const KdTree<CoordinateType>& tree, const Point<CoordinateType>& query)
+        {
+            return tree.withinRadius(query, radius);
+        },
+        [radius](const std::vector<PointNeighbor>&)
+        {
+            return radius * radius;
+        });
+}
+
+
+// route() answers queries in two steps.  If homeFirst is true, each query
+// is first answered by the node whose partition is nearest to it, and
+// bound() then says, given what that found, how near (squared) another
+// partition must be to be worth searching; otherwise, bound() alone
+// decides.  Each node searches its own partition for the queries sent to
+// it, so the trees are only ever read by their own nodes' CPUs; the
+// results are then combined, keeping the closest "keep" of them.
+
+template <typename CoordinateType>
+template <typename Search, typename Bound>
+std::vector<std::vector<PointNeighbor>> NumaPointStore<CoordinateType>::route(
+    const std::vector<Point<CoordinateType>>& queries,
+    bool homeFirst, std::size_t keep, Search search, Bound bound)
+{
+    const std::size_t nodeCount = partitions_.size();
+    std::vector<std::vector<PointNeighbor>> results(queries.size());
+
+    std::vector<double> squaredDistances(queries.size() * nodeCount);
+    std::vector<std::vector<std::size_t>> sent(nodeCount);
+
+    for (std::size_t q = 0; q < queries.size(); ++q)
+    {
+        const Point<double> query = NumaPointStoreImpl::toDouble(queries[q]);
+        std::size_t home = 0;
+
+        for (std::size_t node = 0; node < nodeCount; ++node)
+        {
+            double& squaredDistance = squaredDistances[q * nodeCount + node];
+            squaredDistance = squaredDistanceToShard(query, partitions_[node].shard);
+
+            if (squaredDistance < squaredDistances[q * nodeCount + home])
+            {
+                home = node;
+            }
+        }
+
+        if (homeFirst)
+        {
+            sent[home].push_back(q);
+        }
+    }
+
+    std::vector<std::vector<std::vector<PointNeighbor>>> found(nodeCount);
+
+    auto searchSent =
+        [&](std::size_t node)
+        {
+            const Partition& part = partitions_[node];
+            found[node].assign(sent[node].size(), {});
+
+            part.pool->parallelFor(
+                0, sent[node].size(), NumaPointStoreImpl::queryGrain,
+                [&](std::size_t begin, std::size_t end)
+                {
+                    for (std::size_t i = begin; i < end; ++i)
+                    {
+                        std::vector<PointNeighbor> neighbors = search(*part.tree, queries[sent[node][i]]);
+
+                        for (PointNeighbor& neighbor : neighbors)
+                        {
+                            neighbor.index = part.shard.indexes[neighbor.index];
+                        }
+
+                        found[node][i] = std::move(neighbors);
+                    }
+                });
+        };
+
+    if (homeFirst)
+    {
+        onEachNode(searchSent);
+
+        for (std::size_t node = 0; node < nodeCount; ++node)
+        {
+            for (std::size_t i = 0; i < sent[node].size(); ++i)
+            {
+                results[sent[node][i]] = std::move(found[node][i]);
+            }
+        }
+    }
+
+    std::vector<bool> searched(nodeCount * queries.size(), false);
+
+    for (std::size_t node = 0; node < nodeCount; ++node)
+    {
+        for (std::size_t q : sent[node])
+        {
+            searched[q * nodeCount + node] = true;
+        }
+
+        sent[node].clear();
+    }
+
+    for (std::size_t q = 0; q < queries.size(); ++q)
+    {
+        const double limit = bound(results[q]);
+
+        for (std::size_t node = 0; node < nodeCount; ++node)
+        {
+            if (!searched[q * nodeCount + node] && squaredDistances[q * nodeCount + node] <= limit)
+            {
+                sent[node].push_back(q);
+            }
+        }
+    }
+
+    onEachNode(searchSent);
+
+    for (std::size_t node = 0; node < nodeCount; ++node)
+    {
+        for (std::size_t i = 0; i < sent[node].size(); ++i)
+        {
+            std::vector<PointNeighbor>& result = results[sent[node][i]];
+            const std::size_t oldSize = result.size();
+
+            result.insert(result.end(), found[node][i].begin(), found[node][i].end());
+            std::inplace_merge(
+                result.begin(), result.begin() + oldSize, result.end(), NumaPointStoreImpl::closer);
+
+            result.resize(std::min(result.size(), keep));
+        }
+    }
+
+    return results;
+}
+
+
+
+#endif // NUMAPOINTSTORE_HPP
+
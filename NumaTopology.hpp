@@ -0,0 +1,318 @@
+// NumaTopology.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a class called NumaTopology, which
+// describes which CPUs belong to which NUMA node of the machine we're
+// running on, and a function that asks the operating system to keep a
+// range of memory on a particular node.
+//
+// On a machine with more than one processor socket, each socket has its
+// own memory attached to it.  Every CPU can read every byte of memory, but
+// reading memory attached to another socket (a "remote" node) has to cross
+// the link between the sockets, which is slower and has less bandwidth
+// than reading local memory -- this is what "NUMA" (non-uniform memory
+// access) means.  A program that scans large arrays runs fastest when each
+// thread scans memory on its own node, which takes two things:
+//
+// * Knowing which CPUs are on which node, so that threads can be pinned to
+//   the CPUs of the node whose memory they'll read.  That's what
+//   NumaTopology provides, by reading /sys/devices/system/node.
+// * Getting memory onto the node we want.  By default, Linux puts a page
+//   on the node of the CPU that first touches it ("first-touch"), so memory
+//   filled in by a node's threads usually ends up on that node.
+//   bindMemoryToNode() makes that explicit, using the mbind() system call,
+//   so that the pages land on the node no matter who touches them first.
+//
+// We make the mbind() system call directly, rather than through libnuma,
+// so that nothing more than the C library is needed.  On a machine (or in a
+// container) without NUMA support, NumaTopology reports a single node
+// holding every CPU we're allowed to run on, which makes everything built
+// on it behave sensibly, just without any benefit.
+
+#ifndef NUMATOPOLOGY_HPP
+#define NUMATOPOLOGY_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+
+struct NumaNode
+{
+    // The operating system's number for the node.
+    int id;
+
+    // The CPUs on this node that we're allowed to run on.
+    std::vector<unsigned int> cpus;
+};
+
+
+
+class NumaTopology
+{
+public:
+    // A NumaTopology can be built from a list of nodes, which is mostly
+    // useful for testing (pretending that one node's CPUs are split into
+    // several nodes, say); there must be at least one, and every node must
+    // have at least one CPU.
+    explicit NumaTopology(std::vector<NumaNode> nodes);
+
+
+    // detect() finds out the layout of the machine we're running on.  Nodes
+    // without any CPUs we're allowed to run on (such as memory-only nodes)
+    // are left out.
+    static NumaTopology detect();
+
+
+    std::size_t nodeCount() const;
+    const NumaNode& node(std::size_t index) const;
+
+
+    // nodeOfCpu() returns the index of the node that a CPU belongs to, or
+    // nodeCount() if it's not on any of them.  currentNode() returns the
+    // index of the node that the calling thread is running on right now.
+    std::size_t nodeOfCpu(unsigned int cpu) const;
+    std::size_t currentNode() const;
+
+
+private:
+    std::vector<NumaNode> nodes_;
+};
+
+
+
+// bindMemoryToNode() asks that the pages of the given range of memory be
+// placed on the node with the given operating system number, moving any
+// that have already been touched.  The range is widened to whole pages.
+// It throws a std::system_error if the operating system refuses, which it
+// will if it has no NUMA support (or the process isn't allowed to use it).
+void bindMemoryToNode(void* data, std::size_t length, int nodeId);
+
+
+
+namespace NumaTopologyImpl
+{
+    // These come from the Linux kernel's <linux/mempolicy.h>.
+    constexpr int bindPolicy = 2;            // MPOL_BIND
+    constexpr unsigned int moveFlag = 1 << 1;  // MPOL_MF_MOVE
+
+
+    // A "CPU list" in /sys is a comma-separated list of numbers and ranges,
+    // like "0-7,16-23".
+
+    inline std::vector<unsigned int> parseCpuList(const std::string& text)
+    {
+        std::vector<unsigned int> cpus;
+        std::istringstream in{text};
+        std::string item;
+
+        while (std::getline(in, item, ','))
+        {
+            if (item.empty() || item == "\n")
+            {
+                continue;
+            }
+
+            const std::size_t dash = item.find('-');
+            const unsigned long first = std::stoul(item.substr(0, dash));
+            const unsigned long last = dash == std::string::npos ? first : std::stoul(item.substr(dash + 1));
+
+            for (unsigned long cpu = first; cpu <= last; ++cpu)
+            {
+                cpus.push_back(static_cast<unsigned int>(cpu));
+            }
+        }
+
+        return cpus;
+    }
+
+
+    inline bool readLine(const std::string& path, std::string& line)
+    {
+        std::ifstream in{path};
+        return static_cast<bool>(std::getline(in, line));
+    }
+
+
+    inline std::vector<unsigned int> allowedCpus()
+    {
+        std::vector<unsigned int> cpus;
+        cpu_set_t allowed;
+
+        if (::sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+        {
+            for (unsigned int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            {
+                if (CPU_ISSET(cpu, &allowed))
+                {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+
+        if (cpus.empty())
+        {
+            const unsigned int count = std::max(std::thread::hardware_concurrency(), 1u);
+
+            for (unsigned int cpu = 0; cpu < count; ++cpu)
+            {
+                cpus.push_back(cpu);
+            }
+        }
+
+        return cpus;
+    }
+}
+
+
+
+inline NumaTopology::NumaTopology(std::vector<NumaNode> nodes)
+    : nodes_{std::move(nodes)}
+{
+    if (nodes_.empty())
+    {
+        throw std::invalid_argument{"a NUMA topology needs at least one node"};
+    }
+
+    for (const NumaNode& node : nodes_)
+    {
+        if (node.cpus.empty())
+        {
+            throw std::invalid_argument{"every NUMA node needs at least one CPU"};
+        }
+    }
+}
+
+
+inline NumaTopology NumaTopology::detect()
+{
+    const std::vector<unsigned int> allowed = NumaTopologyImpl::allowedCpus();
+    std::vector<NumaNode> nodes;
+    std::string online;
+
+    if (NumaTopologyImpl::readLine("/sys/devices/system/node/online", online))
+    {
+        for (unsigned int id : NumaTopologyImpl::parseCpuList(online))
+        {
+            std::string cpuList;
+
+            if (!NumaTopologyImpl::readLine(
+                    "/sys/devices/system/node/node" + std::to_string(id) + "/cpulist", cpuList))
+            {
+                continue;
+            }
+
+            NumaNode node{static_cast<int>(id), {}};
+
+            for (unsigned int cpu : NumaTopologyImpl::parseCpuList(cpuList))
+            {
+                if (std::binary_search(allowed.begin(), allowed.end(), cpu))
+                {
+                    node.cpus.push_back(cpu);
+                }
+            }
+
+            if (!node.cpus.empty())
+            {
+                nodes.push_back(std::move(node));
+            }
+        }
+    }
+
+    if (nodes.empty())
+    {
+        nodes.push_back(NumaNode{0, allowed});
+    }
+
+    return NumaTopology{std::move(nodes)};
+}
+
+
+inline std::size_t NumaTopology::nodeCount() const
+{
+    return nodes_.size();
+}
+
+
+inline const NumaNode& NumaTopology::node(std::size_t index) const
+{
+    return nodes_.at(index);
+}
+
+
+inline std::size_t NumaTopology::nodeOfCpu(unsigned int cpu) const
+{
+    for (std::size_t i = 0; i < nodes_.size(); ++i)
+    {
+        if (std::find(nodes_[i].cpus.begin(), nodes_[i].cpus.end(), cpu) != nodes_[i].cpus.end())
+        {
+            return i;
+        }
+    }
+
+    return nodes_.size();
+}
+
+
+inline std::size_t NumaTopology::currentNode() const
+{
+    const int cpu = ::sched_getcpu();
+    return cpu < 0 ? nodes_.size() : nodeOfCpu(static_cast<unsigned int>(cpu));
+}
+
+
+// The kernel's node mask is an array of unsigned longs, one bit per node.
+// For historical reasons, mbind() ignores the last bit of the count of
+// bits it's given, so we pass one more than we need.
+
+inline void bindMemoryToNode(void* data, std::size_t length, int nodeId)
+{
+    if (nodeId < 0)
+    {
+        throw std::invalid_argument{"NUMA node numbers can't be negative"};
+    }
+
+    if (length == 0)
+    {
+        return;
+    }
+
+    const std::uintptr_t pageSize = static_cast<std::uintptr_t>(::sysconf(_SC_PAGESIZE));
+    const std::uintptr_t begin = reinterpret_cast<std::uintptr_t>(data) & ~(pageSize - 1);
+    const std::uintptr_t end =
+        (reinterpret_cast<std::uintptr_t>(data) + length + pageSize - 1) & ~(pageSize - 1);
+
+    const std::size_t bitsPerWord = 8 * sizeof(unsigned long);
+    const std::size_t node = static_cast<std::size_t>(nodeId);
+
+    std::vector<unsigned long> mask(node / bitsPerWord + 1, 0);
+    mask[node / bitsPerWord] |= 1ul << (node % bitsPerWord);
+
+    const long result = ::syscall(
+        SYS_mbind, begin, end - begin, NumaTopologyImpl::bindPolicy,
+        mask.data(), mask.size() * bitsPerWord + 1, NumaTopologyImpl::moveFlag);
+
+    if (result != 0)
+    {
+        throw std::system_error{errno, std::generic_category(), "mbind"};
+    }
+}
+
+
+
+#endif // NUMATOPOLOGY_HPP
+
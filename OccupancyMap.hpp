@@ -0,0 +1,637 @@
+// OccupancyMap.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a class called OccupancyMap, which
+// keeps track of which parts of space are occupied, which are known to be
+// empty ("free"), and which haven't been observed, built up from a series of
+// scans made by a sensor that measures points.
+//
+// Each scan tells us two things.  When the sensor measures a point, there's
+// something at that point, so the space there is occupied.  And the sensor's
+// beam traveled from the sensor to that point without hitting anything, so
+// the space along the way is free.  Sensors aren't perfect, so rather than
+// believing each scan completely, an occupancy map keeps, for each small
+// cube of space (a "voxel"), a running estimate of the probability that
+// it's occupied.  That estimate is stored as "log-odds" -- log(p / (1 - p))
+// -- because then each observation simply adds a constant: a positive one
+// for a hit, a negative one for a miss.  A voxel that's never been observed
+// is unknown; one with positive log-odds is occupied, and one with negative
+// log-odds is free.  The log-odds are clamped to a range, so that a voxel
+// that's been observed many times can still change its mind reasonably
+// quickly if the world changes.
+//
+// The voxels are grouped into blocks of 8x8x8, and only the blocks that
+// have been observed are stored, in a hash table keyed by their position,
+// in the spirit of OpenVDB.  If the number of blocks would exceed a limit,
+// the ones that were least recently updated are forgotten, so memory stays
+// bounded however long the robot keeps exploring.
+//
+// integrate() adds a scan.  The voxels along each beam are found with a
+// "3D DDA" (digital differential analyzer), which steps from one voxel to
+// the next exactly where the beam crosses a voxel boundary.  Beams are
+// traced in parallel, in chunks; each chunk records which voxels its beams
+// passed through and which ones they ended in as two bitmaps per block,
+// so that a voxel crossed by many beams is recorded once, not once per
+// beam.  The chunks' bitmaps are then combined, and each voxel is updated
+// once per scan (a voxel that any beam ends in counts as a hit, even if
+// other beams pass through it), with different blocks updated in parallel,
+// without locking.
+
+#ifndef OCCUPANCYMAP_HPP
+#define OCCUPANCYMAP_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "Point.hpp"
+#include "ThreadPool.hpp"
+
+
+
+enum class Occupancy
+{
+    Unknown,
+    Free,
+    Occupied
+};
+
+
+
+struct OccupancyMapOptions
+{
+    // The length of each side of a voxel.
+    double voxelSize = 0.1;
+
+    // How much log-odds a hit adds and a miss subtracts (that is, a miss
+    // adds missLogOdds, which is negative), and the range the log-odds
+    // are clamped to.
+    float hitLogOdds = 0.85f;
+    float missLogOdds = -0.4f;
+    float minimumLogOdds = -2.0f;
+    float maximumLogOdds = 3.5f;
+
+    // Beams longer than maximumRange are cut off there; their end is
+    // treated as free space, not a hit.
+    double maximumRange = std::numeric_limits<double>::infinity();
+
+    // The most blocks the map will keep.
+    std::size_t maximumBlocks = std::numeric_limits<std::size_t>::max();
+};
+
+
+
+class OccupancyMap
+{
+public:
+    explicit OccupancyMap(const OccupancyMapOptions& options = OccupancyMapOptions{});
+
+
+    // integrate() adds a scan, made by a sensor at origin, of the given
+    // points.
+    template <typename CoordinateType>
+    void integrate(
+        const Point<double>& origin, const std::vector<Point<CoordinateType>>& points,
+        ThreadPool& pool = defaultThreadPool());
+
+
+    // occupancyAt() says whether the voxel containing a location is free,
+    // occupied, or unknown; isOccupied() and isFree() answer one of those
+    // questions.  logOddsAt() returns the voxel's log-odds, which is zero
+    // if it's unknown.  These can be called from many threads at once, as
+    // long as integrate() isn't running.
+    template <typename CoordinateType>
+    Occupancy occupancyAt(const Point<CoordinateType>& location) const;
+
+    template <typename CoordinateType>
+    bool isOccupied(const Point<CoordinateType>& location) const;
+
+    template <typename CoordinateType>
+    bool isFree(const Point<CoordinateType>& location) const;
+
+    template <typename CoordinateType>
+    float logOddsAt(const Point<CoordinateType>& location) const;
+
+
+    std::size_t blockCount() const;
+    const OccupancyMapOptions& options() const;
+
+
+private:
+    static constexpr std::int64_t blockWidth = 8;
+    static constexpr std::int64_t voxelsPerBlock = blockWidth * blockWidth * blockWidth;
+
+    // A voxel's log-odds is NaN if it's unknown.
+    struct Block
+    {
+        std::uint64_t key;
+        std::uint64_t lastUpdated;
+        float logOdds[voxelsPerBlock];
+    };
+
+    template <typename CoordinateType>
+    bool voxelOf(const Point<CoordinateType>& location, std::int64_t voxel[3]) const;
+
+    const float* find(const std::int64_t voxel[3]) const;
+    void evict();
+
+    OccupancyMapOptions options_;
+    std::uint64_t scanCount_;
+    std::vector<std::unique_ptr<Block>> blocks_;
+    std::unordered_map<std::uint64_t, std::size_t> blockIndexes_;
+};
+
+
+
+namespace OccupancyMapImpl
+{
+    // A block is identified by a 64-bit key: its coordinates, offset so
+    // that they're never negative and packed into 18 bits each.  That
+    // limits the map to about a million voxels in each direction from the
+    // origin.
+    constexpr unsigned int blockBits = 18;
+    constexpr std::int64_t blockOffset = std::int64_t{1} << (blockBits - 1);
+    constexpr std::int64_t voxelLimit = blockOffset * 8;
+
+
+    inline std::uint64_t blockKeyOf(const std::int64_t voxel[3])
+    {
+        std::uint64_t key = 0;
+
+        for (unsigned int axis = 0; axis < 3; ++axis)
+        {
+            key = (key << blockBits)
+                | static_cast<std::uint64_t>((voxel[axis] >> 3) + blockOffset);
+        }
+
+        return key;
+    }
+
+
+    inline unsigned int slotOf(const std::int64_t voxel[3])
+    {
+        return static_cast<unsigned int>(
+            (voxel[0] & 7) | ((voxel[1] & 7) << 3) | ((voxel[2] & 7) << 6));
+    }
+
+
+    // A ScanBlock records, for one block, which of its voxels the beams of
+    // one chunk of a scan passed through (misses) and ended in (hits), one
+    // bit per voxel.
+    struct ScanBlock
+    {
+        std::uint64_t misses[8] = {};
+        std::uint64_t hits[8] = {};
+    };
+
+
+    // ScanBlocks is a chunk's collection of ScanBlocks.  Consecutive voxels
+    // along a beam are usually in the same block, so it remembers the last
+    // block it looked up.
+    class ScanBlocks
+    {
+    public:
+        void mark(const std::int64_t voxel[3], bool hit)
+        {
+            const std::uint64_t key = blockKeyOf(voxel);
+
+            if (blocks_.empty() || key != lastKey_)
+            {
+                auto inserted = indexes_.emplace(key, blocks_.size());
+
+                if (inserted.second)
+                {
+                    blocks_.emplace_back(key, ScanBlock{});
+                }
+
+                lastKey_ = key;
+                last_ = &blocks_[inserted.first->second].second;
+            }
+
+            const unsigned int slot = slotOf(voxel);
+            std::uint64_t* bits = hit ? last_->hits : last_->misses;
+            bits[slot >> 6] |= std::uint64_t{1} << (slot & 63);
+        }
+
+        std::vector<std::pair<std::uint64_t, ScanBlock>>& blocks()
+        {
+            return blocks_;
+        }
+
+    private:
+        std::unordered_map<std::uint64_t, std::size_t> indexes_;
+        std::vector<std::pair<std::uint64_t, ScanBlock>> blocks_;
+        std::uint64_t lastKey_ = 0;
+        ScanBlock* last_ = nullptr;
+    };
+
+
+    // traceBeam() marks the voxels a beam from origin to end passes through
+    // as misses, and the one it ends in as a hit if hit is true (or a miss
+    // otherwise).  Everything is in voxel units.
+    // At each step, the DDA moves to whichever neighboring voxel the beam
+    // reaches first; next[axis] is the distance along the beam to the next
+    // boundary along that axis, and step[axis] the distance between them.
+    inline void traceBeam(
+        const double origin[3], const double end[3], bool hit,
+        ScanBlocks& scan)
+    {
+        std::int64_t voxel[3];
+        std::int64_t last[3];
+        std::int64_t direction[3];
+        double next[3];
+        double step[3];
+
+        double length = 0.0;
+
+        for (unsigned int axis = 0; axis < 3; ++axis)
+        {
+            length += (end[axis] - origin[axis]) * (end[axis] - origin[axis]);
+        }
+
+        length = std::sqrt(length);
+
+        for (unsigned int axis = 0; axis < 3; ++axis)
+        {
+            voxel[axis] = static_cast<std::int64_t>(std::floor(origin[axis]));
+            last[axis] = static_cast<std::int64_t>(std::floor(end[axis]));
+
+            const double delta = length > 0.0 ? (end[axis] - origin[axis]) / length : 0.0;
+
+            if (delta > 0.0)
+            {
+                direction[axis] = 1;
+                step[axis] = 1.0 / delta;
+                next[axis] = (static_cast<double>(voxel[axis]) + 1.0 - origin[axis]) * step[axis];
+            }
+            else if (delta < 0.0)
+            {
+                direction[axis] = -1;
+                step[axis] = -1.0 / delta;
+                next[axis] = (origin[axis] - static_cast<double>(voxel[axis])) * step[axis];
+            }
+            else
+            {
+                direction[axis] = 0;
+                step[axis] = std::numeric_limits<double>::infinity();
+                next[axis] = std::numeric_limits<double>::infinity();
+            }
+        }
+
+        // The beam can't cross more boundaries than this, which protects
+        // against rounding leaving it one step short of its last voxel.
+        std::int64_t remaining = 3;
+
+        for (unsigned int axis = 0; axis < 3; ++axis)
+        {
+            remaining += std::abs(last[axis] - voxel[axis]);
+        }
+
+        while (remaining-- > 0
+               && (voxel[0] != last[0] || voxel[1] != last[1] || voxel[2] != last[2]))
+        {
+            scan.mark(voxel, false);
+
+            unsigned int axis = next[0] < next[1] ? 0 : 1;
+            axis = next[2] < next[axis] ? 2 : axis;
+
+            if (next[axis] > length)
+            {
+                break;
+            }
+
+            voxel[axis] += direction[axis];
+            next[axis] += step[axis];
+        }
+
+        scan.mark(last, hit);
+    }
+}
+
+
+
+inline OccupancyMap::OccupancyMap(const OccupancyMapOptions& options)
+    : options_{options}, scanCount_{0}
+{
+    if (!(options.voxelSize > 0.0))
+    {
+        throw std::invalid_argument{"voxel size must be positive"};
+    }
+}
+
+
+template <typename CoordinateType>
+void OccupancyMap::integrate(
+    const Point<double>& origin, const std::vector<Point<CoordinateType>>& points,
+    ThreadPool& pool)
+{
+    using namespace OccupancyMapImpl;
+
+    constexpr std::size_t beamsPerChunk = 1024;
+
+    ++scanCount_;
+
+    const double start[3] = {
+        origin.x() / options_.voxelSize, origin.y() / options_.voxelSize,
+        origin.z() / options_.voxelSize};
+
+    const double range = options_.maximumRange / options_.voxelSize;
+    const double limit = static_cast<double>(voxelLimit - 1);
+
+    for (unsigned int axis = 0; axis < 3; ++axis)
+    {
+        if (!(std::abs(start[axis]) < limit))
+        {
+            throw std::out_of_range{"sensor origin is outside the map"};
+        }
+    }
+
+    const std::size_t chunkCount = (points.size() + beamsPerChunk - 1) / beamsPerChunk;
+    std::vector<ScanBlocks> chunkScans(chunkCount);
+
+    pool.parallelFor(
+        0, chunkCount, 1,
+        [&](std::size_t firstChunk, std::size_t lastChunk)
+        {
+            for (std::size_t chunk = firstChunk; chunk < lastChunk; ++chunk)
+            {
+                const std::size_t begin = chunk * beamsPerChunk;
+                const std::size_t end = std::min(points.size(), begin + beamsPerChunk);
+
+                for (std::size_t i = begin; i < end; ++i)
+                {
+                    double finish[3] = {
+                        static_cast<double>(points[i].x()) / options_.voxelSize,
+                        static_cast<double>(points[i].y()) / options_.voxelSize,
+                        static_cast<double>(points[i].z()) / options_.voxelSize};
+
+                    double length = 0.0;
+
+                    for (unsigned int axis = 0; axis < 3; ++axis)
+                    {
+                        length += (finish[axis] - start[axis]) * (finish[axis] - start[axis]);
+                    }
+
+                    length = std::sqrt(length);
+                    bool hit = true;
+
+                    if (!(length <= range))
+                    {
+                        for (unsigned int axis = 0; axis < 3; ++axis)
+                        {
+                            finish[axis] = start[axis] + (finish[axis] - start[axis]) * (range / length);
+                        }
+
+                        hit = false;
+                    }
+
+                    bool inside = true;
+
+                    for (unsigned int axis = 0; axis < 3; ++axis)
+                    {
+                        inside = inside && std::abs(finish[axis]) < limit;
+                    }
+
+                    if (inside)
+                    {
+                        traceBeam(start, finish, hit, chunkScans[chunk]);
+                    }
+                }
+            }
+        });
+
+    // The chunks' bitmaps are combined into one per block, creating any
+    // blocks the map doesn't have yet (which changes the hash table, so it
+    // isn't done in parallel).
+    std::vector<Block*> scanBlocks;
+    std::vector<ScanBlock> scanBits;
+    std::unordered_map<std::uint64_t, std::size_t> scanIndexes;
+
+    for (ScanBlocks& chunk : chunkScans)
+    {
+        for (const std::pair<std::uint64_t, ScanBlock>& entry : chunk.blocks())
+        {
+            auto scanned = scanIndexes.emplace(entry.first, scanBits.size());
+
+            if (scanned.second)
+            {
+                auto inserted = blockIndexes_.emplace(entry.first, blocks_.size());
+
+                if (inserted.second)
+                {
+                    blocks_.push_back(std::make_unique<Block>());
+                    blocks_.back()->key = entry.first;
+                    std::fill(
+                        std::begin(blocks_.back()->logOdds), std::end(blocks_.back()->logOdds),
+                        std::numeric_limits<float>::quiet_NaN());
+                }
+
+                scanBlocks.push_back(blocks_[inserted.first->second].get());
+                scanBits.push_back(entry.second);
+                continue;
+            }
+
+            ScanBlock& bits = scanBits[scanned.first->second];
+
+            for (unsigned int word = 0; word < 8; ++word)
+            {
+                bits.misses[word] |= entry.second.misses[word];
+                bits.hits[word] |= entry.second.hits[word];
+            }
+        }
+
+        chunk = ScanBlocks{};
+    }
+
+    pool.parallelFor(
+        0, scanBlocks.size(), 16,
+        [&](std::size_t first, std::size_t last)
+        {
+            for (std::size_t b = first; b < last; ++b)
+            {
+                Block& block = *scanBlocks[b];
+                const ScanBlock& bits = scanBits[b];
+
+                block.lastUpdated = scanCount_;
+
+                for (unsigned int slot = 0; slot < voxelsPerBlock; ++slot)
+                {
+                    const std::uint64_t mask = std::uint64_t{1} << (slot & 63);
+                    const bool hit = (bits.hits[slot >> 6] & mask) != 0;
+
+                    if (!hit && (bits.misses[slot >> 6] & mask) == 0)
+                    {
+                        continue;
+                    }
+
+                    float& logOdds = block.logOdds[slot];
+                    const float current = std::isnan(logOdds) ? 0.0f : logOdds;
+                    const float change = hit ? options_.hitLogOdds : options_.missLogOdds;
+
+                    logOdds = std::min(
+                        std::max(current + change, options_.minimumLogOdds), options_.maximumLogOdds);
+                }
+            }
+        });
+
+    if (blocks_.size() > options_.maximumBlocks)
+    {
+        evict();
+    }
+}
+
+
+template <typename CoordinateType>
+Occupancy OccupancyMap::occupancyAt(const Point<CoordinateType>& location) const
+{
+    std::int64_t voxel[3];
+    const float* logOdds = voxelOf(location, voxel) ? find(voxel) : nullptr;
+
+    if (logOdds == nullptr || std::isnan(*logOdds) || *logOdds == 0.0f)
+    {
+        return Occupancy::Unknown;
+    }
+
+    return *logOdds > 0.0f ? Occupancy::Occupied : Occupancy::Free;
+}
+
+
+template <typename CoordinateType>
+bool OccupancyMap::isOccupied(const Point<CoordinateType>& location) const
+{
+    return occupancyAt(location) == Occupancy::Occupied;
+}
+
+
+template <typename CoordinateType>
+bool OccupancyMap::isFree(const Point<CoordinateType>& location) const
+{
+    return occupancyAt(location) == Occupancy::Free;
+}
+
+
+template <typename CoordinateType>
+float OccupancyMap::logOddsAt(const Point<CoordinateType>& location) const
+{
+    std::int64_t voxel[3];
+    const float* logOdds = voxelOf(location, voxel) ? find(voxel) : nullptr;
+
+    return logOdds == nullptr || std::isnan(*logOdds) ? 0.0f : *logOdds;
+}
+
+
+inline std::size_t OccupancyMap::blockCount() const
+{
+    return blocks_.size();
+}
+
+
+inline const OccupancyMapOptions& OccupancyMap::options() const
+{
+    return options_;
+}
+
+
+template <typename CoordinateType>
+bool OccupancyMap::voxelOf(const Point<CoordinateType>& location, std::int64_t voxel[3]) const
+{
+    const double coordinates[3] = {
+        static_cast<double>(location.x()) / options_.voxelSize,
+        static_cast<double>(location.y()) / options_.voxelSize,
+        static_cast<double>(location.z()) / options_.voxelSize};
+
+    for (unsigned int axis = 0; axis < 3; ++axis)
+    {
+        if (!(std::abs(coordinates[axis]) < static_cast<double>(OccupancyMapImpl::voxelLimit - 1)))
+        {
+            return false;
+        }
+
+        voxel[axis] = static_cast<std::int64_t>(std::floor(coordinates[axis]));
+    }
+
+    return true;
+}
+
+
+inline const float* OccupancyMap::find(const std::int64_t voxel[3]) const
+{
+    auto found = blockIndexes_.find(OccupancyMapImpl::blockKeyOf(voxel));
+
+    if (found == blockIndexes_.end())
+    {
+        return nullptr;
+    }
+
+    return &blocks_[found->second]->logOdds[OccupancyMapImpl::slotOf(voxel)];
+}
+
+
+// evict() keeps the maximumBlocks most recently updated blocks, removing
+// the rest by moving the last block into each one's place.
+
+inline void OccupancyMap::evict()
+{
+    std::vector<std::uint64_t> ages(blocks_.size());
+
+    for (std::size_t i = 0; i < blocks_.size(); ++i)
+    {
+        ages[i] = blocks_[i]->lastUpdated;
+    }
+
+    const std::size_t removeCount = blocks_.size() - options_.maximumBlocks;
+    std::nth_element(ages.begin(), ages.begin() + (removeCount - 1), ages.end());
+
+    // Blocks older than the cutoff are all removed; blocks exactly as old
+    // as it are removed until enough have been.
+    const std::uint64_t cutoff = ages[removeCount - 1];
+    std::size_t olderCount = 0;
+
+    for (std::size_t i = 0; i < removeCount; ++i)
+    {
+        olderCount += ages[i] < cutoff ? 1 : 0;
+    }
+
+    std::size_t equalToRemove = removeCount - olderCount;
+    std::size_t i = 0;
+
+    while (i < blocks_.size())
+    {
+        const std::uint64_t age = blocks_[i]->lastUpdated;
+        const bool remove = age < cutoff || (age == cutoff && equalToRemove > 0);
+
+        if (!remove)
+        {
+            ++i;
+            continue;
+        }
+
+        if (age == cutoff)
+        {
+            --equalToRemove;
+        }
+
+        blockIndexes_.erase(blocks_[i]->key);
+
+        if (i + 1 != blocks_.size())
+        {
+            blocks_[i] = std::move(blocks_.back());
+            blockIndexes_[blocks_[i]->key] = i;
+        }
+
+        blocks_.pop_back();
+    }
+}
+
+
+
+#endif // OCCUPANCYMAP_HPP
+
@@ -0,0 +1,387 @@
+// OrientedBoundingBox.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a function that finds an oriented
+// bounding box for a set of points: a box that contains all of them, like
+// the axis-aligned boxes a KdTree keeps for its nodes, except that it can
+// be turned to whatever orientation fits the points best.  A long, thin
+// cluster of points lying diagonally -- a pipe, or a fallen tree -- has a
+// huge axis-aligned box, but a snug oriented one.
+//
+// Finding the smallest possible oriented box is expensive (the best known
+// algorithms take time proportional to the cube of the number of points),
+// so we find a nearly-smallest one in three steps:
+//
+// 1. The principal axes (see PrincipalAxes.hpp) give a good first guess
+//    at the orientation, since a cluster's box usually lines up with the
+//    directions it's most and least spread out in.
+// 2. The box's size only depends on the points on the convex hull of the
+//    set, and only on a few of those.  So in one pass over the points, we
+//    collect the extreme points along 13 directions (the principal axes and
+//    the diagonals between them) -- up to 26 points, all on the hull -- and
+//    do the rest of the search with only those.
+// 3. A smallest box always has one face parallel to an edge of the hull.
+//    For each axis of the best box so far, we try turning the box around
+//    that axis so that a side lines up with the line through each pair of
+//    extreme points, keeping whichever orientation gives the smallest box
+//    around the extreme points.  Each turn can line the box up with edges
+//    the previous ones couldn't reach, so we repeat that until it stops
+//    helping, which rarely takes more than a few rounds.
+//
+// A final pass over all of the points measures the box in the chosen
+// orientation, so it's guaranteed to contain every point.  Nothing along
+// the way allocates any memory, so this is cheap enough to run on each of
+// thousands of clusters.
+
+#ifndef ORIENTEDBOUNDINGBOX_HPP
+#define ORIENTEDBOUNDINGBOX_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+#include "Point.hpp"
+#include "PrincipalAxes.hpp"
+
+
+
+// An OrientedBox has a center, three perpendicular unit-length axes (which
+// form a right-handed coordinate system), and the distance from the center
+// to the box's faces along each of them.
+struct OrientedBox
+{
+    Point<double> center;
+    Point<double> axes[3];
+    double halfExtents[3];
+
+
+    // volume() returns the volume of the box.
+    double volume() const;
+
+
+    // contains() returns true if a point is inside the box, or within
+    // tolerance of its faces.
+    bool contains(const Point<double>& point, double tolerance = 0.0) const;
+};
+
+
+
+// orientedBoundingBox() returns a box containing all of the given points.
+// The box around no points is centered at the origin, with no size.
+template <typename CoordinateType>
+OrientedBox orientedBoundingBox(const Point<CoordinateType>* points, std::size_t count);
+
+template <typename CoordinateType>
+OrientedBox orientedBoundingBox(const std::vector<Point<CoordinateType>>& points);
+
+
+
+namespace OrientedBoundingBoxImpl
+{
+    // The 13 directions along which extreme points are collected, in terms
+    // of the principal axes: the axes themselves, the diagonals of the
+    // faces of a cube aligned with them, and the diagonals of the cube.
+    constexpr double directions[13][3] = {
+        {1.0, 0.0, 0.0}, {0.0, 1.0, 0.0}, {0.0, 0.0, 1.0},
+        {1.0, 1.0, 0.0}, {1.0, -1.0, 0.0}, {1.0, 0.0, 1.0}, {1.0, 0.0, -1.0},
+        {0.0, 1.0, 1.0}, {0.0, 1.0, -1.0},
+        {1.0, 1.0, 1.0}, {1.0, 1.0, -1.0}, {1.0, -1.0, 1.0}, {1.0, -1.0, -1.0}};
+
+    constexpr std::size_t directionCount = 13;
+    constexpr std::size_t extremeCount = 2 * directionCount;
+
+    // The most times the turning search is repeated.
+    constexpr unsigned int maximumRounds = 8;
+
+
+    // A Frame is three perpendicular unit vectors, each stored as an array
+    // so that the projections can be written as loops.
+    struct Frame
+    {
+        double axes[3][3];
+    };
+
+
+    inline double dot(const double* a, const double* b)
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+
+    inline void cross(const double* a, const double* b, double* result)
+    {
+        result[0] = a[1] * b[2] - a[2] * b[1];
+        result[1] = a[2] * b[0] - a[0] * b[2];
+        result[2] = a[0] * b[1] - a[1] * b[0];
+    }
+
+
+    // volumeAround() returns the volume of the box in a given orientation
+    // that surrounds a set of points.
+    inline double volumeAround(const Frame& frame, const double (*points)[3], std::size_t count)
+    {
+        double volume = 1.0;
+
+        for (unsigned int axis = 0; axis < 3; ++axis)
+        {
+            double lowest = std::numeric_limits<double>::infinity();
+            double highest = -std::numeric_limits<double>::infinity();
+
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                const double projection = dot(frame.axes[axis], points[i]);
+                lowest = std::min(lowest, projection);
+                highest = std::max(highest, projection);
+            }
+
+            volume *= highest - lowest;
+        }
+
+        return volume;
+    }
+
+
+    // turnedToward() returns the frame that keeps one axis of a frame and
+    // turns the other two around it so that the first of them is parallel
+    // to an edge, once it's flattened into the plane they lie in.  It
+    // returns false if the edge is (nearly) parallel to the kept axis.
+    inline bool turnedToward(
+        const Frame& frame, unsigned int kept, const double* edge, Frame& result)
+    {
+        const double* normal = frame.axes[kept];
+        const double along = dot(edge, normal);
+        double flattened[3] = {
+            edge[0] - along * normal[0], edge[1] - along * normal[1], edge[2] - along * normal[2]};
+        const double length = std::sqrt(dot(flattened, flattened));
+
+        if (!(length > 1e-12 * std::sqrt(dot(edge, edge))))
+        {
+            return false;
+        }
+
+        for (double& component : flattened)
+        {
+            component /= length;
+        }
+
+        // Keep the frame right-handed: axes (kept, kept + 1, kept + 2), taken
+        // cyclically, satisfy a[kept + 2] = a[kept] x a[kept + 1].
+        const unsigned int next = (kept + 1) % 3;
+        const unsigned int last = (kept + 2) % 3;
+
+        for (unsigned int i = 0; i < 3; ++i)
+        {
+            result.axes[kept][i] = normal[i];
+            result.axes[next][i] = flattened[i];
+        }
+
+        cross(result.axes[kept], result.axes[next], result.axes[last]);
+        return true;
+    }
+}
+
+
+
+inline double OrientedBox::volume() const
+{
+    return 8.0 * halfExtents[0] * halfExtents[1] * halfExtents[2];
+}
+
+
+inline bool OrientedBox::contains(const Point<double>& point, double tolerance) const
+{
+    const double d[3] = {point.x() - center.x(), point.y() - center.y(), point.z() - center.z()};
+
+    for (unsigned int axis = 0; axis < 3; ++axis)
+    {
+        const double projection =
+            d[0] * axes[axis].x() + d[1] * axes[axis].y() + d[2] * axes[axis].z();
+
+        if (std::abs(projection) > halfExtents[axis] + tolerance)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+// All of the arithmetic is done relative to the points' mean, so that sets
+// of points far from the origin don't lose precision.
+
+template <typename CoordinateType>
+OrientedBox orientedBoundingBox(const Point<CoordinateType>* points, std::size_t count)
+{
+    using namespace OrientedBoundingBoxImpl;
+
+    if (count == 0)
+    {
+        return OrientedBox{
+            Point<double>{0.0, 0.0, 0.0},
+            {Point<double>{1.0, 0.0, 0.0}, Point<double>{0.0, 1.0, 0.0}, Point<double>{0.0, 0.0, 1.0}},
+            {0.0, 0.0, 0.0}};
+    }
+
+    CovarianceAccumulator accumulator;
+    accumulator.add(points, count);
+
+    const Point<double> mean = accumulator.mean();
+    const Eigensystem3 principal = symmetricEigensystem(accumulator.covariance());
+
+    auto relative =
+        [&](std::size_t i, double* p)
+        {
+            p[0] = static_cast<double>(points[i].x()) - mean.x();
+            p[1] = static_cast<double>(points[i].y()) - mean.y();
+            p[2] = static_cast<double>(points[i].z()) - mean.z();
+        };
+
+    Frame best;
+
+    for (unsigned int axis = 0; axis < 3; ++axis)
+    {
+        best.axes[axis][0] = principal.vectors[axis].x();
+        best.axes[axis][1] = principal.vectors[axis].y();
+        best.axes[axis][2] = principal.vectors[axis].z();
+    }
+
+    // Collect the extreme points along each direction.
+    double worldDirections[directionCount][3];
+
+    for (std::size_t d = 0; d < directionCount; ++d)
+    {
+        for (unsigned int i = 0; i < 3; ++i)
+        {
+            worldDirections[d][i] =
+                directions[d][0] * best.axes[0][i] + directions[d][1] * best.axes[1][i]
+                + directions[d][2] * best.axes[2][i];
+        }
+    }
+
+    double lowest[directionCount];
+    double highest[directionCount];
+    double extremes[extremeCount][3];
+
+    for (std::size_t d = 0; d < directionCount; ++d)
+    {
+        lowest[d] = std::numeric_limits<double>::infinity();
+        highest[d] = -std::numeric_limits<double>::infinity();
+    }
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        double p[3];
+        relative(i, p);
+
+        for (std::size_t d = 0; d < directionCount; ++d)
+        {
+            const double projection = dot(worldDirections[d], p);
+
+            if (projection < lowest[d])
+            {
+                lowest[d] = projection;
+                std::copy(p, p + 3, extremes[2 * d]);
+            }
+
+            if (projection > highest[d])
+            {
+                highest[d] = projection;
+                std::copy(p, p + 3, extremes[2 * d + 1]);
+            }
+        }
+    }
+
+    // Turn the box toward each line through two extreme points.
+    double bestVolume = volumeAround(best, extremes, extremeCount);
+
+    bool improved = true;
+
+    for (unsigned int round = 0; round < maximumRounds && improved; ++round)
+    {
+        const Frame start = best;
+        improved = false;
+
+        for (unsigned int kept = 0; kept < 3; ++kept)
+        {
+            for (std::size_t i = 0; i < extremeCount; ++i)
+            {
+                for (std::size_t j = i + 1; j < extremeCount; ++j)
+                {
+                    const double edge[3] = {
+                        extremes[j][0] - extremes[i][0], extremes[j][1] - extremes[i][1],
+                        extremes[j][2] - extremes[i][2]};
+
+                    Frame candidate;
+
+                    if (!turnedToward(start, kept, edge, candidate))
+                    {
+                        continue;
+                    }
+
+                    const double volume = volumeAround(candidate, extremes, extremeCount);
+
+                    if (volume < bestVolume * (1.0 - 1e-9))
+                    {
+                        bestVolume = volume;
+                        best = candidate;
+                        improved = true;
+                    }
+                }
+            }
+        }
+    }
+
+    // Measure the box around all of the points.
+    double low[3] = {
+        std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(),
+        std::numeric_limits<double>::infinity()};
+    double high[3] = {-low[0], -low[1], -low[2]};
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        double p[3];
+        relative(i, p);
+
+        for (unsigned int axis = 0; axis < 3; ++axis)
+        {
+            const double projection = dot(best.axes[axis], p);
+            low[axis] = std::min(low[axis], projection);
+            high[axis] = std::max(high[axis], projection);
+        }
+    }
+
+    OrientedBox box;
+    double center[3] = {mean.x(), mean.y(), mean.z()};
+
+    for (unsigned int axis = 0; axis < 3; ++axis)
+    {
+        const double middle = (low[axis] + high[axis]) / 2.0;
+
+        for (unsigned int i = 0; i < 3; ++i)
+        {
+            center[i] += middle * best.axes[axis][i];
+        }
+
+        box.axes[axis] = Point<double>{best.axes[axis][0], best.axes[axis][1], best.axes[axis][2]};
+        box.halfExtents[axis] = (high[axis] - low[axis]) / 2.0;
+    }
+
+    box.center = Point<double>{center[0], center[1], center[2]};
+    return box;
+}
+
+
+template <typename CoordinateType>
+OrientedBox orientedBoundingBox(const std::vector<Point<CoordinateType>>& points)
+{
+    return orientedBoundingBox(points.data(), points.size());
+}
+
+
+
+#endif // ORIENTEDBOUNDINGBOX_HPP
+
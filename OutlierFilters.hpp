@@ -0,0 +1,318 @@
+// OutlierFilters.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines two filters for finding outliers in
+// a set of points: stray measurements, like the ones a laser scanner makes
+// when its beam catches the edge of something or a speck of dust, which sit
+// off by themselves away from the surfaces that were actually scanned.
+//
+// * The statistical filter finds each point's mean distance to its k
+//   nearest neighbors, then the mean and standard deviation of those across
+//   all of the points, and rejects any point whose mean distance is more
+//   than a given number of standard deviations above the mean.
+// * The radius filter rejects any point with fewer than a given number of
+//   other points within a given radius of it.
+//
+// Neither filter changes or copies the points.  Instead, each returns a
+// "keep mask": a vector with one element per point, which is 1 if the point
+// should be kept and 0 if it's an outlier, in the same order as the vector
+// the KdTree was built from.  The caller can use it to filter the points,
+// or anything else that goes along with them, however it likes.
+//
+// Both filters ask one neighbor question about every point in the tree, so
+// they're written to answer those questions in bulk.  The points are
+// visited in the order the tree stores them, which means consecutive
+// questions are about points that are near each other and touch the same
+// parts of the tree, and the work is split among the threads of a
+// ThreadPool, each thread answering its questions without allocating any
+// memory per question.
+
+#ifndef OUTLIERFILTERS_HPP
+#define OUTLIERFILTERS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "KdTree.hpp"
+#include "ThreadPool.hpp"
+
+
+
+// meanNeighborDistances() returns, for each point in the tree (in the order
+// of the vector it was built from), its mean distance to the k other points
+// closest to it.  A point's distance to itself doesn't count, but its
+// distance to other points at the same location does.
+template <typename CoordinateType>
+std::vector<double> meanNeighborDistances(
+    const KdTree<CoordinateType>& tree, std::size_t k,
+    ThreadPool& pool = defaultThreadPool());
+
+
+// statisticalOutlierMask() keeps the points whose mean distance to their k
+// nearest neighbors is no more than the mean of all of those distances plus
+// standardDeviations times their standard deviation.
+template <typename CoordinateType>
+std::vector<std::uint8_t> statisticalOutlierMask(
+    const KdTree<CoordinateType>& tree, std::size_t k, double standardDeviations,
+    ThreadPool& pool = defaultThreadPool());
+
+
+// radiusOutlierMask() keeps the points that have at least minimumNeighbors
+// other points within the given radius.
+template <typename CoordinateType>
+std::vector<std::uint8_t> radiusOutlierMask(
+    const KdTree<CoordinateType>& tree, double radius, std::size_t minimumNeighbors,
+    ThreadPool& pool = defaultThreadPool());
+
+
+
+namespace OutlierFiltersImpl
+{
+    // Each chunk of work handed to the pool is this many consecutive tree
+    // positions.
+    constexpr std::size_t pointsPerChunk = 1024;
+
+
+    // sumOfNearest() returns the sum of the distances from the point at the
+    // given tree position to the k other points nearest it, using closest
+    // (which must have room for k values) to hold the squared distances of
+    // the best points found so far, in ascending order.  It returns the
+    // number of neighbors it found, which is less than k only if the tree
+    // has no more than k points.
+    template <typename CoordinateType>
+    std::size_t sumOfNearest(
+        const KdTree<CoordinateType>& tree, std::size_t position, std::size_t k,
+        double* closest, double& sum)
+    {
+        using Node = typename KdTree<CoordinateType>::Node;
+
+        const std::vector<Node>& nodes = tree.nodes();
+        const Point<CoordinateType>& query = tree.pointAt(position);
+        std::size_t found = 0;
+
+        std::uint32_t pending[64];
+        std::size_t pendingCount = 0;
+        pending[pendingCount++] = tree.root();
+
+        while (pendingCount > 0)
+        {
+            const Node& node = nodes[pending[--pendingCount]];
+
+            if (found == k && tree.squaredDistanceToNode(query, node) >= closest[k - 1])
+            {
+                continue;
+            }
+
+            if (node.left == KdTree<CoordinateType>::noChild)
+            {
+                for (std::uint32_t i = node.begin; i < node.end; ++i)
+                {
+                    if (i == position)
+                    {
+                        continue;
+                    }
+
+                    const double squaredDistance = query.squaredDistanceFrom(tree.pointAt(i));
+
+                    if (found == k && squaredDistance >= closest[k - 1])
+                    {
+                        continue;
+                    }
+
+                    std::size_t slot = found < k ? found++ : k - 1;
+
+                    while (slot > 0 && closest[slot - 1] > squaredDistance)
+                    {
+                        closest[slot] = closest[slot - 1];
+                        --slot;
+                    }
+
+                    closest[slot] = squaredDistance;
+                }
+            }
+            else if (KdTree<CoordinateType>::coordinate(query, node.axis) < node.split)
+            {
+                pending[pendingCount++] = node.right;
+                pending[pendingCount++] = node.left;
+            }
+            else
+            {
+                pending[pendingCount++] = node.left;
+                pending[pendingCount++] = node.right;
+            }
+        }
+
+        sum = 0.0;
+
+        for (std::size_t i = 0; i < found; ++i)
+        {
+            sum += std::sqrt(closest[i]);
+        }
+
+        return found;
+    }
+
+
+    // hasNeighbors() returns true if at least minimumNeighbors points other
+    // than the one at the given tree position are within the radius whose
+    // square is given, stopping as soon as it's found enough.
+    template <typename CoordinateType>
+    bool hasNeighbors(
+        const KdTree<CoordinateType>& tree, std::size_t position,
+        double squaredRadius, std::size_t minimumNeighbors)
+    {
+        using Node = typename KdTree<CoordinateType>::Node;
+
+        if (minimumNeighbors == 0)
+        {
+            return true;
+        }
+
+        const std::vector<Node>& nodes = tree.nodes();
+        const Point<CoordinateType>& query = tree.pointAt(position);
+        std::size_t found = 0;
+
+        std::uint32_t pending[64];
+        std::size_t pendingCount = 0;
+        pending[pendingCount++] = tree.root();
+
+        while (pendingCount > 0)
+        {
+            const Node& node = nodes[pending[--pendingCount]];
+
+            if (tree.squaredDistanceToNode(query, node) > squaredRadius)
+            {
+                continue;
+            }
+
+            if (node.left == KdTree<CoordinateType>::noChild)
+            {
+                for (std::uint32_t i = node.begin; i < node.end; ++i)
+                {
+                    if (i != position
+                        && query.squaredDistanceFrom(tree.pointAt(i)) <= squaredRadius
+                        && ++found == minimumNeighbors)
+                    {
+                        return true;
+                    }
+                }
+            }
+            else
+            {
+                pending[pendingCount++] = node.left;
+                pending[pendingCount++] = node.right;
+            }
+        }
+
+        return false;
+    }
+}
+
+
+
+template <typename CoordinateType>
+std::vector<double> meanNeighborDistances(
+    const KdTree<CoordinateType>& tree, std::size_t k, ThreadPool& pool)
+{
+    using namespace OutlierFiltersImpl;
+
+    std::vector<double> means(tree.size(), 0.0);
+    k = std::min(k, tree.size() > 0 ? tree.size() - 1 : 0);
+
+    if (k == 0)
+    {
+        return means;
+    }
+
+    pool.parallelFor(
+        0, tree.size(), pointsPerChunk,
+        [&](std::size_t begin, std::size_t end)
+        {
+            std::vector<double> closest(k);
+
+            for (std::size_t position = begin; position < end; ++position)
+            {
+                double sum;
+                const std::size_t found = sumOfNearest(tree, position, k, closest.data(), sum);
+
+                means[tree.indexAt(position)] = sum / static_cast<double>(found);
+            }
+        });
+
+    return means;
+}
+
+
+template <typename CoordinateType>
+std::vector<std::uint8_t> statisticalOutlierMask(
+    const KdTree<CoordinateType>& tree, std::size_t k, double standardDeviations,
+    ThreadPool& pool)
+{
+    const std::vector<double> means = meanNeighborDistances(tree, k, pool);
+    std::vector<std::uint8_t> keep(means.size(), 1);
+
+    if (means.empty())
+    {
+        return keep;
+    }
+
+    double total = 0.0;
+
+    for (double mean : means)
+    {
+        total += mean;
+    }
+
+    const double average = total / static_cast<double>(means.size());
+    double squaredDeviations = 0.0;
+
+    for (double mean : means)
+    {
+        squaredDeviations += (mean - average) * (mean - average);
+    }
+
+    const double threshold =
+        average + standardDeviations * std::sqrt(squaredDeviations / static_cast<double>(means.size()));
+
+    for (std::size_t i = 0; i < means.size(); ++i)
+    {
+        keep[i] = means[i] <= threshold ? 1 : 0;
+    }
+
+    return keep;
+}
+
+
+template <typename CoordinateType>
+std::vector<std::uint8_t> radiusOutlierMask(
+    const KdTree<CoordinateType>& tree, double radius, std::size_t minimumNeighbors,
+    ThreadPool& pool)
+{
+    using namespace OutlierFiltersImpl;
+
+    std::vector<std::uint8_t> keep(tree.size(), 0);
+    const double squaredRadius = radius * radius;
+
+    pool.parallelFor(
+        0, tree.size(), pointsPerChunk,
+        [&](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t position = begin; position < end; ++position)
+            {
+                keep[tree.indexAt(position)] =
+                    hasNeighbors(tree, position, squaredRadius, minimumNeighbors) ? 1 : 0;
+            }
+        });
+
+    return keep;
+}
+
+
+
+#endif // OUTLIERFILTERS_HPP
+
@@ -96,6 +96,14 @@ public:
         const CoordinateType& z);
 
 
+    // Default-constructing a Point gives each coordinate its default
+    // value (zero, for the built-in numeric types).  This is mostly useful
+    // when we want to allocate storage for many Points up front -- a
+    // std::vector<Point<double>> with a million elements, say -- and then
+    // fill it in afterward.
+    Point();
+
+
     // x() returns the x-coordinate associated with some point.  The
     // coordinate is returned by reference, with the coordinate returned
     // as a constant if the point is constant, or modifiable otherwise.
@@ -122,6 +130,14 @@ public:
     double distanceFrom(const Point<CoordinateType>& p) const;
 
 
+    // Calculates the square of the distance this point is from another
+    // point.  When all we want to do is compare distances -- "which of
+    // these points is closest?" -- the squares compare the same way the
+    // distances do, so we can skip the square root.  The arithmetic is done
+    // in doubles, so that squaring large integer coordinates can't overflow.
+    double squaredDistanceFrom(const Point<CoordinateType>& p) const;
+
+
 private:
     // Here, we have member variables for the three coordinates.  The
     // appropriate type for these is whatever the CoordinateType is for
@@ -199,6 +215,13 @@ Point<CoordinateType>::Point(
 }
 
 
+template <typename CoordinateType>
+Point<CoordinateType>::Point()
+    : x_{}, y_{}, z_{}
+{
+}
+
+
 template <typename CoordinateType>
 const CoordinateType& Point<CoordinateType>::x() const
 {
@@ -260,6 +283,17 @@ double Point<CoordinateType>::distanceFrom(const Point<CoordinateType>& other) c
 }
 
 
+template <typename CoordinateType>
+double Point<CoordinateType>::squaredDistanceFrom(const Point<CoordinateType>& other) const
+{
+    const double dx = static_cast<double>(x_) - static_cast<double>(other.x_);
+    const double dy = static_cast<double>(y_) - static_cast<double>(other.y_);
+    const double dz = static_cast<double>(z_) - static_cast<double>(other.z_);
+
+    return dx * dx + dy * dy + dz * dz;
+}
+
+
 
 #endif // POINT_HPP
 
@@ -0,0 +1,228 @@
+// PointArrays.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a template class called PointArrays,
+// which stores a sequence of points as three separate arrays: one holding
+// all of the x-coordinates, one holding all of the y-coordinates, and one
+// holding all of the z-coordinates.
+//
+// A std::vector<Point<double>> stores its points one after another, so the
+// coordinates in memory go x, y, z, x, y, z, and so on.  That's what we'd
+// call an "array of structures" (AoS).  PointArrays flips that around into
+// a "structure of arrays" (SoA).  Neither is better in every case, but when
+// a loop wants to do the same arithmetic on the x-coordinates of many
+// points at once, the SoA layout puts exactly those values next to each
+// other, which is what the processor's vector (SIMD) instructions need.
+// Compilers are quite good at vectorizing loops over SoA data with no help
+// from us at all.
+
+#ifndef POINTARRAYS_HPP
+#define POINTARRAYS_HPP
+
+#include <cstddef>
+#include <vector>
+#include "Point.hpp"
+
+
+
+template <typename CoordinateType>
+class PointArrays
+{
+public:
+    // A PointArrays can be constructed empty, with a given number of
+    // (default-constructed) points, or from a vector of Points.
+    PointArrays();
+    explicit PointArrays(std::size_t size);
+    explicit PointArrays(const std::vector<Point<CoordinateType>>& points);
+
+
+    // size() returns the number of points stored.
+    std::size_t size() const;
+
+
+    // resize(), reserve(), and clear() behave the way they do on a
+    // std::vector, except that they apply to all three arrays at once.
+    void resize(std::size_t size);
+    void reserve(std::size_t capacity);
+    void clear();
+
+
+    // pushBack() adds a point to the end.
+    void pushBack(const Point<CoordinateType>& point);
+
+
+    // point() assembles the point at the given index, while setPoint()
+    // overwrites it.
+    Point<CoordinateType> point(std::size_t index) const;
+    void setPoint(std::size_t index, const Point<CoordinateType>& point);
+
+
+    // xs(), ys(), and zs() give direct access to the three arrays, which
+    // is how loops meant to be vectorized should get at the coordinates.
+    const CoordinateType* xs() const;
+    CoordinateType* xs();
+    const CoordinateType* ys() const;
+    CoordinateType* ys();
+    const CoordinateType* zs() const;
+    CoordinateType* zs();
+
+
+    // toPoints() converts back into the array-of-structures layout.
+    std::vector<Point<CoordinateType>> toPoints() const;
+
+
+private:
+    std::vector<CoordinateType> xs_;
+    std::vector<CoordinateType> ys_;
+    std::vector<CoordinateType> zs_;
+};
+
+
+
+template <typename CoordinateType>
+PointArrays<CoordinateType>::PointArrays()
+{
+}
+
+
+template <typename CoordinateType>
+PointArrays<CoordinateType>::PointArrays(std::size_t size)
+    : xs_(size), ys_(size), zs_(size)
+{
+}
+
+
+template <typename CoordinateType>
+PointArrays<CoordinateType>::PointArrays(
+    const std::vector<Point<CoordinateType>>& points)
+    : PointArrays(points.size())
+{
+    for (std::size_t i = 0; i < points.size(); ++i)
+    {
+        setPoint(i, points[i]);
+    }
+}
+
+
+template <typename CoordinateType>
+std::size_t PointArrays<CoordinateType>::size() const
+{
+    return xs_.size();
+}
+
+
+template <typename CoordinateType>
+void PointArrays<CoordinateType>::resize(std::size_t size)
+{
+    xs_.resize(size);
+    ys_.resize(size);
+    zs_.resize(size);
+}
+
+
+template <typename CoordinateType>
+void PointArrays<CoordinateType>::reserve(std::size_t capacity)
+{
+    xs_.reserve(capacity);
+    ys_.reserve(capacity);
+    zs_.reserve(capacity);
+}
+
+
+template <typename CoordinateType>
+void PointArrays<CoordinateType>::clear()
+{
+    xs_.clear();
+    ys_.clear();
+    zs_.clear();
+}
+
+
+template <typename CoordinateType>
+void PointArrays<CoordinateType>::pushBack(const Point<CoordinateType>& point)
+{
+    xs_.push_back(point.x());
+    ys_.push_back(point.y());
+    zs_.push_back(point.z());
+}
+
+
+template <typename CoordinateType>
+Point<CoordinateType> PointArrays<CoordinateType>::point(std::size_t index) const
+{
+    return Point<CoordinateType>{xs_[index], ys_[index], zs_[index]};
+}
+
+
+template <typename CoordinateType>
+void PointArrays<CoordinateType>::setPoint(
+    std::size_t index, const Point<CoordinateType>& point)
+{
+    xs_[index] = point.x();
+    ys_[index] = point.y();
+    zs_[index] = point.z();
+}
+
+
+template <typename CoordinateType>
+const CoordinateType* PointArrays<CoordinateType>::xs() const
+{
+    return xs_.data();
+}
+
+
+template <typename CoordinateType>
+CoordinateType* PointArrays<CoordinateType>::xs()
+{
+    return xs_.data();
+}
+
+
+template <typename CoordinateType>
+const CoordinateType* PointArrays<CoordinateType>::ys() const
+{
+    return ys_.data();
+}
+
+
+template <typename CoordinateType>
+CoordinateType* PointArrays<CoordinateType>::ys()
+{
+    return ys_.data();
+}
+
+
+template <typename CoordinateType>
+const CoordinateType* PointArrays<CoordinateType>::zs() const
+{
+    return zs_.data();
+}
+
+
+template <typename CoordinateType>
+CoordinateType* PointArrays<CoordinateType>::zs()
+{
+    return zs_.data();
+}
+
+
+template <typename CoordinateType>
+std::vector<Point<CoordinateType>> PointArrays<CoordinateType>::toPoints() const
+{
+    std::vector<Point<CoordinateType>> points;
+    points.reserve(size());
+
+    for (std::size_t i = 0; i < size(); ++i)
+    {
+        points.push_back(point(i));
+    }
+
+    return points;
+}
+
+
+
+#endif // POINTARRAYS_HPP
+
@@ -0,0 +1,379 @@
+// PointCodec.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines functions that compress a vector of
+// Points into a (usually much) smaller array of bytes, and decompress those
+// bytes back into exactly the same coordinates, bit for bit.  Nothing is
+// rounded or approximated, so this works just as well for floating-point
+// coordinates as for integers.
+//
+// The compression happens in three steps:
+//
+// 1. The points are sorted into Morton order (see MortonCode.hpp), so that
+//    points that are close together in space are close together in the
+//    array, too.  This is optional; without it, the points come back in
+//    their original order, but usually don't compress as well.
+//
+// 2. Each coordinate is replaced by the exclusive-or (XOR) of its bits with
+//    the bits of the same coordinate of the previous point.  Neighboring
+//    points have similar coordinates, and similar numbers -- floating-point
+//    numbers especially -- tend to agree in their sign, exponent, and first
+//    several digits, which are their high bits.  After the XOR, those bits
+//    are zero.  XOR is its own inverse, so this step loses nothing.
+//
+// 3. The resulting numbers are split into "byte planes" -- all of the lowest
+//    bytes, then all of the next-lowest, and so on -- and each plane is
+//    entropy coded with rANS (see RansCoder.hpp).  The high planes are
+//    mostly zeros, which rANS squeezes down to almost nothing.
+//
+// The points are compressed in independent chunks, which are spread across
+// the threads of a ThreadPool in both directions.
+//
+// The compressed format starts with a header (a magic number, a version,
+// the coordinate type, the point count, and the chunking), followed by the
+// size of each compressed chunk and then the chunks themselves.  Multi-byte
+// numbers are little-endian (see ByteStream.hpp), so compressed data can be
+// decompressed on any machine.
+
+#ifndef POINTCODEC_HPP
+#define POINTCODEC_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "ByteStream.hpp"
+#include "MortonCode.hpp"
+#include "Point.hpp"
+#include "PointFile.hpp"
+#include "RansCoder.hpp"
+#include "ThreadPool.hpp"
+
+
+
+// PointCodecException is thrown when decompressing bytes that weren't
+// produced by compressPoints(), or that hold a different coordinate type.
+class PointCodecException : public std::runtime_error
+{
+public:
+    explicit PointCodecException(const std::string& reason)
+        : std::runtime_error{reason}
+    {
+    }
+};
+
+
+
+struct PointCodecOptions
+{
+    // If true, the points are sorted into Morton order before they're
+    // compressed, and that's the order they'll come back in.
+    bool mortonOrder = true;
+
+    // The number of points compressed together as one chunk, which is
+    // limited to 2^24 (larger values are treated as 2^24).
+    std::size_t pointsPerChunk = 65536;
+};
+
+
+
+// compressPoints() compresses a vector of points.
+template <typename CoordinateType>
+std::vector<std::uint8_t> compressPoints(
+    const std::vector<Point<CoordinateType>>& points,
+    const PointCodecOptions& options = PointCodecOptions{},
+    ThreadPool& pool = defaultThreadPool());
+
+
+// decompressPoints() reverses compressPoints().  Before it allocates
+// anything, it checks that the header is consistent with the number of
+// bytes it's given: every chunk has to be there, and no chunk can be
+// smaller than the few bytes it takes to describe even the most
+// compressible points.  Since a chunk holds at most 2^24 points, that
+// limits how much memory a corrupt (or malicious) header can make it ask
+// for to a fixed multiple of the input's size.
+template <typename CoordinateType>
+std::vector<Point<CoordinateType>> decompressPoints(
+    const std::uint8_t* bytes, std::size_t size,
+    ThreadPool& pool = defaultThreadPool());
+
+template <typename CoordinateType>
+std::vector<Point<CoordinateType>> decompressPoints(
+    const std::vector<std::uint8_t>& bytes,
+    ThreadPool& pool = defaultThreadPool());
+
+
+
+namespace PointCodecImpl
+{
+    constexpr std::uint32_t magic = 0x5A435450;    // "PTCZ"
+    constexpr std::uint16_t version = 1;
+
+    constexpr std::size_t maximumPointsPerChunk = std::size_t{1} << 24;
+
+
+    // The smallest possible chunk stores each byte plane of each axis in
+    // rANS's constant mode, which takes two bytes.
+    template <typename CoordinateType>
+    constexpr std::size_t minimumChunkSize = 3 * sizeof(CoordinateType) * 2;
+
+
+    // Bits<CoordinateType> is the unsigned integer type with the same
+    // size as CoordinateType, which is what we XOR and split into planes.
+    template <typename CoordinateType>
+    using Bits = std::conditional_t<
+        sizeof(CoordinateType) == 4, std::uint32_t, std::uint64_t>;
+
+
+    template <typename CoordinateType>
+    Bits<CoordinateType> bitsOf(const CoordinateType& value)
+    {
+        Bits<CoordinateType> bits;
+        std::memcpy(&bits, &value, sizeof(value));
+        return bits;
+    }
+
+
+    template <typename CoordinateType>
+    CoordinateType valueOf(Bits<CoordinateType> bits)
+    {
+        CoordinateType value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+
+    template <typename CoordinateType>
+    const CoordinateType& coordinateOf(const Point<CoordinateType>& point, unsigned int axis)
+    {
+        return axis == 0 ? point.x() : axis == 1 ? point.y() : point.z();
+    }
+
+
+    template <typename CoordinateType>
+    CoordinateType& coordinateOf(Point<CoordinateType>& point, unsigned int axis)
+    {
+        return axis == 0 ? point.x() : axis == 1 ? point.y() : point.z();
+    }
+
+
+    template <typename CoordinateType>
+    void compressChunk(
+        const std::vector<Point<CoordinateType>>& points,
+        const std::size_t* order, std::size_t first, std::size_t count,
+        std::vector<std::uint8_t>& output)
+    {
+        std::vector<Bits<CoordinateType>> deltas(count);
+        std::vector<std::uint8_t> plane(count);
+
+        for (unsigned int axis = 0; axis < 3; ++axis)
+        {
+            Bits<CoordinateType> previous = 0;
+
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                const Bits<CoordinateType> bits =
+                    bitsOf(coordinateOf(points[order != nullptr ? order[i] : first + i], axis));
+
+                deltas[i] = bits ^ previous;
+                previous = bits;
+            }
+
+            for (unsigned int byte = 0; byte < sizeof(CoordinateType); ++byte)
+            {
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    plane[i] = static_cast<std::uint8_t>(deltas[i] >> (8 * byte));
+                }
+
+                ransEncode(plane.data(), count, output);
+            }
+        }
+    }
+
+
+    template <typename CoordinateType>
+    void decompressChunk(
+        ByteReader& input, Point<CoordinateType>* points, std::size_t count)
+    {
+        std::vector<Bits<CoordinateType>> deltas(count);
+        std::vector<std::uint8_t> plane(count);
+
+        for (unsigned int axis = 0; axis < 3; ++axis)
+        {
+            std::fill(deltas.begin(), deltas.end(), 0);
+
+            for (unsigned int byte = 0; byte < sizeof(CoordinateType); ++byte)
+            {
+                ransDecode(input, plane.data(), count);
+
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    deltas[i] |= static_cast<Bits<CoordinateType>>(plane[i]) << (8 * byte);
+                }
+            }
+
+            Bits<CoordinateType> previous = 0;
+
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                previous ^= deltas[i];
+                coordinateOf(points[i], axis) = valueOf<CoordinateType>(previous);
+            }
+        }
+    }
+}
+
+
+template <typename CoordinateType>
+std::vector<std::uint8_t> compressPoints(
+    const std::vector<Point<CoordinateType>>& points,
+    const PointCodecOptions& options, ThreadPool& pool)
+{
+    using namespace PointCodecImpl;
+
+    const std::size_t pointsPerChunk = std::min<std::size_t>(
+        std::max<std::size_t>(options.pointsPerChunk, 1), maximumPointsPerChunk);
+
+    const std::size_t chunkCount = (points.size() + pointsPerChunk - 1) / pointsPerChunk;
+
+    std::vector<std::size_t> order;
+
+    if (options.mortonOrder)
+    {
+        order = mortonOrder(points);
+    }
+
+    std::vector<std::vector<std::uint8_t>> chunks(chunkCount);
+
+    pool.parallelFor(
+        0, chunkCount, 1,
+        [&](std::size_t firstChunk, std::size_t lastChunk)
+        {
+            for (std::size_t chunk = firstChunk; chunk < lastChunk; ++chunk)
+            {
+                const std::size_t first = chunk * pointsPerChunk;
+                const std::size_t count = std::min(pointsPerChunk, points.size() - first);
+
+                compressChunk(
+                    points, order.empty() ? nullptr : order.data() + first,
+                    first, count, chunks[chunk]);
+            }
+        });
+
+    std::vector<std::uint8_t> output;
+    ByteWriter writer{output};
+
+    writer.writeU32(magic);
+    writer.writeU16(version);
+    writer.writeU8(PointFileCoordinateKind<CoordinateType>::value);
+    writer.writeU8(sizeof(CoordinateType));
+    writer.writeU64(points.size());
+    writer.writeU32(static_cast<std::uint32_t>(pointsPerChunk));
+
+    for (const std::vector<std::uint8_t>& chunk : chunks)
+    {
+        writer.writeU64(chunk.size());
+    }
+
+    for (const std::vector<std::uint8_t>& chunk : chunks)
+    {
+        writer.writeBytes(chunk.data(), chunk.size());
+    }
+
+    return output;
+}
+
+
+template <typename CoordinateType>
+std::vector<Point<CoordinateType>> decompressPoints(
+    const std::uint8_t* bytes, std::size_t size, ThreadPool& pool)
+{
+    using namespace PointCodecImpl;
+
+    ByteReader header{bytes, size};
+
+    if (header.readU32() != magic || header.readU16() != version)
+    {
+        throw PointCodecException{"not compressed point data"};
+    }
+
+    if (header.readU8() != PointFileCoordinateKind<CoordinateType>::value
+        || header.readU8() != sizeof(CoordinateType))
+    {
+        throw PointCodecException{"compressed points have a different coordinate type"};
+    }
+
+    const std::uint64_t pointCount = header.readU64();
+    const std::size_t pointsPerChunk = header.readU32();
+
+    if (pointsPerChunk == 0 || pointsPerChunk > maximumPointsPerChunk)
+    {
+        throw PointCodecException{"invalid chunk size"};
+    }
+
+    // Each chunk needs eight bytes for its size, plus its own bytes, so
+    // there's a limit to how many chunks -- and so how many points -- the
+    // rest of the input could possibly hold.
+    const std::uint64_t chunkCount = pointCount / pointsPerChunk + (pointCount % pointsPerChunk != 0);
+
+    if (chunkCount > header.remaining() / (8 + minimumChunkSize<CoordinateType>))
+    {
+        throw PointCodecException{"point count is too large for the compressed data"};
+    }
+
+    std::vector<const std::uint8_t*> chunkStarts(chunkCount);
+    std::vector<std::size_t> chunkSizes(chunkCount);
+
+    for (std::size_t chunk = 0; chunk < chunkCount; ++chunk)
+    {
+        chunkSizes[chunk] = header.readU64();
+
+        if (chunkSizes[chunk] < minimumChunkSize<CoordinateType>)
+        {
+            throw PointCodecException{"invalid compressed chunk size"};
+        }
+    }
+
+    for (std::size_t chunk = 0; chunk < chunkCount; ++chunk)
+    {
+        chunkStarts[chunk] = header.skip(chunkSizes[chunk]);
+    }
+
+    std::vector<Point<CoordinateType>> points(pointCount);
+
+    pool.parallelFor(
+        0, chunkCount, 1,
+        [&](std::size_t firstChunk, std::size_t lastChunk)
+        {
+            for (std::size_t chunk = firstChunk; chunk < lastChunk; ++chunk)
+            {
+                const std::size_t first = chunk * pointsPerChunk;
+                const std::size_t count = std::min<std::size_t>(pointsPerChunk, pointCount - first);
+
+                ByteReader input{chunkStarts[chunk], chunkSizes[chunk]};
+                decompressChunk(input, points.data() + first, count);
+            }
+        });
+
+    return points;
+}
+
+
+template <typename CoordinateType>
+std::vector<Point<CoordinateType>> decompressPoints(
+    const std::vector<std::uint8_t>& bytes, ThreadPool& pool)
+{
+    return decompressPoints<CoordinateType>(bytes.data(), bytes.size(), pool);
+}
+
+
+
+#endif // POINTCODEC_HPP
+
@@ -0,0 +1,230 @@
+// PointFile.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file describes the binary file format we use for storing
+// large numbers of Points, along with functions for writing and (simply,
+// synchronously) reading such files.  AsyncPointLoader.hpp contains a much
+// faster way to read them.
+//
+// A point file is laid out like this:
+//
+// * A 64-byte header (a PointFileHeader, below), which says how many points
+//   there are, what type their coordinates are, and where they begin.
+// * The points themselves, starting at the header's dataOffset, stored
+//   exactly the way a std::vector<Point<CoordinateType>> stores them in
+//   memory: x, y, z, x, y, z, and so on.
+//
+// Storing the points exactly the way they're laid out in memory means that
+// reading them is nothing more than copying bytes from the file straight
+// into a vector's storage; there's no parsing to do at all.  The price we
+// pay is that the files are only portable between machines that agree on
+// the size and byte order of the coordinate type.  The header lets us
+// detect when they don't, because its magic number will come out scrambled
+// on a machine with the opposite byte order.
+
+#ifndef POINTFILE_HPP
+#define POINTFILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "FileDescriptor.hpp"
+#include "Point.hpp"
+
+
+
+// PointFileException is thrown when a file isn't a valid point file, or
+// is a point file containing a different kind of coordinate than expected.
+class PointFileException : public std::runtime_error
+{
+public:
+    explicit PointFileException(const std::string& reason)
+        : std::runtime_error{reason}
+    {
+    }
+};
+
+
+
+struct PointFileHeader
+{
+    std::uint32_t magic;
+    std::uint16_t version;
+    std::uint8_t coordinateKind;
+    std::uint8_t coordinateSize;
+    std::uint64_t pointCount;
+    std::uint64_t dataOffset;
+    std::uint8_t reserved[40];
+};
+
+static_assert(sizeof(PointFileHeader) == 64, "PointFileHeader must be 64 bytes");
+
+
+constexpr std::uint32_t pointFileMagic = 0x464E5450;   // "PTNF"
+constexpr std::uint16_t pointFileVersion = 1;
+
+
+
+// PointFileCoordinateKind maps each coordinate type we know how to store
+// onto the number that identifies it in a file's header.  It's deliberately
+// left undefined for other types, so that asking for a Point<std::string>
+// file is a compile-time error rather than a file nobody can read.
+
+template <typename CoordinateType>
+struct PointFileCoordinateKind;
+
+template <>
+struct PointFileCoordinateKind<float> { static constexpr std::uint8_t value = 1; };
+
+template <>
+struct PointFileCoordinateKind<double> { static constexpr std::uint8_t value = 2; };
+
+template <>
+struct PointFileCoordinateKind<std::int32_t> { static constexpr std::uint8_t value = 3; };
+
+template <>
+struct PointFileCoordinateKind<std::int64_t> { static constexpr std::uint8_t value = 4; };
+
+
+
+// makePointFileHeader() builds the header for a file of pointCount points.
+template <typename CoordinateType>
+PointFileHeader makePointFileHeader(std::uint64_t pointCount);
+
+
+// validatePointFileHeader() throws a PointFileException unless the header
+// describes a file of Point<CoordinateType> objects that we can read.
+template <typename CoordinateType>
+void validatePointFileHeader(const PointFileHeader& header);
+
+
+// readPointFileHeader() reads and validates the header of an open file.
+template <typename CoordinateType>
+PointFileHeader readPointFileHeader(const FileDescriptor& file);
+
+
+// writePointFile() writes a vector of points into a new point file.
+template <typename CoordinateType>
+void writePointFile(
+    const std::string& path, const std::vector<Point<CoordinateType>>& points);
+
+
+// readPointFile() reads an entire point file, one read() at a time.
+template <typename CoordinateType>
+std::vector<Point<CoordinateType>> readPointFile(const std::string& path);
+
+
+
+template <typename CoordinateType>
+PointFileHeader makePointFileHeader(std::uint64_t pointCount)
+{
+    PointFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+
+    header.magic = pointFileMagic;
+    header.version = pointFileVersion;
+    header.coordinateKind = PointFileCoordinateKind<CoordinateType>::value;
+    header.coordinateSize = sizeof(CoordinateType);
+    header.pointCount = pointCount;
+    header.dataOffset = sizeof(PointFileHeader);
+
+    return header;
+}
+
+
+template <typename CoordinateType>
+void validatePointFileHeader(const PointFileHeader& header)
+{
+    static_assert(
+        sizeof(Point<CoordinateType>) == 3 * sizeof(CoordinateType),
+        "Point must be laid out as three consecutive coordinates");
+
+    if (header.magic != pointFileMagic)
+    {
+        throw PointFileException{"not a point file (or wrong byte order)"};
+    }
+    else if (header.version != pointFileVersion)
+    {
+        throw PointFileException{"unsupported point file version"};
+    }
+    else if (header.coordinateKind != PointFileCoordinateKind<CoordinateType>::value
+             || header.coordinateSize != sizeof(CoordinateType))
+    {
+        throw PointFileException{"point file has a different coordinate type"};
+    }
+    else if (header.dataOffset < sizeof(PointFileHeader))
+    {
+        throw PointFileException{"point file has an invalid data offset"};
+    }
+}
+
+
+template <typename CoordinateType>
+PointFileHeader readPointFileHeader(const FileDescriptor& file)
+{
+    PointFileHeader header;
+    file.readAt(&header, sizeof(header), 0);
+    validatePointFileHeader<CoordinateType>(header);
+
+    // Both numbers come from the file, so we can't just add and multiply
+    // them: a large enough pointCount would wrap around and pass the check.
+    const std::uint64_t fileSize = file.size();
+
+    if (header.dataOffset > fileSize
+        || header.pointCount > (fileSize - header.dataOffset) / sizeof(Point<CoordinateType>))
+    {
+        throw PointFileException{"point file is truncated"};
+    }
+
+    return header;
+}
+
+
+template <typename CoordinateType>
+void writePointFile(
+    const std::string& path, const std::vector<Point<CoordinateType>>& points)
+{
+    static_assert(
+        std::is_trivially_copyable<Point<CoordinateType>>::value,
+        "Points must be trivially copyable to be written as raw bytes");
+
+    std::ofstream out{path, std::ios::binary | std::ios::trunc};
+
+    PointFileHeader header = makePointFileHeader<CoordinateType>(points.size());
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(
+        reinterpret_cast<const char*>(points.data()),
+        static_cast<std::streamsize>(points.size() * sizeof(Point<CoordinateType>)));
+
+    if (!out)
+    {
+        throw PointFileException{"could not write point file " + path};
+    }
+}
+
+
+template <typename CoordinateType>
+std::vector<Point<CoordinateType>> readPointFile(const std::string& path)
+{
+    FileDescriptor file = FileDescriptor::open(path, O_RDONLY);
+    PointFileHeader header = readPointFileHeader<CoordinateType>(file);
+
+    std::vector<Point<CoordinateType>> points(header.pointCount);
+    file.readAt(
+        points.data(), points.size() * sizeof(Point<CoordinateType>),
+        header.dataOffset);
+
+    return points;
+}
+
+
+
+#endif // POINTFILE_HPP
+
@@ -0,0 +1,371 @@
+// PointPartition.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines functions that split a set of
+// points into "shards" -- smaller sets of points that can each be given to
+// a different process, or a different machine, when there are too many
+// points (or their index is too large) for any one of them to hold.
+//
+// How we split the points matters, because a query about a point should
+// only have to be sent to the few shards that could contain an answer.
+// That means each shard's points should be close together, so that its
+// bounding box is small and most queries' neighborhoods miss it entirely.
+// Two ways of splitting are provided:
+//
+// * Morton ranges.  Sorting the points into Morton order (see
+//   MortonCode.hpp) puts points that are close together in space close
+//   together in the sorted order, most of the time.  Cutting the sorted
+//   points into equal-sized ranges gives shards that are each a compact
+//   region of space, and it's cheap: one sort.  The regions aren't boxes,
+//   though, so their bounding boxes can overlap a little.
+// * k-d splits.  Repeatedly cutting the points in two across the longest
+//   side of their bounding box, at the position that divides them in the
+//   right proportion, is the same idea as building a k-d tree (see
+//   KdTree.hpp), stopped after only a few levels.  The shards' boxes never
+//   overlap, so queries near a boundary touch fewer shards.
+//
+// Either way, each shard gets the same number of points, give or take one.
+// A PointPartition records, for each shard, its bounding box and which of
+// the original points it holds, which is all a router (see
+// ShardedPointIndex.hpp) needs to decide where to send a query and to turn
+// a shard's answer back into the original points' indexes.  A partition
+// can be written out and read back with a ByteWriter and ByteReader (see
+// ByteStream.hpp), so that routers don't need the points themselves.
+
+#ifndef POINTPARTITION_HPP
+#define POINTPARTITION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ByteStream.hpp"
+#include "MortonCode.hpp"
+#include "Point.hpp"
+
+
+
+class PointPartitionException : public std::runtime_error
+{
+public:
+    explicit PointPartitionException(const std::string& reason)
+        : std::runtime_error{reason}
+    {
+    }
+};
+
+
+
+enum class PartitionScheme
+{
+    MortonRanges,
+    KdSplits
+};
+
+
+// A shard's points are the original points with the given indexes, in that
+// order, so that point i of the shard is point indexes[i] of the original
+// points.  An empty shard's lower corner is infinite and its upper corner
+// negative infinity.
+struct PointShard
+{
+    Point<double> lower;
+    Point<double> upper;
+    std::vector<std::size_t> indexes;
+};
+
+
+struct PointPartition
+{
+    std::vector<PointShard> shards;
+
+    // pointCount() returns the total number of points in all the shards.
+    std::size_t pointCount() const;
+
+    void writeTo(ByteWriter& writer) const;
+
+    // readFrom() throws a PointPartitionException if the bytes aren't a
+    // partition.
+    static PointPartition readFrom(ByteReader& reader);
+};
+
+
+// partitionPoints() splits the points into the given number of shards
+// (some of which will be empty, if there are fewer points than shards).
+template <typename CoordinateType>
+PointPartition partitionPoints(
+    const std::vector<Point<CoordinateType>>& points, std::size_t shardCount,
+    PartitionScheme scheme = PartitionScheme::KdSplits);
+
+
+// shardPoints() returns the points in one shard of a partition.
+template <typename CoordinateType>
+std::vector<Point<CoordinateType>> shardPoints(
+    const std::vector<Point<CoordinateType>>& points,
+    const PointPartition& partition, std::size_t shard);
+
+
+// squaredDistanceToShard() returns the squared distance from a point to
+// the nearest part of a shard's bounding box, which is zero if the point
+// is inside it and infinite if the shard is empty.  No point in the shard
+// can be closer than that.
+double squaredDistanceToShard(const Point<double>& point, const PointShard& shard);
+
+
+
+namespace PointPartitionImpl
+{
+    constexpr std::uint32_t magic = 0x504D4853;   // "SHMP"
+    constexpr std::uint16_t version = 1;
+
+
+    template <typename CoordinateType>
+    double coordinate(const Point<CoordinateType>& point, unsigned int axis)
+    {
+        return static_cast<double>(axis == 0 ? point.x() : axis == 1 ? point.y() : point.z());
+    }
+
+
+    template <typename CoordinateType>
+    PointShard makeShard(
+        const std::vector<Point<CoordinateType>>& points,
+        std::vector<std::size_t>::const_iterator begin,
+        std::vector<std::size_t>::const_iterator end)
+    {
+        const double infinity = std::numeric_limits<double>::infinity();
+        double lower[3] = {infinity, infinity, infinity};
+        double upper[3] = {-infinity, -infinity, -infinity};
+
+        for (auto i = begin; i != end; ++i)
+        {
+            for (unsigned int axis = 0; axis < 3; ++axis)
+            {
+                const double value = coordinate(points[*i], axis);
+                lower[axis] = std::min(lower[axis], value);
+                upper[axis] = std::max(upper[axis], value);
+            }
+        }
+
+        return PointShard{
+            Point<double>{lower[0], lower[1], lower[2]},
+            Point<double>{upper[0], upper[1], upper[2]},
+            std::vector<std::size_t>(begin, end)};
+    }
+
+
+    // splitKd() divides the indexes in [begin, end) among shardCount
+    // shards, giving the first half of the shards the points on the low
+    // side of a cut across the longest side of their bounding box.
+
+    template <typename CoordinateType>
+    void splitKd(
+        const std::vector<Point<CoordinateType>>& points,
+        std::vector<std::size_t>& indexes, std::size_t begin, std::size_t end,
+        std::size_t shardCount, std::vector<PointShard>& shards)
+    {
+        if (shardCount == 1)
+        {
+            shards.push_back(makeShard(points, indexes.begin() + begin, indexes.begin() + end));
+            return;
+        }
+
+        const PointShard whole = makeShard(points, indexes.begin() + begin, indexes.begin() + end);
+        const double extents[3] = {
+            whole.upper.x() - whole.lower.x(),
+            whole.upper.y() - whole.lower.y(),
+            whole.upper.z() - whole.lower.z()};
+
+        unsigned int axis = 0;
+
+        for (unsigned int a = 1; a < 3; ++a)
+        {
+            if (extents[a] > extents[axis])
+            {
+                axis = a;
+            }
+        }
+
+        const std::size_t lowShards = shardCount / 2;
+        const std::size_t middle = begin + (end - begin) * lowShards / shardCount;
+
+        std::nth_element(
+            indexes.begin() + begin, indexes.begin() + middle, indexes.begin() + end,
+            [&](std::size_t a, std::size_t b)
+            {
+                return coordinate(points[a], axis) < coordinate(points[b], axis);
+            });
+
+        splitKd(points, indexes, begin, middle, lowShards, shards);
+        splitKd(points, indexes, middle, end, shardCount - lowShards, shards);
+    }
+}
+
+
+
+inline std::size_t PointPartition::pointCount() const
+{
+    std::size_t count = 0;
+
+    for (const PointShard& shard : shards)
+    {
+        count += shard.indexes.size();
+    }
+
+    return count;
+}
+
+
+inline void PointPartition::writeTo(ByteWriter& writer) const
+{
+    writer.writeU32(PointPartitionImpl::magic);
+    writer.writeU16(PointPartitionImpl::version);
+    writer.writeU32(static_cast<std::uint32_t>(shards.size()));
+
+    for (const PointShard& shard : shards)
+    {
+        writer.writeDouble(shard.lower.x());
+        writer.writeDouble(shard.lower.y());
+        writer.writeDouble(shard.lower.z());
+        writer.writeDouble(shard.upper.x());
+        writer.writeDouble(shard.upper.y());
+        writer.writeDouble(shard.upper.z());
+        writer.writeU64(shard.indexes.size());
+
+        for (std::size_t index : shard.indexes)
+        {
+            writer.writeU64(index);
+        }
+    }
+}
+
+
+inline PointPartition PointPartition::readFrom(ByteReader& reader)
+{
+    if (reader.readU32() != PointPartitionImpl::magic || reader.readU16() != PointPartitionImpl::version)
+    {
+        throw PointPartitionException{"not a point partition"};
+    }
+
+    PointPartition partition;
+    const std::uint32_t shardCount = reader.readU32();
+
+    for (std::uint32_t s = 0; s < shardCount; ++s)
+    {
+        double corners[6];
+
+        for (double& corner : corners)
+        {
+            corner = reader.readDouble();
+        }
+
+        const std::uint64_t count = reader.readU64();
+
+        if (count > reader.remaining() / 8)
+        {
+            throw PointPartitionException{"invalid point partition"};
+        }
+
+        PointShard shard{
+            Point<double>{corners[0], corners[1], corners[2]},
+            Point<double>{corners[3], corners[4], corners[5]},
+            std::vector<std::size_t>(static_cast<std::size_t>(count))};
+
+        for (std::size_t& index : shard.indexes)
+        {
+            index = static_cast<std::size_t>(reader.readU64());
+        }
+
+        partition.shards.push_back(std::move(shard));
+    }
+
+    return partition;
+}
+
+
+template <typename CoordinateType>
+PointPartition partitionPoints(
+    const std::vector<Point<CoordinateType>>& points, std::size_t shardCount,
+    PartitionScheme scheme)
+{
+    if (shardCount == 0)
+    {
+        throw std::invalid_argument{"a partition needs at least one shard"};
+    }
+
+    PointPartition partition;
+
+    if (scheme == PartitionScheme::MortonRanges)
+    {
+        const std::vector<std::size_t> order = mortonOrder(points);
+
+        for (std::size_t s = 0; s < shardCount; ++s)
+        {
+            const std::size_t begin = order.size() * s / shardCount;
+            const std::size_t end = order.size() * (s + 1) / shardCount;
+
+            partition.shards.push_back(
+                PointPartitionImpl::makeShard(points, order.begin() + begin, order.begin() + end));
+        }
+    }
+    else
+    {
+        std::vector<std::size_t> indexes(points.size());
+        std::iota(indexes.begin(), indexes.end(), std::size_t{0});
+
+        PointPartitionImpl::splitKd(points, indexes, 0, indexes.size(), shardCount, partition.shards);
+    }
+
+    return partition;
+}
+
+
+template <typename CoordinateType>
+std::vector<Point<CoordinateType>> shardPoints(
+    const std::vector<Point<CoordinateType>>& points,
+    const PointPartition& partition, std::size_t shard)
+{
+    std::vector<Point<CoordinateType>> result;
+    result.reserve(partition.shards.at(shard).indexes.size());
+
+    for (std::size_t index : partition.shards[shard].indexes)
+    {
+        result.push_back(points.at(index));
+    }
+
+    return result;
+}
+
+
+inline double squaredDistanceToShard(const Point<double>& point, const PointShard& shard)
+{
+    if (shard.indexes.empty())
+    {
+        return std::numeric_limits<double>::infinity();
+    }
+
+    const double values[3] = {point.x(), point.y(), point.z()};
+    const double lower[3] = {shard.lower.x(), shard.lower.y(), shard.lower.z()};
+    const double upper[3] = {shard.upper.x(), shard.upper.y(), shard.upper.z()};
+
+    double squaredDistance = 0.0;
+
+    for (unsigned int axis = 0; axis < 3; ++axis)
+    {
+        const double gap = std::max({lower[axis] - values[axis], values[axis] - upper[axis], 0.0});
+        squaredDistance += gap * gap;
+    }
+
+    return squaredDistance;
+}
+
+
+
+#endif // POINTPARTITION_HPP
+
@@ -0,0 +1,653 @@
+// PointPipeline.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a template class called
+// PointPipeline, which describes a sequence of processing steps applied to
+// a vector of points (or of anything else), without carrying any of them
+// out until their result is actually needed.
+//
+// The straightforward way to transform some points, throw away the ones we
+// don't want, and then thin out what's left is to write three loops, each
+// producing a new vector for the next one to read.  Each of those vectors
+// takes memory and time to fill, and by the time the third loop runs, the
+// points the first loop wrote have long since been pushed out of the cache.
+// A pipeline instead visits each point once, carrying it through all of
+// the steps before moving on to the next one:
+//
+//     std::vector<Point<float>> result =
+//         (pipelineOf(points)
+//          | transformed(sensorToWorld)
+//          | filtered([](const Point<double>& p) { return p.z() > 0.0; })
+//          | strided(4)
+//          | mortonSorted()
+//          | mapped([](const Point<double>& p) { return Point<float>{...}; }))
+//         .collect();
+//
+// (The parentheses are needed, since a member function call like collect()
+// binds more tightly than |; without them, collect() would be called on
+// the last step rather than on the whole pipeline.)
+//
+// Most steps -- mapped(), filtered(), transformed(), keptBy(), strided() --
+// look at one element at a time, so a chain of them can be "fused" into a
+// single loop.  Some steps can't work that way: sorting needs to see all of
+// the elements before it can produce the first one.  Those steps, which
+// we'll call "barriers," carry out the steps before them, store the result,
+// and start a new pipeline from it.  Nothing else is ever stored in between.
+//
+// When a pipeline runs, its input is split into chunks, which are carried
+// through the steps in parallel on the threads of a ThreadPool.  The
+// functions given to mapped(), filtered(), and forEach() may therefore be
+// called from more than one thread at a time, and shouldn't modify anything
+// shared without synchronizing.  The order of the elements is preserved.
+//
+// Each element is identified by its position in the pipeline's input (that
+// is, in the vector given to pipelineOf(), or in the vector stored by the
+// most recent barrier), which is what keptBy() and strided() look at.
+
+#ifndef POINTPIPELINE_HPP
+#define POINTPIPELINE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "KdTree.hpp"
+#include "MortonCode.hpp"
+#include "Point.hpp"
+#include "PointSetOperations.hpp"
+#include "ThreadPool.hpp"
+
+
+
+namespace PointPipelineImpl
+{
+    // Each chunk of work handed to the pool is this many consecutive input
+    // elements.
+    constexpr std::size_t itemsPerChunk = 16384;
+
+
+    // OutputOf<Input, Stages...>::Type is the type of element that comes
+    // out of the given steps when elements of type Input go in.
+    template <typename Input, typename... Stages>
+    struct OutputOf
+    {
+        using Type = Input;
+    };
+
+    template <typename Input, typename First, typename... Rest>
+    struct OutputOf<Input, First, Rest...>
+    {
+        using Type = typename OutputOf<typename First::template Output<Input>, Rest...>::Type;
+    };
+
+
+    // A step is "one-to-one" if exactly one element comes out of it for
+    // each one that goes in.  When all of a pipeline's steps are, the
+    // result is the same size as the input, and each chunk can write its
+    // results directly into place.
+    template <typename... Stages>
+    constexpr bool allOneToOne = (Stages::oneToOne && ...);
+
+
+    template <typename CoordinateType>
+    struct CoordinateOf;
+
+    template <typename CoordinateType>
+    struct CoordinateOf<Point<CoordinateType>>
+    {
+        using Type = CoordinateType;
+    };
+}
+
+
+
+// Each of the element-by-element steps is a class with a wrap() function
+// that, given a "sink" -- a function that accepts an element's position
+// and value, representing everything that happens to the element after
+// this step -- returns a new sink that carries out this step and then
+// passes the result along.  Wrapping the last step's sink with the one
+// before it, and so on back to the first, produces a single function that
+// carries an element through all of the steps.
+
+template <typename Function>
+struct MappedStage
+{
+    static constexpr bool oneToOne = true;
+
+    template <typename Input>
+    using Output = std::decay_t<std::invoke_result_t<const Function&, const Input&>>;
+
+    template <typename Sink>
+    auto wrap(Sink sink) const
+    {
+        return
+            [this, sink](std::size_t position, const auto& value)
+            {
+                sink(position, function(value));
+            };
+    }
+
+    Function function;
+};
+
+
+template <typename Predicate>
+struct FilteredStage
+{
+    static constexpr bool oneToOne = false;
+
+    template <typename Input>
+    using Output = Input;
+
+    template <typename Sink>
+    auto wrap(Sink sink) const
+    {
+        return
+            [this, sink](std::size_t position, const auto& value)
+            {
+                if (predicate(value))
+                {
+                    sink(position, value);
+                }
+            };
+    }
+
+    Predicate predicate;
+};
+
+
+struct KeptByStage
+{
+    static constexpr bool oneToOne = false;
+
+    template <typename Input>
+    using Output = Input;
+
+    template <typename Sink>
+    auto wrap(Sink sink) const
+    {
+        return
+            [this, sink](std::size_t position, const auto& value)
+            {
+                if (position < mask->size() && (*mask)[position] != 0)
+                {
+                    sink(position, value);
+                }
+            };
+    }
+
+    const std::vector<std::uint8_t>* mask;
+};
+
+
+struct StridedStage
+{
+    static constexpr bool oneToOne = false;
+
+    template <typename Input>
+    using Output = Input;
+
+    template <typename Sink>
+    auto wrap(Sink sink) const
+    {
+        return
+            [this, sink](std::size_t position, const auto& value)
+            {
+                if (position % step == 0)
+                {
+                    sink(position, value);
+                }
+            };
+    }
+
+    std::size_t step;
+};
+
+
+// The barriers don't need a wrap() function, since they're never fused;
+// they're handled by their own versions of operator|.
+
+template <typename Compare>
+struct SortedStage
+{
+    Compare compare;
+};
+
+
+struct MortonSortedStage
+{
+};
+
+
+
+// mapped() replaces each element with the result of calling a function on
+// it, which may be of a different type.  filtered() keeps only elements for
+// which a function returns true.  transformed() applies a RigidTransform to
+// each point.  keptBy() keeps only the elements whose positions are nonzero
+// in a mask, like the ones produced by the functions in OutlierFilters.hpp;
+// the mask must outlive the pipeline.  strided() keeps every step-th
+// element, starting with the first.
+template <typename Function>
+MappedStage<Function> mapped(Function function);
+
+template <typename Predicate>
+FilteredStage<Predicate> filtered(Predicate predicate);
+
+auto transformed(const RigidTransform& transform);
+
+KeptByStage keptBy(const std::vector<std::uint8_t>& mask);
+
+StridedStage strided(std::size_t step);
+
+
+// sorted() is a barrier that sorts the elements using compare, while
+// mortonSorted() is a barrier that sorts points into Morton order (see
+// MortonCode.hpp), which places points that are near each other in space
+// near each other in memory.
+template <typename Compare>
+SortedStage<Compare> sorted(Compare compare);
+
+MortonSortedStage mortonSorted();
+
+
+
+template <typename Element, typename... Stages>
+class PointPipeline
+{
+public:
+    // ValueType is the type of the elements that come out of the pipeline.
+    using ValueType = typename PointPipelineImpl::OutputOf<Element, Stages...>::Type;
+
+
+    // Pipelines are usually created by pipelineOf() and extended by
+    // operator|, rather than being constructed directly.
+    PointPipeline(
+        std::shared_ptr<const std::vector<Element>> input, ThreadPool& pool,
+        std::tuple<Stages...> stages);
+
+
+    // then() returns a new pipeline with one more element-by-element step
+    // at the end of this one.  (operator| calls it.)
+    template <typename Stage>
+    PointPipeline<Element, Stages..., Stage> then(Stage stage) const;
+
+
+    // collect() runs the pipeline and returns its elements.  count()
+    // returns how many elements it produces, without storing any of them.
+    // forEach() calls a function on each of its elements.  index() builds a
+    // KdTree from its elements, which must be Points.
+    std::vector<ValueType> collect() const;
+    std::size_t count() const;
+
+    template <typename Function>
+    void forEach(Function function) const;
+
+    auto index(std::size_t leafSize = 16) const;
+
+
+    ThreadPool& pool() const;
+
+
+private:
+    // run() splits the input into chunks and, for each chunk, calls
+    // makeSink(chunk) to get the function that receives the elements that
+    // come out of the chunk, which it then runs the chunk's elements
+    // through.
+    template <typename MakeSink>
+    void run(MakeSink makeSink) const;
+
+    template <std::size_t Count, typename Sink>
+    auto wrapFirst(Sink sink) const;
+
+    std::size_t chunkCount() const;
+
+    std::shared_ptr<const std::vector<Element>> input_;
+    ThreadPool* pool_;
+    std::tuple<Stages...> stages_;
+};
+
+
+
+// pipelineOf() starts a pipeline whose input is a vector.  If the vector
+// is given as an lvalue, the pipeline refers to it without copying it, so
+// it must outlive the pipeline; if it's given as an rvalue, the pipeline
+// takes it over.
+template <typename Element>
+PointPipeline<Element> pipelineOf(
+    const std::vector<Element>& items, ThreadPool& pool = defaultThreadPool());
+
+template <typename Element>
+PointPipeline<Element> pipelineOf(
+    std::vector<Element>&& items, ThreadPool& pool = defaultThreadPool());
+
+
+
+template <typename Function>
+MappedStage<Function> mapped(Function function)
+{
+    return MappedStage<Function>{std::move(function)};
+}
+
+
+template <typename Predicate>
+FilteredStage<Predicate> filtered(Predicate predicate)
+{
+    return FilteredStage<Predicate>{std::move(predicate)};
+}
+
+
+inline auto transformed(const RigidTransform& transform)
+{
+    return mapped(
+        [transform](const auto& point)
+        {
+            return transform.apply(point);
+        });
+}
+
+
+inline KeptByStage keptBy(const std::vector<std::uint8_t>& mask)
+{
+    return KeptByStage{&mask};
+}
+
+
+inline StridedStage strided(std::size_t step)
+{
+    return StridedStage{std::max<std::size_t>(step, 1)};
+}
+
+
+template <typename Compare>
+SortedStage<Compare> sorted(Compare compare)
+{
+    return SortedStage<Compare>{std::move(compare)};
+}
+
+
+inline MortonSortedStage mortonSorted()
+{
+    return MortonSortedStage{};
+}
+
+
+template <typename Element, typename... Stages>
+PointPipeline<Element, Stages...>::PointPipeline(
+    std::shared_ptr<const std::vector<Element>> input, ThreadPool& pool,
+    std::tuple<Stages...> stages)
+    : input_{std::move(input)}, pool_{&pool}, stages_{std::move(stages)}
+{
+}
+
+
+template <typename Element, typename... Stages>
+template <typename Stage>
+PointPipeline<Element, Stages..., Stage> PointPipeline<Element, Stages...>::then(Stage stage) const
+{
+    return PointPipeline<Element, Stages..., Stage>{
+        input_, *pool_, std::tuple_cat(stages_, std::make_tuple(std::move(stage)))};
+}
+
+
+template <typename Element, typename... Stages>
+std::vector<typename PointPipeline<Element, Stages...>::ValueType>
+PointPipeline<Element, Stages...>::collect() const
+{
+    if constexpr (PointPipelineImpl::allOneToOne<Stages...>
+                  && std::is_default_constructible_v<ValueType>)
+    {
+        std::vector<ValueType> result(input_->size());
+        ValueType* output = result.data();
+
+        run(
+            [output](std::size_t)
+            {
+                return
+                    [output](std::size_t position, const ValueType& value)
+                    {
+                        output[position] = value;
+                    };
+            });
+
+        return result;
+    }
+    else
+    {
+        std::vector<std::vector<ValueType>> parts(chunkCount());
+
+        run(
+            [&parts](std::size_t chunk)
+            {
+                std::vector<ValueType>* part = &parts[chunk];
+
+                return
+                    [part](std::size_t, const ValueType& value)
+                    {
+                        part->push_back(value);
+                    };
+            });
+
+        std::size_t total = 0;
+
+        for (const std::vector<ValueType>& part : parts)
+        {
+            total += part.size();
+        }
+
+        std::vector<ValueType> result;
+        result.reserve(total);
+
+        for (std::vector<ValueType>& part : parts)
+        {
+            result.insert(
+                result.end(), std::make_move_iterator(part.begin()),
+                std::make_move_iterator(part.end()));
+
+            std::vector<ValueType>{}.swap(part);
+        }
+
+        return result;
+    }
+}
+
+
+template <typename Element, typename... Stages>
+std::size_t PointPipeline<Element, Stages...>::count() const
+{
+    if constexpr (PointPipelineImpl::allOneToOne<Stages...>)
+    {
+        return input_->size();
+    }
+    else
+    {
+        std::vector<std::size_t> counts(chunkCount(), 0);
+
+        run(
+            [&counts](std::size_t chunk)
+            {
+                std::size_t* counter = &counts[chunk];
+
+                return
+                    [counter](std::size_t, const ValueType&)
+                    {
+                        ++*counter;
+                    };
+            });
+
+        std::size_t total = 0;
+
+        for (std::size_t count : counts)
+        {
+            total += count;
+        }
+
+        return total;
+    }
+}
+
+
+template <typename Element, typename... Stages>
+template <typename Function>
+void PointPipeline<Element, Stages...>::forEach(Function function) const
+{
+    const Function* functionPointer = &function;
+
+    run(
+        [functionPointer](std::size_t)
+        {
+            return
+                [functionPointer](std::size_t, const ValueType& value)
+                {
+                    (*functionPointer)(value);
+                };
+        });
+}
+
+
+template <typename Element, typename... Stages>
+auto PointPipeline<Element, Stages...>::index(std::size_t leafSize) const
+{
+    using CoordinateType = typename PointPipelineImpl::CoordinateOf<ValueType>::Type;
+    return KdTree<CoordinateType>{collect(), leafSize};
+}
+
+
+template <typename Element, typename... Stages>
+ThreadPool& PointPipeline<Element, Stages...>::pool() const
+{
+    return *pool_;
+}
+
+
+template <typename Element, typename... Stages>
+template <typename MakeSink>
+void PointPipeline<Element, Stages...>::run(MakeSink makeSink) const
+{
+    using namespace PointPipelineImpl;
+
+    const std::vector<Element>& input = *input_;
+
+    pool_->parallelFor(
+        0, chunkCount(), 1,
+        [&](std::size_t firstChunk, std::size_t lastChunk)
+        {
+            for (std::size_t chunk = firstChunk; chunk < lastChunk; ++chunk)
+            {
+                const auto sink = wrapFirst<sizeof...(Stages)>(makeSink(chunk));
+                const std::size_t begin = chunk * itemsPerChunk;
+                const std::size_t end = std::min(input.size(), begin + itemsPerChunk);
+
+                for (std::size_t position = begin; position < end; ++position)
+                {
+                    sink(position, input[position]);
+                }
+            }
+        });
+}
+
+
+// wrapFirst<Count>() wraps a sink with the first Count steps, last one
+// first.
+
+template <typename Element, typename... Stages>
+template <std::size_t Count, typename Sink>
+auto PointPipeline<Element, Stages...>::wrapFirst(Sink sink) const
+{
+    if constexpr (Count == 0)
+    {
+        return sink;
+    }
+    else
+    {
+        return wrapFirst<Count - 1>(std::get<Count - 1>(stages_).wrap(sink));
+    }
+}
+
+
+template <typename Element, typename... Stages>
+std::size_t PointPipeline<Element, Stages...>::chunkCount() const
+{
+    using namespace PointPipelineImpl;
+    return (input_->size() + itemsPerChunk - 1) / itemsPerChunk;
+}
+
+
+// A pipeline that refers to a vector it doesn't own holds a shared_ptr
+// that points to the vector but doesn't own anything, so that it can be
+// treated the same way as one that does.
+
+template <typename Element>
+PointPipeline<Element> pipelineOf(const std::vector<Element>& items, ThreadPool& pool)
+{
+    return PointPipeline<Element>{
+        std::shared_ptr<const std::vector<Element>>{std::shared_ptr<void>{}, &items},
+        pool, std::tuple<>{}};
+}
+
+
+template <typename Element>
+PointPipeline<Element> pipelineOf(std::vector<Element>&& items, ThreadPool& pool)
+{
+    return PointPipeline<Element>{
+        std::make_shared<const std::vector<Element>>(std::move(items)),
+        pool, std::tuple<>{}};
+}
+
+
+// operator| adds a step to the end of a pipeline.  The element-by-element
+// steps are simply remembered; the barriers run the pipeline so far and
+// start a new one from its result.
+
+template <typename Element, typename... Stages, typename Stage>
+auto operator|(const PointPipeline<Element, Stages...>& pipeline, Stage stage)
+    -> decltype(pipeline.then(std::move(stage)))
+{
+    return pipeline.then(std::move(stage));
+}
+
+
+template <typename Element, typename... Stages, typename Compare>
+auto operator|(const PointPipeline<Element, Stages...>& pipeline, SortedStage<Compare> stage)
+{
+    using ValueType = typename PointPipeline<Element, Stages...>::ValueType;
+
+    std::vector<ValueType> items = pipeline.collect();
+    std::sort(items.begin(), items.end(), stage.compare);
+
+    return pipelineOf(std::move(items), pipeline.pool());
+}
+
+
+template <typename Element, typename... Stages>
+auto operator|(const PointPipeline<Element, Stages...>& pipeline, MortonSortedStage)
+{
+    using ValueType = typename PointPipeline<Element, Stages...>::ValueType;
+
+    const std::vector<ValueType> items = pipeline.collect();
+    const std::vector<std::size_t> order = mortonOrder(items);
+
+    std::vector<ValueType> ordered(items.size());
+
+    pipeline.pool().parallelFor(
+        0, items.size(), PointPipelineImpl::itemsPerChunk,
+        [&](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                ordered[i] = items[order[i]];
+            }
+        });
+
+    return pipelineOf(std::move(ordered), pipeline.pool());
+}
+
+
+
+#endif // POINTPIPELINE_HPP
+
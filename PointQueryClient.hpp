@@ -0,0 +1,521 @@
+// PointQueryClient.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a class called PointQueryClient,
+// which connects to a PointQueryServer (see PointQueryServer.hpp) and asks
+// it questions about its points, along with a function for measuring how
+// fast a server answers when many clients ask it questions at once.
+//
+// The simplest way to use a client is one query at a time:
+//
+//     PointQueryClient client = PointQueryClient::connectUnix("/tmp/points");
+//     std::vector<PointNeighbor> neighbors = client.nearest(Point<double>{1, 2, 3}, 10);
+//
+// but each of those takes a round trip to the server and back, which costs
+// far more than the query itself.  Sending a batch of queries with query()
+// pays for one round trip for all of them.  Going further, send() and
+// receive() separate the two halves of the round trip, so a client can
+// have several batches in flight at once ("pipelining"), keeping the
+// server busy while the responses to earlier batches travel back.
+// Responses arrive in the order that their requests were sent.
+//
+// A client's socket is an ordinary blocking one, so each call waits until
+// it's done.  A pipelining client shouldn't get too far ahead of the
+// server, though: if it sends many megabytes of requests without reading
+// any responses, the server will stop reading its requests until it does,
+// and a send() that can't finish will then wait forever.
+
+#ifndef POINTQUERYCLIENT_HPP
+#define POINTQUERYCLIENT_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "BatchScheduler.hpp"
+#include "ByteStream.hpp"
+#include "FileDescriptor.hpp"
+#include "KdTree.hpp"
+#include "Point.hpp"
+#include "PointQueryProtocol.hpp"
+
+
+
+class PointQueryClientException : public std::runtime_error
+{
+public:
+    explicit PointQueryClientException(const std::string& reason)
+        : std::runtime_error{reason}
+    {
+    }
+};
+
+
+
+class PointQueryClient
+{
+public:
+    // connectUnix() connects to a server's Unix domain socket, and
+    // connectTcp() to a server's TCP port on the given host (by default,
+    // the loopback address).
+    static PointQueryClient connectUnix(const std::string& path);
+    static PointQueryClient connectTcp(
+        std::uint16_t port, const std::string& host = "127.0.0.1");
+
+
+    // send() sends a batch of queries as one request, without waiting for
+    // its response; receive() waits for the response to the oldest request
+    // whose response hasn't been received yet, and stores its results (one
+    // per query, in the same order) in the given vector.
+    void send(const PointQuery* queries, std::size_t count);
+    void send(const std::vector<PointQuery>& queries);
+    void receive(std::vector<PointQueryResult>& results);
+
+
+    // query() sends a batch of queries and waits for their results.
+    std::vector<PointQueryResult> query(const std::vector<PointQuery>& queries);
+
+
+    // These functions each ask one question and wait for the answer, which
+    // is the same as what the KdTree member function of the same name
+    // would return, except that the server may cut off very long results.
+    // They throw a PointQueryClientException if the server says the query
+    // is invalid.  The client doesn't know how many points the server has,
+    // so if there are none, closest() returns noNeighbor as the index
+    // (rather than the size, as KdTree::closest() does), along with an
+    // infinite distance.
+    std::vector<PointNeighbor> nearest(const Point<double>& point, std::uint32_t k);
+    std::vector<PointNeighbor> withinRadius(const Point<double>& point, double radius);
+    PointNeighbor closest(const Point<double>& point);
+
+    static constexpr std::size_t noNeighbor = std::numeric_limits<std::size_t>::max();
+
+
+    // pendingCount() returns the number of requests sent whose responses
+    // haven't been received.
+    std::size_t pendingCount() const;
+
+
+private:
+    explicit PointQueryClient(FileDescriptor socket);
+
+    PointQueryResult queryOne(const PointQuery& query);
+    void fill(std::size_t count);
+
+    FileDescriptor socket_;
+    std::vector<std::uint8_t> output_;
+    std::vector<std::uint8_t> input_;
+    std::size_t inputStart_;
+    std::size_t pendingCount_;
+};
+
+
+
+struct PointQueryLoadOptions
+{
+    // The number of connections, each used by its own thread.
+    std::size_t connectionCount = 4;
+
+    // The number of queries in each request.
+    std::size_t batchSize = 64;
+
+    // The most requests each connection has in flight at once.
+    std::size_t pipelineDepth = 4;
+
+    // How long to keep sending requests.
+    double seconds = 1.0;
+};
+
+
+// Latencies are measured per request, from just before it's sent until
+// its response has been received, in seconds.
+struct PointQueryLoadReport
+{
+    std::size_t queryCount = 0;
+    std::size_t requestCount = 0;
+    double seconds = 0.0;
+    double queriesPerSecond = 0.0;
+    double medianLatency = 0.0;
+    double latency90 = 0.0;
+    double latency99 = 0.0;
+    double maxLatency = 0.0;
+};
+
+
+// runPointQueryLoadTest() opens the given number of connections, each by
+// calling connect() (which returns a PointQueryClient), and has each of them
+// send batches of queries -- taken in turn from the given queries, each
+// connection starting at a different place -- as fast as the server will
+// answer them, for the given length of time.  It returns what it measured.
+template <typename Connect>
+PointQueryLoadReport runPointQueryLoadTest(
+    Connect connect, const std::vector<PointQuery>& queries,
+    const PointQueryLoadOptions& options = PointQueryLoadOptions{});
+
+
+
+inline PointQueryClient::PointQueryClient(FileDescriptor socket)
+    : socket_{std::move(socket)}, inputStart_{0}, pendingCount_{0}
+{
+}
+
+
+inline PointQueryClient PointQueryClient::connectUnix(const std::string& path)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+
+    if (path.empty() || path.size() >= sizeof(address.sun_path))
+    {
+        throw std::invalid_argument{"Unix domain socket path is empty or too long"};
+    }
+
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    FileDescriptor socket{::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+
+    if (!socket.isOpen())
+    {
+        throw std::system_error{errno, std::generic_category(), "socket"};
+    }
+
+    if (::connect(socket.get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        throw std::system_error{errno, std::generic_category(), path};
+    }
+
+    return PointQueryClient{std::move(socket)};
+}
+
+
+inline PointQueryClient PointQueryClient::connectTcp(std::uint16_t port, const std::string& host)
+{
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+
+    if (::inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1)
+    {
+        throw std::invalid_argument{"not an IPv4 address: " + host};
+    }
+
+    FileDescriptor socket{::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+
+    if (!socket.isOpen())
+    {
+        throw std::system_error{errno, std::generic_category(), "socket"};
+    }
+
+    if (::connect(socket.get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        throw std::system_error{errno, std::generic_category(), "connect"};
+    }
+
+    const int enable = 1;
+    ::setsockopt(socket.get(), IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    return PointQueryClient{std::move(socket)};
+}
+
+
+inline void PointQueryClient::send(const PointQuery* queries, std::size_t count)
+{
+    output_.clear();
+    PointQueryProtocol::writeRequest(output_, queries, count);
+
+    std::size_t sent = 0;
+
+    while (sent < output_.size())
+    {
+        const ssize_t result = ::send(
+            socket_.get(), output_.data() + sent, output_.size() - sent, MSG_NOSIGNAL);
+
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            throw std::system_error{errno, std::generic_category(), "send"};
+        }
+
+        sent += static_cast<std::size_t>(result);
+    }
+
+    ++pendingCount_;
+}
+
+
+inline void PointQueryClient::send(const std::vector<PointQuery>& queries)
+{
+    send(queries.data(), queries.size());
+}
+
+
+inline void PointQueryClient::receive(std::vector<PointQueryResult>& results)
+{
+    if (pendingCount_ == 0)
+    {
+        throw PointQueryClientException{"no request is waiting for a response"};
+    }
+
+    fill(PointQueryProtocol::lengthBytes);
+
+    const std::uint32_t length = PointQueryProtocol::frameLength(input_.data() + inputStart_);
+    fill(PointQueryProtocol::lengthBytes + length);
+
+    ByteReader reader{input_.data() + inputStart_ + PointQueryProtocol::lengthBytes, length};
+    PointQueryProtocol::readResponse(reader, results);
+
+    inputStart_ += PointQueryProtocol::lengthBytes + length;
+    --pendingCount_;
+}
+
+
+// fill() reads until at least count bytes past inputStart_ have arrived.
+// Reads ask for more than that, when there's room, since the responses to
+// pipelined requests often arrive together.
+
+inline void PointQueryClient::fill(std::size_t count)
+{
+    if (inputStart_ > 0 && input_.size() - inputStart_ < count)
+    {
+        input_.erase(input_.begin(), input_.begin() + inputStart_);
+        inputStart_ = 0;
+    }
+
+    while (input_.size() - inputStart_ < count)
+    {
+        const std::size_t oldSize = input_.size();
+        const std::size_t wanted = std::max<std::size_t>(count - (oldSize - inputStart_), 64 * 1024);
+        input_.resize(oldSize + wanted);
+
+        const ssize_t result = ::recv(socket_.get(), input_.data() + oldSize, wanted, 0);
+        input_.resize(oldSize + static_cast<std::size_t>(std::max<ssize_t>(result, 0)));
+
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            throw std::system_error{errno, std::generic_category(), "recv"};
+        }
+        else if (result == 0)
+        {
+            throw PointQueryClientException{"the server closed the connection"};
+        }
+    }
+}
+
+
+inline std::vector<PointQueryResult> PointQueryClient::query(const std::vector<PointQuery>& queries)
+{
+    std::vector<PointQueryResult> results;
+    send(queries);
+    receive(results);
+
+    if (results.size() != queries.size())
+    {
+        throw PointQueryClientException{"response has the wrong number of results"};
+    }
+
+    return results;
+}
+
+
+inline PointQueryResult PointQueryClient::queryOne(const PointQuery& query)
+{
+    std::vector<PointQueryResult> results = this->query(std::vector<PointQuery>{query});
+
+    if (results[0].status == PointQueryStatus::Invalid)
+    {
+        throw PointQueryClientException{"the server says the query is invalid"};
+    }
+
+    return std::move(results[0]);
+}
+
+
+inline std::vector<PointNeighbor> PointQueryClient::nearest(const Point<double>& point, std::uint32_t k)
+{
+    return queryOne(PointQuery{PointQueryKind::Nearest, point, k, 0.0}).neighbors;
+}
+
+
+inline std::vector<PointNeighbor> PointQueryClient::withinRadius(const Point<double>& point, double radius)
+{
+    return queryOne(PointQuery{PointQueryKind::WithinRadius, point, 0, radius}).neighbors;
+}
+
+
+// As with KdTree::closest(), an empty set of points has no closest point,
+// which we report as an infinite distance, with an index that can't be
+// mistaken for a real point's.
+
+inline PointNeighbor PointQueryClient::closest(const Point<double>& point)
+{
+    PointQueryResult result = queryOne(PointQuery{PointQueryKind::Closest, point, 0, 0.0});
+
+    if (result.neighbors.empty())
+    {
+        return PointNeighbor{noNeighbor, std::numeric_limits<double>::infinity()};
+    }
+
+    return result.neighbors[0];
+}
+
+
+inline std::size_t PointQueryClient::pendingCount() const
+{
+    return pendingCount_;
+}
+
+
+// Each connection keeps its pipeline full: it sends until pipelineDepth
+// requests are in flight, then waits for the oldest response before
+// sending another.  Once time is up, it stops sending but still receives
+// everything it's owed, so every request sent is counted.
+
+template <typename Connect>
+PointQueryLoadReport runPointQueryLoadTest(
+    Connect connect, const std::vector<PointQuery>& queries, const PointQueryLoadOptions& options)
+{
+    if (queries.empty())
+    {
+        throw std::invalid_argument{"a load test needs at least one query"};
+    }
+
+    using Clock = std::chrono::steady_clock;
+
+    const std::size_t connectionCount = std::max<std::size_t>(options.connectionCount, 1);
+    const std::size_t batchSize = std::max<std::size_t>(options.batchSize, 1);
+    const std::size_t pipelineDepth = std::max<std::size_t>(options.pipelineDepth, 1);
+
+    std::vector<PointQueryClient> clients;
+
+    for (std::size_t i = 0; i < connectionCount; ++i)
+    {
+        clients.push_back(connect());
+    }
+
+    std::vector<std::vector<double>> latencies(connectionCount);
+    std::vector<std::size_t> queryCounts(connectionCount, 0);
+    std::exception_ptr failure;
+    std::mutex failureMutex;
+
+    const Clock::time_point start = Clock::now();
+    const Clock::time_point deadline =
+        start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>{options.seconds});
+
+    std::vector<std::thread> threads;
+
+    for (std::size_t c = 0; c < connectionCount; ++c)
+    {
+        threads.emplace_back(
+            [&, c]
+            {
+                try
+                {
+                    PointQueryClient& client = clients[c];
+                    std::vector<PointQuery> batch(batchSize);
+                    std::vector<PointQueryResult> results;
+                    std::deque<Clock::time_point> sendTimes;
+                    std::size_t next = c * queries.size() / connectionCount;
+
+                    while (true)
+                    {
+                        const bool sending = Clock::now() < deadline;
+
+                        if (sending && sendTimes.size() < pipelineDepth)
+                        {
+                            for (PointQuery& query : batch)
+                            {
+                                query = queries[next];
+                                next = (next + 1 == queries.size()) ? 0 : next + 1;
+                            }
+
+                            sendTimes.push_back(Clock::now());
+                            client.send(batch);
+                            continue;
+                        }
+
+                        if (sendTimes.empty())
+                        {
+                            break;
+                        }
+
+                        client.receive(results);
+
+                        latencies[c].push_back(
+                            std::chrono::duration<double>(Clock::now() - sendTimes.front()).count());
+
+                        sendTimes.pop_front();
+                        queryCounts[c] += results.size();
+                    }
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock{failureMutex};
+                    failure = std::current_exception();
+                }
+            });
+    }
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    if (failure)
+    {
+        std::rethrow_exception(failure);
+    }
+
+    PointQueryLoadReport report;
+    report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<double> allLatencies;
+
+    for (std::size_t c = 0; c < connectionCount; ++c)
+    {
+        report.queryCount += queryCounts[c];
+        allLatencies.insert(allLatencies.end(), latencies[c].begin(), latencies[c].end());
+    }
+
+    report.requestCount = allLatencies.size();
+    report.queriesPerSecond = report.seconds > 0.0
+        ? static_cast<double>(report.queryCount) / report.seconds : 0.0;
+
+    report.medianLatency = percentileOf(allLatencies, 0.5);
+    report.latency90 = percentileOf(allLatencies, 0.9);
+    report.latency99 = percentileOf(allLatencies, 0.99);
+    report.maxLatency = percentileOf(allLatencies, 1.0);
+
+    return report;
+}
+
+
+
+#endif // POINTQUERYCLIENT_HPP
+
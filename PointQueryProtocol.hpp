@@ -0,0 +1,294 @@
+// PointQueryProtocol.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file describes the binary protocol that PointQueryServer
+// (see PointQueryServer.hpp) and PointQueryClient (see PointQueryClient.hpp)
+// use to ask and answer questions about a set of points over a socket, and
+// declares and defines the functions that turn queries and their results
+// into bytes and back.
+//
+// Everything sent in either direction is a "frame": a 32-bit length,
+// followed by that many bytes.  A stream socket delivers bytes, not
+// messages, so one read might return half a frame or several frames; the
+// length is what lets the receiver tell where each frame ends.
+//
+// * A request frame holds a batch of queries: a 32-bit count, then each
+//   query's kind (one byte), the query point (three doubles), and the
+//   query's parameter (a 32-bit k for nearest-neighbor queries, or a
+//   double radius for radius queries; closest-point queries have none).
+// * A response frame holds one result per query, in the same order: a
+//   status (one byte), a 32-bit count of neighbors, and then each
+//   neighbor's index (64 bits) and distance (a double).
+//
+// Sending queries in batches is what makes a server like this fast: the
+// cost of a system call, a wakeup, and a trip through the network stack is
+// paid once per batch rather than once per query.  A client can also send
+// several request frames without waiting for their responses
+// ("pipelining"); responses come back in the order the requests were sent.
+//
+// All numbers are little-endian, by way of ByteWriter and ByteReader (see
+// ByteStream.hpp), and everything read is checked against the frame's
+// length, so a malformed frame causes an exception rather than a read past
+// the end of a buffer.
+
+#ifndef POINTQUERYPROTOCOL_HPP
+#define POINTQUERYPROTOCOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "ByteStream.hpp"
+#include "KdTree.hpp"
+#include "Point.hpp"
+
+
+
+enum class PointQueryKind : std::uint8_t
+{
+    Nearest = 1,
+    WithinRadius = 2,
+    Closest = 3
+};
+
+
+// A PointQuery asks for the k points nearest a point, the points within a
+// radius of it, or the one point closest to it.
+struct PointQuery
+{
+    PointQueryKind kind;
+    Point<double> point;
+    std::uint32_t k;
+    double radius;
+};
+
+
+// Ok means the result is complete.  Truncated means there were more
+// neighbors within the radius than the server is willing to send, so only
+// the closest of them were sent.  Invalid means the query couldn't be
+// answered: its point can't be represented in the server's coordinate
+// type, or its radius is negative or not a number.  (A query of an unknown
+// kind can't even be read, since its kind determines how long it is, so
+// the server treats it as a malformed request and closes the connection.)
+enum class PointQueryStatus : std::uint8_t
+{
+    Ok = 0,
+    Truncated = 1,
+    Invalid = 2
+};
+
+
+struct PointQueryResult
+{
+    PointQueryStatus status;
+    std::vector<PointNeighbor> neighbors;
+};
+
+
+
+namespace PointQueryProtocol
+{
+    // The length of a frame, which precedes it, takes this many bytes.
+    constexpr std::size_t lengthBytes = 4;
+
+    // Frames longer than this are rejected as malformed.
+    constexpr std::uint32_t maximumFrameBytes = 64u << 20;
+
+    // The smallest a query or a neighbor can be in a frame.
+    constexpr std::size_t minimumQueryBytes = 1 + 3 * 8;
+    constexpr std::size_t neighborBytes = 8 + 8;
+
+
+    // beginFrame() leaves room for a frame's length at the end of a buffer,
+    // returning where it goes; endFrame() fills it in once the frame's
+    // contents have been written after it.
+    std::size_t beginFrame(std::vector<std::uint8_t>& buffer);
+    void endFrame(std::vector<std::uint8_t>& buffer, std::size_t start);
+
+
+    // frameLength() returns the length of the frame whose length field
+    // starts at the given position, or throws a ByteStreamException if it's
+    // too long.  The caller must have checked that the length field itself
+    // has arrived.
+    std::uint32_t frameLength(const std::uint8_t* start);
+
+
+    void writeRequest(std::vector<std::uint8_t>& buffer, const PointQuery* queries, std::size_t count);
+    void readRequest(ByteReader& reader, std::vector<PointQuery>& queries);
+
+    void writeResult(ByteWriter& writer, const PointQueryResult& result);
+    void readResponse(ByteReader& reader, std::vector<PointQueryResult>& results);
+}
+
+
+
+inline std::size_t PointQueryProtocol::beginFrame(std::vector<std::uint8_t>& buffer)
+{
+    const std::size_t start = buffer.size();
+    buffer.resize(start + lengthBytes);
+    return start;
+}
+
+
+inline void PointQueryProtocol::endFrame(std::vector<std::uint8_t>& buffer, std::size_t start)
+{
+    const std::uint64_t length = buffer.size() - start - lengthBytes;
+
+    if (length > maximumFrameBytes)
+    {
+        throw ByteStreamException{"frame is too long"};
+    }
+
+    for (std::size_t i = 0; i < lengthBytes; ++i)
+    {
+        buffer[start + i] = static_cast<std::uint8_t>(length >> (8 * i));
+    }
+}
+
+
+inline std::uint32_t PointQueryProtocol::frameLength(const std::uint8_t* start)
+{
+    ByteReader reader{start, lengthBytes};
+    const std::uint32_t length = reader.readU32();
+
+    if (length > maximumFrameBytes)
+    {
+        throw ByteStreamException{"frame is too long"};
+    }
+
+    return length;
+}
+
+
+inline void PointQueryProtocol::writeRequest(
+    std::vector<std::uint8_t>& buffer, const PointQuery* queries, std::size_t count)
+{
+    const std::size_t start = beginFrame(buffer);
+    ByteWriter writer{buffer};
+
+    writer.writeU32(static_cast<std::uint32_t>(count));
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        const PointQuery& query = queries[i];
+
+        writer.writeU8(static_cast<std::uint8_t>(query.kind));
+        writer.writeDouble(query.point.x());
+        writer.writeDouble(query.point.y());
+        writer.writeDouble(query.point.z());
+
+        if (query.kind == PointQueryKind::Nearest)
+        {
+            writer.writeU32(query.k);
+        }
+        else if (query.kind == PointQueryKind::WithinRadius)
+        {
+            writer.writeDouble(query.radius);
+        }
+    }
+
+    endFrame(buffer, start);
+}
+
+
+// A query of an unknown kind has no way to say how long its parameter is,
+// so it makes the rest of the frame unreadable; the whole frame is
+// rejected.
+
+inline void PointQueryProtocol::readRequest(ByteReader& reader, std::vector<PointQuery>& queries)
+{
+    const std::uint32_t count = reader.readU32();
+
+    if (count > reader.remaining() / minimumQueryBytes)
+    {
+        throw ByteStreamException{"request has more queries than it has room for"};
+    }
+
+    queries.clear();
+    queries.reserve(count);
+
+    for (std::uint32_t i = 0; i < count; ++i)
+    {
+        PointQuery query{PointQueryKind::Closest, Point<double>{}, 0, 0.0};
+        const std::uint8_t kind = reader.readU8();
+
+        const double x = reader.readDouble();
+        const double y = reader.readDouble();
+        const double z = reader.readDouble();
+        query.point = Point<double>{x, y, z};
+
+        switch (kind)
+        {
+        case static_cast<std::uint8_t>(PointQueryKind::Nearest):
+            query.kind = PointQueryKind::Nearest;
+            query.k = reader.readU32();
+            break;
+
+        case static_cast<std::uint8_t>(PointQueryKind::WithinRadius):
+            query.kind = PointQueryKind::WithinRadius;
+            query.radius = reader.readDouble();
+            break;
+
+        case static_cast<std::uint8_t>(PointQueryKind::Closest):
+            query.kind = PointQueryKind::Closest;
+            break;
+
+        default:
+            throw ByteStreamException{"unknown query kind"};
+        }
+
+        queries.push_back(query);
+    }
+}
+
+
+inline void PointQueryProtocol::writeResult(ByteWriter& writer, const PointQueryResult& result)
+{
+    writer.writeU8(static_cast<std::uint8_t>(result.status));
+    writer.writeU32(static_cast<std::uint32_t>(result.neighbors.size()));
+
+    for (const PointNeighbor& neighbor : result.neighbors)
+    {
+        writer.writeU64(neighbor.index);
+        writer.writeDouble(neighbor.distance);
+    }
+}
+
+
+inline void PointQueryProtocol::readResponse(ByteReader& reader, std::vector<PointQueryResult>& results)
+{
+    const std::uint32_t count = reader.readU32();
+
+    if (count > reader.remaining() / 5)
+    {
+        throw ByteStreamException{"response has more results than it has room for"};
+    }
+
+    results.resize(count);
+
+    for (PointQueryResult& result : results)
+    {
+        result.status = static_cast<PointQueryStatus>(reader.readU8());
+
+        const std::uint32_t neighborCount = reader.readU32();
+
+        if (neighborCount > reader.remaining() / neighborBytes)
+        {
+            throw ByteStreamException{"result has more neighbors than it has room for"};
+        }
+
+        result.neighbors.resize(neighborCount);
+
+        for (PointNeighbor& neighbor : result.neighbors)
+        {
+            neighbor.index = static_cast<std::size_t>(reader.readU64());
+            neighbor.distance = reader.readDouble();
+        }
+    }
+}
+
+
+
+#endif // POINTQUERYPROTOCOL_HPP
+
@@ -0,0 +1,931 @@
+// PointQueryServer.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a class template called
+// PointQueryServer, which answers nearest-neighbor, radius, and
+// closest-point queries about the points in a KdTree for other processes
+// on the same machine, over a Unix domain socket or a TCP socket bound to
+// the loopback address.  When many programs need to ask questions about
+// the same large set of points, it's wasteful for each of them to load the
+// points and build its own tree; instead, one process owns the tree and
+// the others ask it.  The protocol is described in PointQueryProtocol.hpp,
+// and PointQueryClient.hpp provides the other end of the conversation.
+//
+// The server runs a fixed number of worker threads, each pinned to its own
+// core, and each with its own epoll instance (the Linux facility for
+// waiting on many file descriptors at once).  Every worker waits on every
+// listening socket, with EPOLLEXCLUSIVE, so that a new connection wakes
+// only one of them; whichever worker accepts a connection owns it from then
+// on.  That makes each worker a "shard": its connections, buffers, and
+// scratch space are its own, so the workers never lock anything or share
+// any data except the (read-only) tree.
+//
+// Sockets are nonblocking, so a worker never waits on one client while
+// others have work for it.  Each connection has an input buffer, where
+// bytes accumulate until there's at least one complete request frame, and
+// an output buffer, where responses wait until the socket can take them.
+// The complete frames in the input buffer are answered in one go, so a
+// client that pipelines many requests has them answered in a single
+// wakeup.  If a client sends requests faster than it reads responses, its
+// output buffer grows until it reaches a limit, at which point the worker
+// stops answering (and reading) that client's requests until the
+// responses already waiting have been sent; this "back-pressure" bounds
+// the memory any one client can make the server use to the limit plus one
+// response.
+//
+// A client that sends something that isn't a well-formed request frame is
+// disconnected; since a stream has no other way to find the start of the
+// next frame, there's nothing else we could safely do.
+
+#ifndef POINTQUERYSERVER_HPP
+#define POINTQUERYSERVER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "ByteStream.hpp"
+#include "FileDescriptor.hpp"
+#include "KdTree.hpp"
+#include "Point.hpp"
+#include "PointQueryProtocol.hpp"
+
+
+
+class PointQueryServerException : public std::runtime_error
+{
+public:
+    explicit PointQueryServerException(const std::string& reason)
+        : std::runtime_error{reason}
+    {
+    }
+};
+
+
+
+struct PointQueryServerOptions
+{
+    // The number of worker threads; at least one is always started.
+    unsigned int workerCount = std::thread::hardware_concurrency();
+
+    // Whether to pin each worker to its own core, which keeps its
+    // connections' buffers in that core's caches.
+    bool pinWorkers = true;
+
+    // The most neighbors sent back for any one query.  Results with more
+    // are cut off after the closest ones and marked as truncated.
+    std::size_t maximumResults = 65536;
+
+    // Once this many bytes of responses are waiting to be sent to a
+    // client, the server stops answering and reading that client's
+    // requests until they've been sent.
+    std::size_t maximumPendingBytes = 16u << 20;
+};
+
+
+
+template <typename CoordinateType>
+class PointQueryServer
+{
+public:
+    // The tree must outlive the server, and must not be changed while the
+    // server is running.
+    explicit PointQueryServer(
+        const KdTree<CoordinateType>& tree,
+        const PointQueryServerOptions& options = PointQueryServerOptions{});
+
+
+    // Destroying a PointQueryServer stops it, closes its listening sockets,
+    // and removes the files of any Unix domain sockets it created.
+    ~PointQueryServer();
+
+    PointQueryServer(const PointQueryServer&) = delete;
+    PointQueryServer& operator=(const PointQueryServer&) = delete;
+
+
+    // listenUnix() listens on a Unix domain socket with the given path,
+    // replacing any file that's already there.  listenTcp() listens on
+    // the given TCP port of the loopback address (127.0.0.1) only, so that
+    // other machines can't connect; a port of 0 asks the operating system
+    // to choose an unused one.  listenTcp() returns the port.  Both must
+    // be called before start(), and either can be called more than once.
+    void listenUnix(const std::string& path);
+    std::uint16_t listenTcp(std::uint16_t port = 0);
+
+
+    // start() starts the worker threads, which answer queries until stop()
+    // is called.  stop() waits for them to finish and disconnects every
+    // client.
+    void start();
+    void stop();
+
+
+    // queryCount() returns the number of queries answered so far, and
+    // connectionCount() the number of clients currently connected.
+    std::uint64_t queryCount() const;
+    std::size_t connectionCount() const;
+
+
+private:
+    struct Connection
+    {
+        FileDescriptor socket;
+        std::vector<std::uint8_t> input;
+        std::size_t inputStart = 0;
+        std::vector<std::uint8_t> output;
+        std::size_t outputStart = 0;
+        std::uint32_t interest = 0;
+        bool peerClosed = false;
+    };
+
+
+    struct Worker
+    {
+        FileDescriptor epoll;
+        FileDescriptor wake;
+        std::thread thread;
+        std::unordered_map<int, std::unique_ptr<Connection>> connections;
+        std::atomic<std::uint64_t> queryCount{0};
+        std::atomic<std::size_t> connectionCount{0};
+        std::vector<PointQuery> queries;
+        PointQueryResult result;
+    };
+
+
+    void addListener(FileDescriptor listener);
+
+    void run(Worker& worker);
+    void accept(Worker& worker, int listener);
+    bool serve(Worker& worker, Connection& connection, std::uint32_t events);
+    void receive(Connection& connection);
+    bool answerFrames(Worker& worker, Connection& connection);
+    std::size_t pendingOutput(const Connection& connection) const;
+    void answer(Worker& worker, ByteReader& request, std::vector<std::uint8_t>& output);
+    void answerQuery(const PointQuery& query, std::size_t limit, PointQueryResult& result) const;
+    void flush(Connection& connection);
+    void updateInterest(Worker& worker, Connection& connection);
+    void close(Worker& worker, int descriptor);
+
+    const KdTree<CoordinateType>* tree_;
+    PointQueryServerOptions options_;
+    std::vector<FileDescriptor> listeners_;
+    std::vector<std::string> unixPaths_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    bool running_;
+};
+
+
+
+namespace PointQueryServerImpl
+{
+    // Each epoll registration carries 64 bits of data, which tell us what
+    // became ready: a connection's descriptor, a listening socket's index
+    // (with the high bit set), or the worker's wakeup eventfd.
+    constexpr std::uint64_t listenerTag = std::uint64_t{1} << 63;
+    constexpr std::uint64_t wakeTag = ~std::uint64_t{0};
+
+    // Sockets are read in pieces of this many bytes, and at most this many
+    // pieces are read per wakeup, so that one busy client can't starve the
+    // others sharing its worker.
+    constexpr std::size_t readBytes = 64 * 1024;
+    constexpr int readsPerWakeup = 4;
+
+    constexpr int maximumEvents = 64;
+
+
+    inline void epollAdd(int epoll, int descriptor, std::uint32_t events, std::uint64_t tag)
+    {
+        epoll_event event{};
+        event.events = events;
+        event.data.u64 = tag;
+
+        if (::epoll_ctl(epoll, EPOLL_CTL_ADD, descriptor, &event) != 0)
+        {
+            throw std::system_error{errno, std::generic_category(), "epoll_ctl"};
+        }
+    }
+
+
+    template <typename CoordinateType>
+    bool representable(double value)
+    {
+        if (!std::isfinite(value))
+        {
+            return false;
+        }
+
+        if constexpr (std::is_integral<CoordinateType>::value)
+        {
+            return value >= static_cast<double>(std::numeric_limits<CoordinateType>::min())
+                && value <= static_cast<double>(std::numeric_limits<CoordinateType>::max());
+        }
+        else
+        {
+            return true;
+        }
+    }
+}
+
+
+
+template <typename CoordinateType>
+PointQueryServer<CoordinateType>::PointQueryServer(
+    const KdTree<CoordinateType>& tree, const PointQueryServerOptions& options)
+    : tree_{&tree}, options_{options}, running_{false}
+{
+    options_.workerCount = std::max(options_.workerCount, 1u);
+}
+
+
+template <typename CoordinateType>
+PointQueryServer<CoordinateType>::~PointQueryServer()
+{
+    stop();
+
+    for (const std::string& path : unixPaths_)
+    {
+        ::unlink(path.c_str());
+    }
+}
+
+
+template <typename CoordinateType>
+void PointQueryServer<CoordinateType>::listenUnix(const std::string& path)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+
+    if (path.empty() || path.size() >= sizeof(address.sun_path))
+    {
+        throw std::invalid_argument{"Unix domain socket path is empty or too long"};
+    }
+
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    FileDescriptor listener{::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)};
+
+    if (!listener.isOpen())
+    {
+        throw std::system_error{errno, std::generic_category(), "socket"};
+    }
+
+    ::unlink(path.c_str());
+
+    if (::bind(listener.get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        throw std::system_error{errno, std::generic_category(), path};
+    }
+
+    unixPaths_.push_back(path);
+    addListener(std::move(listener));
+}
+
+
+template <typename CoordinateType>
+std::uint16_t PointQueryServer<CoordinateType>::listenTcp(std::uint16_t port)
+{
+    FileDescriptor listener{::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)};
+
+    if (!listener.isOpen())
+    {
+        throw std::system_error{errno, std::generic_category(), "socket"};
+    }
+
+    const int enable = 1;
+    ::setsockopt(listener.get(), SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (::bind(listener.get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        throw std::system_error{errno, std::generic_category(), "bind"};
+    }
+
+    socklen_t addressLength = sizeof(address);
+
+    if (::getsockname(listener.get(), reinterpret_cast<sockaddr*>(&address), &addressLength) != 0)
+    {
+        throw std::system_error{errno, std::generic_category(), "getsockname"};
+    }
+
+    addListener(std::move(listener));
+    return ntohs(address.sin_port);
+}
+
+
+template <typename CoordinateType>
+void PointQueryServer<CoordinateType>::addListener(FileDescriptor listener)
+{
+    if (running_)
+    {
+        throw PointQueryServerException{"cannot listen on a new socket while the server is running"};
+    }
+
+    if (::listen(listener.get(), SOMAXCONN) != 0)
+    {
+        throw std::system_error{errno, std::generic_category(), "listen"};
+    }
+
+    listeners_.push_back(std::move(listener));
+}
+
+
+// All of the workers' epoll instances are set up before any of them start,
+// so that a failure leaves nothing running.
+
+template <typename CoordinateType>
+void PointQueryServer<CoordinateType>::start()
+{
+    if (running_)
+    {
+        return;
+    }
+
+    if (listeners_.empty())
+    {
+        throw PointQueryServerException{"the server isn't listening on any sockets"};
+    }
+
+    workers_.clear();
+
+    for (unsigned int i = 0; i < options_.workerCount; ++i)
+    {
+        std::unique_ptr<Worker> worker = std::make_unique<Worker>();
+
+        worker->epoll = FileDescriptor{::epoll_create1(EPOLL_CLOEXEC)};
+
+        if (!worker->epoll.isOpen())
+        {
+            throw std::system_error{errno, std::generic_category(), "epoll_create1"};
+        }
+
+        worker->wake = FileDescriptor{::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)};
+
+        if (!worker->wake.isOpen())
+        {
+            throw std::system_error{errno, std::generic_category(), "eventfd"};
+        }
+
+        PointQueryServerImpl::epollAdd(
+            worker->epoll.get(), worker->wake.get(), EPOLLIN, PointQueryServerImpl::wakeTag);
+
+        for (std::size_t j = 0; j < listeners_.size(); ++j)
+        {
+            PointQueryServerImpl::epollAdd(
+                worker->epoll.get(), listeners_[j].get(), EPOLLIN | EPOLLEXCLUSIVE,
+                PointQueryServerImpl::listenerTag | j);
+        }
+
+        workers_.push_back(std::move(worker));
+    }
+
+    const unsigned int coreCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+    for (std::size_t i = 0; i < workers_.size(); ++i)
+    {
+        Worker& worker = *workers_[i];
+        worker.thread = std::thread{[this, &worker] { run(worker); }};
+
+        if (options_.pinWorkers)
+        {
+            cpu_set_t cores;
+            CPU_ZERO(&cores);
+            CPU_SET(i % coreCount, &cores);
+            pthread_setaffinity_np(worker.thread.native_handle(), sizeof(cores), &cores);
+        }
+    }
+
+    running_ = true;
+}
+
+
+template <typename CoordinateType>
+void PointQueryServer<CoordinateType>::stop()
+{
+    if (!running_)
+    {
+        return;
+    }
+
+    for (std::unique_ptr<Worker>& worker : workers_)
+    {
+        const std::uint64_t one = 1;
+        [[maybe_unused]] ssize_t written = ::write(worker->wake.get(), &one, sizeof(one));
+    }
+
+    for (std::unique_ptr<Worker>& worker : workers_)
+    {
+        worker->thread.join();
+    }
+
+    workers_.clear();
+    running_ = false;
+}
+
+
+template <typename CoordinateType>
+std::uint64_t PointQueryServer<CoordinateType>::queryCount() const
+{
+    std::uint64_t count = 0;
+
+    for (const std::unique_ptr<Worker>& worker : workers_)
+    {
+        count += worker->queryCount.load(std::memory_order_relaxed);
+    }
+
+    return count;
+}
+
+
+template <typename CoordinateType>
+std::size_t PointQueryServer<CoordinateType>::connectionCount() const
+{
+    std::size_t count = 0;
+
+    for (const std::unique_ptr<Worker>& worker : workers_)
+    {
+        count += worker->connectionCount.load(std::memory_order_relaxed);
+    }
+
+    return count;
+}
+
+
+// Everything that can go wrong with one connection closes just that
+// connection; a worker thread only stops when it's asked to (or when
+// epoll_wait() itself fails, which means something is badly wrong).
+
+template <typename CoordinateType>
+void PointQueryServer<CoordinateType>::run(Worker& worker)
+{
+    epoll_event events[PointQueryServerImpl::maximumEvents];
+
+    while (true)
+    {
+        const int eventCount = ::epoll_wait(
+            worker.epoll.get(), events, PointQueryServerImpl::maximumEvents, -1);
+
+        if (eventCount < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            break;
+        }
+
+        for (int i = 0; i < eventCount; ++i)
+        {
+            const std::uint64_t tag = events[i].data.u64;
+
+            if (tag == PointQueryServerImpl::wakeTag)
+            {
+                worker.connections.clear();
+                worker.connectionCount.store(0, std::memory_order_relaxed);
+                return;
+            }
+            else if ((tag & PointQueryServerImpl::listenerTag) != 0)
+            {
+                accept(worker, listeners_[tag & ~PointQueryServerImpl::listenerTag].get());
+            }
+            else
+            {
+                const int descriptor = static_cast<int>(tag);
+                auto found = worker.connections.find(descriptor);
+
+                if (found == worker.connections.end())
+                {
+                    continue;
+                }
+
+                bool keep;
+
+                try
+                {
+                    keep = serve(worker, *found->second, events[i].events);
+                }
+                catch (const std::exception&)
+                {
+                    keep = false;
+                }
+
+                if (!keep)
+                {
+                    close(worker, descriptor);
+                }
+            }
+        }
+    }
+
+    worker.connections.clear();
+    worker.connectionCount.store(0, std::memory_order_relaxed);
+}
+
+
+// We accept one connection per wakeup.  The listening socket is
+// level-triggered, so if more connections are waiting, another worker
+// (or this one, again) will be woken to accept the next, which spreads
+// connections across the workers rather than giving a burst of them all
+// to whichever worker happened to wake first.
+
+template <typename CoordinateType>
+void PointQueryServer<CoordinateType>::accept(Worker& worker, int listener)
+{
+    FileDescriptor socket{::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)};
+
+    if (!socket.isOpen())
+    {
+        return;
+    }
+
+    // Responses should go out as soon as they're written, rather than
+    // waiting to be combined with later ones.  This fails harmlessly on a
+    // Unix domain socket, which never waits.
+    const int enable = 1;
+    ::setsockopt(socket.get(), IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    const int descriptor = socket.get();
+
+    std::unique_ptr<Connection> connection = std::make_unique<Connection>();
+    connection->socket = std::move(socket);
+    connection->interest = EPOLLIN;
+
+    try
+    {
+        PointQueryServerImpl::epollAdd(
+            worker.epoll.get(), descriptor, EPOLLIN, static_cast<std::uint64_t>(descriptor));
+    }
+    catch (const std::system_error&)
+    {
+        return;
+    }
+
+    worker.connections[descriptor] = std::move(connection);
+    worker.connectionCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+// serve() handles whatever happened on a connection, returning false if
+// it should be closed.
+
+template <typename CoordinateType>
+bool PointQueryServer<CoordinateType>::serve(
+    Worker& worker, Connection& connection, std::uint32_t events)
+{
+    if ((events & EPOLLERR) != 0)
+    {
+        return false;
+    }
+
+    if ((events & (EPOLLIN | EPOLLHUP)) != 0 && !connection.peerClosed)
+    {
+        receive(connection);
+    }
+
+    // Answering stops when too much output is waiting; once some of it
+    // has been sent, we can go back to answering where we left off.
+    bool moreFrames = answerFrames(worker, connection);
+    flush(connection);
+
+    while (moreFrames && pendingOutput(connection) < options_.maximumPendingBytes)
+    {
+        moreFrames = answerFrames(worker, connection);
+        flush(connection);
+    }
+
+    if (connection.peerClosed && connection.outputStart == connection.output.size())
+    {
+        return false;
+    }
+
+    updateInterest(worker, connection);
+    return true;
+}
+
+
+// A client that closes its end of the connection after sending its last
+// requests still gets its answers; we stop reading from it, but keep the
+// connection until everything has been sent.
+
+template <typename CoordinateType>
+void PointQueryServer<CoordinateType>::receive(Connection& connection)
+{
+    std::vector<std::uint8_t>& input = connection.input;
+
+    if (connection.inputStart > 0)
+    {
+        input.erase(input.begin(), input.begin() + connection.inputStart);
+        connection.inputStart = 0;
+    }
+
+    for (int i = 0; i < PointQueryServerImpl::readsPerWakeup; ++i)
+    {
+        const std::size_t oldSize = input.size();
+        input.resize(oldSize + PointQueryServerImpl::readBytes);
+
+        const ssize_t result = ::recv(
+            connection.socket.get(), input.data() + oldSize, PointQueryServerImpl::readBytes, 0);
+
+        input.resize(oldSize + static_cast<std::size_t>(std::max<ssize_t>(result, 0)));
+
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return;
+            }
+
+            throw std::system_error{errno, std::generic_category(), "recv"};
+        }
+        else if (result == 0)
+        {
+            connection.peerClosed = true;
+            return;
+        }
+        else if (static_cast<std::size_t>(result) < PointQueryServerImpl::readBytes)
+        {
+            return;
+        }
+    }
+}
+
+
+// answerFrames() answers complete frames from the input buffer until
+// there are no more or too much output is waiting, returning true in the
+// latter case if there are complete frames left to answer.
+
+template <typename CoordinateType>
+bool PointQueryServer<CoordinateType>::answerFrames(Worker& worker, Connection& connection)
+{
+    const std::vector<std::uint8_t>& input = connection.input;
+    std::size_t& start = connection.inputStart;
+
+    while (input.size() - start >= PointQueryProtocol::lengthBytes)
+    {
+        if (pendingOutput(connection) >= options_.maximumPendingBytes)
+        {
+            return input.size() - start - PointQueryProtocol::lengthBytes
+                >= PointQueryProtocol::frameLength(input.data() + start);
+        }
+
+        const std::uint32_t length = PointQueryProtocol::frameLength(input.data() + start);
+
+        if (input.size() - start - PointQueryProtocol::lengthBytes < length)
+        {
+            break;
+        }
+
+        ByteReader request{input.data() + start + PointQueryProtocol::lengthBytes, length};
+        answer(worker, request, connection.output);
+
+        start += PointQueryProtocol::lengthBytes + length;
+    }
+
+    return false;
+}
+
+
+template <typename CoordinateType>
+std::size_t PointQueryServer<CoordinateType>::pendingOutput(const Connection& connection) const
+{
+    return connection.output.size() - connection.outputStart;
+}
+
+
+// Each result is limited not only by maximumResults, but also by how much
+// room is left in the response frame, after setting aside room for the
+// (possibly empty) results that follow it, so that no response is ever too
+// long for a client to accept.
+
+template <typename CoordinateType>
+void PointQueryServer<CoordinateType>::answer(
+    Worker& worker, ByteReader& request, std::vector<std::uint8_t>& output)
+{
+    PointQueryProtocol::readRequest(request, worker.queries);
+
+    if (request.remaining() != 0)
+    {
+        throw ByteStreamException{"request has bytes left over after its queries"};
+    }
+
+    const std::size_t count = worker.queries.size();
+    const std::size_t resultHeaderBytes = 5;
+
+    const std::size_t start = PointQueryProtocol::beginFrame(output);
+    ByteWriter writer{output};
+    writer.writeU32(static_cast<std::uint32_t>(count));
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        const std::size_t used = output.size() - start - PointQueryProtocol::lengthBytes;
+        const std::size_t reserved = resultHeaderBytes * (count - i);
+        const std::size_t room = PointQueryProtocol::maximumFrameBytes - used - reserved;
+
+        const std::size_t limit = std::min(
+            options_.maximumResults, room / PointQueryProtocol::neighborBytes);
+
+        answerQuery(worker.queries[i], limit, worker.result);
+        PointQueryProtocol::writeResult(writer, worker.result);
+    }
+
+    PointQueryProtocol::endFrame(output, start);
+    worker.queryCount.fetch_add(count, std::memory_order_relaxed);
+}
+
+
+template <typename CoordinateType>
+void PointQueryServer<CoordinateType>::answerQuery(
+    const PointQuery& query, std::size_t limit, PointQueryResult& result) const
+{
+    result.status = PointQueryStatus::Ok;
+    result.neighbors.clear();
+
+    using PointQueryServerImpl::representable;
+
+    if (!representable<CoordinateType>(query.point.x())
+        || !representable<CoordinateType>(query.point.y())
+        || !representable<CoordinateType>(query.point.z()))
+    {
+        result.status = PointQueryStatus::Invalid;
+        return;
+    }
+
+    const Point<CoordinateType> point{
+        static_cast<CoordinateType>(query.point.x()),
+        static_cast<CoordinateType>(query.point.y()),
+        static_cast<CoordinateType>(query.point.z())};
+
+    switch (query.kind)
+    {
+    case PointQueryKind::Nearest:
+    {
+        const std::size_t wanted = std::min<std::size_t>(query.k, tree_->size());
+        result.neighbors = tree_->nearest(point, std::min(wanted, limit));
+
+        if (wanted > limit)
+        {
+            result.status = PointQueryStatus::Truncated;
+        }
+
+        break;
+    }
+
+    case PointQueryKind::WithinRadius:
+        if (!(query.radius >= 0.0))
+        {
+            result.status = PointQueryStatus::Invalid;
+            break;
+        }
+
+        result.neighbors = tree_->withinRadius(point, query.radius);
+
+        if (result.neighbors.size() > limit)
+        {
+            result.neighbors.resize(limit);
+            result.status = PointQueryStatus::Truncated;
+        }
+
+        break;
+
+    case PointQueryKind::Closest:
+        if (tree_->size() == 0)
+        {
+            break;
+        }
+        else if (limit == 0)
+        {
+            result.status = PointQueryStatus::Truncated;
+            break;
+        }
+
+        result.neighbors.push_back(tree_->closest(point));
+        break;
+
+    default:
+        result.status = PointQueryStatus::Invalid;
+        break;
+    }
+}
+
+
+// flush() sends as much pending output as the socket will take without
+// waiting.  MSG_NOSIGNAL keeps a client that has gone away from killing
+// the whole server with a SIGPIPE.
+
+template <typename CoordinateType>
+void PointQueryServer<CoordinateType>::flush(Connection& connection)
+{
+    std::vector<std::uint8_t>& output = connection.output;
+
+    while (connection.outputStart < output.size())
+    {
+        const ssize_t result = ::send(
+            connection.socket.get(), output.data() + connection.outputStart,
+            output.size() - connection.outputStart, MSG_NOSIGNAL);
+
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return;
+            }
+
+            throw std::system_error{errno, std::generic_category(), "send"};
+        }
+
+        connection.outputStart += static_cast<std::size_t>(result);
+    }
+
+    output.clear();
+    connection.outputStart = 0;
+}
+
+
+// We ask to hear about a connection becoming writable only while there's
+// output waiting for it (otherwise, since a socket is almost always
+// writable, we'd be woken constantly), and about it becoming readable only
+// while its pending output is under the limit.
+
+template <typename CoordinateType>
+void PointQueryServer<CoordinateType>::updateInterest(Worker& worker, Connection& connection)
+{
+    const std::size_t pending = pendingOutput(connection);
+    std::uint32_t interest = 0;
+
+    if (!connection.peerClosed && pending < options_.maximumPendingBytes)
+    {
+        interest |= EPOLLIN;
+    }
+
+    if (pending > 0)
+    {
+        interest |= EPOLLOUT;
+    }
+
+    if (interest != connection.interest)
+    {
+        const int descriptor = connection.socket.get();
+
+        epoll_event event{};
+        event.events = interest;
+        event.data.u64 = static_cast<std::uint64_t>(descriptor);
+
+        if (::epoll_ctl(worker.epoll.get(), EPOLL_CTL_MOD, descriptor, &event) != 0)
+        {
+            throw std::system_error{errno, std::generic_category(), "epoll_ctl"};
+        }
+
+        connection.interest = interest;
+    }
+}
+
+
+template <typename CoordinateType>
+void PointQueryServer<CoordinateType>::close(Worker& worker, int descriptor)
+{
+    if (worker.connections.erase(descriptor) > 0)
+    {
+        worker.connectionCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+
+
+#endif // POINTQUERYSERVER_HPP
+
@@ -0,0 +1,300 @@
+// PointQueryStreams.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines "streaming" versions of the queries
+// that a KdTree supports.  Rather than computing every result up front and
+// returning them all in a vector, each of these functions is a coroutine
+// that returns a Generator (see Generator.hpp), which produces results one
+// at a time as the caller asks for them.  This header requires C++20.
+//
+// This matters when the caller only wants the first few results.  Consider
+// a caller that wants "the nearest point that satisfies some condition."
+// With KdTree::nearest(), they'd have to guess how many neighbors to ask
+// for, and ask again for more if none of them satisfied the condition.  With
+// streamNearest(), they just loop until they find one and then stop; the
+// points beyond that one are never found, and the parts of the tree they
+// would have been found in are never visited.
+//
+//     for (const PointNeighbor& neighbor : streamNearest(tree, query))
+//     {
+//         if (isInteresting(neighbor.index))
+//         {
+//             break;
+//         }
+//     }
+//
+// streamNearest() and streamWithinRadius() produce results closest first,
+// using what's called a "best-first" search.  Both nodes and points go into
+// a single priority queue, ordered by their distance from the query; a
+// node's distance is the distance to the nearest part of its box, which is
+// no more than the distance to any of its points.  So when a point reaches
+// the front of the queue, nothing left in the queue -- and nothing inside
+// any node left in the queue -- can be closer, which means it's safe to
+// yield that point right away.
+//
+// Every function has a second form taking std::allocator_arg and a
+// std::pmr::memory_resource as its first two arguments.  Both the coroutine
+// frame and the priority queue are allocated from that resource, so a
+// caller who provides one backed by preallocated memory can run queries
+// without allocating anything.  The KdTree must outlive the Generator.
+
+#ifndef POINTQUERYSTREAMS_HPP
+#define POINTQUERYSTREAMS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+#include "Generator.hpp"
+#include "KdTree.hpp"
+#include "Point.hpp"
+
+
+
+// streamNearest() yields every point in the tree, closest to the query
+// point first.
+template <typename CoordinateType>
+Generator<PointNeighbor> streamNearest(
+    std::allocator_arg_t, std::pmr::memory_resource* resource,
+    const KdTree<CoordinateType>& tree, Point<CoordinateType> query);
+
+template <typename CoordinateType>
+Generator<PointNeighbor> streamNearest(
+    const KdTree<CoordinateType>& tree, Point<CoordinateType> query);
+
+
+// streamWithinRadius() yields the points whose distance from the query
+// point is no more than radius, closest first; a negative radius yields
+// nothing.
+template <typename CoordinateType>
+Generator<PointNeighbor> streamWithinRadius(
+    std::allocator_arg_t, std::pmr::memory_resource* resource,
+    const KdTree<CoordinateType>& tree, Point<CoordinateType> query,
+    double radius);
+
+template <typename CoordinateType>
+Generator<PointNeighbor> streamWithinRadius(
+    const KdTree<CoordinateType>& tree, Point<CoordinateType> query,
+    double radius);
+
+
+// streamWithinBox() yields the indexes of the points inside the box with
+// the given lower and upper corners (inclusive).  There's no natural order
+// for these, so they're yielded in whatever order the tree stores them.
+template <typename CoordinateType>
+Generator<std::size_t> streamWithinBox(
+    std::allocator_arg_t, std::pmr::memory_resource* resource,
+    const KdTree<CoordinateType>& tree, Point<CoordinateType> lower,
+    Point<CoordinateType> upper);
+
+template <typename CoordinateType>
+Generator<std::size_t> streamWithinBox(
+    const KdTree<CoordinateType>& tree, Point<CoordinateType> lower,
+    Point<CoordinateType> upper);
+
+
+
+template <typename CoordinateType>
+Generator<PointNeighbor> streamNearest(
+    std::allocator_arg_t, std::pmr::memory_resource* resource,
+    const KdTree<CoordinateType>& tree, Point<CoordinateType> query)
+{
+    return streamWithinRadius(
+        std::allocator_arg, resource, tree, query,
+        std::numeric_limits<double>::infinity());
+}
+
+
+template <typename CoordinateType>
+Generator<PointNeighbor> streamNearest(
+    const KdTree<CoordinateType>& tree, Point<CoordinateType> query)
+{
+    return streamNearest(
+        std::allocator_arg, std::pmr::get_default_resource(), tree, query);
+}
+
+
+template <typename CoordinateType>
+Generator<PointNeighbor> streamWithinRadius(
+    std::allocator_arg_t, std::pmr::memory_resource* resource,
+    const KdTree<CoordinateType>& tree, Point<CoordinateType> query,
+    double radius)
+{
+    using Node = typename KdTree<CoordinateType>::Node;
+
+    struct Entry
+    {
+        double squaredDistance;
+        std::uint32_t item;
+        bool isPoint;
+
+        bool operator>(const Entry& other) const
+        {
+            return squaredDistance > other.squaredDistance;
+        }
+    };
+
+    if (tree.size() == 0 || !(radius >= 0.0))
+    {
+        co_return;
+    }
+
+    const double squaredRadius = radius * radius;
+    const std::vector<Node>& nodes = tree.nodes();
+
+    std::pmr::vector<Entry> queue{resource};
+    queue.push_back(Entry{tree.squaredDistanceToNode(query, nodes[tree.root()]), tree.root(), false});
+
+    while (!queue.empty())
+    {
+        std::pop_heap(queue.begin(), queue.end(), std::greater<Entry>{});
+        const Entry entry = queue.back();
+        queue.pop_back();
+
+        if (entry.squaredDistance > squaredRadius)
+        {
+            co_return;
+        }
+
+        if (entry.isPoint)
+        {
+            co_yield PointNeighbor{tree.indexAt(entry.item), std::sqrt(entry.squaredDistance)};
+            continue;
+        }
+
+        const Node& node = nodes[entry.item];
+
+        if (node.left == KdTree<CoordinateType>::noChild)
+        {
+            for (std::uint32_t i = node.begin; i < node.end; ++i)
+            {
+                const double squaredDistance = query.squaredDistanceFrom(tree.pointAt(i));
+
+                if (squaredDistance <= squaredRadius)
+                {
+                    queue.push_back(Entry{squaredDistance, i, true});
+                    std::push_heap(queue.begin(), queue.end(), std::greater<Entry>{});
+                }
+            }
+        }
+        else
+        {
+            for (std::uint32_t child : {node.left, node.right})
+            {
+                const double squaredDistance = tree.squaredDistanceToNode(query, nodes[child]);
+
+                if (squaredDistance <= squaredRadius)
+                {
+                    queue.push_back(Entry{squaredDistance, child, false});
+                    std::push_heap(queue.begin(), queue.end(), std::greater<Entry>{});
+                }
+            }
+        }
+    }
+}
+
+
+template <typename CoordinateType>
+Generator<PointNeighbor> streamWithinRadius(
+    const KdTree<CoordinateType>& tree, Point<CoordinateType> query,
+    double radius)
+{
+    return streamWithinRadius(
+        std::allocator_arg, std::pmr::get_default_resource(), tree, query, radius);
+}
+
+
+// A box query has no order to respect, so it walks the tree depth-first
+// with a small fixed-size stack; a balanced tree over fewer than 2^32
+// points is never deep enough to overflow it.
+
+template <typename CoordinateType>
+Generator<std::size_t> streamWithinBox(
+    std::allocator_arg_t, std::pmr::memory_resource*,
+    const KdTree<CoordinateType>& tree, Point<CoordinateType> lower,
+    Point<CoordinateType> upper)
+{
+    using Node = typename KdTree<CoordinateType>::Node;
+
+    if (tree.size() == 0)
+    {
+        co_return;
+    }
+
+    double low[3];
+    double high[3];
+
+    for (unsigned int axis = 0; axis < 3; ++axis)
+    {
+        low[axis] = KdTree<CoordinateType>::coordinate(lower, axis);
+        high[axis] = KdTree<CoordinateType>::coordinate(upper, axis);
+    }
+
+    const std::vector<Node>& nodes = tree.nodes();
+
+    std::uint32_t pending[64];
+    std::size_t pendingCount = 0;
+    pending[pendingCount++] = tree.root();
+
+    while (pendingCount > 0)
+    {
+        const Node& node = nodes[pending[--pendingCount]];
+
+        bool overlaps = true;
+
+        for (unsigned int axis = 0; axis < 3; ++axis)
+        {
+            overlaps = overlaps && node.lower[axis] <= high[axis] && node.upper[axis] >= low[axis];
+        }
+
+        if (!overlaps)
+        {
+            continue;
+        }
+
+        if (node.left != KdTree<CoordinateType>::noChild)
+        {
+            pending[pendingCount++] = node.right;
+            pending[pendingCount++] = node.left;
+            continue;
+        }
+
+        for (std::uint32_t i = node.begin; i < node.end; ++i)
+        {
+            bool inside = true;
+
+            for (unsigned int axis = 0; axis < 3; ++axis)
+            {
+                const double value = KdTree<CoordinateType>::coordinate(tree.pointAt(i), axis);
+                inside = inside && value >= low[axis] && value <= high[axis];
+            }
+
+            if (inside)
+            {
+                co_yield tree.indexAt(i);
+            }
+        }
+    }
+}
+
+
+template <typename CoordinateType>
+Generator<std::size_t> streamWithinBox(
+    const KdTree<CoordinateType>& tree, Point<CoordinateType> lower,
+    Point<CoordinateType> upper)
+{
+    return streamWithinBox(
+        std::allocator_arg, std::pmr::get_default_resource(), tree, lower, upper);
+}
+
+
+
+#endif // POINTQUERYSTREAMS_HPP
+
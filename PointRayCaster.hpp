@@ -0,0 +1,327 @@
+// PointRayCaster.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a template class called
+// PointRayCaster, which finds where rays -- half-lines starting at an origin
+// and heading off in some direction -- first hit a set of points.  Points
+// have no size, so a ray would almost never hit one exactly; instead, each
+// point is treated as a small sphere of a given radius.  Casting rays is
+// how we simulate what a sensor would see from a given position, or check
+// whether one location is visible from another.
+//
+// Testing a ray against every sphere would take time proportional to the
+// number of points.  Instead, we use the boxes a KdTree already keeps for
+// each of its nodes (grown by the radius, so that they contain the spheres
+// and not just their centers) as a "bounding volume hierarchy": if a ray
+// misses a node's box, it misses everything in it.  Nodes are visited
+// nearer child first, and once a ray has hit something, any node whose box
+// it reaches only after that hit can be skipped.
+//
+// Rays cast from nearby origins in similar directions -- the beams of one
+// sensor sweep, say -- tend to visit the same nodes.  castPacket() takes
+// advantage of that by carrying a "packet" of several rays through the tree
+// together: each node is fetched once for the whole packet, and the ray
+// tests are written as loops over the rays, which the compiler can turn
+// into vector (SIMD) instructions that test several rays at once.  A node
+// is visited if any ray in the packet reaches it, so this works best when
+// the rays are coherent; castAll() casts a batch of rays in packets of
+// eight (and any left over at the end one at a time), split among the
+// threads of a ThreadPool.
+
+#ifndef POINTRAYCASTER_HPP
+#define POINTRAYCASTER_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "KdTree.hpp"
+#include "Point.hpp"
+#include "ThreadPool.hpp"
+
+
+
+// A Ray starts at origin and heads in direction, which doesn't need to be
+// of unit length (but can't be zero).
+struct Ray
+{
+    Point<double> origin;
+    Point<double> direction;
+};
+
+
+// A RayHit says which point a ray hit first (by its index in the vector the
+// KdTree was built from) and how far along the ray the hit was.  A ray that
+// hit nothing has an index that's equal to the number of points and an
+// infinite distance.
+struct RayHit
+{
+    std::size_t index;
+    double distance;
+};
+
+
+
+template <typename CoordinateType>
+class PointRayCaster
+{
+public:
+    // A PointRayCaster casts rays against the points in a KdTree, which
+    // must outlive it, treating each as a sphere of the given radius.
+    PointRayCaster(const KdTree<CoordinateType>& tree, double radius);
+
+
+    // cast() returns the first hit along a ray, not counting hits farther
+    // than maxDistance.  A ray whose origin is inside a sphere hits it at
+    // distance zero.
+    RayHit cast(
+        const Ray& ray,
+        double maxDistance = std::numeric_limits<double>::infinity()) const;
+
+
+    // castPacket() casts PacketSize rays together, storing their hits in
+    // hits.  It's equivalent to calling cast() on each of them.
+    template <std::size_t PacketSize>
+    void castPacket(
+        const Ray* rays, RayHit* hits,
+        double maxDistance = std::numeric_limits<double>::infinity()) const;
+
+
+    // castAll() casts every ray in a vector and returns their hits in the
+    // same order.  The rays are cast in packets of eight consecutive rays;
+    // if the number of rays isn't a multiple of eight, the last few are
+    // cast one at a time.
+    std::vector<RayHit> castAll(
+        const std::vector<Ray>& rays,
+        double maxDistance = std::numeric_limits<double>::infinity(),
+        ThreadPool& pool = defaultThreadPool()) const;
+
+
+    double radius() const;
+
+
+private:
+    const KdTree<CoordinateType>* tree_;
+    double radius_;
+};
+
+
+
+template <typename CoordinateType>
+PointRayCaster<CoordinateType>::PointRayCaster(
+    const KdTree<CoordinateType>& tree, double radius)
+    : tree_{&tree}, radius_{radius}
+{
+}
+
+
+template <typename CoordinateType>
+RayHit PointRayCaster<CoordinateType>::cast(const Ray& ray, double maxDistance) const
+{
+    RayHit hit;
+    castPacket<1>(&ray, &hit, maxDistance);
+    return hit;
+}
+
+
+// A packet's rays are kept as separate arrays of each quantity, so that
+// each test is a loop over the rays that does the same arithmetic on
+// consecutive values.  Rays are normalized first, so that distances along
+// them are in the same units as the points; their inverse directions are
+// stored too, since the box test divides by the direction.
+//
+// The box test is the "slab" test: along each axis, the ray is between the
+// box's two planes for some interval of distances, and it's inside the box
+// where all three intervals overlap.  A ray parallel to two of the planes
+// is between them either all the way along or not at all, so we set its
+// interval along that axis to everything or nothing directly.  (Its
+// inverse direction along the axis is infinite, which usually gives the
+// right answer by itself, but if its origin is exactly on one of the
+// planes, it's multiplied by zero, and the result is NaN.)
+//
+// best[r] is the distance to ray r's closest hit so far (or maxDistance),
+// so a ray only reaches a node if the box is between distance zero and
+// best[r].  Rays with a zero direction start with best[r] negative, so
+// they never reach anything.
+
+template <typename CoordinateType>
+template <std::size_t PacketSize>
+void PointRayCaster<CoordinateType>::castPacket(
+    const Ray* rays, RayHit* hits, double maxDistance) const
+{
+    using Node = typename KdTree<CoordinateType>::Node;
+
+    double origin[3][PacketSize];
+    double direction[3][PacketSize];
+    double inverse[3][PacketSize];
+    double best[PacketSize];
+    std::size_t bestIndex[PacketSize];
+
+    for (std::size_t r = 0; r < PacketSize; ++r)
+    {
+        const double d[3] = {rays[r].direction.x(), rays[r].direction.y(), rays[r].direction.z()};
+        const double length = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+
+        origin[0][r] = rays[r].origin.x();
+        origin[1][r] = rays[r].origin.y();
+        origin[2][r] = rays[r].origin.z();
+
+        for (unsigned int axis = 0; axis < 3; ++axis)
+        {
+            direction[axis][r] = length > 0.0 ? d[axis] / length : 0.0;
+            inverse[axis][r] = 1.0 / direction[axis][r];
+        }
+
+        best[r] = length > 0.0 ? maxDistance : -1.0;
+        bestIndex[r] = tree_->size();
+    }
+
+    const std::vector<Node>& nodes = tree_->nodes();
+    const double squaredRadius = radius_ * radius_;
+
+    std::uint32_t pending[64];
+    std::size_t pendingCount = 0;
+
+    if (tree_->root() != KdTree<CoordinateType>::noChild)
+    {
+        pending[pendingCount++] = tree_->root();
+    }
+
+    while (pendingCount > 0)
+    {
+        const Node& node = nodes[pending[--pendingCount]];
+        bool reached = false;
+
+        for (std::size_t r = 0; r < PacketSize; ++r)
+        {
+            double entry = 0.0;
+            double exit = best[r];
+
+            for (unsigned int axis = 0; axis < 3; ++axis)
+            {
+                constexpr double infinity = std::numeric_limits<double>::infinity();
+
+                const double below = node.lower[axis] - radius_ - origin[axis][r];
+                const double above = node.upper[axis] + radius_ - origin[axis][r];
+                const bool parallel = direction[axis][r] == 0.0;
+                const bool between = below <= 0.0 && above >= 0.0;
+
+                const double near = parallel ? -infinity : below * inverse[axis][r];
+                const double far = parallel ? (between ? infinity : -infinity) : above * inverse[axis][r];
+
+                entry = std::max(entry, std::min(near, far));
+                exit = std::min(exit, std::max(near, far));
+            }
+
+            reached |= entry <= exit;
+        }
+
+        if (!reached)
+        {
+            continue;
+        }
+
+        if (node.left == KdTree<CoordinateType>::noChild)
+        {
+            for (std::uint32_t i = node.begin; i < node.end; ++i)
+            {
+                const Point<CoordinateType>& center = tree_->pointAt(i);
+                const double c[3] = {
+                    static_cast<double>(center.x()), static_cast<double>(center.y()),
+                    static_cast<double>(center.z())};
+
+                for (std::size_t r = 0; r < PacketSize; ++r)
+                {
+                    const double ox = origin[0][r] - c[0];
+                    const double oy = origin[1][r] - c[1];
+                    const double oz = origin[2][r] - c[2];
+
+                    const double b = ox * direction[0][r] + oy * direction[1][r] + oz * direction[2][r];
+                    const double discriminant = b * b - (ox * ox + oy * oy + oz * oz - squaredRadius);
+                    const double root = std::sqrt(std::max(discriminant, 0.0));
+
+                    const double enter = -b - root;
+                    const double leave = -b + root;
+                    const double t = enter >= 0.0 ? enter : 0.0;
+
+                    if (discriminant >= 0.0 && leave >= 0.0 && t < best[r])
+                    {
+                        best[r] = t;
+                        bestIndex[r] = i;
+                    }
+                }
+            }
+        }
+        else
+        {
+            // Visit the child on the side the rays come from first; the
+            // packet's first ray decides which side that is.
+            const bool leftFirst = direction[node.axis][0] >= 0.0;
+
+            pending[pendingCount++] = leftFirst ? node.right : node.left;
+            pending[pendingCount++] = leftFirst ? node.left : node.right;
+        }
+    }
+
+    for (std::size_t r = 0; r < PacketSize; ++r)
+    {
+        if (bestIndex[r] == tree_->size())
+        {
+            hits[r] = RayHit{tree_->size(), std::numeric_limits<double>::infinity()};
+        }
+        else
+        {
+            hits[r] = RayHit{tree_->indexAt(bestIndex[r]), best[r]};
+        }
+    }
+}
+
+
+template <typename CoordinateType>
+std::vector<RayHit> PointRayCaster<CoordinateType>::castAll(
+    const std::vector<Ray>& rays, double maxDistance, ThreadPool& pool) const
+{
+    constexpr std::size_t packetSize = 8;
+
+    std::vector<RayHit> hits(rays.size());
+    const std::size_t packetCount = (rays.size() + packetSize - 1) / packetSize;
+
+    pool.parallelFor(
+        0, packetCount, 256,
+        [&](std::size_t firstPacket, std::size_t lastPacket)
+        {
+            for (std::size_t packet = firstPacket; packet < lastPacket; ++packet)
+            {
+                const std::size_t begin = packet * packetSize;
+
+                if (begin + packetSize <= rays.size())
+                {
+                    castPacket<packetSize>(&rays[begin], &hits[begin], maxDistance);
+                    continue;
+                }
+
+                for (std::size_t r = begin; r < rays.size(); ++r)
+                {
+                    hits[r] = cast(rays[r], maxDistance);
+                }
+            }
+        });
+
+    return hits;
+}
+
+
+template <typename CoordinateType>
+double PointRayCaster<CoordinateType>::radius() const
+{
+    return radius_;
+}
+
+
+
+#endif // POINTRAYCASTER_HPP
+
@@ -0,0 +1,469 @@
+// PointSampling.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines three ways of choosing a smaller,
+// representative subset of a set of points.  Each of them returns the
+// indexes of the points it chose, rather than copies of the points, so the
+// caller can use them to select from the points themselves or from any
+// other data that goes along with them (colors, normals, labels, ...).
+//
+// * A ReservoirSampler chooses a uniformly random subset of a fixed size
+//   from a stream of items whose length isn't known in advance, seeing each
+//   item only once.  randomSample() uses one to sample from a set of known
+//   size.
+// * farthestPointSample() chooses points one at a time, each time choosing
+//   the point farthest from all of the ones already chosen, which spreads
+//   the sample evenly over the shape of the points regardless of how
+//   densely different parts of it were measured.
+// * poissonDiskSample() chooses points so that no two of them are closer
+//   together than a given radius, but every point left out is within that
+//   radius of one that was chosen.
+
+#ifndef POINTSAMPLING_HPP
+#define POINTSAMPLING_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include "Point.hpp"
+#include "PointArrays.hpp"
+#include "ThreadPool.hpp"
+
+
+
+// A ReservoirSampler is offered items one at a time (or a run of them at
+// once), numbering them 0, 1, 2, ..., and keeps a uniformly random sample
+// of sampleSize of them (or all of them, if there have been fewer than
+// that).
+//
+// Rather than drawing a random number for every item, it draws one to decide
+// how many items to skip before the next one that will enter the sample
+// (Li's "Algorithm L"), so offering a long run of items at once costs time
+// proportional to the number of items that actually enter the sample, not
+// the length of the run.
+class ReservoirSampler
+{
+public:
+    explicit ReservoirSampler(std::size_t sampleSize, std::uint64_t seed = 0);
+
+
+    // offer() offers the next count items.
+    void offer(std::size_t count = 1);
+
+
+    // sample() returns the indexes of the items currently in the sample, in
+    // no particular order.  seen() returns how many items have been offered.
+    const std::vector<std::size_t>& sample() const;
+    std::size_t seen() const;
+
+
+private:
+    double nextUniform();
+    void scheduleNext();
+
+    std::size_t sampleSize_;
+    std::vector<std::size_t> sample_;
+    std::size_t seen_;
+    std::size_t next_;
+    double weight_;
+    std::mt19937_64 engine_;
+};
+
+
+
+// randomSample() returns, in ascending order, the indexes of sampleSize
+// points chosen uniformly at random from pointCount points (or all of them
+// if there are fewer than that).
+std::vector<std::size_t> randomSample(
+    std::size_t pointCount, std::size_t sampleSize, std::uint64_t seed = 0);
+
+
+
+// farthestPointSample() returns the indexes of sampleSize of the points (or
+// all of them, if there are fewer), in the order they were chosen, starting
+// with the point at firstIndex.  No index is chosen twice.  If there are
+// fewer distinct locations than sampleSize, then once every location has
+// been chosen, the remaining points are all at distance zero, and they're
+// chosen in order of index.
+//
+// Each step updates every point's distance to its closest chosen point,
+// so the whole sample takes O(n * sampleSize) time; the update loop runs
+// over the coordinates stored as separate arrays so that the compiler can
+// vectorize it, and large sets of points are split among the threads of a
+// ThreadPool.
+template <typename CoordinateType>
+std::vector<std::size_t> farthestPointSample(
+    const PointArrays<CoordinateType>& points, std::size_t sampleSize,
+    std::size_t firstIndex = 0, ThreadPool& pool = defaultThreadPool());
+
+template <typename CoordinateType>
+std::vector<std::size_t> farthestPointSample(
+    const std::vector<Point<CoordinateType>>& points, std::size_t sampleSize,
+    std::size_t firstIndex = 0, ThreadPool& pool = defaultThreadPool());
+
+
+
+// poissonDiskSample() visits the points in a random order, choosing each one
+// that isn't within the given radius of a point already chosen, and returns
+// the indexes of the chosen points in the order they were chosen.  Chosen
+// points are kept in a hashed grid of cells one radius wide, so checking a
+// point means looking only at the chosen points in the 27 cells around it.
+template <typename CoordinateType>
+std::vector<std::size_t> poissonDiskSample(
+    const std::vector<Point<CoordinateType>>& points, double radius,
+    std::uint64_t seed = 0);
+
+
+
+namespace PointSamplingImpl
+{
+    // Farthest-point sampling splits the points into chunks of this many,
+    // which is enough work per chunk to make handing chunks to other
+    // threads worthwhile.
+    constexpr std::size_t pointsPerChunk = 16384;
+
+
+    struct Candidate
+    {
+        double distance;
+        std::size_t index;
+    };
+
+
+    // updateDistances() lowers each of distances[begin, end) to the squared
+    // distance to (x, y, z), if that's smaller, and returns the point in the
+    // range that's now farthest from its closest chosen point (the first
+    // one, if there's a tie).  Points already chosen have a distance of -1,
+    // which no squared distance is smaller than, so they're never returned
+    // unless every point in the range has been chosen, and then the
+    // distance returned is -1, which any unchosen point beats.  The first
+    // loop is written so that it can be vectorized; the second only runs
+    // until it finds the maximum.
+    template <typename CoordinateType>
+    Candidate updateDistances(
+        const CoordinateType* xs, const CoordinateType* ys, const CoordinateType* zs,
+        double* distances, std::size_t begin, std::size_t end,
+        double x, double y, double z)
+    {
+        double farthest = -1.0;
+
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            const double dx = static_cast<double>(xs[i]) - x;
+            const double dy = static_cast<double>(ys[i]) - y;
+            const double dz = static_cast<double>(zs[i]) - z;
+            const double d = dx * dx + dy * dy + dz * dz;
+            const double lowered = d < distances[i] ? d : distances[i];
+
+            distances[i] = lowered;
+            farthest = lowered > farthest ? lowered : farthest;
+        }
+
+        std::size_t index = begin;
+
+        while (index < end && distances[index] != farthest)
+        {
+            ++index;
+        }
+
+        return Candidate{farthest, index};
+    }
+
+
+    struct Cell
+    {
+        std::int64_t x;
+        std::int64_t y;
+        std::int64_t z;
+
+        bool operator==(const Cell& other) const
+        {
+            return x == other.x && y == other.y && z == other.z;
+        }
+    };
+
+
+    struct CellHash
+    {
+        std::size_t operator()(const Cell& cell) const
+        {
+            std::uint64_t h = static_cast<std::uint64_t>(cell.x) * 0x9E3779B97F4A7C15ull;
+            h ^= static_cast<std::uint64_t>(cell.y) * 0xC2B2AE3D27D4EB4Full;
+            h ^= static_cast<std::uint64_t>(cell.z) * 0x165667B19E3779F9ull;
+            return static_cast<std::size_t>(h ^ (h >> 29));
+        }
+    };
+}
+
+
+
+inline ReservoirSampler::ReservoirSampler(std::size_t sampleSize, std::uint64_t seed)
+    : sampleSize_{sampleSize}, seen_{0}, next_{0}, weight_{1.0}, engine_{seed}
+{
+    sample_.reserve(sampleSize);
+}
+
+
+// Once the reservoir is full, next_ is the number of the next item that
+// will replace one already in it.
+
+inline void ReservoirSampler::offer(std::size_t count)
+{
+    const std::size_t end = seen_ + count;
+
+    while (seen_ < end && sample_.size() < sampleSize_)
+    {
+        sample_.push_back(seen_);
+        ++seen_;
+
+        if (sample_.size() == sampleSize_)
+        {
+            weight_ = std::exp(std::log(nextUniform()) / static_cast<double>(sampleSize_));
+            scheduleNext();
+        }
+    }
+
+    if (sampleSize_ == 0 || sample_.size() < sampleSize_)
+    {
+        seen_ = end;
+        return;
+    }
+
+    while (next_ < end)
+    {
+        std::uniform_int_distribution<std::size_t> slot{0, sampleSize_ - 1};
+        sample_[slot(engine_)] = next_;
+
+        weight_ *= std::exp(std::log(nextUniform()) / static_cast<double>(sampleSize_));
+        scheduleNext();
+    }
+
+    seen_ = end;
+}
+
+
+inline const std::vector<std::size_t>& ReservoirSampler::sample() const
+{
+    return sample_;
+}
+
+
+inline std::size_t ReservoirSampler::seen() const
+{
+    return seen_;
+}
+
+
+// nextUniform() returns a value in (0, 1], so that its logarithm is finite.
+
+inline double ReservoirSampler::nextUniform()
+{
+    return 1.0 - std::uniform_real_distribution<double>{0.0, 1.0}(engine_);
+}
+
+
+inline void ReservoirSampler::scheduleNext()
+{
+    const double skip = std::floor(std::log(nextUniform()) / std::log1p(-weight_));
+    const std::size_t after = std::max(seen_, next_ + 1);
+
+    if (!(skip < static_cast<double>(std::numeric_limits<std::size_t>::max() - after)))
+    {
+        next_ = std::numeric_limits<std::size_t>::max();
+    }
+    else
+    {
+        next_ = after + static_cast<std::size_t>(skip);
+    }
+}
+
+
+inline std::vector<std::size_t> randomSample(
+    std::size_t pointCount, std::size_t sampleSize, std::uint64_t seed)
+{
+    ReservoirSampler sampler{std::min(sampleSize, pointCount), seed};
+    sampler.offer(pointCount);
+
+    std::vector<std::size_t> indexes = sampler.sample();
+    std::sort(indexes.begin(), indexes.end());
+    return indexes;
+}
+
+
+// Each step hands the chunks to the pool, each of which reports its own
+// farthest point; the farthest of those is the next point chosen.
+
+template <typename CoordinateType>
+std::vector<std::size_t> farthestPointSample(
+    const PointArrays<CoordinateType>& points, std::size_t sampleSize,
+    std::size_t firstIndex, ThreadPool& pool)
+{
+    using namespace PointSamplingImpl;
+
+    const std::size_t count = points.size();
+    sampleSize = std::min(sampleSize, count);
+
+    std::vector<std::size_t> chosen;
+    chosen.reserve(sampleSize);
+
+    if (sampleSize == 0)
+    {
+        return chosen;
+    }
+
+    const CoordinateType* xs = points.xs();
+    const CoordinateType* ys = points.ys();
+    const CoordinateType* zs = points.zs();
+
+    std::vector<double> distances(count, std::numeric_limits<double>::infinity());
+    const std::size_t chunkCount = (count + pointsPerChunk - 1) / pointsPerChunk;
+    std::vector<Candidate> candidates(chunkCount);
+
+    std::size_t next = std::min(firstIndex, count - 1);
+
+    while (true)
+    {
+        chosen.push_back(next);
+        distances[next] = -1.0;
+
+        if (chosen.size() == sampleSize)
+        {
+            break;
+        }
+
+        const double x = static_cast<double>(xs[next]);
+        const double y = static_cast<double>(ys[next]);
+        const double z = static_cast<double>(zs[next]);
+
+        pool.parallelFor(
+            0, chunkCount, 1,
+            [&](std::size_t firstChunk, std::size_t lastChunk)
+            {
+                for (std::size_t chunk = firstChunk; chunk < lastChunk; ++chunk)
+                {
+                    const std::size_t begin = chunk * pointsPerChunk;
+                    const std::size_t end = std::min(count, begin + pointsPerChunk);
+
+                    candidates[chunk] = updateDistances(xs, ys, zs, distances.data(), begin, end, x, y, z);
+                }
+            });
+
+        Candidate best = candidates[0];
+
+        for (std::size_t chunk = 1; chunk < chunkCount; ++chunk)
+        {
+            if (candidates[chunk].distance > best.distance)
+            {
+                best = candidates[chunk];
+            }
+        }
+
+        next = best.index;
+    }
+
+    return chosen;
+}
+
+
+template <typename CoordinateType>
+std::vector<std::size_t> farthestPointSample(
+    const std::vector<Point<CoordinateType>>& points, std::size_t sampleSize,
+    std::size_t firstIndex, ThreadPool& pool)
+{
+    return farthestPointSample(PointArrays<CoordinateType>{points}, sampleSize, firstIndex, pool);
+}
+
+
+// Each cell of the grid holds the first chosen point in it, and each chosen
+// point knows the next one in the same cell, so that the grid is a hash
+// table of linked lists threaded through the chosen points.
+
+template <typename CoordinateType>
+std::vector<std::size_t> poissonDiskSample(
+    const std::vector<Point<CoordinateType>>& points, double radius,
+    std::uint64_t seed)
+{
+    using namespace PointSamplingImpl;
+
+    std::vector<std::size_t> order(points.size());
+    std::iota(order.begin(), order.end(), std::size_t{0});
+
+    std::mt19937_64 engine{seed};
+    std::shuffle(order.begin(), order.end(), engine);
+
+    if (!(radius > 0.0))
+    {
+        return order;
+    }
+
+    constexpr std::size_t noPoint = std::numeric_limits<std::size_t>::max();
+
+    const double squaredRadius = radius * radius;
+    std::unordered_map<Cell, std::size_t, CellHash> heads;
+    std::vector<std::size_t> chosen;
+    std::vector<std::size_t> nextInCell;
+
+    auto cellOf =
+        [radius](const Point<CoordinateType>& p)
+        {
+            return Cell{
+                static_cast<std::int64_t>(std::floor(static_cast<double>(p.x()) / radius)),
+                static_cast<std::int64_t>(std::floor(static_cast<double>(p.y()) / radius)),
+                static_cast<std::int64_t>(std::floor(static_cast<double>(p.z()) / radius))};
+        };
+
+    for (std::size_t index : order)
+    {
+        const Point<CoordinateType>& p = points[index];
+        const Cell cell = cellOf(p);
+        bool covered = false;
+
+        for (std::int64_t dx = -1; dx <= 1 && !covered; ++dx)
+        {
+            for (std::int64_t dy = -1; dy <= 1 && !covered; ++dy)
+            {
+                for (std::int64_t dz = -1; dz <= 1 && !covered; ++dz)
+                {
+                    auto found = heads.find(Cell{cell.x + dx, cell.y + dy, cell.z + dz});
+
+                    if (found == heads.end())
+                    {
+                        continue;
+                    }
+
+                    for (std::size_t s = found->second; s != noPoint; s = nextInCell[s])
+                    {
+                        if (p.squaredDistanceFrom(points[chosen[s]]) < squaredRadius)
+                        {
+                            covered = true;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (!covered)
+        {
+            auto inserted = heads.emplace(cell, noPoint);
+            nextInCell.push_back(inserted.first->second);
+            inserted.first->second = chosen.size();
+            chosen.push_back(index);
+        }
+    }
+
+    return chosen;
+}
+
+
+
+#endif // POINTSAMPLING_HPP
+
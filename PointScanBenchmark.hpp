@@ -0,0 +1,208 @@
+// PointScanBenchmark.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines functions that measure how the
+// way a large array of points is mapped -- with or without huge pages, and
+// with or without prefaulting (see MappedRegion.hpp and MappedPoints.hpp)
+// -- affects how long it takes to set up and to read, along with the page
+// faults and TLB misses behind those times (see MemoryCounters.hpp).
+//
+// Each benchmark has up to four phases:
+//
+// * Setup: allocating a PointBuffer, or mapping a point file.  This is
+//   where prefaulting puts its page faults.
+// * For a PointBuffer, a fill pass, writing every point.  Without
+//   prefaulting, this is the first time each page is touched, so this is
+//   where its page faults land.  (A point file has nothing to fill, so
+//   this phase is left empty.)
+// * A sequential pass, summing every coordinate in order.  For a point
+//   file that wasn't prefaulted, this is where the page faults land; and
+//   since sequential access is what hardware prefetchers handle best, it
+//   shows TLB misses at their least harmful.
+// * A random pass, reading points at pseudo-random positions.  Nearly every
+//   read lands on a different page than the last one, so with ordinary
+//   pages, nearly every read misses in the TLB; this is where huge pages
+//   make the biggest difference.
+//
+// The sums are returned as a checksum, both so that the compiler can't
+// decide the passes are pointless and skip them, and so that runs with
+// different options can be checked against each other.
+
+#ifndef POINTSCANBENCHMARK_HPP
+#define POINTSCANBENCHMARK_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "MappedPoints.hpp"
+#include "MemoryCounters.hpp"
+#include "Point.hpp"
+
+
+
+struct PointScanPhase
+{
+    double seconds = 0.0;
+    MemoryCounts counts;
+};
+
+
+struct PointScanReport
+{
+    std::size_t pointCount = 0;
+    PointScanPhase setup;
+    PointScanPhase fill;
+    PointScanPhase sequential;
+    PointScanPhase random;
+    double checksum = 0.0;
+};
+
+
+// benchmarkPointBuffer() measures a PointBuffer of the given number of
+// points, filled with a simple pattern, and randomReads random reads.
+template <typename CoordinateType>
+PointScanReport benchmarkPointBuffer(
+    std::size_t pointCount, const PointMemoryOptions& options, std::size_t randomReads);
+
+
+// benchmarkPointFile() measures a mapped point file.  To see the cost of
+// the file's page faults, rather than of reading it from disk, the file
+// should already be in the page cache, which it will be if it was written
+// or read recently.
+template <typename CoordinateType>
+PointScanReport benchmarkPointFile(
+    const std::string& path, const PointMemoryOptions& options, std::size_t randomReads);
+
+
+
+namespace PointScanBenchmarkImpl
+{
+    using Clock = std::chrono::steady_clock;
+
+
+    template <typename Function>
+    PointScanPhase measure(MemoryCounters& counters, Function function)
+    {
+        PointScanPhase phase;
+        const Clock::time_point start = Clock::now();
+
+        counters.start();
+        function();
+        phase.counts = counters.stop();
+
+        phase.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        return phase;
+    }
+
+
+    // The random positions come from a 64-bit linear congruential
+    // generator, which is cheap enough not to hide the cost of the reads.
+
+    template <typename CoordinateType>
+    void scan(
+        const Point<CoordinateType>* points, std::size_t count, std::size_t randomReads,
+        MemoryCounters& counters, PointScanReport& report)
+    {
+        double sequentialSum = 0.0;
+        double randomSum = 0.0;
+
+        report.pointCount = count;
+
+        report.sequential = measure(
+            counters,
+            [&]
+            {
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    sequentialSum += static_cast<double>(points[i].x())
+                        + static_cast<double>(points[i].y())
+                        + static_cast<double>(points[i].z());
+                }
+            });
+
+        report.random = measure(
+            counters,
+            [&]
+            {
+                if (count == 0)
+                {
+                    return;
+                }
+
+                std::uint64_t state = 0x9E3779B97F4A7C15ull;
+
+                for (std::size_t i = 0; i < randomReads; ++i)
+                {
+                    state = state * 6364136223846793005ull + 1442695040888963407ull;
+                    const std::size_t index = static_cast<std::size_t>((state >> 33) % count);
+                    randomSum += static_cast<double>(points[index].x());
+                }
+            });
+
+        report.checksum = sequentialSum + randomSum;
+    }
+}
+
+
+
+template <typename CoordinateType>
+PointScanReport benchmarkPointBuffer(
+    std::size_t pointCount, const PointMemoryOptions& options, std::size_t randomReads)
+{
+    MemoryCounters counters;
+    PointScanReport report;
+    std::unique_ptr<PointBuffer<CoordinateType>> buffer;
+
+    report.setup = PointScanBenchmarkImpl::measure(
+        counters,
+        [&]
+        {
+            buffer = std::make_unique<PointBuffer<CoordinateType>>(pointCount, options);
+        });
+
+    report.fill = PointScanBenchmarkImpl::measure(
+        counters,
+        [&]
+        {
+            for (std::size_t i = 0; i < pointCount; ++i)
+            {
+                (*buffer)[i] = Point<CoordinateType>{
+                    static_cast<CoordinateType>(i % 1000),
+                    static_cast<CoordinateType>(i % 7),
+                    static_cast<CoordinateType>(1)};
+            }
+        });
+
+    PointScanBenchmarkImpl::scan(buffer->data(), buffer->size(), randomReads, counters, report);
+    return report;
+}
+
+
+template <typename CoordinateType>
+PointScanReport benchmarkPointFile(
+    const std::string& path, const PointMemoryOptions& options, std::size_t randomReads)
+{
+    MemoryCounters counters;
+    PointScanReport report;
+    std::unique_ptr<MappedPointFile<CoordinateType>> file;
+
+    report.setup = PointScanBenchmarkImpl::measure(
+        counters,
+        [&]
+        {
+            file = std::make_unique<MappedPointFile<CoordinateType>>(
+                MappedPointFile<CoordinateType>::open(path, options));
+        });
+
+    PointScanBenchmarkImpl::scan(file->data(), file->size(), randomReads, counters, report);
+    return report;
+}
+
+
+
+#endif // POINTSCANBENCHMARK_HPP
+
@@ -0,0 +1,300 @@
+// PointSetOperations.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a handful of basic operations on
+// sets of Points: finding their centroid, moving them with a rigid
+// transformation (a rotation followed by a translation), and finding the
+// distance from each point in one set to the closest point in another.
+//
+// These are written to work on a pointer and a count, rather than only on
+// a std::vector, so that they can be used on any consecutive run of points
+// -- part of a larger vector, or points stored in memory allocated from a
+// ScratchArena, for example -- without copying them first.  Where they
+// produce an array of results, the caller provides the space for it.
+
+#ifndef POINTSETOPERATIONS_HPP
+#define POINTSETOPERATIONS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+#include "Point.hpp"
+
+
+
+// centroidOf() returns the average of a set of points, which is the origin
+// if there aren't any.
+template <typename CoordinateType>
+Point<double> centroidOf(const Point<CoordinateType>* points, std::size_t count);
+
+template <typename CoordinateType>
+Point<double> centroidOf(const std::vector<Point<CoordinateType>>& points);
+
+
+
+// A RigidTransform moves points without changing the distances between
+// them: it rotates them (about the origin) and then translates them.  The
+// rotation is stored as a 3x3 matrix, which is expected to be orthonormal.
+class RigidTransform
+{
+public:
+    // The default RigidTransform leaves points where they are.
+    RigidTransform();
+
+    RigidTransform(const double (&rotation)[3][3], const Point<double>& translation);
+
+
+    // rotationAbout() returns a transform that rotates points by the given
+    // angle (in radians) about an axis through the origin; the axis doesn't
+    // need to be of unit length.  translation() returns one that only
+    // translates them.
+    static RigidTransform rotationAbout(const Point<double>& axis, double angle);
+    static RigidTransform translation(const Point<double>& offset);
+
+
+    // apply() returns where this transform moves a point.
+    template <typename CoordinateType>
+    Point<CoordinateType> apply(const Point<CoordinateType>& point) const;
+
+
+    // then() returns the transform that applies this one and then the
+    // other one.
+    RigidTransform then(const RigidTransform& other) const;
+
+
+    // inverse() returns the transform that undoes this one.
+    RigidTransform inverse() const;
+
+
+    double rotation(unsigned int row, unsigned int column) const;
+    const Point<double>& translationPart() const;
+
+
+private:
+    double rotation_[3][3];
+    Point<double> translation_;
+};
+
+
+
+// transformPoints() applies a transform to count points, writing the
+// results into output (which may be the same array as input).
+template <typename CoordinateType>
+void transformPoints(
+    const RigidTransform& transform, const Point<CoordinateType>* input,
+    std::size_t count, Point<CoordinateType>* output);
+
+
+// closestDistances() writes, for each of the source points, its distance
+// to the closest of the target points.  It compares every pair, which is
+// the fastest way for small sets; for large ones, build a KdTree instead.
+template <typename CoordinateType>
+void closestDistances(
+    const Point<CoordinateType>* sources, std::size_t sourceCount,
+    const Point<CoordinateType>* targets, std::size_t targetCount,
+    double* distances);
+
+
+
+template <typename CoordinateType>
+Point<double> centroidOf(const Point<CoordinateType>* points, std::size_t count)
+{
+    double x = 0.0;
+    double y = 0.0;
+    double z = 0.0;
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        x += static_cast<double>(points[i].x());
+        y += static_cast<double>(points[i].y());
+        z += static_cast<double>(points[i].z());
+    }
+
+    if (count > 0)
+    {
+        x /= static_cast<double>(count);
+        y /= static_cast<double>(count);
+        z /= static_cast<double>(count);
+    }
+
+    return Point<double>{x, y, z};
+}
+
+
+template <typename CoordinateType>
+Point<double> centroidOf(const std::vector<Point<CoordinateType>>& points)
+{
+    return centroidOf(points.data(), points.size());
+}
+
+
+inline RigidTransform::RigidTransform()
+    : rotation_{{1.0, 0.0, 0.0}, {0.0, 1.0, 0.0}, {0.0, 0.0, 1.0}},
+      translation_{0.0, 0.0, 0.0}
+{
+}
+
+
+inline RigidTransform::RigidTransform(
+    const double (&rotation)[3][3], const Point<double>& translation)
+    : translation_{translation}
+{
+    for (unsigned int row = 0; row < 3; ++row)
+    {
+        for (unsigned int column = 0; column < 3; ++column)
+        {
+            rotation_[row][column] = rotation[row][column];
+        }
+    }
+}
+
+
+// This is Rodrigues' rotation formula, written out as a matrix.
+
+inline RigidTransform RigidTransform::rotationAbout(const Point<double>& axis, double angle)
+{
+    const double length = std::sqrt(axis.squaredDistanceFrom(Point<double>{0.0, 0.0, 0.0}));
+
+    if (length == 0.0)
+    {
+        return RigidTransform{};
+    }
+
+    const double x = axis.x() / length;
+    const double y = axis.y() / length;
+    const double z = axis.z() / length;
+    const double c = std::cos(angle);
+    const double s = std::sin(angle);
+    const double t = 1.0 - c;
+
+    const double rotation[3][3] = {
+        {t * x * x + c, t * x * y - s * z, t * x * z + s * y},
+        {t * x * y + s * z, t * y * y + c, t * y * z - s * x},
+        {t * x * z - s * y, t * y * z + s * x, t * z * z + c}};
+
+    return RigidTransform{rotation, Point<double>{0.0, 0.0, 0.0}};
+}
+
+
+inline RigidTransform RigidTransform::translation(const Point<double>& offset)
+{
+    RigidTransform transform;
+    transform.translation_ = offset;
+    return transform;
+}
+
+
+template <typename CoordinateType>
+Point<CoordinateType> RigidTransform::apply(const Point<CoordinateType>& point) const
+{
+    const double x = static_cast<double>(point.x());
+    const double y = static_cast<double>(point.y());
+    const double z = static_cast<double>(point.z());
+
+    return Point<CoordinateType>{
+        static_cast<CoordinateType>(
+            rotation_[0][0] * x + rotation_[0][1] * y + rotation_[0][2] * z + translation_.x()),
+        static_cast<CoordinateType>(
+            rotation_[1][0] * x + rotation_[1][1] * y + rotation_[1][2] * z + translation_.y()),
+        static_cast<CoordinateType>(
+            rotation_[2][0] * x + rotation_[2][1] * y + rotation_[2][2] * z + translation_.z())};
+}
+
+
+// Applying this transform and then the other one takes p to
+// B(Ap + a) + b = (BA)p + (Ba + b).
+
+inline RigidTransform RigidTransform::then(const RigidTransform& other) const
+{
+    double rotation[3][3];
+
+    for (unsigned int row = 0; row < 3; ++row)
+    {
+        for (unsigned int column = 0; column < 3; ++column)
+        {
+            rotation[row][column] = 0.0;
+
+            for (unsigned int k = 0; k < 3; ++k)
+            {
+                rotation[row][column] += other.rotation_[row][k] * rotation_[k][column];
+            }
+        }
+    }
+
+    return RigidTransform{rotation, other.apply(translation_)};
+}
+
+
+// A rotation matrix's inverse is its transpose, so the inverse of
+// p -> Rp + t is p -> R'p - R't.
+
+inline RigidTransform RigidTransform::inverse() const
+{
+    double rotation[3][3];
+
+    for (unsigned int row = 0; row < 3; ++row)
+    {
+        for (unsigned int column = 0; column < 3; ++column)
+        {
+            rotation[row][column] = rotation_[column][row];
+        }
+    }
+
+    RigidTransform transposed{rotation, Point<double>{0.0, 0.0, 0.0}};
+    const Point<double> moved = transposed.apply(translation_);
+
+    return RigidTransform{rotation, Point<double>{-moved.x(), -moved.y(), -moved.z()}};
+}
+
+
+inline double RigidTransform::rotation(unsigned int row, unsigned int column) const
+{
+    return rotation_[row][column];
+}
+
+
+inline const Point<double>& RigidTransform::translationPart() const
+{
+    return translation_;
+}
+
+
+template <typename CoordinateType>
+void transformPoints(
+    const RigidTransform& transform, const Point<CoordinateType>* input,
+    std::size_t count, Point<CoordinateType>* output)
+{
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        output[i] = transform.apply(input[i]);
+    }
+}
+
+
+template <typename CoordinateType>
+void closestDistances(
+    const Point<CoordinateType>* sources, std::size_t sourceCount,
+    const Point<CoordinateType>* targets, std::size_t targetCount,
+    double* distances)
+{
+    for (std::size_t i = 0; i < sourceCount; ++i)
+    {
+        double best = std::numeric_limits<double>::infinity();
+
+        for (std::size_t j = 0; j < targetCount; ++j)
+        {
+            best = std::min(best, sources[i].squaredDistanceFrom(targets[j]));
+        }
+
+        distances[i] = std::sqrt(best);
+    }
+}
+
+
+
+#endif // POINTSETOPERATIONS_HPP
+
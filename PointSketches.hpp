@@ -0,0 +1,1014 @@
+// PointSketches.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines "sketches": small summaries of
+// streams of points that are too long to keep.  Each sketch takes points
+// one at a time or in batches, answers questions about every point it has
+// seen, and uses a fixed amount of memory no matter how many that is.
+//
+// * A MomentSketch knows the count, mean (the centroid), and covariance
+//   (the spread) of the points.
+// * A BoundsSketch knows the smallest box containing the points.
+// * A ReservoirSketch keeps a uniform random sample of a fixed number of
+//   the points.
+// * A VoxelDensitySketch estimates how many points fell into any given
+//   voxel (a cube in a grid of cubes), using a "count-min sketch".
+// * A PointSummary is one of each, for the common case of wanting them
+//   all.
+//
+// What makes these useful across many threads, or many machines, is that
+// every sketch can be merged with another of the same kind: the result is
+// the sketch that would have been built had it seen both streams.  Merging
+// is associative, so sketches can be combined in any grouping -- pairwise
+// up a tree of threads, say.  And every sketch can be written to (and read
+// from) a compact sequence of bytes, using ByteWriter and ByteReader, so
+// that sketches built in separate processes can be sent to one place and
+// merged there.
+//
+// Batch updates work a few hundred points at a time, first doing the
+// arithmetic for the whole batch in simple loops over arrays that the
+// compiler can turn into vector (SIMD) instructions -- finding each point's
+// voxel, or its random sampling key -- and then doing the parts that can't
+// be vectorized, like updating counters, in a second loop.
+
+#ifndef POINTSKETCHES_HPP
+#define POINTSKETCHES_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ByteStream.hpp"
+#include "Point.hpp"
+#include "PrincipalAxes.hpp"
+
+
+
+class PointSketchException : public std::runtime_error
+{
+public:
+    explicit PointSketchException(const std::string& reason)
+        : std::runtime_error{reason}
+    {
+    }
+};
+
+
+
+class MomentSketch
+{
+public:
+    template <typename CoordinateType>
+    void add(const Point<CoordinateType>& point);
+
+    template <typename CoordinateType>
+    void add(const Point<CoordinateType>* points, std::size_t count);
+
+    void merge(const MomentSketch& other);
+
+    std::uint64_t count() const;
+    Point<double> mean() const;
+    SymmetricMatrix3 covariance() const;
+
+    void writeTo(ByteWriter& writer) const;
+    static MomentSketch readFrom(ByteReader& reader);
+
+private:
+    CovarianceAccumulator accumulator_;
+};
+
+
+
+class BoundsSketch
+{
+public:
+    // A new BoundsSketch has seen no points, and its bounds are empty:
+    // its lower corner is infinite and its upper corner is negative
+    // infinity.
+    BoundsSketch();
+
+    template <typename CoordinateType>
+    void add(const Point<CoordinateType>& point);
+
+    template <typename CoordinateType>
+    void add(const Point<CoordinateType>* points, std::size_t count);
+
+    void merge(const BoundsSketch& other);
+
+    std::uint64_t count() const;
+    Point<double> lower() const;
+    Point<double> upper() const;
+
+    void writeTo(ByteWriter& writer) const;
+    static BoundsSketch readFrom(ByteReader& reader);
+
+private:
+    std::uint64_t count_;
+    double lower_[3];
+    double upper_[3];
+};
+
+
+
+// A ReservoirSketch gives each point it sees a random "key" and keeps the
+// sampleSize points with the smallest keys, which are a uniform random
+// sample of all of them.  Merging two sketches keeps the sampleSize
+// smallest keys of both, which is still a uniform sample, as long as the
+// two sketches' keys were independent.  A key is a hash of the seed, the
+// point's position in the stream, and the point's coordinates, so two
+// sketches fed different points get independent keys even when they have
+// the same seed (as a PointSummary's do, by default).
+class ReservoirSketch
+{
+public:
+    explicit ReservoirSketch(std::size_t sampleSize, std::uint64_t seed = 0);
+
+    template <typename CoordinateType>
+    void add(const Point<CoordinateType>& point);
+
+    template <typename CoordinateType>
+    void add(const Point<CoordinateType>* points, std::size_t count);
+
+    // merge() throws a PointSketchException if the other sketch has a
+    // different sample size.
+    void merge(const ReservoirSketch& other);
+
+    std::uint64_t count() const;
+    std::size_t sampleSize() const;
+
+    // sample() returns the sampled points, in no particular order.
+    std::vector<Point<double>> sample() const;
+
+    void writeTo(ByteWriter& writer) const;
+    static ReservoirSketch readFrom(ByteReader& reader);
+
+private:
+    struct Entry
+    {
+        std::uint64_t key;
+        Point<double> point;
+
+        bool operator<(const Entry& other) const
+        {
+            return key < other.key;
+        }
+    };
+
+    void offer(std::uint64_t key, const Point<double>& point);
+
+    std::size_t sampleSize_;
+    std::uint64_t seed_;
+    std::uint64_t count_;
+
+    // entries_ is a max-heap by key, so the entry to evict is at the front.
+    std::vector<Entry> entries_;
+};
+
+
+
+// A VoxelDensitySketch is a count-min sketch of voxel counts: depth rows of
+// width counters, each row with its own hash function from voxels to
+// counters.  Adding a point increments its voxel's counter in every row;
+// a voxel's count is estimated by the smallest of its counters.  Other
+// voxels that hash to the same counters can only make them larger, so the
+// estimate is never too small, and with high probability it's too large by
+// no more than a small fraction (about e / width) of all the points seen.
+// Merging adds the counters, so both sketches must have the same voxel
+// size, width, and depth.
+class VoxelDensitySketch
+{
+public:
+    // The width is rounded up to a power of two.  The constructor throws
+    // an std::invalid_argument if the voxel size isn't positive or the
+    // width or depth is zero.
+    explicit VoxelDensitySketch(
+        double voxelSize, std::size_t width = 16384, std::size_t depth = 4);
+
+    template <typename CoordinateType>
+    void add(const Point<CoordinateType>& point);
+
+    template <typename CoordinateType>
+    void add(const Point<CoordinateType>* points, std::size_t count);
+
+    // merge() throws a PointSketchException if the other sketch has a
+    // different voxel size, width, or depth.
+    void merge(const VoxelDensitySketch& other);
+
+    // estimate() returns the estimated number of points that were in the
+    // voxel containing a given point.
+    template <typename CoordinateType>
+    std::uint64_t estimate(const Point<CoordinateType>& point) const;
+
+    std::uint64_t count() const;
+    double voxelSize() const;
+
+    // Counters that are zero take one byte each when written, so a sketch
+    // that has seen few voxels is small.
+    void writeTo(ByteWriter& writer) const;
+    static VoxelDensitySketch readFrom(ByteReader& reader);
+
+private:
+    std::size_t counterOf(std::uint64_t voxelHash, std::size_t row) const;
+
+    template <typename CoordinateType>
+    std::uint64_t voxelHashOf(const Point<CoordinateType>& point) const;
+
+    double voxelSize_;
+    std::size_t width_;
+    std::size_t depth_;
+    std::uint64_t count_;
+    std::vector<std::uint64_t> counters_;
+};
+
+
+
+// A PointSummary is one of each kind of sketch, all fed the same points.
+class PointSummary
+{
+public:
+    PointSummary(
+        std::size_t sampleSize, double voxelSize, std::uint64_t seed = 0,
+        std::size_t densityWidth = 16384, std::size_t densityDepth = 4);
+
+    template <typename CoordinateType>
+    void add(const Point<CoordinateType>* points, std::size_t count);
+
+    template <typename CoordinateType>
+    void add(const std::vector<Point<CoordinateType>>& points);
+
+    void merge(const PointSummary& other);
+
+    const MomentSketch& moments() const;
+    const BoundsSketch& bounds() const;
+    const ReservoirSketch& sample() const;
+    const VoxelDensitySketch& density() const;
+
+    void writeTo(ByteWriter& writer) const;
+    static PointSummary readFrom(ByteReader& reader);
+
+private:
+    PointSummary(
+        MomentSketch moments, BoundsSketch bounds, ReservoirSketch sample,
+        VoxelDensitySketch density);
+
+    MomentSketch moments_;
+    BoundsSketch bounds_;
+    ReservoirSketch sample_;
+    VoxelDensitySketch density_;
+};
+
+
+
+namespace PointSketchesImpl
+{
+    // Batch updates work on this many points at a time.
+    constexpr std::size_t batchSize = 256;
+
+    // Each kind of sketch starts with its own magic number, followed by a
+    // version, so that reading the wrong kind of bytes fails cleanly.
+    constexpr std::uint32_t momentMagic = 0x4D4F4B53;     // "SKOM"
+    constexpr std::uint32_t boundsMagic = 0x44424B53;     // "SKBD"
+    constexpr std::uint32_t reservoirMagic = 0x53524B53;  // "SKRS"
+    constexpr std::uint32_t densityMagic = 0x4D434B53;    // "SKCM"
+    constexpr std::uint32_t summaryMagic = 0x4D534B53;    // "SKSM"
+    constexpr std::uint16_t version = 1;
+
+
+    // mix() is the finishing step of the SplitMix64 generator, which turns
+    // consecutive (or otherwise similar) numbers into unrelated-looking
+    // ones.  It's arithmetic only, so loops of it can be vectorized.
+    inline std::uint64_t mix(std::uint64_t x)
+    {
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    }
+
+
+    // bitsOf() returns the bits of a double, for hashing.
+    inline std::uint64_t bitsOf(double value)
+    {
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+
+    inline void writeHeader(ByteWriter& writer, std::uint32_t magic)
+    {
+        writer.writeU32(magic);
+        writer.writeU16(version);
+    }
+
+
+    inline void readHeader(ByteReader& reader, std::uint32_t magic, const char* kind)
+    {
+        if (reader.readU32() != magic || reader.readU16() != version)
+        {
+            throw PointSketchException{std::string{"not a "} + kind};
+        }
+    }
+
+
+    inline void writePoint(ByteWriter& writer, const Point<double>& point)
+    {
+        writer.writeDouble(point.x());
+        writer.writeDouble(point.y());
+        writer.writeDouble(point.z());
+    }
+
+
+    inline Point<double> readPoint(ByteReader& reader)
+    {
+        const double x = reader.readDouble();
+        const double y = reader.readDouble();
+        const double z = reader.readDouble();
+        return Point<double>{x, y, z};
+    }
+
+
+    // Varints store seven bits per byte, least significant first, with the
+    // high bit set on every byte but the last, so small numbers are short.
+    inline void writeVarint(ByteWriter& writer, std::uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            writer.writeU8(static_cast<std::uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+
+        writer.writeU8(static_cast<std::uint8_t>(value));
+    }
+
+
+    inline std::uint64_t readVarint(ByteReader& reader)
+    {
+        std::uint64_t value = 0;
+
+        for (unsigned int shift = 0; shift < 64; shift += 7)
+        {
+            const std::uint8_t byte = reader.readU8();
+            value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+
+            if ((byte & 0x80) == 0)
+            {
+                return value;
+            }
+        }
+
+        throw PointSketchException{"invalid varint"};
+    }
+}
+
+
+
+template <typename CoordinateType>
+void MomentSketch::add(const Point<CoordinateType>& point)
+{
+    accumulator_.add(point);
+}
+
+
+template <typename CoordinateType>
+void MomentSketch::add(const Point<CoordinateType>* points, std::size_t count)
+{
+    accumulator_.add(points, count);
+}
+
+
+inline void MomentSketch::merge(const MomentSketch& other)
+{
+    accumulator_.merge(other.accumulator_);
+}
+
+
+inline std::uint64_t MomentSketch::count() const
+{
+    return accumulator_.count();
+}
+
+
+inline Point<double> MomentSketch::mean() const
+{
+    return accumulator_.mean();
+}
+
+
+inline SymmetricMatrix3 MomentSketch::covariance() const
+{
+    return accumulator_.covariance();
+}
+
+
+inline void MomentSketch::writeTo(ByteWriter& writer) const
+{
+    using namespace PointSketchesImpl;
+
+    writeHeader(writer, momentMagic);
+    writer.writeU64(accumulator_.count());
+    writePoint(writer, accumulator_.mean());
+
+    const SymmetricMatrix3 c = accumulator_.covariance();
+
+    for (double value : {c.xx, c.xy, c.xz, c.yy, c.yz, c.zz})
+    {
+        writer.writeDouble(value);
+    }
+}
+
+
+inline MomentSketch MomentSketch::readFrom(ByteReader& reader)
+{
+    using namespace PointSketchesImpl;
+
+    readHeader(reader, momentMagic, "moment sketch");
+
+    const std::uint64_t count = reader.readU64();
+    const Point<double> mean = readPoint(reader);
+
+    SymmetricMatrix3 c;
+    c.xx = reader.readDouble();
+    c.xy = reader.readDouble();
+    c.xz = reader.readDouble();
+    c.yy = reader.readDouble();
+    c.yz = reader.readDouble();
+    c.zz = reader.readDouble();
+
+    MomentSketch sketch;
+    sketch.accumulator_ = CovarianceAccumulator{count, mean, c};
+    return sketch;
+}
+
+
+
+inline BoundsSketch::BoundsSketch()
+    : count_{0}
+{
+    std::fill(lower_, lower_ + 3, std::numeric_limits<double>::infinity());
+    std::fill(upper_, upper_ + 3, -std::numeric_limits<double>::infinity());
+}
+
+
+template <typename CoordinateType>
+void BoundsSketch::add(const Point<CoordinateType>& point)
+{
+    add(&point, 1);
+}
+
+
+// Each batch's bounds are found with one loop per coordinate, each keeping
+// its own minimum and maximum, which the compiler can vectorize.
+
+template <typename CoordinateType>
+void BoundsSketch::add(const Point<CoordinateType>* points, std::size_t count)
+{
+    for (std::size_t first = 0; first < count; first += PointSketchesImpl::batchSize)
+    {
+        const std::size_t last = std::min(count, first + PointSketchesImpl::batchSize);
+
+        double lx = lower_[0], ly = lower_[1], lz = lower_[2];
+        double ux = upper_[0], uy = upper_[1], uz = upper_[2];
+
+        for (std::size_t i = first; i < last; ++i)
+        {
+            const double x = static_cast<double>(points[i].x());
+            const double y = static_cast<double>(points[i].y());
+            const double z = static_cast<double>(points[i].z());
+
+            lx = x < lx ? x : lx;
+            ly = y < ly ? y : ly;
+            lz = z < lz ? z : lz;
+            ux = x > ux ? x : ux;
+            uy = y > uy ? y : uy;
+            uz = z > uz ? z : uz;
+        }
+
+        lower_[0] = lx;
+        lower_[1] = ly;
+        lower_[2] = lz;
+        upper_[0] = ux;
+        upper_[1] = uy;
+        upper_[2] = uz;
+    }
+
+    count_ += count;
+}
+
+
+inline void BoundsSketch::merge(const BoundsSketch& other)
+{
+    for (unsigned int axis = 0; axis < 3; ++axis)
+    {
+        lower_[axis] = std::min(lower_[axis], other.lower_[axis]);
+        upper_[axis] = std::max(upper_[axis], other.upper_[axis]);
+    }
+
+    count_ += other.count_;
+}
+
+
+inline std::uint64_t BoundsSketch::count() const
+{
+    return count_;
+}
+
+
+inline Point<double> BoundsSketch::lower() const
+{
+    return Point<double>{lower_[0], lower_[1], lower_[2]};
+}
+
+
+inline Point<double> BoundsSketch::upper() const
+{
+    return Point<double>{upper_[0], upper_[1], upper_[2]};
+}
+
+
+inline void BoundsSketch::writeTo(ByteWriter& writer) const
+{
+    using namespace PointSketchesImpl;
+
+    writeHeader(writer, boundsMagic);
+    writer.writeU64(count_);
+    writePoint(writer, lower());
+    writePoint(writer, upper());
+}
+
+
+inline BoundsSketch BoundsSketch::readFrom(ByteReader& reader)
+{
+    using namespace PointSketchesImpl;
+
+    readHeader(reader, boundsMagic, "bounds sketch");
+
+    BoundsSketch sketch;
+    sketch.count_ = reader.readU64();
+
+    const Point<double> lower = readPoint(reader);
+    const Point<double> upper = readPoint(reader);
+
+    sketch.lower_[0] = lower.x();
+    sketch.lower_[1] = lower.y();
+    sketch.lower_[2] = lower.z();
+    sketch.upper_[0] = upper.x();
+    sketch.upper_[1] = upper.y();
+    sketch.upper_[2] = upper.z();
+    return sketch;
+}
+
+
+
+inline ReservoirSketch::ReservoirSketch(std::size_t sampleSize, std::uint64_t seed)
+    : sampleSize_{sampleSize}, seed_{PointSketchesImpl::mix(seed ^ 0x9E3779B97F4A7C15ull)}, count_{0}
+{
+}
+
+
+template <typename CoordinateType>
+void ReservoirSketch::add(const Point<CoordinateType>& point)
+{
+    add(&point, 1);
+}
+
+
+// A point's key comes from mixing the seed with the point's position in
+// the stream and the bits of its coordinates.  The position keeps repeated
+// points within one stream apart; the coordinates keep two streams apart,
+// since otherwise the nth point of every sketch with the same seed would
+// get the same key, and merging them would keep the nth points of all of
+// them or none.  The keys for a whole batch are computed in one
+// vectorizable loop.  Once the reservoir is full, only a point whose key is
+// smaller than the largest kept key gets in, which becomes rarer and rarer
+// as the stream goes on, so most batches do little more than compute keys
+// and compare them.
+
+template <typename CoordinateType>
+void ReservoirSketch::add(const Point<CoordinateType>* points, std::size_t count)
+{
+    using namespace PointSketchesImpl;
+
+    std::uint64_t keys[batchSize];
+
+    for (std::size_t first = 0; first < count; first += batchSize)
+    {
+        const std::size_t size = std::min(count - first, batchSize);
+
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            const Point<CoordinateType>& p = points[first + i];
+
+            std::uint64_t h = seed_ + (count_ + i) * 0x9E3779B97F4A7C15ull;
+            h ^= bitsOf(static_cast<double>(p.x())) * 0xC2B2AE3D27D4EB4Full;
+            h ^= bitsOf(static_cast<double>(p.y())) * 0x165667B19E3779F9ull;
+            h ^= bitsOf(static_cast<double>(p.z())) * 0xD6E8FEB86659FD93ull;
+            keys[i] = mix(h);
+        }
+
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            if (entries_.size() < sampleSize_ || keys[i] < entries_.front().key)
+            {
+                const Point<CoordinateType>& p = points[first + i];
+
+                offer(keys[i], Point<double>{
+                    static_cast<double>(p.x()), static_cast<double>(p.y()),
+                    static_cast<double>(p.z())});
+            }
+        }
+
+        count_ += size;
+    }
+}
+
+
+inline void ReservoirSketch::offer(std::uint64_t key, const Point<double>& point)
+{
+    if (sampleSize_ == 0)
+    {
+        return;
+    }
+
+    if (entries_.size() == sampleSize_)
+    {
+        if (!(key < entries_.front().key))
+        {
+            return;
+        }
+
+        std::pop_heap(entries_.begin(), entries_.end());
+        entries_.pop_back();
+    }
+
+    entries_.push_back(Entry{key, point});
+    std::push_heap(entries_.begin(), entries_.end());
+}
+
+
+inline void ReservoirSketch::merge(const ReservoirSketch& other)
+{
+    if (other.sampleSize_ != sampleSize_)
+    {
+        throw PointSketchException{"cannot merge reservoir sketches of different sizes"};
+    }
+
+    for (const Entry& entry : other.entries_)
+    {
+        offer(entry.key, entry.point);
+    }
+
+    count_ += other.count_;
+}
+
+
+inline std::uint64_t ReservoirSketch::count() const
+{
+    return count_;
+}
+
+
+inline std::size_t ReservoirSketch::sampleSize() const
+{
+    return sampleSize_;
+}
+
+
+inline std::vector<Point<double>> ReservoirSketch::sample() const
+{
+    std::vector<Point<double>> points;
+    points.reserve(entries_.size());
+
+    for (const Entry& entry : entries_)
+    {
+        points.push_back(entry.point);
+    }
+
+    return points;
+}
+
+
+// The seed is written too, so that a sketch read back in can keep adding
+// points with the same keys it would have used.
+
+inline void ReservoirSketch::writeTo(ByteWriter& writer) const
+{
+    using namespace PointSketchesImpl;
+
+    writeHeader(writer, reservoirMagic);
+    writer.writeU64(sampleSize_);
+    writer.writeU64(seed_);
+    writer.writeU64(count_);
+    writer.writeU64(entries_.size());
+
+    for (const Entry& entry : entries_)
+    {
+        writer.writeU64(entry.key);
+        writePoint(writer, entry.point);
+    }
+}
+
+
+inline ReservoirSketch ReservoirSketch::readFrom(ByteReader& reader)
+{
+    using namespace PointSketchesImpl;
+
+    readHeader(reader, reservoirMagic, "reservoir sketch");
+
+    ReservoirSketch sketch{0};
+    sketch.sampleSize_ = reader.readU64();
+    sketch.seed_ = reader.readU64();
+    sketch.count_ = reader.readU64();
+
+    const std::uint64_t entryCount = reader.readU64();
+
+    if (entryCount > sketch.sampleSize_ || entryCount > reader.remaining() / 32)
+    {
+        throw PointSketchException{"invalid reservoir sketch"};
+    }
+
+    sketch.entries_.reserve(entryCount);
+
+    for (std::uint64_t i = 0; i < entryCount; ++i)
+    {
+        const std::uint64_t key = reader.readU64();
+        sketch.entries_.push_back(Entry{key, readPoint(reader)});
+    }
+
+    std::make_heap(sketch.entries_.begin(), sketch.entries_.end());
+    return sketch;
+}
+
+
+
+inline VoxelDensitySketch::VoxelDensitySketch(
+    double voxelSize, std::size_t width, std::size_t depth)
+    : voxelSize_{voxelSize}, width_{1}, depth_{depth}, count_{0}
+{
+    if (!(voxelSize > 0.0) || width == 0 || depth == 0)
+    {
+        throw std::invalid_argument{"VoxelDensitySketch: invalid voxel size, width, or depth"};
+    }
+
+    while (width_ < width)
+    {
+        width_ *= 2;
+    }
+
+    counters_.assign(width_ * depth_, 0);
+}
+
+
+// A voxel is hashed once, to 64 bits, and each row takes its counter from
+// mixing that hash with the row number; the rows' hash functions are
+// independent enough for count-min's guarantees in practice.
+
+template <typename CoordinateType>
+std::uint64_t VoxelDensitySketch::voxelHashOf(const Point<CoordinateType>& point) const
+{
+    const std::int64_t x = static_cast<std::int64_t>(std::floor(static_cast<double>(point.x()) / voxelSize_));
+    const std::int64_t y = static_cast<std::int64_t>(std::floor(static_cast<double>(point.y()) / voxelSize_));
+    const std::int64_t z = static_cast<std::int64_t>(std::floor(static_cast<double>(point.z()) / voxelSize_));
+
+    std::uint64_t h = static_cast<std::uint64_t>(x) * 0x9E3779B97F4A7C15ull;
+    h ^= static_cast<std::uint64_t>(y) * 0xC2B2AE3D27D4EB4Full;
+    h ^= static_cast<std::uint64_t>(z) * 0x165667B19E3779F9ull;
+    return PointSketchesImpl::mix(h);
+}
+
+
+inline std::size_t VoxelDensitySketch::counterOf(std::uint64_t voxelHash, std::size_t row) const
+{
+    const std::uint64_t h = PointSketchesImpl::mix(voxelHash + row * 0xD6E8FEB86659FD93ull);
+    return row * width_ + static_cast<std::size_t>(h & (width_ - 1));
+}
+
+
+template <typename CoordinateType>
+void VoxelDensitySketch::add(const Point<CoordinateType>& point)
+{
+    add(&point, 1);
+}
+
+
+template <typename CoordinateType>
+void VoxelDensitySketch::add(const Point<CoordinateType>* points, std::size_t count)
+{
+    using namespace PointSketchesImpl;
+
+    std::uint64_t hashes[batchSize];
+
+    for (std::size_t first = 0; first < count; first += batchSize)
+    {
+        const std::size_t size = std::min(count - first, batchSize);
+
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            hashes[i] = voxelHashOf(points[first + i]);
+        }
+
+        for (std::size_t row = 0; row < depth_; ++row)
+        {
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                ++counters_[counterOf(hashes[i], row)];
+            }
+        }
+    }
+
+    count_ += count;
+}
+
+
+inline void VoxelDensitySketch::merge(const VoxelDensitySketch& other)
+{
+    if (other.voxelSize_ != voxelSize_ || other.width_ != width_ || other.depth_ != depth_)
+    {
+        throw PointSketchException{"cannot merge voxel density sketches of different shapes"};
+    }
+
+    for (std::size_t i = 0; i < counters_.size(); ++i)
+    {
+        counters_[i] += other.counters_[i];
+    }
+
+    count_ += other.count_;
+}
+
+
+template <typename CoordinateType>
+std::uint64_t VoxelDensitySketch::estimate(const Point<CoordinateType>& point) const
+{
+    const std::uint64_t hash = voxelHashOf(point);
+    std::uint64_t smallest = std::numeric_limits<std::uint64_t>::max();
+
+    for (std::size_t row = 0; row < depth_; ++row)
+    {
+        smallest = std::min(smallest, counters_[counterOf(hash, row)]);
+    }
+
+    return smallest;
+}
+
+
+inline std::uint64_t VoxelDensitySketch::count() const
+{
+    return count_;
+}
+
+
+inline double VoxelDensitySketch::voxelSize() const
+{
+    return voxelSize_;
+}
+
+
+inline void VoxelDensitySketch::writeTo(ByteWriter& writer) const
+{
+    using namespace PointSketchesImpl;
+
+    writeHeader(writer, densityMagic);
+    writer.writeDouble(voxelSize_);
+    writer.writeU64(width_);
+    writer.writeU64(depth_);
+    writer.writeU64(count_);
+
+    for (std::uint64_t counter : counters_)
+    {
+        writeVarint(writer, counter);
+    }
+}
+
+
+inline VoxelDensitySketch VoxelDensitySketch::readFrom(ByteReader& reader)
+{
+    using namespace PointSketchesImpl;
+
+    readHeader(reader, densityMagic, "voxel density sketch");
+
+    const double voxelSize = reader.readDouble();
+    const std::uint64_t width = reader.readU64();
+    const std::uint64_t depth = reader.readU64();
+
+    // Every counter takes at least a byte, which bounds how large a sketch
+    // the remaining bytes can describe.
+    if (width == 0 || (width & (width - 1)) != 0 || depth == 0
+        || width > reader.remaining() || depth > reader.remaining() / width)
+    {
+        throw PointSketchException{"invalid voxel density sketch"};
+    }
+
+    VoxelDensitySketch sketch{voxelSize, static_cast<std::size_t>(width), static_cast<std::size_t>(depth)};
+    sketch.count_ = reader.readU64();
+
+    for (std::uint64_t& counter : sketch.counters_)
+    {
+        counter = readVarint(reader);
+    }
+
+    return sketch;
+}
+
+
+
+inline PointSummary::PointSummary(
+    std::size_t sampleSize, double voxelSize, std::uint64_t seed,
+    std::size_t densityWidth, std::size_t densityDepth)
+    : sample_{sampleSize, seed}, density_{voxelSize, densityWidth, densityDepth}
+{
+}
+
+
+inline PointSummary::PointSummary(
+    MomentSketch moments, BoundsSketch bounds, ReservoirSketch sample,
+    VoxelDensitySketch density)
+    : moments_{std::move(moments)}, bounds_{std::move(bounds)},
+      sample_{std::move(sample)}, density_{std::move(density)}
+{
+}
+
+
+template <typename CoordinateType>
+void PointSummary::add(const Point<CoordinateType>* points, std::size_t count)
+{
+    moments_.add(points, count);
+    bounds_.add(points, count);
+    sample_.add(points, count);
+    density_.add(points, count);
+}
+
+
+template <typename CoordinateType>
+void PointSummary::add(const std::vector<Point<CoordinateType>>& points)
+{
+    add(points.data(), points.size());
+}
+
+
+inline void PointSummary::merge(const PointSummary& other)
+{
+    moments_.merge(other.moments_);
+    bounds_.merge(other.bounds_);
+    sample_.merge(other.sample_);
+    density_.merge(other.density_);
+}
+
+
+inline const MomentSketch& PointSummary::moments() const
+{
+    return moments_;
+}
+
+
+inline const BoundsSketch& PointSummary::bounds() const
+{
+    return bounds_;
+}
+
+
+inline const ReservoirSketch& PointSummary::sample() const
+{
+    return sample_;
+}
+
+
+inline const VoxelDensitySketch& PointSummary::density() const
+{
+    return density_;
+}
+
+
+inline void PointSummary::writeTo(ByteWriter& writer) const
+{
+    PointSketchesImpl::writeHeader(writer, PointSketchesImpl::summaryMagic);
+    moments_.writeTo(writer);
+    bounds_.writeTo(writer);
+    sample_.writeTo(writer);
+    density_.writeTo(writer);
+}
+
+
+inline PointSummary PointSummary::readFrom(ByteReader& reader)
+{
+    PointSketchesImpl::readHeader(reader, PointSketchesImpl::summaryMagic, "point summary");
+
+    MomentSketch moments = MomentSketch::readFrom(reader);
+    BoundsSketch bounds = BoundsSketch::readFrom(reader);
+    ReservoirSketch sample = ReservoirSketch::readFrom(reader);
+    VoxelDensitySketch density = VoxelDensitySketch::readFrom(reader);
+
+    return PointSummary{std::move(moments), std::move(bounds), std::move(sample), std::move(density)};
+}
+
+
+
+#endif // POINTSKETCHES_HPP
+
@@ -0,0 +1,522 @@
+// PrincipalAxes.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines the pieces of "principal component
+// analysis" for sets of points: finding the directions along which a set
+// of points is most and least spread out.  A set of points scanned from a
+// wall, for example, is spread out along the wall's length and height but
+// hardly at all through its thickness, so the direction of least spread is
+// the wall's normal.
+//
+// There are two pieces:
+//
+// * A CovarianceAccumulator computes the mean and covariance of points fed
+//   to it one at a time (or in batches), without storing them.  It uses
+//   Welford's method, which updates the mean and the sums of products of
+//   deviations from it as each point arrives.  The obvious alternative --
+//   summing x, x^2, xy, and so on, and combining them at the end -- loses
+//   most of its precision when the points are far from the origin, since
+//   it subtracts nearly equal large numbers.  Two accumulators can also be
+//   merged, so separate threads (or processes) can each accumulate part of
+//   a set of points and combine their results afterward.
+// * symmetricEigensystem() finds the eigenvalues and eigenvectors of a
+//   3x3 symmetric matrix, like a covariance matrix, directly from formulas
+//   rather than by iterating.  The eigenvectors are the directions of most,
+//   middle, and least spread, and the eigenvalues are the variances along
+//   them.
+//
+// Neither allocates any memory, so both are cheap enough to use on every
+// one of thousands of small clusters of points.
+
+#ifndef PRINCIPALAXES_HPP
+#define PRINCIPALAXES_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include "Point.hpp"
+
+
+
+// A SymmetricMatrix3 is a 3x3 symmetric matrix, which only needs six of
+// its nine elements to be stored.
+struct SymmetricMatrix3
+{
+    double xx;
+    double xy;
+    double xz;
+    double yy;
+    double yz;
+    double zz;
+};
+
+
+// An Eigensystem3 holds the eigenvalues of a 3x3 symmetric matrix, largest
+// first, and the corresponding eigenvectors, which have unit length and
+// are perpendicular to one another.  The third is the cross product of the
+// first two, so that they form a right-handed coordinate system.
+struct Eigensystem3
+{
+    double values[3];
+    Point<double> vectors[3];
+};
+
+
+
+class CovarianceAccumulator
+{
+public:
+    // A new CovarianceAccumulator has seen no points.
+    CovarianceAccumulator();
+
+
+    // This constructor rebuilds an accumulator from what another one
+    // reported -- its count, mean, and covariance -- so that accumulators
+    // can be sent elsewhere (to another process, say) and merged there.
+    CovarianceAccumulator(
+        std::uint64_t count, const Point<double>& mean, const SymmetricMatrix3& covariance);
+
+
+    // add() accounts for one more point, or for count of them.
+    void add(double x, double y, double z);
+
+    template <typename CoordinateType>
+    void add(const Point<CoordinateType>& point);
+
+    template <typename CoordinateType>
+    void add(const Point<CoordinateType>* points, std::size_t count);
+
+
+    // merge() accounts for every point another accumulator has seen, as
+    // though they had been added to this one.
+    void merge(const CovarianceAccumulator& other);
+
+
+    // count() returns the number of points seen; mean() returns their
+    // mean, and covariance() their (population) covariance matrix, which
+    // are all zeroes if no points have been seen.
+    std::uint64_t count() const;
+    Point<double> mean() const;
+    SymmetricMatrix3 covariance() const;
+
+
+private:
+    std::uint64_t count_;
+    double mean_[3];
+
+    // The sums of the products of the points' deviations from the mean,
+    // which the covariance divides by the count.
+    SymmetricMatrix3 products_;
+};
+
+
+
+// symmetricEigensystem() returns the eigenvalues and eigenvectors of a
+// symmetric matrix.
+Eigensystem3 symmetricEigensystem(const SymmetricMatrix3& matrix);
+
+
+// principalAxes() returns the eigenvalues and eigenvectors of the
+// covariance of a set of points.
+template <typename CoordinateType>
+Eigensystem3 principalAxes(const Point<CoordinateType>* points, std::size_t count);
+
+
+
+namespace PrincipalAxesImpl
+{
+    // Batches of points are added this many at a time: the batch's own
+    // mean and products are found first, which is simple arithmetic the
+    // compiler can vectorize, and then merged in.
+    constexpr std::size_t batchSize = 256;
+
+
+    inline Point<double> cross(const double* a, const double* b)
+    {
+        return Point<double>{
+            a[1] * b[2] - a[2] * b[1],
+            a[2] * b[0] - a[0] * b[2],
+            a[0] * b[1] - a[1] * b[0]};
+    }
+
+
+    inline double squaredLength(const Point<double>& v)
+    {
+        return v.x() * v.x() + v.y() * v.y() + v.z() * v.z();
+    }
+
+
+    inline Point<double> scaled(const Point<double>& v, double factor)
+    {
+        return Point<double>{v.x() * factor, v.y() * factor, v.z() * factor};
+    }
+
+
+    inline double dot(const Point<double>& a, const Point<double>& b)
+    {
+        return a.x() * b.x() + a.y() * b.y() + a.z() * b.z();
+    }
+
+
+    inline Point<double> multiply(const SymmetricMatrix3& m, const Point<double>& v)
+    {
+        return Point<double>{
+            m.xx * v.x() + m.xy * v.y() + m.xz * v.z(),
+            m.xy * v.x() + m.yy * v.y() + m.yz * v.z(),
+            m.xz * v.x() + m.yz * v.y() + m.zz * v.z()};
+    }
+
+
+    // eigenvectorOf() finds a unit eigenvector for an eigenvalue that
+    // occurs only once.  The matrix minus that eigenvalue times the
+    // identity then has rank two, so its rows span a plane, and the
+    // eigenvector is perpendicular to that plane: it's the cross product
+    // of two of the rows.  We take the longest of the three cross
+    // products, since nearly parallel rows would give an inaccurate one.
+    inline Point<double> eigenvectorOf(const SymmetricMatrix3& m, double value)
+    {
+        const double rows[3][3] = {
+            {m.xx - value, m.xy, m.xz},
+            {m.xy, m.yy - value, m.yz},
+            {m.xz, m.yz, m.zz - value}};
+
+        const Point<double> candidates[3] = {
+            cross(rows[0], rows[1]), cross(rows[0], rows[2]), cross(rows[1], rows[2])};
+
+        Point<double> best = candidates[0];
+
+        for (const Point<double>& candidate : candidates)
+        {
+            if (squaredLength(candidate) > squaredLength(best))
+            {
+                best = candidate;
+            }
+        }
+
+        const double length = std::sqrt(squaredLength(best));
+        return length > 0.0 ? scaled(best, 1.0 / length) : Point<double>{1.0, 0.0, 0.0};
+    }
+
+
+    // perpendicularTo() returns a unit vector perpendicular to a unit
+    // vector, built from whichever axis is least parallel to it.
+    inline Point<double> perpendicularTo(const Point<double>& v)
+    {
+        const double axis[3] = {
+            std::abs(v.x()) < 0.5 ? 1.0 : 0.0,
+            std::abs(v.x()) < 0.5 ? 0.0 : 1.0,
+            0.0};
+
+        const double components[3] = {v.x(), v.y(), v.z()};
+        const Point<double> p = cross(components, axis);
+        return scaled(p, 1.0 / std::sqrt(squaredLength(p)));
+    }
+}
+
+
+
+inline CovarianceAccumulator::CovarianceAccumulator()
+    : count_{0}, mean_{0.0, 0.0, 0.0}, products_{0.0, 0.0, 0.0, 0.0, 0.0, 0.0}
+{
+}
+
+
+inline CovarianceAccumulator::CovarianceAccumulator(
+    std::uint64_t count, const Point<double>& mean, const SymmetricMatrix3& covariance)
+    : count_{count}, mean_{mean.x(), mean.y(), mean.z()}
+{
+    const double n = static_cast<double>(count);
+
+    products_ = SymmetricMatrix3{
+        covariance.xx * n, covariance.xy * n, covariance.xz * n,
+        covariance.yy * n, covariance.yz * n, covariance.zz * n};
+}
+
+
+// Welford's update moves the mean by the new point's deviation from it
+// divided by the new count, then adds the product of the point's deviation
+// from the old mean and its deviation from the new one.
+
+inline void CovarianceAccumulator::add(double x, double y, double z)
+{
+    ++count_;
+
+    const double n = static_cast<double>(count_);
+    const double before[3] = {x - mean_[0], y - mean_[1], z - mean_[2]};
+
+    mean_[0] += before[0] / n;
+    mean_[1] += before[1] / n;
+    mean_[2] += before[2] / n;
+
+    const double after[3] = {x - mean_[0], y - mean_[1], z - mean_[2]};
+
+    products_.xx += before[0] * after[0];
+    products_.xy += before[0] * after[1];
+    products_.xz += before[0] * after[2];
+    products_.yy += before[1] * after[1];
+    products_.yz += before[1] * after[2];
+    products_.zz += before[2] * after[2];
+}
+
+
+template <typename CoordinateType>
+void CovarianceAccumulator::add(const Point<CoordinateType>& point)
+{
+    add(static_cast<double>(point.x()), static_cast<double>(point.y()),
+        static_cast<double>(point.z()));
+}
+
+
+// Each batch is accumulated the "two-pass" way, which is exact enough for
+// a few hundred points: first its mean, then its products of deviations
+// from that mean.  Then it's merged in like any other accumulator.
+
+template <typename CoordinateType>
+void CovarianceAccumulator::add(const Point<CoordinateType>* points, std::size_t count)
+{
+    for (std::size_t first = 0; first < count; first += PrincipalAxesImpl::batchSize)
+    {
+        const std::size_t last = std::min(count, first + PrincipalAxesImpl::batchSize);
+        const double n = static_cast<double>(last - first);
+
+        double sx = 0.0;
+        double sy = 0.0;
+        double sz = 0.0;
+
+        for (std::size_t i = first; i < last; ++i)
+        {
+            sx += static_cast<double>(points[i].x());
+            sy += static_cast<double>(points[i].y());
+            sz += static_cast<double>(points[i].z());
+        }
+
+        CovarianceAccumulator batch;
+        batch.count_ = last - first;
+        batch.mean_[0] = sx / n;
+        batch.mean_[1] = sy / n;
+        batch.mean_[2] = sz / n;
+
+        SymmetricMatrix3 products{0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+
+        for (std::size_t i = first; i < last; ++i)
+        {
+            const double dx = static_cast<double>(points[i].x()) - batch.mean_[0];
+            const double dy = static_cast<double>(points[i].y()) - batch.mean_[1];
+            const double dz = static_cast<double>(points[i].z()) - batch.mean_[2];
+
+            products.xx += dx * dx;
+            products.xy += dx * dy;
+            products.xz += dx * dz;
+            products.yy += dy * dy;
+            products.yz += dy * dz;
+            products.zz += dz * dz;
+        }
+
+        batch.products_ = products;
+        merge(batch);
+    }
+}
+
+
+// Merging (Chan's method) weights the two means by their counts; the
+// products of the combined set are the two sets' own products plus a term
+// for how far apart their means are.
+
+inline void CovarianceAccumulator::merge(const CovarianceAccumulator& other)
+{
+    if (other.count_ == 0)
+    {
+        return;
+    }
+
+    if (count_ == 0)
+    {
+        *this = other;
+        return;
+    }
+
+    const double n1 = static_cast<double>(count_);
+    const double n2 = static_cast<double>(other.count_);
+    const double n = n1 + n2;
+    const double d[3] = {
+        other.mean_[0] - mean_[0], other.mean_[1] - mean_[1], other.mean_[2] - mean_[2]};
+    const double weight = n1 * n2 / n;
+
+    products_.xx += other.products_.xx + d[0] * d[0] * weight;
+    products_.xy += other.products_.xy + d[0] * d[1] * weight;
+    products_.xz += other.products_.xz + d[0] * d[2] * weight;
+    products_.yy += other.products_.yy + d[1] * d[1] * weight;
+    products_.yz += other.products_.yz + d[1] * d[2] * weight;
+    products_.zz += other.products_.zz + d[2] * d[2] * weight;
+
+    for (unsigned int axis = 0; axis < 3; ++axis)
+    {
+        mean_[axis] += d[axis] * (n2 / n);
+    }
+
+    count_ += other.count_;
+}
+
+
+inline std::uint64_t CovarianceAccumulator::count() const
+{
+    return count_;
+}
+
+
+inline Point<double> CovarianceAccumulator::mean() const
+{
+    return Point<double>{mean_[0], mean_[1], mean_[2]};
+}
+
+
+inline SymmetricMatrix3 CovarianceAccumulator::covariance() const
+{
+    if (count_ == 0)
+    {
+        return SymmetricMatrix3{0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+    }
+
+    const double n = static_cast<double>(count_);
+
+    return SymmetricMatrix3{
+        products_.xx / n, products_.xy / n, products_.xz / n,
+        products_.yy / n, products_.yz / n, products_.zz / n};
+}
+
+
+// The eigenvalues are the roots of a cubic, which has three real roots
+// since the matrix is symmetric.  Shifting the matrix by a third of its
+// trace (q) and scaling it by p makes the cubic x^3 - 3x - 2r, whose roots
+// are 2 cos(phi + 2 pi k / 3) for phi = acos(r) / 3; working with the
+// shifted, scaled matrix also keeps the arithmetic accurate when the
+// eigenvalues are close together.
+//
+// The eigenvalue farther from the middle one occurs only once (unless all
+// three are equal), so eigenvectorOf() can find its eigenvector reliably.
+// The other two eigenvectors lie in the plane perpendicular to it, where
+// the matrix acts like a 2x2 symmetric matrix; a single rotation by the
+// angle theta, from the closed-form solution of that 2x2 problem, lines
+// two perpendicular vectors in the plane up with them, even if their
+// eigenvalues are equal.
+
+inline Eigensystem3 symmetricEigensystem(const SymmetricMatrix3& m)
+{
+    using namespace PrincipalAxesImpl;
+
+    const double pi = 3.14159265358979323846;
+
+    const double offDiagonal = m.xy * m.xy + m.xz * m.xz + m.yz * m.yz;
+    const double q = (m.xx + m.yy + m.zz) / 3.0;
+    const double p = std::sqrt(
+        ((m.xx - q) * (m.xx - q) + (m.yy - q) * (m.yy - q) + (m.zz - q) * (m.zz - q)
+            + 2.0 * offDiagonal) / 6.0);
+
+    Eigensystem3 result;
+
+    if (p == 0.0)
+    {
+        result.values[0] = result.values[1] = result.values[2] = q;
+        result.vectors[0] = Point<double>{1.0, 0.0, 0.0};
+        result.vectors[1] = Point<double>{0.0, 1.0, 0.0};
+        result.vectors[2] = Point<double>{0.0, 0.0, 1.0};
+        return result;
+    }
+
+    const double bxx = (m.xx - q) / p;
+    const double byy = (m.yy - q) / p;
+    const double bzz = (m.zz - q) / p;
+    const double bxy = m.xy / p;
+    const double bxz = m.xz / p;
+    const double byz = m.yz / p;
+
+    const double determinant =
+        bxx * (byy * bzz - byz * byz) - bxy * (bxy * bzz - byz * bxz) + bxz * (bxy * byz - byy * bxz);
+    const double r = std::clamp(determinant / 2.0, -1.0, 1.0);
+    const double phi = std::acos(r) / 3.0;
+
+    result.values[0] = q + 2.0 * p * std::cos(phi);
+    result.values[2] = q + 2.0 * p * std::cos(phi + 2.0 * pi / 3.0);
+    result.values[1] = 3.0 * q - result.values[0] - result.values[2];
+
+    const bool largestIsDistinct =
+        result.values[0] - result.values[1] >= result.values[1] - result.values[2];
+    const unsigned int distinct = largestIsDistinct ? 0 : 2;
+
+    const Point<double> v = eigenvectorOf(m, result.values[distinct]);
+    const Point<double> u = perpendicularTo(v);
+    const double vComponents[3] = {v.x(), v.y(), v.z()};
+    const double uComponents[3] = {u.x(), u.y(), u.z()};
+    const Point<double> w = cross(vComponents, uComponents);
+
+    const double a = dot(u, multiply(m, u));
+    const double b = dot(u, multiply(m, w));
+    const double c = dot(w, multiply(m, w));
+    const double theta = 0.5 * std::atan2(2.0 * b, a - c);
+    const double cosine = std::cos(theta);
+    const double sine = std::sin(theta);
+
+    // The rotated u has the larger of the two eigenvalues.
+    const Point<double> larger{
+        cosine * u.x() + sine * w.x(), cosine * u.y() + sine * w.y(), cosine * u.z() + sine * w.z()};
+    const Point<double> smaller{
+        cosine * w.x() - sine * u.x(), cosine * w.y() - sine * u.y(), cosine * w.z() - sine * u.z()};
+
+    if (largestIsDistinct)
+    {
+        result.vectors[0] = v;
+        result.vectors[1] = larger;
+    }
+    else
+    {
+        result.vectors[0] = larger;
+        result.vectors[1] = smaller;
+    }
+
+    result.vectors[2] = largestIsDistinct ? smaller : v;
+
+    // The formula's eigenvalues lose precision when two of them are nearly
+    // equal (acos() is badly behaved near 1), but the vectors are accurate
+    // regardless, so each eigenvalue is recomputed from its vector, and
+    // the (rare) pair put out of order by rounding is swapped back.
+    for (unsigned int k = 0; k < 3; ++k)
+    {
+        result.values[k] = dot(result.vectors[k], multiply(m, result.vectors[k]));
+    }
+
+    for (unsigned int pass = 0; pass < 2; ++pass)
+    {
+        for (unsigned int k = 0; k + 1 < 3; ++k)
+        {
+            if (result.values[k] < result.values[k + 1])
+            {
+                std::swap(result.values[k], result.values[k + 1]);
+                std::swap(result.vectors[k], result.vectors[k + 1]);
+            }
+        }
+    }
+
+    const double first[3] = {result.vectors[0].x(), result.vectors[0].y(), result.vectors[0].z()};
+    const double second[3] = {result.vectors[1].x(), result.vectors[1].y(), result.vectors[1].z()};
+    result.vectors[2] = cross(first, second);
+
+    return result;
+}
+
+
+template <typename CoordinateType>
+Eigensystem3 principalAxes(const Point<CoordinateType>* points, std::size_t count)
+{
+    CovarianceAccumulator accumulator;
+    accumulator.add(points, count);
+    return symmetricEigensystem(accumulator.covariance());
+}
+
+
+
+#endif // PRINCIPALAXES_HPP
+
@@ -0,0 +1,374 @@
+// ProgressivePointCodec.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a "progressive" encoding for a
+// vector of Points.  A progressive encoding is arranged so that the first
+// part of it is already useful on its own: any prefix of the encoded bytes
+// decodes into a lower-resolution version of the whole cloud, and each
+// additional byte adds detail.  A client receiving the encoding over a
+// network can start drawing something right away, rather than waiting for
+// the whole thing to arrive.
+//
+// The arrangement comes from an octree.  Imagine a cube around all of the
+// points, cut into eight smaller cubes, each of those cut into eight more,
+// and so on, 21 times.  At each of these "levels" of the octree, we pick one
+// point to represent each cube that contains any points at all, and we never
+// pick the same point twice.  Then we write out the points in level order:
+// the single point chosen at level 0 (which represents the whole cloud),
+// then the (at most 8) new points chosen at level 1, the (at most 64) new
+// points chosen at level 2, and so on.  Anything left over after level 21 --
+// points that landed in the same finest cell as another one -- goes at the
+// very end, in a final level of its own.
+//
+// So once a decoder has received all of the points up to some level, it
+// has at least one point in every occupied cube at that level, spread
+// evenly over the cloud, even if there are many more points still to come.
+// Partway through a level, it has all of the coarser levels plus some of
+// the detail at that one.
+//
+// Choosing the points is easy with Morton codes (see MortonCode.hpp).  In
+// Morton order, the points in any octree cube are consecutive, so the point
+// representing a cube at some level can simply be the first of its points.
+// A point is first in its level-L cube exactly when its code differs from
+// the previous point's somewhere in the top 3L bits, which we can find from
+// the highest bit in which the two codes differ.
+//
+// Encoding is done in parallel, one subtree of the octree at a time: the
+// points are split among the 64 cubes at level 2, each of which is sorted
+// and has its points' levels computed independently.
+//
+// The encoding is a header -- a magic number, a version, the coordinate
+// type, the number of points, and the number of points in each level --
+// followed by the points themselves, each stored as its three coordinates'
+// exact bits in little-endian order.  Nothing is rounded, so decoding the
+// whole thing gives back exactly the original points (in a different
+// order).
+
+#ifndef PROGRESSIVEPOINTCODEC_HPP
+#define PROGRESSIVEPOINTCODEC_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "ByteStream.hpp"
+#include "MortonCode.hpp"
+#include "Point.hpp"
+#include "PointCodec.hpp"
+#include "PointFile.hpp"
+#include "ThreadPool.hpp"
+
+
+
+// The number of levels in a progressive encoding: levels 0 through 21 of
+// the octree, plus a final level for the leftover points.
+constexpr unsigned int progressiveLevelCount = MortonGrid<double>::maxBitsPerAxis + 2;
+
+
+
+// encodeProgressive() builds a progressive encoding of a vector of points.
+template <typename CoordinateType>
+std::vector<std::uint8_t> encodeProgressive(
+    const std::vector<Point<CoordinateType>>& points,
+    ThreadPool& pool = defaultThreadPool());
+
+
+// decodeProgressive() decodes as many whole points as there are in the
+// given bytes, which can be any prefix of an encoding, as long as it
+// contains the whole header.  It throws a PointCodecException if the
+// header isn't there or doesn't describe Point<CoordinateType> objects.
+template <typename CoordinateType>
+std::vector<Point<CoordinateType>> decodeProgressive(
+    const std::uint8_t* bytes, std::size_t size);
+
+
+// progressiveHeaderSize() returns the number of bytes in the header of a
+// progressive encoding, which a decoder needs before it can decode anything.
+std::size_t progressiveHeaderSize();
+
+
+// progressivePrefixSize() returns the number of bytes of an encoding (given
+// at least its header) that it takes to hold every point up to and including
+// the given level.  A server can use it to send a client a particular level
+// of detail and no more.
+template <typename CoordinateType>
+std::size_t progressivePrefixSize(
+    const std::uint8_t* bytes, std::size_t size, unsigned int level);
+
+
+
+namespace ProgressivePointCodecImpl
+{
+    constexpr std::uint32_t magic = 0x444C5450;    // "PTLD"
+    constexpr std::uint16_t version = 1;
+    constexpr unsigned int subtreeLevel = 2;
+
+
+    // levelOf() returns the level at which the point with the given code
+    // is chosen, given the code of the point before it in Morton order.
+    inline unsigned int levelOf(std::uint64_t code, std::uint64_t previous)
+    {
+        const std::uint64_t difference = code ^ previous;
+
+        if (difference == 0)
+        {
+            return progressiveLevelCount - 1;
+        }
+
+        const unsigned int highestBit = 63 - static_cast<unsigned int>(__builtin_clzll(difference));
+        return MortonGrid<double>::maxBitsPerAxis - highestBit / 3;
+    }
+
+
+    template <typename CoordinateType>
+    std::size_t pointSize()
+    {
+        return 3 * sizeof(CoordinateType);
+    }
+
+
+    // readHeader() reads and checks a header, filling in the number of
+    // points in each level.
+    template <typename CoordinateType>
+    std::uint64_t readHeader(ByteReader& reader, std::uint64_t* levelCounts)
+    {
+        if (reader.readU32() != magic || reader.readU16() != version)
+        {
+            throw PointCodecException{"not a progressive point encoding"};
+        }
+
+        if (reader.readU8() != PointFileCoordinateKind<CoordinateType>::value
+            || reader.readU8() != sizeof(CoordinateType))
+        {
+            throw PointCodecException{"progressive encoding has a different coordinate type"};
+        }
+
+        const std::uint64_t pointCount = reader.readU64();
+        std::uint64_t total = 0;
+
+        for (unsigned int level = 0; level < progressiveLevelCount; ++level)
+        {
+            levelCounts[level] = reader.readU64();
+            total += levelCounts[level];
+        }
+
+        if (total != pointCount)
+        {
+            throw PointCodecException{"progressive encoding has inconsistent level counts"};
+        }
+
+        return pointCount;
+    }
+}
+
+
+inline std::size_t progressiveHeaderSize()
+{
+    return 4 + 2 + 1 + 1 + 8 + 8 * progressiveLevelCount;
+}
+
+
+template <typename CoordinateType>
+std::vector<std::uint8_t> encodeProgressive(
+    const std::vector<Point<CoordinateType>>& points, ThreadPool& pool)
+{
+    using namespace ProgressivePointCodecImpl;
+    using PointCodecImpl::Bits;
+
+    constexpr std::size_t subtreeCount = std::size_t{1} << (3 * subtreeLevel);
+    constexpr unsigned int subtreeShift = 3 * (MortonGrid<double>::maxBitsPerAxis - subtreeLevel);
+
+    const MortonGrid<CoordinateType> grid{points};
+    const std::vector<std::uint64_t> codes = mortonCodes(points, grid);
+
+    // First, the points are divided up by the level-2 subtree they belong to.
+    std::vector<std::size_t> subtreeStarts(subtreeCount + 1, 0);
+
+    for (std::uint64_t code : codes)
+    {
+        ++subtreeStarts[(code >> subtreeShift) + 1];
+    }
+
+    for (std::size_t subtree = 0; subtree < subtreeCount; ++subtree)
+    {
+        subtreeStarts[subtree + 1] += subtreeStarts[subtree];
+    }
+
+    std::vector<std::pair<std::uint64_t, std::size_t>> entries(points.size());
+
+    {
+        std::vector<std::size_t> next(subtreeStarts.begin(), subtreeStarts.end() - 1);
+
+        for (std::size_t i = 0; i < codes.size(); ++i)
+        {
+            entries[next[codes[i] >> subtreeShift]++] = std::make_pair(codes[i], i);
+        }
+    }
+
+    // Then each subtree is sorted into Morton order, and its points'
+    // levels are counted.  The first point in a subtree is compared with
+    // the last point of the nearest nonempty subtree before it.
+    std::vector<std::uint8_t> levels(points.size());
+    std::vector<std::uint64_t> counts(subtreeCount * progressiveLevelCount, 0);
+
+    pool.parallelFor(
+        0, subtreeCount, 1,
+        [&](std::size_t firstSubtree, std::size_t lastSubtree)
+        {
+            for (std::size_t subtree = firstSubtree; subtree < lastSubtree; ++subtree)
+            {
+                std::sort(
+                    entries.begin() + subtreeStarts[subtree],
+                    entries.begin() + subtreeStarts[subtree + 1]);
+            }
+        });
+
+    pool.parallelFor(
+        0, subtreeCount, 1,
+        [&](std::size_t firstSubtree, std::size_t lastSubtree)
+        {
+            for (std::size_t subtree = firstSubtree; subtree < lastSubtree; ++subtree)
+            {
+                std::uint64_t* subtreeCounts = counts.data() + subtree * progressiveLevelCount;
+
+                for (std::size_t i = subtreeStarts[subtree]; i < subtreeStarts[subtree + 1]; ++i)
+                {
+                    const unsigned int level = i == 0
+                        ? 0 : levelOf(entries[i].first, entries[i - 1].first);
+
+                    levels[i] = static_cast<std::uint8_t>(level);
+                    ++subtreeCounts[level];
+                }
+            }
+        });
+
+    // Finally, each point's position in the output is its level's starting
+    // position, plus the number of points at that level in earlier subtrees,
+    // plus the number before it at that level in its own subtree.
+    std::uint64_t levelCounts[progressiveLevelCount] = {};
+    std::vector<std::uint64_t> starts(counts.size());
+    std::uint64_t position = 0;
+
+    for (unsigned int level = 0; level < progressiveLevelCount; ++level)
+    {
+        for (std::size_t subtree = 0; subtree < subtreeCount; ++subtree)
+        {
+            starts[subtree * progressiveLevelCount + level] = position;
+            position += counts[subtree * progressiveLevelCount + level];
+            levelCounts[level] += counts[subtree * progressiveLevelCount + level];
+        }
+    }
+
+    std::vector<std::uint8_t> output;
+    ByteWriter writer{output};
+
+    writer.writeU32(magic);
+    writer.writeU16(version);
+    writer.writeU8(PointFileCoordinateKind<CoordinateType>::value);
+    writer.writeU8(sizeof(CoordinateType));
+    writer.writeU64(points.size());
+
+    for (std::uint64_t levelCount : levelCounts)
+    {
+        writer.writeU64(levelCount);
+    }
+
+    const std::size_t headerSize = output.size();
+    output.resize(headerSize + points.size() * pointSize<CoordinateType>());
+
+    pool.parallelFor(
+        0, subtreeCount, 1,
+        [&](std::size_t firstSubtree, std::size_t lastSubtree)
+        {
+            for (std::size_t subtree = firstSubtree; subtree < lastSubtree; ++subtree)
+            {
+                std::uint64_t* next = starts.data() + subtree * progressiveLevelCount;
+
+                for (std::size_t i = subtreeStarts[subtree]; i < subtreeStarts[subtree + 1]; ++i)
+                {
+                    const Point<CoordinateType>& point = points[entries[i].second];
+                    std::uint8_t* target =
+                        output.data() + headerSize + next[levels[i]]++ * pointSize<CoordinateType>();
+
+                    for (unsigned int axis = 0; axis < 3; ++axis)
+                    {
+                        const Bits<CoordinateType> bits =
+                            PointCodecImpl::bitsOf(PointCodecImpl::coordinateOf(point, axis));
+
+                        for (unsigned int byte = 0; byte < sizeof(CoordinateType); ++byte)
+                        {
+                            *target++ = static_cast<std::uint8_t>(bits >> (8 * byte));
+                        }
+                    }
+                }
+            }
+        });
+
+    return output;
+}
+
+
+template <typename CoordinateType>
+std::vector<Point<CoordinateType>> decodeProgressive(
+    const std::uint8_t* bytes, std::size_t size)
+{
+    using namespace ProgressivePointCodecImpl;
+    using PointCodecImpl::Bits;
+
+    ByteReader reader{bytes, size};
+    std::uint64_t levelCounts[progressiveLevelCount];
+    const std::uint64_t pointCount = readHeader<CoordinateType>(reader, levelCounts);
+
+    const std::size_t available = std::min<std::uint64_t>(
+        pointCount, reader.remaining() / pointSize<CoordinateType>());
+
+    const std::uint8_t* next = reader.skip(available * pointSize<CoordinateType>());
+    std::vector<Point<CoordinateType>> points(available);
+
+    for (Point<CoordinateType>& point : points)
+    {
+        for (unsigned int axis = 0; axis < 3; ++axis)
+        {
+            Bits<CoordinateType> bits = 0;
+
+            for (unsigned int byte = 0; byte < sizeof(CoordinateType); ++byte)
+            {
+                bits |= static_cast<Bits<CoordinateType>>(*next++) << (8 * byte);
+            }
+
+            PointCodecImpl::coordinateOf(point, axis) =
+                PointCodecImpl::valueOf<CoordinateType>(bits);
+        }
+    }
+
+    return points;
+}
+
+
+template <typename CoordinateType>
+std::size_t progressivePrefixSize(
+    const std::uint8_t* bytes, std::size_t size, unsigned int level)
+{
+    using namespace ProgressivePointCodecImpl;
+
+    ByteReader reader{bytes, size};
+    std::uint64_t levelCounts[progressiveLevelCount];
+    readHeader<CoordinateType>(reader, levelCounts);
+
+    std::uint64_t pointCount = 0;
+
+    for (unsigned int i = 0; i <= level && i < progressiveLevelCount; ++i)
+    {
+        pointCount += levelCounts[i];
+    }
+
+    return progressiveHeaderSize() + pointCount * pointSize<CoordinateType>();
+}
+
+
+
+#endif // PROGRESSIVEPOINTCODEC_HPP
+
@@ -0,0 +1,485 @@
+// RansCoder.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines an entropy coder for arrays of
+// bytes, based on a technique called rANS ("range asymmetric numeral
+// systems").  An entropy coder makes data smaller by giving common symbols
+// short codes and rare symbols long ones; a Huffman code is the classic
+// example.  rANS does the same job, but rather than giving each symbol a
+// whole number of bits, it can effectively spend fractions of a bit on each
+// one, which gets it closer to the theoretical best for skewed data -- say,
+// a byte that is zero 95% of the time.
+//
+// The coder keeps its state in a single integer, x.  Encoding a symbol s,
+// whose frequency (out of a total of M) is f, turns x into roughly x * M / f;
+// common symbols (large f) grow x a little, while rare ones grow it a lot.
+// Whenever x would grow too large, its low 16 bits are written out.  The
+// limits are chosen so that this never needs to happen more than once per
+// symbol, which lets the decoder replace a loop with a single, usually
+// branch-free, step.  Decoding runs the same steps backward, which is why
+// the encoder processes the symbols last-to-first: the decoder then gets
+// them back first-to-last.
+//
+// To go faster, we run four independent coders, with the first handling
+// symbols 0, 4, 8, ..., the second handling 1, 5, 9, ..., and so on.  This
+// doesn't change how well the data compresses, but because the four chains
+// of arithmetic don't depend on each other, the processor can work on them
+// at the same time.
+//
+// Each encoded array begins with a byte saying how it was encoded.  Arrays
+// containing only one distinct byte are stored as just that byte, and
+// arrays that rANS can't make smaller are stored as they are.
+
+#ifndef RANSCODER_HPP
+#define RANSCODER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ByteStream.hpp"
+
+
+
+// ransEncode() appends an encoding of count bytes to the output vector.
+void ransEncode(
+    const std::uint8_t* symbols, std::size_t count, std::vector<std::uint8_t>& output);
+
+
+// ransDecode() reads an encoding produced by ransEncode() and writes the
+// count bytes it describes into symbols.  It throws a ByteStreamException
+// if the encoding is malformed.
+void ransDecode(ByteReader& input, std::uint8_t* symbols, std::size_t count);
+
+
+
+namespace RansCoderImpl
+{
+    constexpr unsigned int scaleBits = 12;
+    constexpr std::uint32_t totalFrequency = std::uint32_t{1} << scaleBits;
+    constexpr std::uint32_t lowerBound = std::uint32_t{1} << 15;
+    constexpr unsigned int stateCount = 4;
+
+    constexpr std::uint8_t storedMode = 0;
+    constexpr std::uint8_t constantMode = 1;
+    constexpr std::uint8_t ransMode = 2;
+
+
+    // normalize() scales symbol counts so that they add up to exactly
+    // totalFrequency, while making sure that every symbol that appears
+    // gets a frequency of at least 1 (or else it couldn't be encoded).
+    inline void normalize(const std::size_t* counts, std::size_t total, std::uint32_t* frequencies)
+    {
+        std::uint32_t sum = 0;
+        unsigned int mostCommon = 0;
+
+        for (unsigned int symbol = 0; symbol < 256; ++symbol)
+        {
+            frequencies[symbol] = 0;
+
+            if (counts[symbol] > 0)
+            {
+                const std::uint64_t scaled =
+                    static_cast<std::uint64_t>(counts[symbol]) * totalFrequency / total;
+
+                frequencies[symbol] = scaled > 0 ? static_cast<std::uint32_t>(scaled) : 1;
+                sum += frequencies[symbol];
+            }
+
+            if (counts[symbol] > counts[mostCommon])
+            {
+                mostCommon = symbol;
+            }
+        }
+
+        while (sum < totalFrequency)
+        {
+            ++frequencies[mostCommon];
+            ++sum;
+        }
+
+        while (sum > totalFrequency)
+        {
+            unsigned int largest = mostCommon;
+
+            for (unsigned int symbol = 0; symbol < 256; ++symbol)
+            {
+                if (frequencies[symbol] > frequencies[largest])
+                {
+                    largest = symbol;
+                }
+            }
+
+            --frequencies[largest];
+            --sum;
+        }
+    }
+
+
+    // An EncodeEntry holds what the encoder needs to know about a symbol.
+    // Dividing by the symbol's frequency is the slowest part of encoding,
+    // so instead we multiply by a precomputed fixed-point reciprocal and
+    // shift, which gives exactly the same quotient.  (A frequency of 1 is a
+    // special case, handled by the bias, since its reciprocal doesn't fit.)
+    struct EncodeEntry
+    {
+        std::uint32_t limit;
+        std::uint32_t reciprocal;
+        std::uint32_t bias;
+        std::uint32_t complement;
+        std::uint32_t shift;
+    };
+
+
+    inline EncodeEntry makeEncodeEntry(std::uint32_t start, std::uint32_t frequency)
+    {
+        EncodeEntry entry;
+        entry.limit = ((lowerBound >> scaleBits) << 16) * frequency;
+        entry.complement = totalFrequency - frequency;
+
+        if (frequency < 2)
+        {
+            entry.reciprocal = 0xffffffff;
+            entry.shift = 0;
+            entry.bias = start + totalFrequency - 1;
+        }
+        else
+        {
+            std::uint32_t shift = 0;
+
+            while (frequency > (std::uint32_t{1} << shift))
+            {
+                ++shift;
+            }
+
+            entry.reciprocal = static_cast<std::uint32_t>(
+                ((std::uint64_t{1} << (shift + 31)) + frequency - 1) / frequency);
+            entry.shift = shift - 1;
+            entry.bias = start;
+        }
+
+        return entry;
+    }
+
+
+    inline void encodeSymbol(std::uint32_t& state, std::uint8_t*& next, const EncodeEntry& entry)
+    {
+        if (state >= entry.limit)
+        {
+            next -= 2;
+            next[0] = static_cast<std::uint8_t>(state);
+            next[1] = static_cast<std::uint8_t>(state >> 8);
+            state >>= 16;
+        }
+
+        const std::uint32_t quotient = static_cast<std::uint32_t>(
+            (static_cast<std::uint64_t>(state) * entry.reciprocal) >> 32) >> entry.shift;
+
+        state += entry.bias + quotient * entry.complement;
+    }
+
+
+    struct DecodeEntry
+    {
+        std::uint16_t frequency;
+        std::uint16_t bias;
+        std::uint8_t symbol;
+    };
+}
+
+
+inline void ransEncode(
+    const std::uint8_t* symbols, std::size_t count, std::vector<std::uint8_t>& output)
+{
+    using namespace RansCoderImpl;
+
+    ByteWriter writer{output};
+
+    std::size_t counts[256] = {};
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        ++counts[symbols[i]];
+    }
+
+    unsigned int distinct = 0;
+
+    for (std::size_t symbolCount : counts)
+    {
+        distinct += symbolCount > 0 ? 1 : 0;
+    }
+
+    if (distinct == 1)
+    {
+        writer.writeU8(constantMode);
+        writer.writeU8(symbols[0]);
+        return;
+    }
+
+    std::vector<std::uint8_t> encoded;
+
+    if (count > 0)
+    {
+        std::uint32_t frequencies[256];
+        normalize(counts, count, frequencies);
+
+        EncodeEntry entries[256];
+        std::uint32_t start = 0;
+
+        for (unsigned int symbol = 0; symbol < 256; ++symbol)
+        {
+            entries[symbol] = makeEncodeEntry(start, frequencies[symbol]);
+            start += frequencies[symbol];
+        }
+
+        // A symbol whose frequency is 1 costs 12 bits, the most any symbol
+        // can cost, so this much space is always enough.
+        encoded.resize(count + count / 2 + 4 * stateCount + 16);
+        std::uint8_t* next = encoded.data() + encoded.size();
+
+        std::uint32_t states[stateCount] = {lowerBound, lowerBound, lowerBound, lowerBound};
+
+        // The last few symbols (the ones past a multiple of four) are
+        // encoded first, one at a time; then the rest go four at a time,
+        // each group in reverse.
+        std::size_t i = count;
+
+        while (i % stateCount != 0)
+        {
+            --i;
+            encodeSymbol(states[i % stateCount], next, entries[symbols[i]]);
+        }
+
+        // The states are copied into local variables for the main loop; as
+        // elements of an array, the compiler would have to assume that every
+        // byte we write might change them, and reload them from memory.
+        std::uint32_t state0 = states[0];
+        std::uint32_t state1 = states[1];
+        std::uint32_t state2 = states[2];
+        std::uint32_t state3 = states[3];
+
+        while (i > 0)
+        {
+            i -= stateCount;
+            encodeSymbol(state3, next, entries[symbols[i + 3]]);
+            encodeSymbol(state2, next, entries[symbols[i + 2]]);
+            encodeSymbol(state1, next, entries[symbols[i + 1]]);
+            encodeSymbol(state0, next, entries[symbols[i]]);
+        }
+
+        states[0] = state0;
+        states[1] = state1;
+        states[2] = state2;
+        states[3] = state3;
+
+        for (unsigned int s = stateCount; s > 0; --s)
+        {
+            next -= 4;
+
+            for (unsigned int byte = 0; byte < 4; ++byte)
+            {
+                next[byte] = static_cast<std::uint8_t>(states[s - 1] >> (8 * byte));
+            }
+        }
+
+        const std::size_t encodedSize =
+            static_cast<std::size_t>(encoded.data() + encoded.size() - next);
+
+        const std::size_t tableSize = 32 + 2 * distinct;
+
+        if (encodedSize + tableSize + 4 < count)
+        {
+            writer.writeU8(ransMode);
+
+            std::uint8_t present[32] = {};
+
+            for (unsigned int symbol = 0; symbol < 256; ++symbol)
+            {
+                if (frequencies[symbol] > 0)
+                {
+                    present[symbol / 8] |= static_cast<std::uint8_t>(1u << (symbol % 8));
+                }
+            }
+
+            writer.writeBytes(present, sizeof(present));
+
+            for (unsigned int symbol = 0; symbol < 256; ++symbol)
+            {
+                if (frequencies[symbol] > 0)
+                {
+                    writer.writeU16(static_cast<std::uint16_t>(frequencies[symbol]));
+                }
+            }
+
+            writer.writeU32(static_cast<std::uint32_t>(encodedSize));
+            writer.writeBytes(next, encodedSize);
+            return;
+        }
+    }
+
+    writer.writeU8(storedMode);
+    writer.writeBytes(symbols, count);
+}
+
+
+// The decoder looks up each symbol with a table indexed by the low 12 bits
+// of the state, which tells it the symbol and everything it needs to undo
+// that symbol's encoding step.
+
+inline void ransDecode(ByteReader& input, std::uint8_t* symbols, std::size_t count)
+{
+    using namespace RansCoderImpl;
+
+    const std::uint8_t mode = input.readU8();
+
+    if (mode == storedMode)
+    {
+        input.readBytes(symbols, count);
+        return;
+    }
+    else if (mode == constantMode)
+    {
+        std::memset(symbols, input.readU8(), count);
+        return;
+    }
+    else if (mode != ransMode)
+    {
+        throw ByteStreamException{"unknown rANS encoding mode"};
+    }
+
+    std::uint8_t present[32];
+    input.readBytes(present, sizeof(present));
+
+    std::vector<DecodeEntry> table(totalFrequency);
+    std::uint32_t start = 0;
+
+    for (unsigned int symbol = 0; symbol < 256; ++symbol)
+    {
+        if ((present[symbol / 8] & (1u << (symbol % 8))) == 0)
+        {
+            continue;
+        }
+
+        const std::uint32_t frequency = input.readU16();
+
+        if (frequency == 0 || start + frequency > totalFrequency)
+        {
+            throw ByteStreamException{"invalid rANS frequency table"};
+        }
+
+        for (std::uint32_t slot = start; slot < start + frequency; ++slot)
+        {
+            table[slot] = DecodeEntry{
+                static_cast<std::uint16_t>(frequency),
+                static_cast<std::uint16_t>(slot - start),
+                static_cast<std::uint8_t>(symbol)};
+        }
+
+        start += frequency;
+    }
+
+    if (start != totalFrequency)
+    {
+        throw ByteStreamException{"invalid rANS frequency table"};
+    }
+
+    const std::size_t encodedSize = input.readU32();
+    const std::uint8_t* next = input.skip(encodedSize);
+    const std::uint8_t* end = next + encodedSize;
+
+    if (encodedSize < 4 * stateCount)
+    {
+        throw ByteStreamException{"truncated rANS data"};
+    }
+
+    std::uint32_t states[stateCount];
+
+    for (std::uint32_t& state : states)
+    {
+        state = static_cast<std::uint32_t>(next[0])
+            | (static_cast<std::uint32_t>(next[1]) << 8)
+            | (static_cast<std::uint32_t>(next[2]) << 16)
+            | (static_cast<std::uint32_t>(next[3]) << 24);
+
+        next += 4;
+    }
+
+    // Each decoding step needs at most two more bytes per state, so while
+    // there are at least eight bytes left, we can decode four symbols at a
+    // time without checking each read against the end of the data.  As in
+    // the encoder, the states are kept in local variables in the main loop.
+    auto decodeSymbol =
+        [&table](std::uint32_t& state)
+        {
+            const DecodeEntry& entry = table[state & (totalFrequency - 1)];
+            state = entry.frequency * (state >> scaleBits) + entry.bias;
+            return entry.symbol;
+        };
+
+    auto refill =
+        [](std::uint32_t& state, const std::uint8_t*& position)
+        {
+            const bool needed = state < lowerBound;
+            const std::uint32_t word =
+                static_cast<std::uint32_t>(position[0]) | (static_cast<std::uint32_t>(position[1]) << 8);
+
+            state = needed ? (state << 16) | word : state;
+            position += needed ? 2 : 0;
+        };
+
+    std::uint32_t state0 = states[0];
+    std::uint32_t state1 = states[1];
+    std::uint32_t state2 = states[2];
+    std::uint32_t state3 = states[3];
+
+    std::size_t i = 0;
+
+    while (i + stateCount <= count && end - next >= 2 * static_cast<std::ptrdiff_t>(stateCount))
+    {
+        const std::uint8_t symbol0 = decodeSymbol(state0);
+        const std::uint8_t symbol1 = decodeSymbol(state1);
+        const std::uint8_t symbol2 = decodeSymbol(state2);
+        const std::uint8_t symbol3 = decodeSymbol(state3);
+
+        refill(state0, next);
+        refill(state1, next);
+        refill(state2, next);
+        refill(state3, next);
+
+        symbols[i] = symbol0;
+        symbols[i + 1] = symbol1;
+        symbols[i + 2] = symbol2;
+        symbols[i + 3] = symbol3;
+
+        i += stateCount;
+    }
+
+    states[0] = state0;
+    states[1] = state1;
+    states[2] = state2;
+    states[3] = state3;
+
+    for (; i < count; ++i)
+    {
+        std::uint32_t& state = states[i % stateCount];
+        symbols[i] = decodeSymbol(state);
+
+        if (state < lowerBound)
+        {
+            if (end - next < 2)
+            {
+                throw ByteStreamException{"truncated rANS data"};
+            }
+
+            refill(state, next);
+        }
+    }
+}
+
+
+#endif // RANSCODER_HPP
+
@@ -0,0 +1,177 @@
+// ScratchArena.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a class called ScratchArena, a
+// memory allocator for temporary data that all becomes garbage at the same
+// time -- the intermediate results of processing one item of work, say.
+//
+// Allocating from a ScratchArena is as cheap as allocation gets: the arena
+// owns a large block of memory and hands out consecutive pieces of it,
+// remembering only where the next piece begins.  Individual pieces are never
+// freed.  Instead, once we're done with everything we allocated, reset()
+// makes the whole block available again in one step.  If a block fills up,
+// the arena allocates another (at least twice as big), and keeps it; so
+// after the first few items of work, a ScratchArena that's reset between
+// items never needs to ask the heap for anything.
+//
+// ScratchArena is a std::pmr::memory_resource, so it can be handed to any
+// of the std::pmr containers (std::pmr::vector, for example), as well as to
+// anything else in this code base that accepts a memory resource.
+//
+// A ScratchArena isn't safe to use from more than one thread at a time; the
+// idea is for each thread to have its own.
+
+#ifndef SCRATCHARENA_HPP
+#define SCRATCHARENA_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <vector>
+
+
+
+class ScratchArena : public std::pmr::memory_resource
+{
+public:
+    // A ScratchArena starts with a single block of the given size.
+    explicit ScratchArena(std::size_t initialBytes = 1 << 16);
+
+
+    // allocateArray<T>() returns uninitialized space for count objects of
+    // type T, throwing std::bad_array_new_length if they wouldn't fit in
+    // a std::size_t's worth of bytes.  (It isn't called allocate(), so it
+    // doesn't hide memory_resource's allocate(bytes, alignment).)
+    template <typename T>
+    T* allocateArray(std::size_t count);
+
+
+    // reset() makes all of the arena's memory available again.  Anything
+    // previously allocated from it must no longer be in use.
+    void reset();
+
+
+    // capacity() returns the total size of the arena's blocks, and used()
+    // returns how much of that has been allocated since the last reset().
+    std::size_t capacity() const;
+    std::size_t used() const;
+
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void* pointer, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+    struct Block
+    {
+        std::unique_ptr<std::byte[]> memory;
+        std::size_t size;
+    };
+
+    std::vector<Block> blocks_;
+    std::size_t currentBlock_;
+    std::size_t offset_;
+    std::size_t usedInEarlierBlocks_;
+};
+
+
+
+inline ScratchArena::ScratchArena(std::size_t initialBytes)
+    : currentBlock_{0}, offset_{0}, usedInEarlierBlocks_{0}
+{
+    initialBytes = std::max<std::size_t>(initialBytes, 64);
+    blocks_.push_back(Block{std::make_unique<std::byte[]>(initialBytes), initialBytes});
+}
+
+
+template <typename T>
+T* ScratchArena::allocateArray(std::size_t count)
+{
+    if (count > std::numeric_limits<std::size_t>::max() / sizeof(T))
+    {
+        throw std::bad_array_new_length{};
+    }
+
+    return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+}
+
+
+inline void ScratchArena::reset()
+{
+    currentBlock_ = 0;
+    offset_ = 0;
+    usedInEarlierBlocks_ = 0;
+}
+
+
+inline std::size_t ScratchArena::capacity() const
+{
+    std::size_t total = 0;
+
+    for (const Block& block : blocks_)
+    {
+        total += block.size;
+    }
+
+    return total;
+}
+
+
+inline std::size_t ScratchArena::used() const
+{
+    return usedInEarlierBlocks_ + offset_;
+}
+
+
+// When the current block doesn't have room, we move on to the next block
+// we already have, if it's big enough, or allocate a new one otherwise.
+// Memory skipped at the end of a block is wasted until the next reset().
+
+inline void* ScratchArena::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+    while (true)
+    {
+        Block& block = blocks_[currentBlock_];
+        const std::uintptr_t base = reinterpret_cast<std::uintptr_t>(block.memory.get());
+        const std::uintptr_t aligned = (base + offset_ + alignment - 1) & ~(alignment - 1);
+        const std::size_t start = static_cast<std::size_t>(aligned - base);
+
+        if (start + bytes <= block.size)
+        {
+            offset_ = start + bytes;
+            return block.memory.get() + start;
+        }
+
+        usedInEarlierBlocks_ += offset_;
+        offset_ = 0;
+        ++currentBlock_;
+
+        if (currentBlock_ == blocks_.size())
+        {
+            const std::size_t size = std::max(2 * block.size, bytes + alignment);
+            blocks_.push_back(Block{std::make_unique<std::byte[]>(size), size});
+        }
+    }
+}
+
+
+inline void ScratchArena::do_deallocate(void*, std::size_t, std::size_t)
+{
+}
+
+
+inline bool ScratchArena::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+    return this == &other;
+}
+
+
+
+#endif // SCRATCHARENA_HPP
+
@@ -0,0 +1,281 @@
+// SetDistances.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines functions that measure how far
+// apart two sets of points are -- how well a predicted shape matches the
+// real one, say.  There's no one right answer to that question, so there
+// are two common measures, both built from the distance between each point
+// in one set and the closest point in the other:
+//
+// * The Chamfer distance averages those distances, so it describes how far
+//   apart the sets are typically.  We follow the convention common in
+//   machine learning: the mean of the squared distances from the first set
+//   to the second, plus the mean of the squared distances from the second
+//   set to the first.
+// * The Hausdorff distance is the largest of those distances, so it
+//   describes how far apart the sets are at their worst.  The "directed"
+//   Hausdorff distance from one set to another only considers the first
+//   set's points; the (symmetric) Hausdorff distance is the larger of the
+//   two directed distances.
+//
+// setDistances() finds every point's distance to the other set, using a
+// KdTree and the threads of a ThreadPool (through cloudToCloudDistances()),
+// and returns all of them, along with both measures.
+//
+// When only the Hausdorff distance is wanted, though, most of that work
+// can be skipped.  Once we know that some point is at least a distance h
+// from the other set, any point that has a point of the other set within h
+// can't change the answer, and finding out that there *is* such a point is
+// much cheaper than finding the closest one: anyWithin() stops as soon as
+// it finds one, and it's usually nearby.  Only points that have nothing
+// within h need a full search, and each one of those raises h.  Measuring
+// a few hundred points chosen at random first makes h large from the start,
+// so that nearly every point is dismissed cheaply; the rest are visited in
+// Morton order, so that consecutive searches touch the same parts of the
+// tree.  hausdorffDistance() works that way, with the threads sharing the
+// largest distance found so far.
+
+#ifndef SETDISTANCES_HPP
+#define SETDISTANCES_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <vector>
+#include "ChangeDetection.hpp"
+#include "KdTree.hpp"
+#include "Point.hpp"
+#include "ThreadPool.hpp"
+
+
+
+// A SetDistances holds each point's distance to the closest point in the
+// other set, in the order of the vectors the points came from, along with
+// the Chamfer distance, the two mean distances, and the Hausdorff distance.
+// Either mean is zero if its set is empty; if the other set is empty, the
+// distances (and so the Chamfer and Hausdorff distances) are infinite.
+struct SetDistances
+{
+    std::vector<double> firstDistances;
+    std::vector<double> secondDistances;
+    double chamfer;
+    double firstMean;
+    double secondMean;
+    double hausdorff;
+};
+
+
+// A HausdorffDistance is a Hausdorff distance along with the point that's
+// that far from the other set: its index, and whether it's in the first
+// set.  If both sets are empty, the distance is zero and the index is
+// zero.
+struct HausdorffDistance
+{
+    double distance;
+    std::size_t index;
+    bool inFirst;
+};
+
+
+
+// setDistances() measures the distance from every point in each set to the
+// other set.
+template <typename CoordinateType>
+SetDistances setDistances(
+    const std::vector<Point<CoordinateType>>& first,
+    const std::vector<Point<CoordinateType>>& second,
+    ThreadPool& pool = defaultThreadPool());
+
+
+// directedHausdorffDistance() returns the largest distance from one of the
+// given points to the closest point in the tree.  The result's inFirst is
+// always true, and its index is into points.
+template <typename CoordinateType>
+HausdorffDistance directedHausdorffDistance(
+    const std::vector<Point<CoordinateType>>& points,
+    const KdTree<CoordinateType>& other,
+    ThreadPool& pool = defaultThreadPool());
+
+
+// hausdorffDistance() returns the (symmetric) Hausdorff distance between
+// two sets.
+template <typename CoordinateType>
+HausdorffDistance hausdorffDistance(
+    const std::vector<Point<CoordinateType>>& first,
+    const std::vector<Point<CoordinateType>>& second,
+    ThreadPool& pool = defaultThreadPool());
+
+
+
+namespace SetDistancesImpl
+{
+    // Each chunk of work handed to the pool is this many points.
+    constexpr std::size_t pointsPerChunk = 1024;
+
+
+    // The early-terminating Hausdorff distance starts by measuring this
+    // many points chosen at random, always the same ones, so that the
+    // amount of work doesn't vary from one run to the next.
+    constexpr std::size_t sampleSize = 256;
+    constexpr std::uint64_t sampleSeed = 0x5E7D157A11CEull;
+
+
+    inline double meanOfSquares(const std::vector<double>& distances)
+    {
+        double sum = 0.0;
+
+        for (double distance : distances)
+        {
+            sum += distance * distance;
+        }
+
+        return distances.empty() ? 0.0 : sum / static_cast<double>(distances.size());
+    }
+}
+
+
+
+template <typename CoordinateType>
+SetDistances setDistances(
+    const std::vector<Point<CoordinateType>>& first,
+    const std::vector<Point<CoordinateType>>& second,
+    ThreadPool& pool)
+{
+    using namespace SetDistancesImpl;
+
+    SetDistances result;
+
+    {
+        const KdTree<CoordinateType> secondTree{second};
+        result.firstDistances = cloudToCloudDistances(secondTree, first, pool);
+    }
+
+    {
+        const KdTree<CoordinateType> firstTree{first};
+        result.secondDistances = cloudToCloudDistances(firstTree, second, pool);
+    }
+
+    result.firstMean = meanOfSquares(result.firstDistances);
+    result.secondMean = meanOfSquares(result.secondDistances);
+    result.chamfer = result.firstMean + result.secondMean;
+
+    result.hausdorff = 0.0;
+
+    for (double distance : result.firstDistances)
+    {
+        result.hausdorff = std::max(result.hausdorff, distance);
+    }
+
+    for (double distance : result.secondDistances)
+    {
+        result.hausdorff = std::max(result.hausdorff, distance);
+    }
+
+    return result;
+}
+
+
+// The largest distance so far is kept in an atomic variable that every
+// thread reads before each point, so a large distance found by one thread
+// immediately lets the others dismiss more points.  Raising it is rare, so
+// the mutex that keeps the distance and its point consistent costs little.
+
+template <typename CoordinateType>
+HausdorffDistance directedHausdorffDistance(
+    const std::vector<Point<CoordinateType>>& points,
+    const KdTree<CoordinateType>& other,
+    ThreadPool& pool)
+{
+    using namespace SetDistancesImpl;
+
+    HausdorffDistance result{0.0, 0, true};
+
+    if (points.empty())
+    {
+        return result;
+    }
+
+    std::mt19937_64 engine{sampleSeed};
+    std::uniform_int_distribution<std::size_t> pick{0, points.size() - 1};
+
+    for (std::size_t i = 0; i < sampleSize; ++i)
+    {
+        const std::size_t index = pick(engine);
+        const double distance = other.closest(points[index]).distance;
+
+        if (distance > result.distance)
+        {
+            result.distance = distance;
+            result.index = index;
+        }
+    }
+
+    const std::vector<std::size_t> order = mortonOrder(points);
+
+    std::atomic<double> largest{result.distance};
+    std::mutex resultMutex;
+
+    pool.parallelFor(
+        0, order.size(), pointsPerChunk,
+        [&](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                const std::size_t index = order[i];
+                const double bound = largest.load(std::memory_order_relaxed);
+
+                if (other.anyWithin(points[index], bound))
+                {
+                    continue;
+                }
+
+                const double distance = other.closest(points[index]).distance;
+
+                std::lock_guard<std::mutex> lock{resultMutex};
+
+                if (distance > result.distance)
+                {
+                    result.distance = distance;
+                    result.index = index;
+                    largest.store(distance, std::memory_order_relaxed);
+                }
+            }
+        });
+
+    return result;
+}
+
+
+template <typename CoordinateType>
+HausdorffDistance hausdorffDistance(
+    const std::vector<Point<CoordinateType>>& first,
+    const std::vector<Point<CoordinateType>>& second,
+    ThreadPool& pool)
+{
+    HausdorffDistance forward;
+    HausdorffDistance backward;
+
+    {
+        const KdTree<CoordinateType> secondTree{second};
+        forward = directedHausdorffDistance(first, secondTree, pool);
+    }
+
+    {
+        const KdTree<CoordinateType> firstTree{first};
+        backward = directedHausdorffDistance(second, firstTree, pool);
+        backward.inFirst = false;
+    }
+
+    return backward.distance > forward.distance ? backward : forward;
+}
+
+
+
+#endif // SETDISTANCES_HPP
+
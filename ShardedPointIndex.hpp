@@ -0,0 +1,468 @@
+// ShardedPointIndex.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a class called ShardedPointIndex,
+// which answers nearest-neighbor, radius, and closest-point queries about a
+// set of points that has been split into shards (see PointPartition.hpp),
+// each held by its own PointQueryServer (see PointQueryServer.hpp) --
+// usually in its own process, and possibly on its own machine.  To the
+// code asking the questions, a ShardedPointIndex looks like one big index:
+// it takes the same queries as a PointQueryClient and returns the same
+// kinds of results, with the original points' indexes.
+//
+// The point of sharding is that most queries only need a few shards.  A
+// radius query can only find points in shards whose bounding boxes come
+// within the radius of the query point, so it's sent only to those.  A
+// nearest-neighbor query is trickier, since we don't know how far away its
+// neighbors are until we've found them, so it's answered in rounds:
+//
+// * First, it's sent to the single shard whose box is closest to the query
+//   point (usually the one containing it), which finds k candidates.
+// * The k-th candidate's distance is now an upper bound on how far away
+//   the true k-th nearest neighbor can be, so only shards whose boxes are
+//   closer than that need to be asked; they're asked next, nearest first.
+//   Whatever they find can only tighten the bound.
+//
+// In each round, a query is sent to at most maximumFanOut shards, which
+// bounds how much work one query can cause at once; a query that needs
+// more shards than that takes more rounds, with a tighter bound each time,
+// which often means some of those shards never need to be asked at all.
+//
+// Queries are handled in batches, and each round sends every shard one
+// request containing all of the batch's queries that need it, so each
+// round costs one round trip to each shard involved, no matter how many
+// queries there are.  Every shard's request is sent before any response is
+// awaited, so the shards work on their parts of a round at the same time.
+//
+// Each shard is queried through a PointQueryClient, which must be
+// connected to a server whose tree holds exactly the shard's points, in
+// the order that shardPoints() returns them.  For testing, each shard's
+// server can be run in its own local process, standing in for a separate
+// machine.
+
+#ifndef SHARDEDPOINTINDEX_HPP
+#define SHARDEDPOINTINDEX_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "KdTree.hpp"
+#include "Point.hpp"
+#include "PointPartition.hpp"
+#include "PointQueryClient.hpp"
+#include "PointQueryProtocol.hpp"
+
+
+
+struct ShardedPointIndexOptions
+{
+    // The most shards any one query is sent to in a single round.
+    std::size_t maximumFanOut = 8;
+};
+
+
+
+class ShardedPointIndex
+{
+public:
+    // There must be one client for each of the partition's shards.
+    ShardedPointIndex(
+        PointPartition partition, std::vector<PointQueryClient> shards,
+        const ShardedPointIndexOptions& options = ShardedPointIndexOptions{});
+
+
+    // query() answers a batch of queries, returning one result per query,
+    // in the same order.  The neighbors in each result are identified by
+    // their indexes among the original points, and are closest first.
+    //
+    // If talking to a shard fails partway through, some shards may still
+    // have responses on their way that nothing will read, and the next
+    // response read from them would belong to the wrong request.  So once
+    // query() has thrown because of a shard, the index is broken, and every
+    // later query throws a PointQueryClientException; the only way forward
+    // is a new index with new connections.
+    std::vector<PointQueryResult> query(const std::vector<PointQuery>& queries);
+
+
+    // These functions each answer one query, like the PointQueryClient
+    // member functions of the same names; in particular, if there are no
+    // points, closest() returns PointQueryClient::noNeighbor as the index.
+    std::vector<PointNeighbor> nearest(const Point<double>& point, std::uint32_t k);
+    std::vector<PointNeighbor> withinRadius(const Point<double>& point, double radius);
+    PointNeighbor closest(const Point<double>& point);
+
+
+    const PointPartition& partition() const;
+    std::size_t shardCount() const;
+
+
+    // shardQueryCount() returns the number of times so far that a query
+    // has been sent to a shard, which shows how well routing is working:
+    // a perfect router would send each query to exactly one shard.
+    std::uint64_t shardQueryCount() const;
+
+
+private:
+    struct QueryState
+    {
+        std::vector<std::pair<double, std::size_t>> candidates;
+        std::size_t nextCandidate = 0;
+        std::size_t roundCount = 0;
+        bool done = false;
+    };
+
+    PointQueryResult queryOne(const PointQuery& query);
+
+    void plan(const PointQuery& query, QueryState& state, PointQueryResult& result) const;
+    bool route(const PointQuery& query, QueryState& state, const PointQueryResult& result, std::size_t queryIndex);
+    void merge(const PointQuery& query, std::size_t shard, PointQueryResult& shardResult, PointQueryResult& result) const;
+
+    PointPartition partition_;
+    std::vector<PointQueryClient> shards_;
+    ShardedPointIndexOptions options_;
+    std::vector<std::vector<PointQuery>> shardBatches_;
+    std::vector<std::vector<std::size_t>> shardQueryIndexes_;
+    std::uint64_t shardQueryCount_;
+    bool broken_;
+};
+
+
+
+inline ShardedPointIndex::ShardedPointIndex(
+    PointPartition partition, std::vector<PointQueryClient> shards,
+    const ShardedPointIndexOptions& options)
+    : partition_{std::move(partition)}, shards_{std::move(shards)}, options_{options},
+      shardBatches_(shards_.size()), shardQueryIndexes_(shards_.size()), shardQueryCount_{0},
+      broken_{false}
+{
+    if (shards_.size() != partition_.shards.size())
+    {
+        throw std::invalid_argument{"there must be one client for each shard"};
+    }
+
+    options_.maximumFanOut = std::max<std::size_t>(options_.maximumFanOut, 1);
+}
+
+
+// Each round gathers, for every shard, the queries that need it next, then
+// sends every shard its batch, then collects and merges the answers.  The
+// rounds end when no query needs any more shards.
+
+inline std::vector<PointQueryResult> ShardedPointIndex::query(const std::vector<PointQuery>& queries)
+{
+    if (broken_)
+    {
+        throw PointQueryClientException{"an earlier query failed, leaving the shard connections unusable"};
+    }
+
+    std::vector<QueryState> states(queries.size());
+    std::vector<PointQueryResult> results(queries.size());
+
+    for (std::size_t i = 0; i < queries.size(); ++i)
+    {
+        plan(queries[i], states[i], results[i]);
+    }
+
+    std::vector<PointQueryResult> shardResults;
+
+    while (true)
+    {
+        for (std::size_t s = 0; s < shards_.size(); ++s)
+        {
+            shardBatches_[s].clear();
+            shardQueryIndexes_[s].clear();
+        }
+
+        bool anyRouted = false;
+
+        for (std::size_t i = 0; i < queries.size(); ++i)
+        {
+            if (!states[i].done && route(queries[i], states[i], results[i], i))
+            {
+                anyRouted = true;
+            }
+        }
+
+        if (!anyRouted)
+        {
+            break;
+        }
+
+        try
+        {
+            for (std::size_t s = 0; s < shards_.size(); ++s)
+            {
+                if (!shardBatches_[s].empty())
+                {
+                    shards_[s].send(shardBatches_[s]);
+                    shardQueryCount_ += shardBatches_[s].size();
+                }
+            }
+
+            for (std::size_t s = 0; s < shards_.size(); ++s)
+            {
+                if (shardBatches_[s].empty())
+                {
+                    continue;
+                }
+
+                shards_[s].receive(shardResults);
+
+                if (shardResults.size() != shardBatches_[s].size())
+                {
+                    throw PointQueryClientException{"shard response has the wrong number of results"};
+                }
+
+                for (std::size_t j = 0; j < shardResults.size(); ++j)
+                {
+                    const std::size_t i = shardQueryIndexes_[s][j];
+                    merge(queries[i], s, shardResults[j], results[i]);
+                }
+            }
+        }
+        catch (...)
+        {
+            broken_ = true;
+            throw;
+        }
+    }
+
+    for (std::size_t i = 0; i < queries.size(); ++i)
+    {
+        if (results[i].status == PointQueryStatus::Invalid)
+        {
+            results[i].neighbors.clear();
+        }
+    }
+
+    return results;
+}
+
+
+// plan() lists the shards that a query might need, nearest first, or marks
+// the query as done if it's invalid or can't need any.
+
+inline void ShardedPointIndex::plan(const PointQuery& query, QueryState& state, PointQueryResult& result) const
+{
+    result.status = PointQueryStatus::Ok;
+    result.neighbors.clear();
+
+    const bool validPoint =
+        std::isfinite(query.point.x()) && std::isfinite(query.point.y()) && std::isfinite(query.point.z());
+
+    const bool validKind =
+        query.kind == PointQueryKind::Nearest
+        || query.kind == PointQueryKind::Closest
+        || (query.kind == PointQueryKind::WithinRadius && query.radius >= 0.0);
+
+    if (!validPoint || !validKind)
+    {
+        result.status = PointQueryStatus::Invalid;
+        state.done = true;
+        return;
+    }
+
+    if (query.kind == PointQueryKind::Nearest && query.k == 0)
+    {
+        state.done = true;
+        return;
+    }
+
+    for (std::size_t s = 0; s < partition_.shards.size(); ++s)
+    {
+        const double squaredDistance = squaredDistanceToShard(query.point, partition_.shards[s]);
+
+        if (squaredDistance < std::numeric_limits<double>::infinity())
+        {
+            state.candidates.emplace_back(squaredDistance, s);
+        }
+    }
+
+    std::sort(state.candidates.begin(), state.candidates.end());
+}
+
+
+// route() adds a query to the batches of the shards it needs in the next
+// round, returning false (and marking it done) if it needs no more.  A
+// radius query needs every shard within its radius.  A nearest-neighbor
+// query needs every shard until it has k neighbors, and after that only
+// shards closer than its k-th neighbor; it starts with one shard, so that
+// it has a bound before it asks any others.
+
+inline bool ShardedPointIndex::route(
+    const PointQuery& query, QueryState& state, const PointQueryResult& result, std::size_t queryIndex)
+{
+    if (result.status == PointQueryStatus::Invalid)
+    {
+        state.done = true;
+        return false;
+    }
+
+    double bound = std::numeric_limits<double>::infinity();
+    bool inclusive = true;
+    std::size_t fanOut = options_.maximumFanOut;
+
+    if (query.kind == PointQueryKind::WithinRadius)
+    {
+        bound = query.radius * query.radius;
+    }
+    else
+    {
+        const std::size_t wanted = query.kind == PointQueryKind::Nearest ? query.k : 1;
+
+        if (result.neighbors.size() >= wanted)
+        {
+            const double distance = result.neighbors[wanted - 1].distance;
+            bound = distance * distance;
+            inclusive = false;
+        }
+
+        if (state.roundCount == 0)
+        {
+            fanOut = 1;
+        }
+    }
+
+    std::size_t routed = 0;
+
+    while (routed < fanOut && state.nextCandidate < state.candidates.size())
+    {
+        const auto& [squaredDistance, shard] = state.candidates[state.nextCandidate];
+
+        if (inclusive ? squaredDistance > bound : squaredDistance >= bound)
+        {
+            break;
+        }
+
+        shardBatches_[shard].push_back(query);
+        shardQueryIndexes_[shard].push_back(queryIndex);
+        ++state.nextCandidate;
+        ++routed;
+    }
+
+    if (routed == 0)
+    {
+        state.done = true;
+        return false;
+    }
+
+    ++state.roundCount;
+    return true;
+}
+
+
+// merge() turns a shard's indexes into the original points' indexes and
+// combines its neighbors with those found so far.  Both lists are sorted
+// by distance, so merging them keeps the result sorted.
+
+inline void ShardedPointIndex::merge(
+    const PointQuery& query, std::size_t shard, PointQueryResult& shardResult, PointQueryResult& result) const
+{
+    if (shardResult.status == PointQueryStatus::Invalid)
+    {
+        result.status = PointQueryStatus::Invalid;
+        return;
+    }
+    else if (shardResult.status == PointQueryStatus::Truncated)
+    {
+        result.status = PointQueryStatus::Truncated;
+    }
+
+    const std::vector<std::size_t>& indexes = partition_.shards[shard].indexes;
+
+    for (PointNeighbor& neighbor : shardResult.neighbors)
+    {
+        if (neighbor.index >= indexes.size())
+        {
+            throw PointQueryClientException{"shard returned a point it doesn't have"};
+        }
+
+        neighbor.index = indexes[neighbor.index];
+    }
+
+    std::vector<PointNeighbor>& neighbors = result.neighbors;
+    const std::size_t oldSize = neighbors.size();
+
+    neighbors.insert(neighbors.end(), shardResult.neighbors.begin(), shardResult.neighbors.end());
+
+    std::inplace_merge(
+        neighbors.begin(), neighbors.begin() + oldSize, neighbors.end(),
+        [](const PointNeighbor& a, const PointNeighbor& b)
+        {
+            return a.distance < b.distance;
+        });
+
+    if (query.kind != PointQueryKind::WithinRadius)
+    {
+        const std::size_t wanted = query.kind == PointQueryKind::Nearest ? query.k : 1;
+        neighbors.resize(std::min<std::size_t>(neighbors.size(), wanted));
+    }
+}
+
+
+inline PointQueryResult ShardedPointIndex::queryOne(const PointQuery& query)
+{
+    std::vector<PointQueryResult> results = this->query(std::vector<PointQuery>{query});
+
+    if (results[0].status == PointQueryStatus::Invalid)
+    {
+        throw PointQueryClientException{"the query is invalid"};
+    }
+
+    return std::move(results[0]);
+}
+
+
+inline std::vector<PointNeighbor> ShardedPointIndex::nearest(const Point<double>& point, std::uint32_t k)
+{
+    return queryOne(PointQuery{PointQueryKind::Nearest, point, k, 0.0}).neighbors;
+}
+
+
+inline std::vector<PointNeighbor> ShardedPointIndex::withinRadius(const Point<double>& point, double radius)
+{
+    return queryOne(PointQuery{PointQueryKind::WithinRadius, point, 0, radius}).neighbors;
+}
+
+
+inline PointNeighbor ShardedPointIndex::closest(const Point<double>& point)
+{
+    PointQueryResult result = queryOne(PointQuery{PointQueryKind::Closest, point, 0, 0.0});
+
+    if (result.neighbors.empty())
+    {
+        return PointNeighbor{PointQueryClient::noNeighbor, std::numeric_limits<double>::infinity()};
+    }
+
+    return result.neighbors[0];
+}
+
+
+inline const PointPartition& ShardedPointIndex::partition() const
+{
+    return partition_;
+}
+
+
+inline std::size_t ShardedPointIndex::shardCount() const
+{
+    return shards_.size();
+}
+
+
+inline std::uint64_t ShardedPointIndex::shardQueryCount() const
+{
+    return shardQueryCount_;
+}
+
+
+
+#endif // SHARDEDPOINTINDEX_HPP
+
@@ -0,0 +1,783 @@
+// SharedPointStore.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a way for several processes on the
+// same machine to share one copy of a set of points (and a KdTree over
+// them), instead of each loading its own.  One process -- the publisher --
+// writes the points into a POSIX shared memory object, and any number of
+// readers map that object into their own address spaces, read-only.  The
+// pages are the same physical memory in every process, so a data set that
+// takes a gigabyte takes a gigabyte in total, not a gigabyte per process.
+//
+// Sharing memory between processes has a wrinkle that sharing it between
+// threads doesn't: each process may map the memory at a different address,
+// so nothing stored in it can be a pointer.  Everything in a shared segment
+// refers to everything else by offset (from the start of the segment) or
+// by index (into an array).  A KdTree already links its nodes by index, so
+// its nodes, points, and indexes can be copied into the segment exactly as
+// they are, and searched there without rebuilding anything.
+//
+// Data sets change, and readers shouldn't have to stop when they do.  So
+// each published version of the data set is a separate shared memory
+// object, which is never modified once it's published, and a small
+// "control" object holds the generation number of the current one.
+//
+// * The publisher writes a new version into a new object, named for its
+//   generation, and only then stores the new generation number into the
+//   control object -- one atomic store, so a reader sees either the old
+//   version or the new one, never something in between.  The old version's
+//   name is then removed.
+// * A reader loads the current generation number, opens and maps the
+//   object with that generation, and keeps using its mapping for as long
+//   as it likes.  Removing the name of a shared memory object doesn't
+//   affect anyone who already has it mapped; the memory is freed when the
+//   last of them unmaps it.  If the name was removed between loading the
+//   number and opening the object, the reader just tries again with the
+//   newer number.
+//
+// So publishing never waits for readers, and readers never wait for the
+// publisher; a reader that wants the newest data checks isCurrent() now
+// and then and attaches again when it returns false.  There should only
+// be one publisher for a store at a time.
+
+#ifndef SHAREDPOINTSTORE_HPP
+#define SHAREDPOINTSTORE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "FileDescriptor.hpp"
+#include "KdTree.hpp"
+#include "MappedRegion.hpp"
+#include "Point.hpp"
+#include "PointFile.hpp"
+
+
+
+// SharedPointStoreException is thrown when a store's shared memory objects
+// are missing or aren't what they should be.  Failures reported by the
+// operating system are std::system_errors instead.
+class SharedPointStoreException : public std::runtime_error
+{
+public:
+    explicit SharedPointStoreException(const std::string& reason)
+        : std::runtime_error{reason}
+    {
+    }
+};
+
+
+
+// A SharedPointStore publishes versions of a data set under a name, which
+// can contain anything but slashes.  Its shared memory objects outlive it,
+// so readers can keep using the published data after the publisher exits;
+// removeSharedPointStore() removes them.
+class SharedPointStore
+{
+public:
+    // The constructor creates the store's control object, or opens it if
+    // it already exists, in which case publishing continues from its
+    // current generation.
+    explicit SharedPointStore(const std::string& name);
+
+
+    // publish() makes a new version of the data set current and returns its
+    // generation number, which starts at 1.  If leafSize isn't zero, a
+    // KdTree is built over the points (with that leaf size) and published
+    // along with them.
+    template <typename CoordinateType>
+    std::uint64_t publish(const std::vector<Point<CoordinateType>>& points, std::size_t leafSize = 16);
+
+
+    // generation() returns the generation number of the current version, or
+    // 0 if none has been published.
+    std::uint64_t generation() const;
+
+
+private:
+    std::string name_;
+    MappedRegion control_;
+};
+
+
+
+// A SharedPointSnapshot is one version of a store's data set, mapped into
+// this process read-only.  It stays valid, and unchanged, for as long as
+// the object exists, no matter what's published after it.
+template <typename CoordinateType>
+class SharedPointSnapshot
+{
+public:
+    // attach() maps the store's current version.  It throws a
+    // SharedPointStoreException if nothing has been published, or if the
+    // version holds a different coordinate type.
+    static SharedPointSnapshot attach(const std::string& name);
+
+
+    std::uint64_t generation() const;
+    std::size_t size() const;
+
+
+    // points() returns the points, in the order they were published.
+    const Point<CoordinateType>* points() const;
+
+
+    // isCurrent() returns false once a newer version has been published.
+    bool isCurrent() const;
+
+
+    // hasIndex() returns true if a KdTree was published with the points, in
+    // which case closest() and withinRadius() answer the same questions as
+    // KdTree's functions of the same names.  They throw a
+    // SharedPointStoreException if there's no index.
+    bool hasIndex() const;
+
+    PointNeighbor closest(const Point<CoordinateType>& query) const;
+
+    std::vector<PointNeighbor> withinRadius(
+        const Point<CoordinateType>& query, double radius) const;
+
+
+private:
+    using Node = typename KdTree<CoordinateType>::Node;
+
+    SharedPointSnapshot(MappedRegion control, MappedRegion segment);
+
+    void requireIndex() const;
+
+    MappedRegion control_;
+    MappedRegion segment_;
+    std::uint64_t generation_;
+    std::size_t size_;
+    const Point<CoordinateType>* points_;
+    const Node* nodes_;
+    const Point<CoordinateType>* treePoints_;
+    const std::uint32_t* treeIndexes_;
+    std::uint32_t root_;
+};
+
+
+
+// removeSharedPointStore() removes the names of a store's control object
+// and current version, so that no new readers can attach to it.  Readers
+// that are already attached are unaffected.
+void removeSharedPointStore(const std::string& name);
+
+
+
+namespace SharedPointStoreImpl
+{
+    constexpr std::uint32_t controlMagic = 0x43505453;    // "STPC"
+    constexpr std::uint32_t segmentMagic = 0x53505453;    // "STPS"
+    constexpr std::uint16_t version = 1;
+
+    // Sections of a segment start at multiples of this many bytes, so that
+    // each begins on a cache line.
+    constexpr std::uint64_t sectionAlignment = 64;
+
+    // A reader gives up after this many attempts to open a version that
+    // was replaced before it could be opened.
+    constexpr unsigned int attachAttempts = 100;
+
+
+    // The generation number is shared between processes through an atomic
+    // variable in shared memory, which only works if it doesn't need a
+    // lock (a lock would be private to each process).
+    static_assert(
+        std::atomic<std::uint64_t>::is_always_lock_free,
+        "shared generation numbers need lock-free atomics");
+
+    struct Control
+    {
+        std::uint32_t magic;
+        std::uint16_t version;
+        std::uint16_t reserved;
+        std::atomic<std::uint64_t> generation;
+    };
+
+
+    // A segment starts with this header; the offsets are from the start of
+    // the segment.  nodeSize records the size of a KdTree node, so that a
+    // reader built with a different layout notices.  A segment without an
+    // index has nodeCount zero.
+    struct SegmentHeader
+    {
+        std::uint32_t magic;
+        std::uint16_t version;
+        std::uint8_t coordinateKind;
+        std::uint8_t coordinateSize;
+        std::uint64_t generation;
+        std::uint64_t totalSize;
+        std::uint64_t pointCount;
+        std::uint64_t pointsOffset;
+        std::uint64_t nodeCount;
+        std::uint64_t nodesOffset;
+        std::uint64_t treePointsOffset;
+        std::uint64_t treeIndexesOffset;
+        std::uint32_t root;
+        std::uint32_t nodeSize;
+        std::uint8_t reserved[48];
+    };
+
+    static_assert(sizeof(SegmentHeader) == 128, "SegmentHeader must be 128 bytes");
+
+
+    inline std::string controlName(const std::string& name)
+    {
+        if (name.empty() || name.find('/') != std::string::npos)
+        {
+            throw std::invalid_argument{"shared point store names can't be empty or contain '/'"};
+        }
+
+        return "/" + name;
+    }
+
+
+    inline std::string segmentName(const std::string& name, std::uint64_t generation)
+    {
+        return controlName(name) + "." + std::to_string(generation);
+    }
+
+
+    // openShared() opens a shared memory object, returning a FileDescriptor
+    // that owns nothing if it doesn't exist and throwing for other errors.
+    inline FileDescriptor openShared(const std::string& name, int flags, mode_t mode = 0)
+    {
+        const int descriptor = ::shm_open(name.c_str(), flags | O_CLOEXEC, mode);
+
+        if (descriptor < 0)
+        {
+            if (errno == ENOENT)
+            {
+                return FileDescriptor{};
+            }
+
+            throw std::system_error{errno, std::generic_category(), name};
+        }
+
+        return FileDescriptor{descriptor};
+    }
+
+
+    inline void resize(const FileDescriptor& file, std::uint64_t size, const std::string& name)
+    {
+        if (::ftruncate(file.get(), static_cast<off_t>(size)) != 0)
+        {
+            throw std::system_error{errno, std::generic_category(), name};
+        }
+    }
+
+
+    inline std::uint64_t aligned(std::uint64_t offset)
+    {
+        return (offset + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+    }
+
+
+    inline const Control& controlIn(const MappedRegion& region)
+    {
+        return *static_cast<const Control*>(region.data());
+    }
+
+
+    // mapControl() maps a store's control object read-only, checking that
+    // it is one.
+    inline MappedRegion mapControl(const std::string& name)
+    {
+        const std::string path = controlName(name);
+        FileDescriptor file = openShared(path, O_RDONLY);
+
+        if (!file.isOpen() || file.size() < sizeof(Control))
+        {
+            throw SharedPointStoreException{"no shared point store named " + name};
+        }
+
+        MappedRegion region = MappedRegion::map(file, sizeof(Control), PROT_READ);
+
+        if (controlIn(region).magic != controlMagic || controlIn(region).version != version)
+        {
+            throw SharedPointStoreException{path + " is not a shared point store"};
+        }
+
+        return region;
+    }
+
+
+    // fits() returns true if count elements of the given size, starting at
+    // offset, lie within a segment of totalSize bytes.
+    inline bool fits(
+        std::uint64_t offset, std::uint64_t count, std::uint64_t elementSize,
+        std::uint64_t totalSize)
+    {
+        return offset <= totalSize && count <= (totalSize - offset) / elementSize;
+    }
+
+
+    template <typename Node>
+    double squaredDistanceToNode(const double* query, const Node& node)
+    {
+        double squaredDistance = 0.0;
+
+        for (unsigned int axis = 0; axis < 3; ++axis)
+        {
+            const double below = node.lower[axis] - query[axis];
+            const double above = query[axis] - node.upper[axis];
+            const double outside = std::max(0.0, std::max(below, above));
+            squaredDistance += outside * outside;
+        }
+
+        return squaredDistance;
+    }
+}
+
+
+
+inline SharedPointStore::SharedPointStore(const std::string& name)
+    : name_{name}
+{
+    using namespace SharedPointStoreImpl;
+
+    const std::string path = controlName(name);
+    FileDescriptor file = openShared(path, O_RDWR | O_CREAT, 0644);
+    const bool created = file.size() == 0;
+
+    if (created)
+    {
+        resize(file, sizeof(Control), path);
+    }
+    else if (file.size() < sizeof(Control))
+    {
+        throw SharedPointStoreException{path + " is not a shared point store"};
+    }
+
+    control_ = MappedRegion::map(file, sizeof(Control), PROT_READ | PROT_WRITE);
+    Control* control = static_cast<Control*>(control_.data());
+
+    if (created)
+    {
+        control->magic = controlMagic;
+        control->version = version;
+        control->reserved = 0;
+        new (&control->generation) std::atomic<std::uint64_t>{0};
+    }
+    else if (control->magic != controlMagic || control->version != version)
+    {
+        throw SharedPointStoreException{path + " is not a shared point store"};
+    }
+}
+
+
+// A segment is laid out as its header, then the points, then (if there's
+// an index) the tree's nodes, its copy of the points in tree order, and the
+// original index of each of those.  It's filled in through a writable
+// mapping that's unmapped before the new generation is announced, and a
+// leftover object with the same name (from a publisher that crashed part
+// way through) is replaced.
+
+template <typename CoordinateType>
+std::uint64_t SharedPointStore::publish(
+    const std::vector<Point<CoordinateType>>& points, std::size_t leafSize)
+{
+    using namespace SharedPointStoreImpl;
+    using Node = typename KdTree<CoordinateType>::Node;
+
+    static_assert(
+        std::is_trivially_copyable<Point<CoordinateType>>::value
+            && std::is_trivially_copyable<Node>::value,
+        "shared points and nodes must be trivially copyable");
+
+    Control* control = static_cast<Control*>(control_.data());
+    const std::uint64_t previous = control->generation.load(std::memory_order_acquire);
+    const std::uint64_t generation = previous + 1;
+
+    std::vector<Node> nodes;
+    std::vector<Point<CoordinateType>> treePoints;
+    std::vector<std::uint32_t> treeIndexes;
+    std::uint32_t root = KdTree<CoordinateType>::noChild;
+
+    if (leafSize > 0)
+    {
+        const KdTree<CoordinateType> tree{points, leafSize};
+        nodes = tree.nodes();
+        root = tree.root();
+        treePoints.reserve(tree.size());
+        treeIndexes.reserve(tree.size());
+
+        for (std::size_t position = 0; position < tree.size(); ++position)
+        {
+            treePoints.push_back(tree.pointAt(position));
+            treeIndexes.push_back(static_cast<std::uint32_t>(tree.indexAt(position)));
+        }
+    }
+
+    SegmentHeader header;
+    std::memset(&header, 0, sizeof(header));
+
+    header.magic = segmentMagic;
+    header.version = version;
+    header.coordinateKind = PointFileCoordinateKind<CoordinateType>::value;
+    header.coordinateSize = sizeof(CoordinateType);
+    header.generation = generation;
+    header.pointCount = points.size();
+    header.pointsOffset = aligned(sizeof(SegmentHeader));
+    header.nodeCount = nodes.size();
+    header.nodesOffset = aligned(header.pointsOffset + points.size() * sizeof(Point<CoordinateType>));
+    header.treePointsOffset = aligned(header.nodesOffset + nodes.size() * sizeof(Node));
+    header.treeIndexesOffset = aligned(
+        header.treePointsOffset + treePoints.size() * sizeof(Point<CoordinateType>));
+    header.totalSize = header.treeIndexesOffset + treeIndexes.size() * sizeof(std::uint32_t);
+    header.root = root;
+    header.nodeSize = sizeof(Node);
+
+    const std::string path = segmentName(name_, generation);
+    ::shm_unlink(path.c_str());
+    FileDescriptor file = openShared(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+
+    try
+    {
+        resize(file, header.totalSize, path);
+
+        MappedRegion segment = MappedRegion::map(file, header.totalSize, PROT_READ | PROT_WRITE);
+        char* base = static_cast<char*>(segment.data());
+
+        std::memcpy(base, &header, sizeof(header));
+        std::memcpy(base + header.pointsOffset, points.data(), points.size() * sizeof(Point<CoordinateType>));
+        std::memcpy(base + header.nodesOffset, nodes.data(), nodes.size() * sizeof(Node));
+        std::memcpy(
+            base + header.treePointsOffset, treePoints.data(),
+            treePoints.size() * sizeof(Point<CoordinateType>));
+        std::memcpy(
+            base + header.treeIndexesOffset, treeIndexes.data(),
+            treeIndexes.size() * sizeof(std::uint32_t));
+    }
+    catch (...)
+    {
+        ::shm_unlink(path.c_str());
+        throw;
+    }
+
+    control->generation.store(generation, std::memory_order_release);
+
+    if (previous > 0)
+    {
+        ::shm_unlink(segmentName(name_, previous).c_str());
+    }
+
+    return generation;
+}
+
+
+inline std::uint64_t SharedPointStore::generation() const
+{
+    return SharedPointStoreImpl::controlIn(control_).generation.load(std::memory_order_acquire);
+}
+
+
+
+template <typename CoordinateType>
+SharedPointSnapshot<CoordinateType>::SharedPointSnapshot(MappedRegion control, MappedRegion segment)
+    : control_{std::move(control)}, segment_{std::move(segment)}
+{
+    using namespace SharedPointStoreImpl;
+
+    const char* base = static_cast<const char*>(segment_.data());
+    const SegmentHeader& header = *reinterpret_cast<const SegmentHeader*>(base);
+
+    generation_ = header.generation;
+    size_ = header.pointCount;
+    points_ = reinterpret_cast<const Point<CoordinateType>*>(base + header.pointsOffset);
+    nodes_ = reinterpret_cast<const Node*>(base + header.nodesOffset);
+    treePoints_ = reinterpret_cast<const Point<CoordinateType>*>(base + header.treePointsOffset);
+    treeIndexes_ = reinterpret_cast<const std::uint32_t*>(base + header.treeIndexesOffset);
+    root_ = header.nodeCount > 0 ? header.root : KdTree<CoordinateType>::noChild;
+}
+
+
+// The header is checked against the mapping before anything in it is
+// trusted: every section has to lie within the segment, and the segment
+// has to be the generation we asked for.  (The nodes themselves aren't
+// checked; the publisher is trusted to have built a valid tree.)
+
+template <typename CoordinateType>
+SharedPointSnapshot<CoordinateType> SharedPointSnapshot<CoordinateType>::attach(const std::string& name)
+{
+    using namespace SharedPointStoreImpl;
+
+    MappedRegion control = mapControl(name);
+
+    for (unsigned int attempt = 0; attempt < attachAttempts; ++attempt)
+    {
+        const std::uint64_t generation = controlIn(control).generation.load(std::memory_order_acquire);
+
+        if (generation == 0)
+        {
+            throw SharedPointStoreException{"nothing has been published to " + name};
+        }
+
+        const std::string path = segmentName(name, generation);
+        FileDescriptor file = openShared(path, O_RDONLY);
+
+        if (!file.isOpen())
+        {
+            continue;
+        }
+
+        const std::uint64_t size = file.size();
+
+        if (size < sizeof(SegmentHeader))
+        {
+            throw SharedPointStoreException{path + " is truncated"};
+        }
+
+        MappedRegion segment = MappedRegion::map(file, size, PROT_READ);
+        const SegmentHeader& header = *static_cast<const SegmentHeader*>(segment.data());
+
+        if (header.magic != segmentMagic || header.version != version
+            || header.generation != generation || header.totalSize > size)
+        {
+            throw SharedPointStoreException{path + " is not a valid shared point segment"};
+        }
+
+        if (header.coordinateKind != PointFileCoordinateKind<CoordinateType>::value
+            || header.coordinateSize != sizeof(CoordinateType))
+        {
+            throw SharedPointStoreException{path + " has a different coordinate type"};
+        }
+
+        const std::uint64_t pointSize = sizeof(Point<CoordinateType>);
+        const std::uint64_t treeSize = header.nodeCount > 0 ? header.pointCount : 0;
+
+        if (!fits(header.pointsOffset, header.pointCount, pointSize, header.totalSize)
+            || !fits(header.nodesOffset, header.nodeCount, sizeof(Node), header.totalSize)
+            || !fits(header.treePointsOffset, treeSize, pointSize, header.totalSize)
+            || !fits(header.treeIndexesOffset, treeSize, sizeof(std::uint32_t), header.totalSize)
+            || (header.nodeCount > 0
+                && (header.nodeSize != sizeof(Node) || header.root >= header.nodeCount)))
+        {
+            throw SharedPointStoreException{path + " is not a valid shared point segment"};
+        }
+
+        return SharedPointSnapshot{std::move(control), std::move(segment)};
+    }
+
+    throw SharedPointStoreException{"could not attach to " + name + "; it's being republished too often"};
+}
+
+
+template <typename CoordinateType>
+std::uint64_t SharedPointSnapshot<CoordinateType>::generation() const
+{
+    return generation_;
+}
+
+
+template <typename CoordinateType>
+std::size_t SharedPointSnapshot<CoordinateType>::size() const
+{
+    return size_;
+}
+
+
+template <typename CoordinateType>
+const Point<CoordinateType>* SharedPointSnapshot<CoordinateType>::points() const
+{
+    return points_;
+}
+
+
+template <typename CoordinateType>
+bool SharedPointSnapshot<CoordinateType>::isCurrent() const
+{
+    return SharedPointStoreImpl::controlIn(control_).generation.load(std::memory_order_acquire)
+        == generation_;
+}
+
+
+template <typename CoordinateType>
+bool SharedPointSnapshot<CoordinateType>::hasIndex() const
+{
+    return root_ != KdTree<CoordinateType>::noChild;
+}
+
+
+template <typename CoordinateType>
+void SharedPointSnapshot<CoordinateType>::requireIndex() const
+{
+    if (!hasIndex() && size_ > 0)
+    {
+        throw SharedPointStoreException{"this shared point segment has no index"};
+    }
+}
+
+
+// These are the same searches KdTree does, reading the tree's arrays out of
+// the shared segment instead of its own vectors.
+
+template <typename CoordinateType>
+PointNeighbor SharedPointSnapshot<CoordinateType>::closest(const Point<CoordinateType>& query) const
+{
+    requireIndex();
+
+    const double q[3] = {
+        KdTree<CoordinateType>::coordinate(query, 0), KdTree<CoordinateType>::coordinate(query, 1),
+        KdTree<CoordinateType>::coordinate(query, 2)};
+
+    double bestSquaredDistance = std::numeric_limits<double>::infinity();
+    std::size_t bestIndex = size_;
+
+    if (!hasIndex())
+    {
+        return PointNeighbor{bestIndex, bestSquaredDistance};
+    }
+
+    std::uint32_t pending[64];
+    std::size_t pendingCount = 0;
+    pending[pendingCount++] = root_;
+
+    while (pendingCount > 0)
+    {
+        const Node& node = nodes_[pending[--pendingCount]];
+
+        if (SharedPointStoreImpl::squaredDistanceToNode(q, node) >= bestSquaredDistance)
+        {
+            continue;
+        }
+
+        if (node.left == KdTree<CoordinateType>::noChild)
+        {
+            for (std::uint32_t i = node.begin; i < node.end; ++i)
+            {
+                const double squaredDistance = query.squaredDistanceFrom(treePoints_[i]);
+
+                if (squaredDistance < bestSquaredDistance)
+                {
+                    bestSquaredDistance = squaredDistance;
+                    bestIndex = treeIndexes_[i];
+                }
+            }
+        }
+        else if (q[node.axis] < node.split)
+        {
+            pending[pendingCount++] = node.right;
+            pending[pendingCount++] = node.left;
+        }
+        else
+        {
+            pending[pendingCount++] = node.left;
+            pending[pendingCount++] = node.right;
+        }
+    }
+
+    return PointNeighbor{bestIndex, std::sqrt(bestSquaredDistance)};
+}
+
+
+template <typename CoordinateType>
+std::vector<PointNeighbor> SharedPointSnapshot<CoordinateType>::withinRadius(
+    const Point<CoordinateType>& query, double radius) const
+{
+    requireIndex();
+
+    const double q[3] = {
+        KdTree<CoordinateType>::coordinate(query, 0), KdTree<CoordinateType>::coordinate(query, 1),
+        KdTree<CoordinateType>::coordinate(query, 2)};
+    const double squaredRadius = radius * radius;
+
+    std::vector<PointNeighbor> result;
+
+    if (!hasIndex() || !(radius >= 0.0))
+    {
+        return result;
+    }
+
+    std::uint32_t pending[64];
+    std::size_t pendingCount = 0;
+    pending[pendingCount++] = root_;
+
+    while (pendingCount > 0)
+    {
+        const Node& node = nodes_[pending[--pendingCount]];
+
+        if (SharedPointStoreImpl::squaredDistanceToNode(q, node) > squaredRadius)
+        {
+            continue;
+        }
+
+        if (node.left == KdTree<CoordinateType>::noChild)
+        {
+            for (std::uint32_t i = node.begin; i < node.end; ++i)
+            {
+                const double squaredDistance = query.squaredDistanceFrom(treePoints_[i]);
+
+                if (squaredDistance <= squaredRadius)
+                {
+                    result.push_back(PointNeighbor{treeIndexes_[i], squaredDistance});
+                }
+            }
+        }
+        else
+        {
+            pending[pendingCount++] = node.right;
+            pending[pendingCount++] = node.left;
+        }
+    }
+
+    std::sort(
+        result.begin(), result.end(),
+        [](const PointNeighbor& a, const PointNeighbor& b)
+        {
+            return a.distance < b.distance;
+        });
+
+    for (PointNeighbor& neighbor : result)
+    {
+        neighbor.distance = std::sqrt(neighbor.distance);
+    }
+
+    return result;
+}
+
+
+
+inline void removeSharedPointStore(const std::string& name)
+{
+    using namespace SharedPointStoreImpl;
+
+    const std::string path = controlName(name);
+    FileDescriptor file = openShared(path, O_RDONLY);
+
+    if (file.isOpen() && file.size() >= sizeof(Control))
+    {
+        MappedRegion region = MappedRegion::map(file, sizeof(Control), PROT_READ);
+        const std::uint64_t generation = controlIn(region).generation.load(std::memory_order_acquire);
+
+        if (controlIn(region).magic == controlMagic && generation > 0)
+        {
+            ::shm_unlink(segmentName(name, generation).c_str());
+        }
+    }
+
+    ::shm_unlink(path.c_str());
+}
+
+
+
+#endif // SHAREDPOINTSTORE_HPP
+
@@ -0,0 +1,786 @@
+// SparseDistanceField.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a class called SparseDistanceField,
+// which reconstructs a surface from points measured on it (along with the
+// direction the surface faces at each of them, its "normal") and turns that
+// surface into a TriangleMesh.
+//
+// The surface is represented implicitly, by a "signed distance field": a
+// function that gives, for any location, its distance from the surface,
+// positive on the outside (the side the normals point to) and negative on
+// the inside.  The surface itself is where the function is zero.  We store
+// the function's value at the corners of a grid of cubes (which we'll call
+// "samples"), estimating each one from the points near it: each point says
+// that the surface passes through it, facing along its normal, so a sample
+// at a location s is roughly dot(s - p, n) from the surface, according to a
+// point p with normal n.  Each sample averages the estimates of the points
+// within a "truncation distance" of it, weighting the closer ones more.
+//
+// Only samples near a point ever get a value, so storing the whole grid
+// would be a waste; most of it would be empty.  Instead, the grid is split
+// into blocks of 8x8x8 samples, and only blocks that have samples near a
+// point are stored, in a hash table keyed by their position.  The memory
+// used is proportional to the area of the surface, not the volume of space
+// around it.
+//
+// extractSurface() finds the zero crossings of the field and turns them
+// into triangles.  The classic way to do that is "marching cubes," which
+// handles each cube of the grid separately using a 256-entry table of the
+// ways a surface can pass through a cube.  We use a close relative,
+// "marching tetrahedra," which splits each cube into six tetrahedra and
+// handles each of those separately; a tetrahedron has only a handful of
+// cases, simple enough to handle without a table, and the surface it
+// produces never has the holes that marching cubes can leave in ambiguous
+// cases.  All of the cubes split the same way, so neighboring cubes always
+// agree on where the surface crosses their shared faces.
+//
+// Each vertex of the mesh lies on an edge between two samples, and every
+// triangle touching that edge uses the same vertex.  Blocks are handled in
+// parallel, each describing the vertices of its triangles by which edge
+// they're on; the edges are then sorted, so that each distinct one becomes
+// one vertex, and the triangles are rewritten in terms of vertex indexes.
+
+#ifndef SPARSEDISTANCEFIELD_HPP
+#define SPARSEDISTANCEFIELD_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include "MortonCode.hpp"
+#include "Point.hpp"
+#include "ThreadPool.hpp"
+#include "TriangleMesh.hpp"
+
+
+
+class SparseDistanceField
+{
+public:
+    // Each block holds blockWidth samples along each axis.
+    static constexpr std::int64_t blockWidth = 8;
+
+
+    // A SparseDistanceField has samples spaced voxelSize apart, with the
+    // sample (i, j, k) at the location (i * voxelSize, j * voxelSize,
+    // k * voxelSize).  Each point affects the samples within
+    // truncationDistance of it, which is typically a few voxels.
+    SparseDistanceField(double voxelSize, double truncationDistance);
+
+
+    // integrate() adds the estimates made by a set of points, with one
+    // normal per point, to the field.  Normals don't need to be of unit
+    // length; points whose normal is zero are ignored.  It can be called
+    // more than once, combining the points from all of the calls.
+    template <typename CoordinateType>
+    void integrate(
+        const std::vector<Point<CoordinateType>>& points,
+        const std::vector<Point<double>>& normals,
+        ThreadPool& pool = defaultThreadPool());
+
+
+    // valueAt() stores the value of sample (i, j, k) in value and returns
+    // true, or returns false if no point has affected that sample.
+    bool valueAt(std::int64_t i, std::int64_t j, std::int64_t k, double& value) const;
+
+
+    // extractSurface() returns a mesh of the surface where the field is
+    // zero, in the parts of it where all of the samples have values.
+    TriangleMesh extractSurface(ThreadPool& pool = defaultThreadPool()) const;
+
+
+    double voxelSize() const;
+    double truncationDistance() const;
+    std::size_t blockCount() const;
+
+
+private:
+    static constexpr std::int64_t samplesPerBlock = blockWidth * blockWidth * blockWidth;
+
+    struct Block
+    {
+        std::int64_t x;
+        std::int64_t y;
+        std::int64_t z;
+        double distanceSums[samplesPerBlock];
+        double weights[samplesPerBlock];
+    };
+
+    struct BlockKey
+    {
+        std::int64_t x;
+        std::int64_t y;
+        std::int64_t z;
+
+        bool operator==(const BlockKey& other) const
+        {
+            return x == other.x && y == other.y && z == other.z;
+        }
+    };
+
+    struct BlockKeyHash
+    {
+        std::size_t operator()(const BlockKey& key) const
+        {
+            std::uint64_t h = static_cast<std::uint64_t>(key.x) * 0x9E3779B97F4A7C15ull;
+            h ^= static_cast<std::uint64_t>(key.y) * 0xC2B2AE3D27D4EB4Full;
+            h ^= static_cast<std::uint64_t>(key.z) * 0x165667B19E3779F9ull;
+            return static_cast<std::size_t>(h ^ (h >> 29));
+        }
+    };
+
+    static std::int64_t blockAlong(std::int64_t sample);
+    const Block* findBlock(const BlockKey& key) const;
+
+    void extractBlock(
+        const Block& block, const std::int64_t minimumSample[3],
+        std::vector<std::uint64_t>& edgeKeys) const;
+
+    double voxelSize_;
+    double truncationDistance_;
+    std::vector<std::unique_ptr<Block>> blocks_;
+    std::unordered_map<BlockKey, std::size_t, BlockKeyHash> blockIndexes_;
+};
+
+
+
+// reconstructSurface() builds a SparseDistanceField from a set of points and
+// their normals and returns the mesh extracted from it.
+template <typename CoordinateType>
+TriangleMesh reconstructSurface(
+    const std::vector<Point<CoordinateType>>& points,
+    const std::vector<Point<double>>& normals,
+    double voxelSize, double truncationDistance,
+    ThreadPool& pool = defaultThreadPool());
+
+
+
+namespace SparseDistanceFieldImpl
+{
+    // Vertices are identified by the edge they lie on, which is given by
+    // the sample at its lower end (relative to the lowest sample in the
+    // field) and its direction, packed into 64 bits: 19 bits for each
+    // coordinate and 3 for the direction.
+    constexpr unsigned int coordinateBits = 19;
+
+
+    // The corners of a cube are numbered 0-7, with bit 0 saying whether the
+    // corner is at the cube's larger x-coordinate, bit 1 y, and bit 2 z.  An
+    // edge between two corners, one of which is at least as large as the
+    // other in every coordinate, has a direction numbered by the corners'
+    // difference minus one, which is 0-6.
+    //
+    // The six tetrahedra all share the diagonal from corner 0 to corner 7;
+    // each takes one of the six paths from 0 to 7 that moves along one axis
+    // at a time.  Every edge of every tetrahedron then runs from a smaller
+    // corner to a larger one.
+    constexpr unsigned int tetrahedra[6][4] = {
+        {0, 1, 3, 7}, {0, 1, 5, 7}, {0, 2, 3, 7},
+        {0, 2, 6, 7}, {0, 4, 5, 7}, {0, 4, 6, 7}};
+
+
+    inline std::uint64_t edgeKey(
+        std::int64_t x, std::int64_t y, std::int64_t z, unsigned int direction)
+    {
+        return (static_cast<std::uint64_t>(x) << (2 * coordinateBits + 3))
+            | (static_cast<std::uint64_t>(y) << (coordinateBits + 3))
+            | (static_cast<std::uint64_t>(z) << 3)
+            | direction;
+    }
+
+
+    struct EdgePoint
+    {
+        std::uint64_t key;
+        double position[3];
+    };
+}
+
+
+
+inline SparseDistanceField::SparseDistanceField(double voxelSize, double truncationDistance)
+    : voxelSize_{voxelSize}, truncationDistance_{truncationDistance}
+{
+    if (!(voxelSize > 0.0) || !(truncationDistance > 0.0))
+    {
+        throw std::invalid_argument{"voxel size and truncation distance must be positive"};
+    }
+}
+
+
+// Integration happens in two steps.  First, we find all of the blocks the
+// points can affect, adding any that don't exist yet, and sort the points
+// into "buckets" by the block they're in.  Then each affected block is
+// handled separately (and in parallel), looking at the points in the
+// buckets near enough to affect it.  Since each block is only ever written
+// by one thread, no locking is needed.
+
+template <typename CoordinateType>
+void SparseDistanceField::integrate(
+    const std::vector<Point<CoordinateType>>& points,
+    const std::vector<Point<double>>& normals,
+    ThreadPool& pool)
+{
+    if (normals.size() != points.size())
+    {
+        throw std::invalid_argument{"integrate() needs one normal per point"};
+    }
+
+    std::unordered_map<BlockKey, std::vector<std::uint32_t>, BlockKeyHash> buckets;
+    std::vector<std::size_t> affected;
+    std::vector<bool> isAffected(blocks_.size(), false);
+
+    for (std::size_t i = 0; i < points.size(); ++i)
+    {
+        const double location[3] = {
+            static_cast<double>(points[i].x()),
+            static_cast<double>(points[i].y()),
+            static_cast<double>(points[i].z())};
+
+        std::int64_t lowest[3];
+        std::int64_t highest[3];
+
+        for (unsigned int axis = 0; axis < 3; ++axis)
+        {
+            lowest[axis] = blockAlong(static_cast<std::int64_t>(
+                std::ceil((location[axis] - truncationDistance_) / voxelSize_)));
+            highest[axis] = blockAlong(static_cast<std::int64_t>(
+                std::floor((location[axis] + truncationDistance_) / voxelSize_)));
+        }
+
+        buckets[BlockKey{
+            blockAlong(static_cast<std::int64_t>(std::floor(location[0] / voxelSize_))),
+            blockAlong(static_cast<std::int64_t>(std::floor(location[1] / voxelSize_))),
+            blockAlong(static_cast<std::int64_t>(std::floor(location[2] / voxelSize_)))}]
+            .push_back(static_cast<std::uint32_t>(i));
+
+        for (std::int64_t x = lowest[0]; x <= highest[0]; ++x)
+        {
+            for (std::int64_t y = lowest[1]; y <= highest[1]; ++y)
+            {
+                for (std::int64_t z = lowest[2]; z <= highest[2]; ++z)
+                {
+                    auto inserted = blockIndexes_.emplace(BlockKey{x, y, z}, blocks_.size());
+
+                    if (inserted.second)
+                    {
+                        blocks_.push_back(std::make_unique<Block>());
+                        blocks_.back()->x = x;
+                        blocks_.back()->y = y;
+                        blocks_.back()->z = z;
+                        isAffected.push_back(false);
+                    }
+
+                    if (!isAffected[inserted.first->second])
+                    {
+                        isAffected[inserted.first->second] = true;
+                        affected.push_back(inserted.first->second);
+                    }
+                }
+            }
+        }
+    }
+
+    // A point in a bucket is within one voxel of that bucket's samples, so
+    // it can affect samples up to this many blocks away.
+    const std::int64_t reach = static_cast<std::int64_t>(
+        std::ceil((truncationDistance_ / voxelSize_ + 1.0) / static_cast<double>(blockWidth)));
+
+    const double squaredTruncation = truncationDistance_ * truncationDistance_;
+
+    pool.parallelFor(
+        0, affected.size(), 1,
+        [&](std::size_t first, std::size_t last)
+        {
+            for (std::size_t a = first; a < last; ++a)
+            {
+                Block& block = *blocks_[affected[a]];
+                const std::int64_t base[3] = {
+                    block.x * blockWidth, block.y * blockWidth, block.z * blockWidth};
+
+                for (std::int64_t bx = block.x - reach; bx <= block.x + reach; ++bx)
+                {
+                    for (std::int64_t by = block.y - reach; by <= block.y + reach; ++by)
+                    {
+                        for (std::int64_t bz = block.z - reach; bz <= block.z + reach; ++bz)
+                        {
+                            auto bucket = buckets.find(BlockKey{bx, by, bz});
+
+                            if (bucket == buckets.end())
+                            {
+                                continue;
+                            }
+
+                            for (std::uint32_t i : bucket->second)
+                            {
+                                const double location[3] = {
+                                    static_cast<double>(points[i].x()),
+                                    static_cast<double>(points[i].y()),
+                                    static_cast<double>(points[i].z())};
+
+                                double normal[3] = {normals[i].x(), normals[i].y(), normals[i].z()};
+                                const double length = std::sqrt(
+                                    normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+                                if (length == 0.0)
+                                {
+                                    continue;
+                                }
+
+                                std::int64_t lowest[3];
+                                std::int64_t highest[3];
+                                bool empty = false;
+
+                                for (unsigned int axis = 0; axis < 3; ++axis)
+                                {
+                                    normal[axis] /= length;
+
+                                    lowest[axis] = std::max(
+                                        base[axis],
+                                        static_cast<std::int64_t>(std::ceil(
+                                            (location[axis] - truncationDistance_) / voxelSize_)));
+
+                                    highest[axis] = std::min(
+                                        base[axis] + blockWidth - 1,
+                                        static_cast<std::int64_t>(std::floor(
+                                            (location[axis] + truncationDistance_) / voxelSize_)));
+
+                                    empty = empty || lowest[axis] > highest[axis];
+                                }
+
+                                if (empty)
+                                {
+                                    continue;
+                                }
+
+                                for (std::int64_t z = lowest[2]; z <= highest[2]; ++z)
+                                {
+                                    const double dz = static_cast<double>(z) * voxelSize_ - location[2];
+
+                                    for (std::int64_t y = lowest[1]; y <= highest[1]; ++y)
+                                    {
+                                        const double dy = static_cast<double>(y) * voxelSize_ - location[1];
+
+                                        for (std::int64_t x = lowest[0]; x <= highest[0]; ++x)
+                                        {
+                                            const double dx = static_cast<double>(x) * voxelSize_ - location[0];
+                                            const double squaredDistance = dx * dx + dy * dy + dz * dz;
+                                            const double weight = 1.0 - squaredDistance / squaredTruncation;
+
+                                            if (weight <= 0.0)
+                                            {
+                                                continue;
+                                            }
+
+                                            const std::size_t s = static_cast<std::size_t>(
+                                                (x - base[0])
+                                                + blockWidth * ((y - base[1]) + blockWidth * (z - base[2])));
+
+                                            block.distanceSums[s] +=
+                                                weight * (dx * normal[0] + dy * normal[1] + dz * normal[2]);
+                                            block.weights[s] += weight;
+                                        }
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        });
+}
+
+
+inline bool SparseDistanceField::valueAt(
+    std::int64_t i, std::int64_t j, std::int64_t k, double& value) const
+{
+    const Block* block = findBlock(BlockKey{blockAlong(i), blockAlong(j), blockAlong(k)});
+
+    if (block == nullptr)
+    {
+        return false;
+    }
+
+    const std::size_t s = static_cast<std::size_t>(
+        (i - block->x * blockWidth)
+        + blockWidth * ((j - block->y * blockWidth) + blockWidth * (k - block->z * blockWidth)));
+
+    if (block->weights[s] <= 0.0)
+    {
+        return false;
+    }
+
+    value = block->distanceSums[s] / block->weights[s];
+    return true;
+}
+
+
+// Extraction happens in three steps.  Each block finds its triangles,
+// describing each vertex by its edge key; then all of the edge keys are
+// sorted, so that each distinct key can be given a vertex index; and finally
+// each vertex's position is found by interpolating along its edge.
+
+inline TriangleMesh SparseDistanceField::extractSurface(ThreadPool& pool) const
+{
+    using namespace SparseDistanceFieldImpl;
+
+    TriangleMesh mesh;
+
+    if (blocks_.empty())
+    {
+        return mesh;
+    }
+
+    std::int64_t minimumBlock[3] = {blocks_[0]->x, blocks_[0]->y, blocks_[0]->z};
+    std::int64_t maximumBlock[3] = {blocks_[0]->x, blocks_[0]->y, blocks_[0]->z};
+
+    for (const std::unique_ptr<Block>& block : blocks_)
+    {
+        const std::int64_t position[3] = {block->x, block->y, block->z};
+
+        for (unsigned int axis = 0; axis < 3; ++axis)
+        {
+            minimumBlock[axis] = std::min(minimumBlock[axis], position[axis]);
+            maximumBlock[axis] = std::max(maximumBlock[axis], position[axis]);
+        }
+    }
+
+    std::int64_t minimumSample[3];
+
+    for (unsigned int axis = 0; axis < 3; ++axis)
+    {
+        if ((maximumBlock[axis] - minimumBlock[axis] + 1) * blockWidth >= (std::int64_t{1} << coordinateBits))
+        {
+            throw std::length_error{"distance field is too large to extract"};
+        }
+
+        minimumSample[axis] = minimumBlock[axis] * blockWidth;
+    }
+
+    std::vector<std::vector<std::uint64_t>> blockKeys(blocks_.size());
+
+    pool.parallelFor(
+        0, blocks_.size(), 1,
+        [&](std::size_t first, std::size_t last)
+        {
+            for (std::size_t b = first; b < last; ++b)
+            {
+                extractBlock(*blocks_[b], minimumSample, blockKeys[b]);
+            }
+        });
+
+    std::vector<std::uint64_t> keys;
+
+    for (std::vector<std::uint64_t>& block : blockKeys)
+    {
+        keys.insert(keys.end(), block.begin(), block.end());
+        std::vector<std::uint64_t>{}.swap(block);
+    }
+
+    const std::vector<std::size_t> order = sortedOrder(keys);
+    std::vector<std::uint64_t> vertexKeys;
+    mesh.indexes.resize(keys.size());
+
+    for (std::size_t i = 0; i < order.size(); ++i)
+    {
+        if (vertexKeys.empty() || vertexKeys.back() != keys[order[i]])
+        {
+            vertexKeys.push_back(keys[order[i]]);
+        }
+
+        mesh.indexes[order[i]] = static_cast<std::uint32_t>(vertexKeys.size() - 1);
+    }
+
+    mesh.vertices.resize(vertexKeys.size());
+    const std::uint64_t coordinateMask = (std::uint64_t{1} << coordinateBits) - 1;
+
+    pool.parallelFor(
+        0, vertexKeys.size(), 4096,
+        [&](std::size_t first, std::size_t last)
+        {
+            for (std::size_t v = first; v < last; ++v)
+            {
+                const std::uint64_t key = vertexKeys[v];
+                const unsigned int difference = static_cast<unsigned int>(key & 7) + 1;
+
+                const std::int64_t lower[3] = {
+                    static_cast<std::int64_t>((key >> (2 * coordinateBits + 3)) & coordinateMask) + minimumSample[0],
+                    static_cast<std::int64_t>((key >> (coordinateBits + 3)) & coordinateMask) + minimumSample[1],
+                    static_cast<std::int64_t>((key >> 3) & coordinateMask) + minimumSample[2]};
+
+                const std::int64_t upper[3] = {
+                    lower[0] + (difference & 1), lower[1] + ((difference >> 1) & 1),
+                    lower[2] + ((difference >> 2) & 1)};
+
+                double lowerValue = 0.0;
+                double upperValue = 0.0;
+                valueAt(lower[0], lower[1], lower[2], lowerValue);
+                valueAt(upper[0], upper[1], upper[2], upperValue);
+
+                const double t = lowerValue / (lowerValue - upperValue);
+
+                mesh.vertices[v] = Point<double>{
+                    (static_cast<double>(lower[0]) + t * static_cast<double>(upper[0] - lower[0])) * voxelSize_,
+                    (static_cast<double>(lower[1]) + t * static_cast<double>(upper[1] - lower[1])) * voxelSize_,
+                    (static_cast<double>(lower[2]) + t * static_cast<double>(upper[2] - lower[2])) * voxelSize_};
+            }
+        });
+
+    return mesh;
+}
+
+
+inline double SparseDistanceField::voxelSize() const
+{
+    return voxelSize_;
+}
+
+
+inline double SparseDistanceField::truncationDistance() const
+{
+    return truncationDistance_;
+}
+
+
+inline std::size_t SparseDistanceField::blockCount() const
+{
+    return blocks_.size();
+}
+
+
+// blockAlong() returns the block coordinate of a sample coordinate, rounding
+// down even when the sample coordinate is negative.
+
+inline std::int64_t SparseDistanceField::blockAlong(std::int64_t sample)
+{
+    return sample >= 0 ? sample / blockWidth : -((-sample + blockWidth - 1) / blockWidth);
+}
+
+
+inline const SparseDistanceField::Block* SparseDistanceField::findBlock(const BlockKey& key) const
+{
+    auto found = blockIndexes_.find(key);
+    return found == blockIndexes_.end() ? nullptr : blocks_[found->second].get();
+}
+
+
+// extractBlock() handles the cubes whose lowest corner is in the given
+// block.  Their other corners can be in the blocks just above it along each
+// axis, so it first copies the values of all of the samples it needs -- a
+// 9x9x9 region -- into one array, with NaN for samples that have no value.
+//
+// Within a tetrahedron, if the corners with negative values (the "inside"
+// ones) are separated from the others by the surface, the surface crosses
+// each edge between an inside and an outside corner.  With one inside
+// corner or one outside corner, that's three edges, making a triangle; with
+// two of each, it's four, making a quadrilateral that we split into two
+// triangles.  Each triangle is turned, if necessary, so that its front faces
+// from the inside corners toward the outside ones.
+
+inline void SparseDistanceField::extractBlock(
+    const Block& block, const std::int64_t minimumSample[3],
+    std::vector<std::uint64_t>& edgeKeys) const
+{
+    using namespace SparseDistanceFieldImpl;
+
+    constexpr std::int64_t width = blockWidth + 1;
+    double values[width * width * width];
+
+    const Block* neighbors[8];
+
+    for (unsigned int n = 0; n < 8; ++n)
+    {
+        neighbors[n] = findBlock(BlockKey{block.x + (n & 1), block.y + ((n >> 1) & 1), block.z + ((n >> 2) & 1)});
+    }
+
+    for (std::int64_t z = 0; z < width; ++z)
+    {
+        for (std::int64_t y = 0; y < width; ++y)
+        {
+            for (std::int64_t x = 0; x < width; ++x)
+            {
+                const Block* owner = neighbors[
+                    (x / blockWidth) | ((y / blockWidth) << 1) | ((z / blockWidth) << 2)];
+
+                double& value = values[x + width * (y + width * z)];
+                value = std::nan("");
+
+                if (owner != nullptr)
+                {
+                    const std::size_t s = static_cast<std::size_t>(
+                        (x % blockWidth) + blockWidth * ((y % blockWidth) + blockWidth * (z % blockWidth)));
+
+                    if (owner->weights[s] > 0.0)
+                    {
+                        value = owner->distanceSums[s] / owner->weights[s];
+                    }
+                }
+            }
+        }
+    }
+
+    const std::int64_t base[3] = {
+        block.x * blockWidth - minimumSample[0],
+        block.y * blockWidth - minimumSample[1],
+        block.z * blockWidth - minimumSample[2]};
+
+    for (std::int64_t z = 0; z < blockWidth; ++z)
+    {
+        for (std::int64_t y = 0; y < blockWidth; ++y)
+        {
+            for (std::int64_t x = 0; x < blockWidth; ++x)
+            {
+                double corners[8];
+                bool complete = true;
+                unsigned int insideCount = 0;
+
+                for (unsigned int c = 0; c < 8; ++c)
+                {
+                    corners[c] = values[
+                        (x + (c & 1)) + width * ((y + ((c >> 1) & 1)) + width * (z + ((c >> 2) & 1)))];
+
+                    complete = complete && !std::isnan(corners[c]);
+                    insideCount += corners[c] < 0.0 ? 1 : 0;
+                }
+
+                if (!complete || insideCount == 0 || insideCount == 8)
+                {
+                    continue;
+                }
+
+                auto edgePoint =
+                    [&](unsigned int a, unsigned int b)
+                    {
+                        if (a > b)
+                        {
+                            std::swap(a, b);
+                        }
+
+                        const double t = corners[a] / (corners[a] - corners[b]);
+                        EdgePoint point;
+
+                        point.key = edgeKey(
+                            base[0] + x + (a & 1), base[1] + y + ((a >> 1) & 1),
+                            base[2] + z + ((a >> 2) & 1), (b - a) - 1);
+
+                        for (unsigned int axis = 0; axis < 3; ++axis)
+                        {
+                            const double from = static_cast<double>((a >> axis) & 1);
+                            const double to = static_cast<double>((b >> axis) & 1);
+                            point.position[axis] = from + t * (to - from);
+                        }
+
+                        return point;
+                    };
+
+                for (const unsigned int (&tetrahedron)[4] : tetrahedra)
+                {
+                    unsigned int inside[4];
+                    unsigned int outside[4];
+                    unsigned int insideHere = 0;
+                    unsigned int outsideHere = 0;
+                    double direction[3];
+
+                    for (unsigned int corner : tetrahedron)
+                    {
+                        if (corners[corner] < 0.0)
+                        {
+                            inside[insideHere++] = corner;
+                        }
+                        else
+                        {
+                            outside[outsideHere++] = corner;
+                        }
+                    }
+
+                    auto emit =
+                        [&](const EdgePoint& p, const EdgePoint& q, const EdgePoint& r)
+                        {
+                            double u[3];
+                            double v[3];
+
+                            for (unsigned int axis = 0; axis < 3; ++axis)
+                            {
+                                u[axis] = q.position[axis] - p.position[axis];
+                                v[axis] = r.position[axis] - p.position[axis];
+                            }
+
+                            const double facing =
+                                (u[1] * v[2] - u[2] * v[1]) * direction[0]
+                                + (u[2] * v[0] - u[0] * v[2]) * direction[1]
+                                + (u[0] * v[1] - u[1] * v[0]) * direction[2];
+
+                            edgeKeys.push_back(p.key);
+                            edgeKeys.push_back(facing >= 0.0 ? q.key : r.key);
+                            edgeKeys.push_back(facing >= 0.0 ? r.key : q.key);
+                        };
+
+                    // The direction from the inside corners toward the
+                    // outside ones is the difference of their averages.
+                    for (unsigned int axis = 0; axis < 3; ++axis)
+                    {
+                        direction[axis] = 0.0;
+
+                        for (unsigned int i = 0; i < insideHere; ++i)
+                        {
+                            direction[axis] -= static_cast<double>((inside[i] >> axis) & 1) / insideHere;
+                        }
+
+                        for (unsigned int o = 0; o < outsideHere; ++o)
+                        {
+                            direction[axis] += static_cast<double>((outside[o] >> axis) & 1) / outsideHere;
+                        }
+                    }
+
+                    if (insideHere == 1)
+                    {
+                        emit(
+                            edgePoint(inside[0], outside[0]), edgePoint(inside[0], outside[1]),
+                            edgePoint(inside[0], outside[2]));
+                    }
+                    else if (outsideHere == 1)
+                    {
+                        emit(
+                            edgePoint(outside[0], inside[0]), edgePoint(outside[0], inside[1]),
+                            edgePoint(outside[0], inside[2]));
+                    }
+                    else if (insideHere == 2)
+                    {
+                        const EdgePoint p = edgePoint(inside[0], outside[0]);
+                        const EdgePoint q = edgePoint(inside[0], outside[1]);
+                        const EdgePoint r = edgePoint(inside[1], outside[1]);
+                        const EdgePoint s = edgePoint(inside[1], outside[0]);
+
+                        emit(p, q, r);
+                        emit(p, r, s);
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+template <typename CoordinateType>
+TriangleMesh reconstructSurface(
+    const std::vector<Point<CoordinateType>>& points,
+    const std::vector<Point<double>>& normals,
+    double voxelSize, double truncationDistance,
+    ThreadPool& pool)
+{
+    SparseDistanceField field{voxelSize, truncationDistance};
+    field.integrate(points, normals, pool);
+    return field.extractSurface(pool);
+}
+
+
+
+#endif // SPARSEDISTANCEFIELD_HPP
+
@@ -0,0 +1,338 @@
+// ThreadPool.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares and defines a class called ThreadPool, which
+// owns a fixed set of worker threads and runs tasks on them.  Creating a
+// thread is expensive compared to the small pieces of work we often want
+// to run in parallel, so rather than creating a new thread for every task,
+// we create the threads once and hand them work as it arrives.
+//
+// There are two ways to give a ThreadPool work:
+//
+// * submit() queues a single task and returns a std::future that becomes
+//   ready (with the task's result, or the exception it threw) once some
+//   worker has run it.
+// * parallelFor() splits a range of indexes into chunks and runs a function
+//   on each chunk, returning only once every chunk has been processed.  The
+//   calling thread takes chunks, too, rather than sitting idle, which means
+//   that it's safe to call parallelFor() from within a task that is itself
+//   running on the pool; even if every worker is busy, the caller simply
+//   ends up doing all of the chunks itself.
+
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+
+
+class ThreadPool
+{
+public:
+    // Constructing a ThreadPool starts its worker threads.  By default, we
+    // start one per hardware thread; we always start at least one, since
+    // std::thread::hardware_concurrency() is permitted to return 0 when it
+    // can't tell.
+    explicit ThreadPool(
+        unsigned int threadCount = std::thread::hardware_concurrency());
+
+
+    // Alternatively, a ThreadPool can start one worker for each of the
+    // given CPUs, with each worker pinned to its CPU, so that the operating
+    // system never moves it elsewhere.  That's what we want when the work
+    // given to the pool should stay near particular memory or caches (see
+    // NumaPointStore.hpp, for example).  If a worker can't be pinned, it
+    // runs unpinned.
+    explicit ThreadPool(const std::vector<unsigned int>& cpus);
+
+
+    // Destroying a ThreadPool lets its workers finish whatever tasks are
+    // already queued, then joins them.
+    ~ThreadPool();
+
+
+    // A ThreadPool owns threads, which can't sensibly be copied.
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+
+    // threadCount() returns the number of worker threads in the pool.
+    unsigned int threadCount() const;
+
+
+    // submit() queues a function (taking no arguments) to be run by one of
+    // the workers, returning a future for its result.
+    template <typename Function>
+    std::future<std::invoke_result_t<Function>> submit(Function function);
+
+
+    // parallelFor() calls function(chunkBegin, chunkEnd) for consecutive
+    // chunks of at most grainSize indexes covering [begin, end), spreading
+    // the chunks across the workers and the calling thread.  If any call
+    // throws, the first exception is rethrown here once all of the chunks
+    // are done.
+    template <typename Function>
+    void parallelFor(
+        std::size_t begin, std::size_t end, std::size_t grainSize,
+        Function function);
+
+
+private:
+    void enqueue(std::function<void()> task);
+    void run();
+    void pin(unsigned int cpu);
+
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable available_;
+    bool stopping_;
+};
+
+
+
+// defaultThreadPool() returns a pool shared by everything in this code base
+// that wants parallelism but wasn't handed a specific pool to use.  It's
+// created the first time it's asked for.
+ThreadPool& defaultThreadPool();
+
+
+
+inline ThreadPool::ThreadPool(unsigned int threadCount)
+    : stopping_{false}
+{
+    threadCount = std::max(threadCount, 1u);
+
+    for (unsigned int i = 0; i < threadCount; ++i)
+    {
+        workers_.emplace_back([this] { run(); });
+    }
+}
+
+
+inline ThreadPool::ThreadPool(const std::vector<unsigned int>& cpus)
+    : stopping_{false}
+{
+    if (cpus.empty())
+    {
+        workers_.emplace_back([this] { run(); });
+    }
+
+    for (unsigned int cpu : cpus)
+    {
+        workers_.emplace_back([this, cpu] { pin(cpu); run(); });
+    }
+}
+
+
+inline ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        stopping_ = true;
+    }
+
+    available_.notify_all();
+
+    for (std::thread& worker : workers_)
+    {
+        worker.join();
+    }
+}
+
+
+inline unsigned int ThreadPool::threadCount() const
+{
+    return static_cast<unsigned int>(workers_.size());
+}
+
+
+// std::function requires that what it stores be copyable, but a
+// std::packaged_task can only be moved.  So we keep the packaged_task
+// behind a shared_ptr and queue a small copyable lambda that runs it.
+
+template <typename Function>
+std::future<std::invoke_result_t<Function>> ThreadPool::submit(Function function)
+{
+    using ResultType = std::invoke_result_t<Function>;
+
+    auto task = std::make_shared<std::packaged_task<ResultType()>>(
+        std::move(function));
+
+    std::future<ResultType> result = task->get_future();
+    enqueue([task] { (*task)(); });
+    return result;
+}
+
+
+// The chunks are handed out through an atomic counter, so whichever thread
+// gets to the counter next takes the next chunk.  The helper tasks we queue
+// only ever touch "function" after successfully claiming a chunk, and the
+// caller doesn't return until every claimed chunk is finished, so it's safe
+// for the helpers to refer to it by pointer rather than copying it; helpers
+// that don't get started until after we've returned will find no chunks left
+// and do nothing.
+
+template <typename Function>
+void ThreadPool::parallelFor(
+    std::size_t begin, std::size_t end, std::size_t grainSize,
+    Function function)
+{
+    if (begin >= end)
+    {
+        return;
+    }
+
+    grainSize = std::max<std::size_t>(grainSize, 1);
+    const std::size_t chunkCount = (end - begin + grainSize - 1) / grainSize;
+
+    if (chunkCount == 1)
+    {
+        function(begin, end);
+        return;
+    }
+
+    struct State
+    {
+        std::atomic<std::size_t> nextChunk{0};
+        std::size_t finishedChunks = 0;
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+
+    auto state = std::make_shared<State>();
+    Function* functionPointer = &function;
+
+    auto work =
+        [state, functionPointer, begin, end, grainSize, chunkCount]
+        {
+            std::size_t chunk;
+
+            while ((chunk = state->nextChunk.fetch_add(1)) < chunkCount)
+            {
+                const std::size_t chunkBegin = begin + chunk * grainSize;
+                const std::size_t chunkEnd = std::min(end, chunkBegin + grainSize);
+
+                std::exception_ptr error;
+
+                try
+                {
+                    (*functionPointer)(chunkBegin, chunkEnd);
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+
+                std::lock_guard<std::mutex> lock{state->mutex};
+
+                if (error && !state->error)
+                {
+                    state->error = error;
+                }
+
+                if (++state->finishedChunks == chunkCount)
+                {
+                    state->finished.notify_all();
+                }
+            }
+        };
+
+    const std::size_t helperCount = std::min<std::size_t>(
+        workers_.size(), chunkCount - 1);
+
+    for (std::size_t i = 0; i < helperCount; ++i)
+    {
+        enqueue(work);
+    }
+
+    work();
+
+    std::unique_lock<std::mutex> lock{state->mutex};
+    state->finished.wait(
+        lock, [&] { return state->finishedChunks == chunkCount; });
+
+    if (state->error)
+    {
+        std::rethrow_exception(state->error);
+    }
+}
+
+
+inline void ThreadPool::enqueue(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        tasks_.push_back(std::move(task));
+    }
+
+    available_.notify_one();
+}
+
+
+inline void ThreadPool::run()
+{
+    while (true)
+    {
+        std::function<void()> task;
+
+        {
+            std::unique_lock<std::mutex> lock{mutex_};
+            available_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+
+            if (tasks_.empty())
+            {
+                return;
+            }
+
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+
+        task();
+    }
+}
+
+
+inline void ThreadPool::pin(unsigned int cpu)
+{
+    if (cpu >= CPU_SETSIZE)
+    {
+        return;
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+}
+
+
+inline ThreadPool& defaultThreadPool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+
+
+#endif // THREADPOOL_HPP
+
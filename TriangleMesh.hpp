@@ -0,0 +1,48 @@
+// TriangleMesh.hpp
+//
+// ICS 46 Spring 2014
+// Code Example
+//
+// This header file declares a struct called TriangleMesh, which represents
+// a surface as a collection of triangles.
+//
+// The simplest way to store triangles is to store three points for each of
+// them, but in a typical mesh, each vertex is shared by about six triangles,
+// so that stores each point about six times over.  Instead, a TriangleMesh
+// is "indexed": it stores each vertex once, and each triangle is three
+// indexes into the vector of vertices.  Besides saving memory, this makes
+// it clear which triangles are connected to which, since connected
+// triangles share the same indexes.
+//
+// The vertices of each triangle are listed counterclockwise when seen from
+// the outside of the surface, so that the cross product of its first two
+// edges points outward.
+
+#ifndef TRIANGLEMESH_HPP
+#define TRIANGLEMESH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Point.hpp"
+
+
+
+struct TriangleMesh
+{
+    // vertices holds the position of each vertex.  indexes holds three
+    // elements per triangle, each an index into vertices.
+    std::vector<Point<double>> vertices;
+    std::vector<std::uint32_t> indexes;
+
+
+    std::size_t triangleCount() const
+    {
+        return indexes.size() / 3;
+    }
+};
+
+
+
+#endif // TRIANGLEMESH_HPP
+